@@ -0,0 +1,273 @@
+/************************************************************************************************
+ * This file is part of SerialPundit.
+ *
+ * Copyright (C) 2014-2016, Rishi Gupta. All rights reserved.
+ *
+ * The SerialPundit is DUAL LICENSED. It is made available under the terms of the GNU Affero
+ * General Public License (AGPL) v3.0 for non-commercial use and under the terms of a commercial
+ * license for commercial use of this software.
+ *
+ * The SerialPundit is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ ************************************************************************************************/
+
+/*
+ * Measures throughput of one or more serial ports concurrently, typically all UARTs of a CP2105 or
+ * CP2108. TX of every port must be looped back to its own RX (jumper). For every port a writer thread
+ * sends a known byte sequence and a reader thread receives and verifies it. Per port and aggregate
+ * receive throughput is printed at the end along with number of bytes which did not match.
+ *
+ * Build : gcc -O2 -Wall -pthread -o bench-cp210x bench-cp210x.c
+ * Run   : ./bench-cp210x -b 3000000 -t 10 -r /dev/ttyUSB0 /dev/ttyUSB1 /dev/ttyUSB2 /dev/ttyUSB3
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+
+#define MAX_PORTS    16
+#define CHUNK_SIZE   4096
+#define PATTERN_MOD  251
+#define DRAIN_MSECS  500
+
+struct bench_port {
+    const char *name;
+    int fd;
+    pthread_t writer;
+    pthread_t reader;
+    unsigned long long tx_bytes;
+    unsigned long long rx_bytes;
+    unsigned long long mismatch;
+};
+
+static struct bench_port ports[MAX_PORTS];
+static volatile int writers_stop = 0;
+static volatile int readers_stop = 0;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/*
+ * Opens port in raw mode with given baudrate (any value, set through BOTHER) and 8N1.
+ *
+ * @name: device node
+ * @baud: baudrate
+ * @rtscts: 1 to enable hardware flow control
+ *
+ * @return file descriptor on success otherwise -1.
+ */
+static int open_port(const char *name, unsigned int baud, int rtscts)
+{
+    int fd;
+    struct termios2 tio;
+
+    fd = open(name, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: open failed: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    if (ioctl(fd, TCGETS2, &tio) < 0) {
+        fprintf(stderr, "%s: TCGETS2 failed: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    tio.c_iflag = 0;
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    tio.c_cflag = CS8 | CREAD | CLOCAL | BOTHER;
+    if (rtscts)
+        tio.c_cflag |= CRTSCTS;
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+
+    if (ioctl(fd, TCSETS2, &tio) < 0) {
+        fprintf(stderr, "%s: TCSETS2 failed: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if ((ioctl(fd, TCGETS2, &tio) == 0) && (tio.c_ospeed != baud))
+        fprintf(stderr, "%s: warning baudrate set to %u instead of %u\n", name, tio.c_ospeed, baud);
+
+    ioctl(fd, TCFLSH, TCIOFLUSH);
+    return fd;
+}
+
+static void *writer_thread(void *arg)
+{
+    int x;
+    ssize_t ret;
+    unsigned int seq = 0;
+    unsigned char buf[CHUNK_SIZE];
+    struct bench_port *bp = arg;
+
+    while (!writers_stop) {
+        for (x = 0; x < CHUNK_SIZE; x++) {
+            buf[x] = (unsigned char) seq;
+            seq = (seq + 1) % PATTERN_MOD;
+        }
+
+        x = 0;
+        while ((x < CHUNK_SIZE) && !writers_stop) {
+            ret = write(bp->fd, buf + x, CHUNK_SIZE - x);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                fprintf(stderr, "%s: write failed: %s\n", bp->name, strerror(errno));
+                return NULL;
+            }
+            x += ret;
+            bp->tx_bytes += ret;
+        }
+    }
+
+    return NULL;
+}
+
+static void *reader_thread(void *arg)
+{
+    int x;
+    ssize_t ret;
+    unsigned int expected = 0;
+    unsigned char buf[CHUNK_SIZE];
+    struct pollfd pfd;
+    struct bench_port *bp = arg;
+
+    pfd.fd = bp->fd;
+    pfd.events = POLLIN;
+
+    while (1) {
+        ret = poll(&pfd, 1, DRAIN_MSECS);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "%s: poll failed: %s\n", bp->name, strerror(errno));
+            return NULL;
+        }
+        if (ret == 0) {
+            /* Nothing arrived for a while; done once writers have stopped. */
+            if (readers_stop)
+                return NULL;
+            continue;
+        }
+
+        ret = read(bp->fd, buf, sizeof(buf));
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "%s: read failed: %s\n", bp->name, strerror(errno));
+            return NULL;
+        }
+
+        for (x = 0; x < ret; x++) {
+            if (buf[x] != expected)
+                bp->mismatch++;
+            expected = (buf[x] + 1) % PATTERN_MOD;
+        }
+        bp->rx_bytes += ret;
+    }
+
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-b baudrate] [-t seconds] [-r] device [device ...]\n", prog);
+    fprintf(stderr, "  -b  baudrate for all ports (default 921600)\n");
+    fprintf(stderr, "  -t  duration of transmission in seconds (default 10)\n");
+    fprintf(stderr, "  -r  enable RTS/CTS hardware flow control\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int x = 0;
+    int opt = 0;
+    int num_ports = 0;
+    int rtscts = 0;
+    unsigned int baud = 921600;
+    unsigned int duration = 10;
+    double start, elapsed;
+    unsigned long long total = 0, errors = 0;
+
+    while ((opt = getopt(argc, argv, "b:t:rh")) != -1) {
+        switch (opt) {
+        case 'b':
+            baud = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            duration = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            rtscts = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    num_ports = argc - optind;
+    if ((num_ports < 1) || (num_ports > MAX_PORTS) || (baud == 0) || (duration == 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (x = 0; x < num_ports; x++) {
+        ports[x].name = argv[optind + x];
+        ports[x].fd = open_port(ports[x].name, baud, rtscts);
+        if (ports[x].fd < 0)
+            return 1;
+    }
+
+    start = now_secs();
+
+    for (x = 0; x < num_ports; x++) {
+        pthread_create(&ports[x].reader, NULL, reader_thread, &ports[x]);
+        pthread_create(&ports[x].writer, NULL, writer_thread, &ports[x]);
+    }
+
+    sleep(duration);
+    writers_stop = 1;
+    for (x = 0; x < num_ports; x++)
+        pthread_join(ports[x].writer, NULL);
+
+    /* Writes may still be draining out of tty and device buffers. */
+    for (x = 0; x < num_ports; x++)
+        ioctl(ports[x].fd, TCSBRK, 1);
+
+    elapsed = now_secs() - start;
+    readers_stop = 1;
+    for (x = 0; x < num_ports; x++)
+        pthread_join(ports[x].reader, NULL);
+
+    printf("%-16s %14s %14s %12s %10s\n", "port", "tx bytes", "rx bytes", "rx KB/s", "mismatch");
+    for (x = 0; x < num_ports; x++) {
+        printf("%-16s %14llu %14llu %12.1f %10llu\n", ports[x].name, ports[x].tx_bytes, ports[x].rx_bytes,
+                ports[x].rx_bytes / elapsed / 1024.0, ports[x].mismatch);
+        total += ports[x].rx_bytes;
+        errors += ports[x].mismatch;
+        close(ports[x].fd);
+    }
+
+    printf("%-16s %14s %14llu %12.1f %10llu\n", "aggregate", "", total, total / elapsed / 1024.0, errors);
+    printf("baudrate %u, %d port(s), %.2f seconds, theoretical max per port %.1f KB/s\n", baud, num_ports,
+            elapsed, baud / 10.0 / 1024.0);
+
+    return errors ? 2 : 0;
+}
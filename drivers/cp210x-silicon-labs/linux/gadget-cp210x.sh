@@ -0,0 +1,84 @@
+#!/bin/bash
+#
+# This file is part of SerialPundit.
+# 
+# Copyright (C) 2014-2016, Rishi Gupta. All rights reserved.
+#
+# The SerialPundit is DUAL LICENSED. It is made available under the terms of the GNU Affero 
+# General Public License (AGPL) v3.0 for non-commercial use and under the terms of a commercial 
+# license for commercial use of this software. 
+#
+# The SerialPundit is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+# without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#################################################################################################
+
+# Run this script as root user.
+
+# Creates an emulated CP210x (usb_f_sp_cp210x.ko) on dummy_hcd so that sp_cp210x can be tested and
+# benchmarked without hardware. sp_cp210x.ko must be loaded already (see load.sh), it binds to the
+# emulated device and a new ttyUSBx appears.
+#
+# ./gadget-cp210x.sh [partnum] [loopback]  : create, default part 0x04 (CP2104) with loopback 1
+# ./gadget-cp210x.sh remove                : remove emulated device
+
+set -e
+
+if [[ $EUID -ne 0 ]]; then
+   echo "This script must be run as root user !" 1>&2
+   exit 1
+fi
+
+cd "$(dirname "$0")"
+
+gadget=/sys/kernel/config/usb_gadget/sp_cp210x
+
+if [ "$1" == "remove" ]; then
+	if [ -d $gadget ]; then
+		echo "" > $gadget/UDC || true
+		rm -f $gadget/configs/c.1/sp_cp210x.0
+		rmdir $gadget/configs/c.1/strings/0x409 $gadget/configs/c.1
+		rmdir $gadget/functions/sp_cp210x.0
+		rmdir $gadget/strings/0x409 $gadget
+	fi
+	rmmod usb_f_sp_cp210x 2>/dev/null || true
+	echo "emulated cp210x removed !"
+	exit 0
+fi
+
+partnum=${1:-0x04}
+loopback=${2:-1}
+
+if [ ! -f ./usb_f_sp_cp210x.ko ]; then
+	echo "File usb_f_sp_cp210x.ko not found !" 1>&2
+	exit 1
+fi
+
+modprobe libcomposite
+# CP210x is a full speed device, keep dummy_hcd from connecting at high speed
+modprobe dummy_hcd is_high_speed=0
+mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+lsmod | grep -q usb_f_sp_cp210x || insmod ./usb_f_sp_cp210x.ko
+
+mkdir $gadget
+echo 0x10c4 > $gadget/idVendor
+echo 0xea60 > $gadget/idProduct
+mkdir $gadget/strings/0x409
+echo "0001" > $gadget/strings/0x409/serialnumber
+echo "Silicon Labs" > $gadget/strings/0x409/manufacturer
+echo "CP210x emulator" > $gadget/strings/0x409/product
+[ -f $gadget/max_speed ] && echo "full-speed" > $gadget/max_speed
+
+mkdir $gadget/functions/sp_cp210x.0
+echo $partnum > $gadget/functions/sp_cp210x.0/partnum
+echo $loopback > $gadget/functions/sp_cp210x.0/loopback
+
+mkdir $gadget/configs/c.1
+mkdir $gadget/configs/c.1/strings/0x409
+echo "CP210x" > $gadget/configs/c.1/strings/0x409/configuration
+ln -s $gadget/functions/sp_cp210x.0 $gadget/configs/c.1
+
+# dummy_hcd creates a single UDC named dummy_udc.0
+ls /sys/class/udc | grep dummy_udc | head -n 1 > $gadget/UDC
+
+echo "emulated cp210x (part $partnum, loopback $loopback) attached !"
+exit 0
@@ -20,10 +20,21 @@
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
+#include <linux/gpio/driver.h>
 #include <linux/usb.h>
+#include <linux/pm_runtime.h>
 #include <linux/uaccess.h>
 #include <linux/serial.h>
 #include <linux/usb/serial.h>
+#include <asm/unaligned.h>
+
+#define CREATE_TRACE_POINTS
+#include "sp_cp210x_trace.h"
 
 /* CP210x chip type definitions */
 #define PART_CP2101  0x01
@@ -33,10 +44,108 @@
 #define PART_CP2105  0x05
 #define PART_CP2108  0x08
 #define PART_CP2109  0x09
+#define PART_CP2102N_QFN28  0x20
+#define PART_CP2102N_QFN24  0x21
+#define PART_CP2102N_QFN20  0x22
 
 /* IOCTLs */
 #define IOCTL_GPIOGET  0x8000
 #define IOCTL_GPIOSET  0x8001
+#define IOCTL_CTRLFENCE  0x8002
+#define IOCTL_GPIOWAVE   0x8003
+
+/* Bulk-IN (reception) URBs; the number of URBs queued and their transfer length follow baud rate
+ * unless fixed by module parameters rx_urbs and rx_urb_size. */
+#define CP210X_MAX_RX_URBS   16
+#define CP210X_DEF_RX_URBS   8
+#define CP210X_MIN_RX_SIZE   64
+#define CP210X_MAX_RX_SIZE   16384
+#define CP210X_DEF_RX_SIZE   4096
+
+/* CP210X_EMBED_EVENTS; escape character and sequences following it */
+#define CP210X_ESCCHAR          0xEC
+#define CP210X_ESCSEQ_DATA      0x00
+#define CP210X_ESCSEQ_LSR_DATA  0x01
+#define CP210X_ESCSEQ_LSR       0x02
+#define CP210X_ESCSEQ_MSR       0x03
+
+#define CP210X_LSR_OVERRUN  0x02
+#define CP210X_LSR_PARITY   0x04
+#define CP210X_LSR_FRAME    0x08
+#define CP210X_LSR_BREAK    0x10
+
+#define CP210X_MSR_DELTA_CTS   0x01
+#define CP210X_MSR_DELTA_DSR   0x02
+#define CP210X_MSR_DELTA_RI    0x04
+#define CP210X_MSR_DELTA_DCD   0x08
+#define CP210X_MSR_DELTA_MASK  0x0F
+#define CP210X_MSR_DCD         0x80
+
+/* State of embedded events scanner */
+#define CP210X_ES_DATA        0
+#define CP210X_ES_ESCAPE      1
+#define CP210X_ES_LSR_DATA_0  2
+#define CP210X_ES_LSR_DATA_1  3
+#define CP210X_ES_LSR         4
+#define CP210X_ES_MSR         5
+
+/* Size of per port buffer used for control transfers, largest request is CP210X_GET_COMM_STATUS (19 bytes) */
+#define CP210X_CTRL_BUF_SIZE 64
+
+/* Asynchronous control requests; pending requests per port and largest data stage */
+#define CP210X_MAX_CTRL_INFLIGHT  32
+#define CP210X_CTRL_REQ_DATA      16
+
+/* GPIO waveform; steps per ioctl and latch writes queued at a time */
+#define CP210X_MAX_WAVE_STEPS  1024
+#define CP210X_WAVE_SLOTS      32
+
+/* Upper limit of write coalescing deadline in microseconds */
+#define CP210X_MAX_TX_USECS  100000
+
+/* Counters in cp210x_port_private::stats, shown in debugfs file "stats" */
+#define CP210X_STAT_RX_BYTES          0
+#define CP210X_STAT_RX_URBS           1
+#define CP210X_STAT_RX_URB_ERRORS     2
+#define CP210X_STAT_RX_RESUBMITS      3
+#define CP210X_STAT_RX_SUBMIT_ERRORS  4
+#define CP210X_STAT_TX_BYTES          5
+#define CP210X_STAT_TX_URBS           6
+#define CP210X_STAT_TX_URB_ERRORS     7
+#define CP210X_STAT_THROTTLES         8
+#define CP210X_STAT_UNTHROTTLES       9
+#define CP210X_NUM_STATS              10
+
+/* Control request latency histograms; request codes up to CP210X_SET_BAUDRATE have their own slot, vendor
+ * specific requests and anything else are accounted together. Bucket n counts requests which took less
+ * than 2^n microseconds, last bucket counts everything slower. */
+#define CP210X_CTRL_STAT_OTHER   0x1F
+#define CP210X_CTRL_STAT_VENDOR  0x20
+#define CP210X_CTRL_STAT_REQS    0x21
+#define CP210X_HIST_BUCKETS      16
+
+/* Part numbers remembered across replug; entries and longest USB serial number string kept */
+#define CP210X_PARTNUM_CACHE_SIZE  64
+#define CP210X_SERIAL_LEN          64
+
+/* Default XON/XOFF limits (free bytes in receive buffer) for software flow control */
+#define CP210X_XONXOFF_LIMIT_SCI  500
+#define CP210X_XONXOFF_LIMIT_ECI  280
+
+/* Sanity bound for user supplied XON/XOFF limits, larger than receive buffer of any part */
+#define CP210X_MAX_FLOW_LIMIT  4096
+
+/* ulControlHandshake bits which user may add through flow_handshake sysfs file (AN571) */
+#define CP210X_DSR_HANDSHAKE     0x10
+#define CP210X_DCD_HANDSHAKE     0x20
+#define CP210X_DSR_SENSITIVITY   0x40
+#define CP210X_USER_HANDSHAKE_MASK  (CP210X_DSR_HANDSHAKE | CP210X_DCD_HANDSHAKE | CP210X_DSR_SENSITIVITY)
+
+/* Line settings cached in cp210x_port_private::cached */
+#define CP210X_CACHED_BAUD   0x01
+#define CP210X_CACHED_LINE   0x02
+#define CP210X_CACHED_FLOW   0x04
+#define CP210X_CACHED_CHARS  0x08
 
 /* Config/Commands request types */
 #define REQTYPE_HOST_TO_INTERFACE  0x41
@@ -85,6 +194,9 @@
 /* CP210X_(SET|GET)_BAUDDIV */
 #define BAUD_RATE_GEN_FREQ  0x384000
 
+/* CP210X_SET_BAUDRATE; clock from which parts having free divider derive baudrate */
+#define CP210X_BAUD_CLOCK  48000000
+
 /* CP210X_(SET|GET)_LINE_CTL */
 #define BITS_DATA_MASK  0X0F00
 #define BITS_DATA_5     0X0500
@@ -119,15 +231,38 @@
 #define CONTROL_WRITE_DTR  0x0100
 #define CONTROL_WRITE_RTS  0x0200
 
+struct cp210x_port_private;
+
 /* Function prototypes for cp210x usb-serial converter */
 static int write_cp210x_register(struct usb_serial_port *port, u8 request, u8 requestType, int value, 
-        int index, unsigned int *data, int size);
+        int index, void *data, int size);
 static int read_cp210x_register(struct usb_serial_port *port, u8 request, u8 requestType, int value, 
-        int index, unsigned int *data, int size);
+        int index, void *data, int size);
 
 static ssize_t cp210x_gpio_1_store(struct device *dev, struct device_attribute *attr, const char *valbuf, size_t count);
 static ssize_t cp210x_gpio_1_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t tx_coalesce_bytes_store(struct device *dev, struct device_attribute *attr, const char *valbuf, size_t count);
+static ssize_t tx_coalesce_bytes_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t tx_coalesce_usecs_store(struct device *dev, struct device_attribute *attr, const char *valbuf, size_t count);
+static ssize_t tx_coalesce_usecs_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t tx_stats_store(struct device *dev, struct device_attribute *attr, const char *valbuf, size_t count);
+static ssize_t tx_stats_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t xon_limit_store(struct device *dev, struct device_attribute *attr, const char *valbuf, size_t count);
+static ssize_t xon_limit_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t xoff_limit_store(struct device *dev, struct device_attribute *attr, const char *valbuf, size_t count);
+static ssize_t xoff_limit_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t flow_handshake_store(struct device *dev, struct device_attribute *attr, const char *valbuf, size_t count);
+static ssize_t flow_handshake_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t flow_ctl_show(struct device *dev, struct device_attribute *attr, char *buf);
 static void remove_cp210x_sysfs_attrs(struct usb_serial_port *port);
+
+static int read_cp210x_gpio_latch(struct usb_serial_port *port, u16 *latch);
+static int write_cp210x_gpio_latch(struct usb_serial_port *port, u16 mask, u16 state);
+static int fill_cp210x_latch_request(struct cp210x_port_private *port_priv, struct usb_ctrlrequest *setup,
+        u8 *data, u16 mask, u16 state);
+static int stream_cp210x_gpio_wave(struct usb_serial_port *port, unsigned long arg);
+static int register_cp210x_gpio_chip(struct usb_serial_port *port);
+static void unregister_cp210x_gpio_chip(struct usb_serial_port *port);
 static int create_cp210x_sysfs_attrs(struct usb_serial_port *port);
 
 static int xyz_product_probe(struct usb_serial *serial);
@@ -149,12 +284,275 @@ static int sp_cp210x_tiocmget(struct tty_struct *tty);
 static void sp_cp210x_break_ctl(struct tty_struct *tty, int break_state);
 static int sp_cp210x_open(struct tty_struct *tty, struct usb_serial_port *port);
 static void sp_cp210x_close(struct usb_serial_port *port);
+static void sp_cp210x_throttle(struct tty_struct *tty);
+static void sp_cp210x_unthrottle(struct tty_struct *tty);
+static int sp_cp210x_suspend(struct usb_serial *serial, pm_message_t message);
+static int sp_cp210x_resume(struct usb_serial *serial);
+static int sp_cp210x_reset_resume(struct usb_serial *serial);
+static int restore_cp210x_port(struct usb_serial_port *port);
+static void remember_cp210x_latch(struct cp210x_port_private *port_priv, u16 mask, u16 state);
+
+static int alloc_cp210x_read_urbs(struct usb_serial_port *port);
+static void free_cp210x_read_urbs(struct usb_serial_port *port);
+static int submit_cp210x_read_urbs(struct usb_serial_port *port, gfp_t mem_flags);
+static void kill_cp210x_read_urbs(struct usb_serial_port *port);
+static int write_cp210x_register_async(struct usb_serial_port *port, u8 request, u8 requestType, int value,
+        int index, void *data, int size);
+static void cp210x_ctrl_callback(struct urb *urb);
+static int fence_cp210x_ctrl_requests(struct usb_serial_port *port);
+
+static void update_cp210x_rx_policy(struct usb_serial_port *port, u32 baud);
+static void sp_cp210x_read_bulk_callback(struct urb *urb);
+
+static int set_cp210x_embed_events(struct usb_serial_port *port, int enable);
+static char process_cp210x_lsr(struct usb_serial_port *port, u8 lsr);
+static void process_cp210x_msr(struct usb_serial_port *port, u8 msr);
+static void process_cp210x_rx_events(struct usb_serial_port *port, unsigned char *data, int len);
+
+static int is_cp210x_eci(struct cp210x_port_private *port_priv);
+static void init_cp210x_baud_limits(struct cp210x_port_private *port_priv);
+static u32 get_cp210x_actual_baudrate(struct cp210x_port_private *port_priv, u32 baud);
+
+static void invalidate_cp210x_line_cache(struct usb_serial_port *port);
+static int apply_cp210x_baudrate(struct usb_serial_port *port, u32 baud);
+static int apply_cp210x_line_ctl(struct usb_serial_port *port, unsigned int bits);
+static int apply_cp210x_flow(struct usb_serial_port *port, unsigned int *flowctrl);
+static int apply_cp210x_chars(struct usb_serial_port *port, unsigned char *splchar);
+
+static int sp_cp210x_write(struct tty_struct *tty, struct usb_serial_port *port, const unsigned char *buf, int count);
+static int sp_cp210x_prepare_write_buffer(struct usb_serial_port *port, void *dest, size_t size);
+static enum hrtimer_restart cp210x_tx_flush_timer(struct hrtimer *timer);
+static void sp_cp210x_write_bulk_callback(struct urb *urb);
+
+static void cp210x_stat_add(struct cp210x_port_private *port_priv, int stat, u64 val);
+static void cp210x_stat_ctrl(struct cp210x_port_private *port_priv, u8 request, ktime_t start, int error);
+static void create_cp210x_debugfs(struct usb_serial_port *port);
+static void remove_cp210x_debugfs(struct usb_serial_port *port);
+
+static int has_cp210x_serial(struct usb_device *usbdev);
+static int lookup_cp210x_partnum(struct usb_device *usbdev, u8 *part_num);
+static int cache_cp210x_partnum(struct usb_device *usbdev, u8 part_num);
+static void forget_cp210x_partnum(struct usb_device *usbdev);
+static void free_cp210x_partnum_cache(void);
 
 static bool dbg = false;
+static int rx_urbs = 0;
+static int rx_urb_size = 0;
+static bool embed_events = true;
+static bool async_ctrl = true;
+static bool partnum_cache = false;
+static int autosuspend_ms = -1;
+
+/* Root of debugfs hierarchy, /sys/kernel/debug/sp_cp210x */
+static struct dentry *cp210x_debugfs_root;
+
+static const char * const cp210x_stat_names[CP210X_NUM_STATS] = {
+        "rx_bytes", "rx_urbs", "rx_urb_errors", "rx_resubmits", "rx_submit_errors",
+        "tx_bytes", "tx_urbs", "tx_urb_errors", "throttles", "unthrottles",
+};
+
+static const char * const cp210x_ctrl_names[CP210X_CTRL_STAT_REQS] = {
+        [CP210X_IFC_ENABLE]      = "IFC_ENABLE",
+        [CP210X_SET_BAUDDIV]     = "SET_BAUDDIV",
+        [CP210X_GET_BAUDDIV]     = "GET_BAUDDIV",
+        [CP210X_SET_LINE_CTL]    = "SET_LINE_CTL",
+        [CP210X_GET_LINE_CTL]    = "GET_LINE_CTL",
+        [CP210X_SET_BREAK]       = "SET_BREAK",
+        [CP210X_IMM_CHAR]        = "IMM_CHAR",
+        [CP210X_SET_MHS]         = "SET_MHS",
+        [CP210X_GET_MDMSTS]      = "GET_MDMSTS",
+        [CP210X_SET_XON]         = "SET_XON",
+        [CP210X_SET_XOFF]        = "SET_XOFF",
+        [CP210X_SET_EVENTMASK]   = "SET_EVENTMASK",
+        [CP210X_GET_EVENTMASK]   = "GET_EVENTMASK",
+        [CP210X_SET_CHAR]        = "SET_CHAR",
+        [CP210X_GET_CHARS]       = "GET_CHARS",
+        [CP210X_GET_PROPS]       = "GET_PROPS",
+        [CP210X_GET_COMM_STATUS] = "GET_COMM_STATUS",
+        [CP210X_RESET]           = "RESET",
+        [CP210X_PURGE]           = "PURGE",
+        [CP210X_SET_FLOW]        = "SET_FLOW",
+        [CP210X_GET_FLOW]        = "GET_FLOW",
+        [CP210X_EMBED_EVENTS]    = "EMBED_EVENTS",
+        [CP210X_GET_EVENTSTATE]  = "GET_EVENTSTATE",
+        [CP210X_SET_CHARS]       = "SET_CHARS",
+        [CP210X_GET_BAUDRATE]    = "GET_BAUDRATE",
+        [CP210X_SET_BAUDRATE]    = "SET_BAUDRATE",
+        [CP210X_CTRL_STAT_OTHER] = "OTHER",
+        [CP210X_CTRL_STAT_VENDOR] = "VENDOR_SPECIFIC",
+};
+
+/* Part number of a device seen earlier. While device is attached entry belongs to it (usbdev), so other
+ * interfaces of the same device use it; users counts interfaces bound to it. When last one goes usbdev is
+ * NULL and, only if partnum_cache is set, entry is kept for replug keyed by VID, PID, bcdDevice and USB
+ * serial number string. */
+struct cp210x_partnum_entry {
+    struct list_head list;
+    struct usb_device *usbdev;
+    int users;
+    u16 vid;
+    u16 pid;
+    u16 bcd;
+    u8 part_num;
+    char serial[CP210X_SERIAL_LEN];
+};
+
+/* Most recently used entry is at head, cp210x_partnum_mutex protects list and count. */
+static LIST_HEAD(cp210x_partnum_list);
+static DEFINE_MUTEX(cp210x_partnum_mutex);
+static int cp210x_partnum_count;
+
+/* An asynchronous control request, setup packet and data stage are DMA'd from here. */
+struct cp210x_ctrl_req {
+    struct usb_ctrlrequest setup;
+    u8 data[CP210X_CTRL_REQ_DATA];
+    struct usb_serial_port *port;
+    ktime_t start;
+};
+
+/* Context of a bulk-IN URB, tells completion handler which slot of rx_urb[] the URB occupies. */
+struct cp210x_rx_slot {
+    struct usb_serial_port *port;
+    int index;
+};
+
+/* One step of a GPIO waveform (IOCTL_GPIOWAVE); GPIOs in mask are set to value, then next step is executed
+ * delay_us microseconds after device has executed this one (0 means immediately). */
+struct cp210x_gpio_step {
+    __u16 mask;
+    __u16 value;
+    __u32 delay_us;
+};
+
+/* Argument of IOCTL_GPIOWAVE. Application fills num_steps, steps (address of struct cp210x_gpio_step array)
+ * and optionally timestamps (address of __u64 array of num_steps, 0 if not needed). Driver fills steps_done,
+ * timestamps (nanoseconds from submission of first step to completion of each step), elapsed_ns and the
+ * smallest and largest interval between completion of consecutive steps. */
+struct cp210x_gpio_wave {
+    __u32 num_steps;
+    __u32 steps_done;
+    __u64 steps;
+    __u64 timestamps;
+    __u64 elapsed_ns;
+    __u64 min_gap_ns;
+    __u64 max_gap_ns;
+};
+
+/* A GPIO waveform being streamed; lock protects done and error. */
+struct cp210x_wave {
+    struct usb_serial_port *port;
+    struct usb_anchor anchor;
+    wait_queue_head_t wait;
+    spinlock_t lock;
+    unsigned int done;
+    int error;
+    ktime_t start;
+    ktime_t *done_at;
+    struct urb *urb[CP210X_WAVE_SLOTS];
+    struct cp210x_ctrl_req *req[CP210X_WAVE_SLOTS];
+    unsigned int slot_step[CP210X_WAVE_SLOTS];
+};
+
+/* Baudrates supported by parts without free divider (AN205); any rate up to 'upto' maps to 'rate'. */
+static const struct {
+    u32 upto;
+    u32 rate;
+} an205_baud_table[] = {
+        { 300,    300    }, { 600,    600    }, { 1200,   1200   }, { 1800,   1800   },
+        { 2400,   2400   }, { 4000,   4000   }, { 4803,   4800   }, { 7207,   7200   },
+        { 9612,   9600   }, { 14428,  14400  }, { 16062,  16000  }, { 19250,  19200  },
+        { 28912,  28800  }, { 38601,  38400  }, { 51558,  51200  }, { 56280,  56000  },
+        { 58053,  57600  }, { 64111,  64000  }, { 77608,  76800  }, { 117028, 115200 },
+        { 129347, 128000 }, { 156868, 153600 }, { 237832, 230400 }, { 254234, 250000 },
+        { 273066, 256000 }, { 491520, 460800 }, { 567138, 500000 }, { 670254, 576000 },
+        { 999999, 921600 },
+};
 
 struct cp210x_port_private {
     int cp210x_chip_type;
     int interface_enabled;
+    int ifnum;
+    int partnum_ref; /* holds a reference on part number cache entry of this device */
+
+    /* Baudrate range and whether any rate from free divider can be generated */
+    u32 min_baud;
+    u32 max_baud;
+    int use_actual_rate;
+
+    /* DMA-safe buffer for control transfers, serialized by ctrl_mutex. */
+    struct mutex ctrl_mutex;
+    unsigned char *ctrl_buf;
+
+    /* Asynchronous control requests; ctrl_lock protects sequence numbers and error. */
+    struct usb_anchor ctrl_anchor;
+    wait_queue_head_t ctrl_wait;
+    spinlock_t ctrl_lock;
+    atomic_t ctrl_inflight;
+    u32 ctrl_issued;
+    u32 ctrl_done;
+    int ctrl_error;
+
+    /* Serializes GPIO waveforms */
+    struct mutex wave_mutex;
+
+    /* Reception; rx_lock protects everything below except URBs and buffers themselves. */
+    spinlock_t rx_lock;
+    struct urb *rx_urb[CP210X_MAX_RX_URBS];
+    struct cp210x_rx_slot rx_slot[CP210X_MAX_RX_URBS];
+    unsigned long rx_urbs_free;
+    int rx_num_urbs;
+    int rx_buf_size;
+    int rx_active;
+    int rx_inflight;
+    int rx_xfer_len;
+    int rx_throttled;
+    int rx_stopped;
+
+    /* Embedded events; scanner state is touched only from read completion. */
+    int evt_enabled;
+    int evt_state;
+    u8 evt_lsr;
+
+    /* Write coalescing. When tx_coalesce_usecs is 0 every write is sent immediately. */
+    struct usb_serial_port *port;
+    struct hrtimer tx_timer;
+    unsigned int tx_coalesce_bytes;
+    unsigned int tx_coalesce_usecs;
+
+    /* User tuning of flow control applied at next termios update; 0 limit means chip default. */
+    unsigned int xon_limit;
+    unsigned int xoff_limit;
+    unsigned int flow_handshake;
+
+    /* Statistics shown through debugfs (tx_stats sysfs file too), all protected by stats_lock. */
+    spinlock_t stats_lock;
+    u64 stats[CP210X_NUM_STATS];
+    u32 ctrl_count[CP210X_CTRL_STAT_REQS];
+    u32 ctrl_errors[CP210X_CTRL_STAT_REQS];
+    u32 ctrl_hist[CP210X_CTRL_STAT_REQS][CP210X_HIST_BUCKETS];
+    struct dentry *debugfs_dir;
+
+    /* Line settings applied successfully last time, valid only if respective CP210X_CACHED_XXX bit
+     * is set in cached. Used to skip control transfers when nothing has changed. */
+    int cached;
+    u32 cached_baud;
+    unsigned int cached_bits;
+    unsigned int cached_flow[4];
+    unsigned char cached_chars[6];
+
+    /* Modem lines and GPIO latch as last written, replayed if device loses its state; protected by ctrl_lock.
+     * mctrl_written and latch_mask tell which lines and GPIOs have been written at all. */
+    unsigned int mctrl;
+    unsigned int mctrl_written;
+    u16 latch_state;
+    u16 latch_mask;
+
+#ifdef CONFIG_GPIOLIB
+    /* GPIO pins exported through gpiolib; gpio_input has bit set for lines released as input. */
+    struct gpio_chip gc;
+    int gpio_registered;
+    unsigned long gpio_input;
+#endif
 };
 
 /* struct cp210x_products_quirk is used by products that need to do extra things. */
@@ -181,6 +579,7 @@ static const struct usb_device_id id_table[] = {
         { USB_DEVICE(0x10C4, 0xEA60) },
         { USB_DEVICE(0x10C4, 0xEA61) },
         { USB_DEVICE(0x10C4, 0xEA70) },
+        { USB_DEVICE(0x10C4, 0xEA71) },
         { USB_DEVICE(0x10C4, 0xEA80), .driver_info = (kernel_ulong_t) &xyz_product_quirk },
         { } /* terminating entry */
 };
@@ -200,11 +599,14 @@ MODULE_DEVICE_TABLE(usb, id_table);
  *
  * Read : To move data from the port to the host, the host issues IN requests to the port’s data IN endpoint. 
  * When data is received by the USB serial driver for a specific port, is should be placed into the specific 
- * tty structure assigned to that port's flip buffer. The read_bulk_callback function is used for this purpose.
+ * tty structure assigned to that port's flip buffer. The sp_cp210x_read_bulk_callback function is used for this
+ * purpose. The generic read path keeps at most two URBs queued, at high baudrates the time between completion
+ * and resubmission of an URB is enough to overrun cp210x's FIFO during bursts. This driver therefore manages its
+ * own set of bulk-IN URBs (up to 16) and keeps several of them queued all the time (see rx_urbs, rx_urb_size).
  *
- * Overrun: The usb_serial_generic_throttle function is called when the tty layer's input buffers are getting 
+ * Overrun: The sp_cp210x_throttle function is called when the tty layer's input buffers are getting 
  * full to prevent overrun. The tty driver should try to signal the device that no more data should be sent to 
- * it. The usb_serial_generic_unthrottle function is called when the tty layer's input buffers have been emptied 
+ * it. The sp_cp210x_unthrottle function is called when the tty layer's input buffers have been emptied 
  * out and ready to accept data. The tty driver should then signal to the device that data can be received.
  *
  * Typically usb-uart converters handles software/hardware flow control in hardware itself. The driver just 
@@ -222,6 +624,12 @@ MODULE_DEVICE_TABLE(usb, id_table);
  * TCFLSH: As soon as data is given from host to cp210x it will get sent out of port. Similarly, as soon as data
  * is received it will be pushed to flip buffers. So flushing happens only at tty and line discipline layers.
  *
+ * Multi-UART devices: CP2105 (2 UARTs) and CP2108 (4 UARTs) present every UART as a USB interface of its own
+ * with its own pair of bulk endpoints. The USB serial core probes each interface separately, so every UART
+ * gets its own usb_serial instance, one port (num_ports is therefore 1), private data, bulk URBs, control
+ * buffer and locks. Nothing in this driver is shared between interfaces of a chip, so traffic on one UART
+ * never waits for another except for the control endpoint which USB itself shares between them.
+ *
  * Some of the functions which are not set here gets set to their generic version by usbserial driver.
  *
  * Driver name "sp_cp210x" will be seen in /sys/bus/usb/drivers/ directory. From this place scripts can get path to
@@ -231,6 +639,9 @@ static struct usb_serial_driver sp_cp210x_device = {
         .driver = {
                 .owner = THIS_MODULE,
                 .name  = "sp_cp210x",
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,2,0)
+                .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+#endif
         },
         .description   = "CP210X USB Serial Device",
         .id_table      = id_table,
@@ -247,13 +658,19 @@ static struct usb_serial_driver sp_cp210x_device = {
         .ioctl         = sp_cp210x_ioctl,
         .set_termios   = sp_cp210x_set_termios,
         .break_ctl     = sp_cp210x_break_ctl,
-        .throttle      = usb_serial_generic_throttle,
-        .unthrottle    = usb_serial_generic_unthrottle,
+        .throttle      = sp_cp210x_throttle,
+        .unthrottle    = sp_cp210x_unthrottle,
+        .write         = sp_cp210x_write,
+        .prepare_write_buffer = sp_cp210x_prepare_write_buffer,
+        .write_bulk_callback = sp_cp210x_write_bulk_callback,
         .tiocmget      = sp_cp210x_tiocmget,
         .tiocmset      = sp_cp210x_tiocmset,
         .tiocmiwait    = usb_serial_generic_tiocmiwait,
         .get_icount    = usb_serial_generic_get_icount,
         .dtr_rts       = sp_cp210x_dtr_rts,
+        .suspend       = sp_cp210x_suspend,
+        .resume        = sp_cp210x_resume,
+        .reset_resume  = sp_cp210x_reset_resume,
 };
 static struct usb_serial_driver * const serial_drivers[] = {
         &sp_cp210x_device, NULL
@@ -286,6 +703,42 @@ static const struct attribute_group sp_cp210x_attr_group = {
         .attrs = sp_cp210x_attrs,
 };
 
+/* Write coalescing controls and statistics, created for every port irrespective of chip type. */
+static DEVICE_ATTR(tx_coalesce_bytes, (S_IWUSR | S_IRUGO), tx_coalesce_bytes_show, tx_coalesce_bytes_store);
+static DEVICE_ATTR(tx_coalesce_usecs, (S_IWUSR | S_IRUGO), tx_coalesce_usecs_show, tx_coalesce_usecs_store);
+static DEVICE_ATTR(tx_stats, (S_IWUSR | S_IRUGO), tx_stats_show, tx_stats_store);
+
+static struct attribute *sp_cp210x_tx_attrs[] = {
+        &dev_attr_tx_coalesce_bytes.attr,
+        &dev_attr_tx_coalesce_usecs.attr,
+        &dev_attr_tx_stats.attr,
+        NULL,
+};
+
+static const struct attribute_group sp_cp210x_tx_attr_group = {
+        .name = "sp_cp210x_tx",
+        .attrs = sp_cp210x_tx_attrs,
+};
+
+/* Flow control tuning, created for every port irrespective of chip type. */
+static DEVICE_ATTR(xon_limit, (S_IWUSR | S_IRUGO), xon_limit_show, xon_limit_store);
+static DEVICE_ATTR(xoff_limit, (S_IWUSR | S_IRUGO), xoff_limit_show, xoff_limit_store);
+static DEVICE_ATTR(flow_handshake, (S_IWUSR | S_IRUGO), flow_handshake_show, flow_handshake_store);
+static DEVICE_ATTR(flow_ctl, S_IRUGO, flow_ctl_show, NULL);
+
+static struct attribute *sp_cp210x_flow_attrs[] = {
+        &dev_attr_xon_limit.attr,
+        &dev_attr_xoff_limit.attr,
+        &dev_attr_flow_handshake.attr,
+        &dev_attr_flow_ctl.attr,
+        NULL,
+};
+
+static const struct attribute_group sp_cp210x_flow_attr_group = {
+        .name = "sp_cp210x_flow",
+        .attrs = sp_cp210x_flow_attrs,
+};
+
 /* 
  * Creates subdirectory and all sysfs files to be handled explicitly by this driver. The attributes are grouped 
  * to create and destroy all attributes at once easily.
@@ -311,12 +764,25 @@ static int create_cp210x_sysfs_attrs(struct usb_serial_port *port)
     int ret;
     struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
+    ret = sysfs_create_group(&port->dev.kobj, &sp_cp210x_tx_attr_group);
+    if (ret < 0)
+        return ret;
+
+    ret = sysfs_create_group(&port->dev.kobj, &sp_cp210x_flow_attr_group);
+    if (ret < 0) {
+        sysfs_remove_group(&port->dev.kobj, &sp_cp210x_tx_attr_group);
+        return ret;
+    }
+
     if((port_priv->cp210x_chip_type == PART_CP2102) || (port_priv->cp210x_chip_type == PART_CP2109))
         return 0;
 
     ret = sysfs_create_group(&port->dev.kobj, &sp_cp210x_attr_group);
-    if (ret < 0)
+    if (ret < 0) {
+        sysfs_remove_group(&port->dev.kobj, &sp_cp210x_flow_attr_group);
+        sysfs_remove_group(&port->dev.kobj, &sp_cp210x_tx_attr_group);
         return ret;
+    }
 
     return 0;
 }
@@ -331,6 +797,9 @@ static void remove_cp210x_sysfs_attrs(struct usb_serial_port *port)
     struct cp210x_port_private *port_priv;
     port_priv = usb_get_serial_port_data(port);
 
+    sysfs_remove_group(&port->dev.kobj, &sp_cp210x_tx_attr_group);
+    sysfs_remove_group(&port->dev.kobj, &sp_cp210x_flow_attr_group);
+
     if((port_priv->cp210x_chip_type == PART_CP2102) || (port_priv->cp210x_chip_type == PART_CP2109))
         return;
 
@@ -349,35 +818,14 @@ static void remove_cp210x_sysfs_attrs(struct usb_serial_port *port)
 static ssize_t cp210x_gpio_1_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
     int result = 0;
-    unsigned long latch_buf = 0;
+    u16 latch = 0;
     struct usb_serial_port *port = to_usb_serial_port(dev);
-    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
-    if ((PART_CP2103 == port_priv->cp210x_chip_type) || (PART_CP2104 == port_priv->cp210x_chip_type)) {
-        result = read_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_HOST_TO_DEVICE, CP210X_READ_LATCH,
-                0, (unsigned int*)&latch_buf, 1);
-        if (result != 0)
-            return result;
-    }
-    else if (PART_CP2105 == port_priv->cp210x_chip_type) {
-        result = read_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_INTERFACE_TO_HOST, CP210X_READ_LATCH,
-                port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-                (unsigned int*)&latch_buf, 1);
-        if (result != 0)
-            return result;
-    }
-    else if (PART_CP2108 == port_priv->cp210x_chip_type) {
-        result = read_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_DEVICE_TO_HOST, CP210X_READ_LATCH,
-                port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-                (unsigned int*)&latch_buf, 2);
-        if (result != 0)
-            return result;
-    }
-    else {
-        return -ENOTSUPP;
-    }
+    result = read_cp210x_gpio_latch(port, &latch);
+    if (result != 0)
+        return result;
 
-    return sprintf(buf, "%d\n", (int)(latch_buf & 0x02));
+    return sprintf(buf, "%d\n", (int)(latch & 0x02));
 }
 
 /* 
@@ -395,454 +843,1609 @@ static ssize_t cp210x_gpio_1_store(struct device *dev, struct device_attribute *
 {
     int result = 0;
     unsigned int val = 0;
-    unsigned long latch_buf = 0;
     struct usb_serial_port *port = to_usb_serial_port(dev);
-    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
     result = kstrtouint(valbuf, 10, &val);
     if (result != 0)
         return result;
 
-    if(val > 0)
-        latch_buf = 0x202; // 00000010 00000010
-    else
-        latch_buf = 0x200; // 00000010 00000000
-
-    if ((PART_CP2103 == port_priv->cp210x_chip_type) || (PART_CP2104 == port_priv->cp210x_chip_type)) {
-        result = write_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_HOST_TO_DEVICE,
-                CP210X_WRITE_LATCH, latch_buf, NULL, 0);
-        if (result != 0)
-            return result;
-    }
-    else if (PART_CP2105 == port_priv->cp210x_chip_type) {
-        result = write_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_HOST_TO_INTERFACE,
-                CP210X_WRITE_LATCH,
-                port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-                (unsigned int*)&latch_buf, 2);
-        if (result != 0)
-            return result;
-    }
-    else if (PART_CP2108 == port_priv->cp210x_chip_type) {
-        result = write_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_HOST_TO_DEVICE,
-                CP210X_WRITE_LATCH,
-                port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-                (unsigned int*)&latch_buf, 4);
-        if (result != 0)
-            return result;
-    }
-    else {
-        return -ENOTSUPP;
-    }
+    result = write_cp210x_gpio_latch(port, 0x02, (val > 0) ? 0x02 : 0x00);
+    if (result != 0)
+        return result;
 
     return count;
 }
 
-/* 
- * Invoked when a USB core finds a matching device (product) and it's port is probed.
+/*
+ * Reads GPIO latch of cp210x with a single control transfer. Bit n of latch gives state of GPIOn.
  *
- * @port: port corresponding to the end device.
+ * @port: serial port
+ * @latch: location where latch value is returned
  *
  * @return 0 on success otherwise negative error code on failure.
  */
-static int xyz_product_port_probe(struct usb_serial_port *port) 
+static int read_cp210x_gpio_latch(struct usb_serial_port *port, u16 *latch)
 {
-    /*
-     * Let us assume that the CP2104 based product is a temperature monitor product. It senses ambient temperature
-     * and send that value to computer through cp2104 IC, The board uses a LDO (low drop out) voltage regulator
-     * to power temperature sensor. The LDO takes power from Vbus pin of USB port and step down it and supply
-     * power to sensor. In order to save power, this LDO is turned on when this port is probed and turned off when
-     * this port is released. A GPIO_0 pin of cp2104 connects to LDO's enable pin to turn on/off it.
-     *
-     * int result = 0;
-     * struct usb_device *usbdev = port->serial->dev;
-     * struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
-     *
-     * if (usbdev->manufacturer && !strcmp(usbdev->manufacturer, "company name")) {
-     *     if (usbdev->product && !strcmp(usbdev->product, "product name")) {
-     *         result = write_cp210x_register(port, CP210X_IFC_ENABLE, REQTYPE_HOST_TO_INTERFACE, UART_ENABLE,
-     *                               serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
-     *         if (result != 0)
-     *             return result;
-     *
-     *         result = write_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_HOST_TO_DEVICE, CP210X_WRITE_LATCH,
-     *                                        0x101, NULL, 0);
-     *         if (result != 0) {
-     *             write_cp210x_register(port, CP210X_IFC_ENABLE, REQTYPE_HOST_TO_INTERFACE, UART_DISABLE,
-     *                                   serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
-     *         }
-     *         return result;
-     *      }
-     *
-     *      port_priv->interface_enabled = 1;
-     *  }
-     */
-    return 0;
+    int result = 0;
+    u8 latch8 = 0;
+    __le16 latch16 = 0;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    /* GPIOs are used even when port is closed and device may have been autosuspended. */
+    result = usb_autopm_get_interface(port->serial->interface);
+    if (result < 0)
+        return result;
+
+    switch (port_priv->cp210x_chip_type) {
+    case PART_CP2103:
+    case PART_CP2104:
+        result = read_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_DEVICE_TO_HOST, CP210X_READ_LATCH,
+                0, &latch8, 1);
+        *latch = latch8;
+        break;
+    case PART_CP2105:
+        result = read_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_INTERFACE_TO_HOST, CP210X_READ_LATCH,
+                port_priv->ifnum, &latch8, 1);
+        *latch = latch8;
+        break;
+    case PART_CP2108:
+        result = read_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_DEVICE_TO_HOST, CP210X_READ_LATCH,
+                port_priv->ifnum, &latch16, 2);
+        *latch = le16_to_cpu(latch16);
+        break;
+    default:
+        result = -ENOTSUPP;
+        break;
+    }
+
+    usb_autopm_put_interface(port->serial->interface);
+    return result;
 }
 
 /*
- * Invoked when a USB core finds a matching device and a port in this device is probed.
+ * Changes GPIOs selected by mask to the state given in state with a single control transfer. Other GPIOs
+ * are not affected. Request is queued asynchronously (see write_cp210x_register_async).
  *
- * @port: port corresponding to the usb interface.
+ * @port: serial port
+ * @mask: bit n set if GPIOn is to be changed
+ * @state: bit n gives new state of GPIOn
  *
  * @return 0 on success otherwise negative error code on failure.
  */
-static int sp_cp210x_port_probe(struct usb_serial_port *port) 
+static int write_cp210x_gpio_latch(struct usb_serial_port *port, u16 mask, u16 state)
 {
-    struct cp210x_products_quirk *quirk = usb_get_serial_data(port->serial);
+    int size = 0;
+    int result = 0;
+    u8 data[4];
+    struct usb_ctrlrequest setup;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
-    /* If this device has a product specific port probe defined by this driver, call it. */
-    if (quirk && quirk->port_probe) {
-        int ret = quirk->port_probe(port);
-        if (ret != 0)
-            return ret;
-    }
+    size = fill_cp210x_latch_request(port_priv, &setup, data, mask, state);
+    if (size < 0)
+        return size;
 
-    /* Create sysfs entries */
-    create_cp210x_sysfs_attrs(port);
+    /* Device is kept awake until queued request completes, suspend waits for control anchor to drain. */
+    result = usb_autopm_get_interface(port->serial->interface);
+    if (result < 0)
+        return result;
 
-    return 0;
+    result = write_cp210x_register_async(port, setup.bRequest, setup.bRequestType, le16_to_cpu(setup.wValue),
+            le16_to_cpu(setup.wIndex), data, size);
+    if (result == 0)
+        remember_cp210x_latch(port_priv, mask, state);
+
+    usb_mark_last_busy(port->serial->dev);
+    usb_autopm_put_interface(port->serial->interface);
+    return result;
 }
 
 /*
- * Invoked by USB serial core when port is to be removed.
+ * Records GPIO latch change so that it can be written again if device loses its state. Every path writing
+ * the latch (gpio_chip, IOCTL_GPIOSET, IOCTL_GPIOWAVE) must record what device has been asked to latch.
  *
- * @port: port removed
- *
- * @return 0 on success otherwise negative error code on failure.
+ * @port_priv: private data of port
+ * @mask: bit n set if GPIOn has been changed
+ * @state: bit n gives new state of GPIOn
  */
-static int sp_cp210x_port_remove(struct usb_serial_port *port)
+static void remember_cp210x_latch(struct cp210x_port_private *port_priv, u16 mask, u16 state)
 {
-    remove_cp210x_sysfs_attrs(port);
-    return 0;
+    spin_lock_irq(&port_priv->ctrl_lock);
+    port_priv->latch_state = (port_priv->latch_state & ~mask) | (state & mask);
+    port_priv->latch_mask |= mask;
+    spin_unlock_irq(&port_priv->ctrl_lock);
 }
 
-/* 
- * Invoked when a USB core finds a matching device and it is probed if this device 
- * represent a particular product.
+/*
+ * Builds latch write request in the format the part expects: CP2103/CP2104 carry mask and state in wIndex,
+ * CP2105 sends them as two bytes and CP2108 as two little endian 16 bit words in data stage.
  *
- * @serial: usb_serial instance for this matching device.
+ * @port_priv: private data of port
+ * @setup: setup packet to be filled
+ * @data: data stage to be filled (at least 4 bytes)
+ * @mask: bit n set if GPIOn is to be changed
+ * @state: bit n gives new state of GPIOn
  *
- * @return 0 on success otherwise negative error code on failure.
+ * @return length of data stage on success otherwise -ENOTSUPP if part has no GPIO latch.
  */
-static int xyz_product_probe(struct usb_serial *serial) 
+static int fill_cp210x_latch_request(struct cp210x_port_private *port_priv, struct usb_ctrlrequest *setup,
+        u8 *data, u16 mask, u16 state)
 {
-    /*
-     * 1. On a dual/quad serial port devices, a particular port may be dedicated for a particular functionality
-     *    and may be driven from user space driver. This is typically the case with JTAG adapters where usually
-     *    1st serial port will be used for JTAG purpose while others will be used for regular serial communication.
-     *
-     * The code given below makes this driver ignore 1st serial port and hence available for user space driver.
-     *
-     *  struct usb_device *usbdev = serial->dev;
-     *  struct usb_interface *interface = serial->interface;
-     *  if (usbdev->manufacturer && !strcmp(usbdev->manufacturer, "company name")) {
-     *      if (interface == usbdev->actconfig->interface[0]) {
-     *          dev_info(&usbdev->dev, "Ignoring usb-serial first port reserved for JTAG usage.\n");
-     *          return -ENODEV;
-     *      }
-     *  }
-     *
-     * 2. Product specific initialization can be done like setting latency related parameters or a
-     *    particular GPIO pin can be configured.
-     *
-     * The code given below sends a configuration control message to the given USB device.
-     *
-     * struct usb_device *usbdev = serial->dev;
-     * int result = 0;
-     * int latency = 2;
-     * dev_info(&usbdev->dev, Setting latency value for usb-serial device : %d\n", latency);
-     * result = write_cp210x_register(serial->port, XYZ_REQUEST, REQTYPE_HOST_TO_INTERFACE, latency,
-     *                                serial->interface->cur_altsetting->desc.bInterfaceNumber,
-     *                                NULL, 0);
-     * if (result != 0) {
-     *     return result;
-     * }
-     * return 0;
-     *
-     * 3. For non-standard or device firmware specific task such as identification of end points and then
-     *    configuring something may be done here. Drivers usually need to detect endpoint addresses and
-     *    buffer sizes.
-     *
-     * 4. For some USB devices, firmware is loaded into them when probed.
-     */
-    return 0;
+    int size = 0;
+
+    setup->bRequest = CP210X_VENDOR_SPECIFIC;
+    setup->wValue = cpu_to_le16(CP210X_WRITE_LATCH);
+
+    switch (port_priv->cp210x_chip_type) {
+    case PART_CP2103:
+    case PART_CP2104:
+        setup->bRequestType = REQTYPE_HOST_TO_DEVICE;
+        setup->wIndex = cpu_to_le16(((state & 0xFF) << 8) | (mask & 0xFF));
+        break;
+    case PART_CP2105:
+        setup->bRequestType = REQTYPE_HOST_TO_INTERFACE;
+        setup->wIndex = cpu_to_le16(port_priv->ifnum);
+        data[0] = mask & 0xFF;
+        data[1] = state & 0xFF;
+        size = 2;
+        break;
+    case PART_CP2108:
+        setup->bRequestType = REQTYPE_HOST_TO_DEVICE;
+        setup->wIndex = cpu_to_le16(port_priv->ifnum);
+        put_unaligned_le16(mask, &data[0]);
+        put_unaligned_le16(state, &data[2]);
+        size = 4;
+        break;
+    default:
+        return -ENOTSUPP;
+    }
+
+    setup->wLength = cpu_to_le16(size);
+    return size;
 }
 
-/* 
- * 1. User inserts a CP210x device in system. USB host controller IC detects this device and if valid USB
- *    device is found, USB hub driver detects a new USB device. Hub driver fetches some basic information from
- *    USB device and populates some structures to represent this device and associated interfaces etc.
- * 
- * 2. The USB core than takes this device and registers USB interfaces with the kernel driver core. The kernel 
- *    driver core browse through the currently registered list of USB drivers to determine if any of them will
- *    be able to take this device and drive it.
- * 
- * 3. The cp210x driver has registered with usb core via usbserial driver for cp210x device and therefore USB 
- *    serial core accepts control of cp210x device from kernel driver core and builds up a usb_serial structure 
- *    and calls this (probe) function. After this driver initialize or do whatever is required, control is given
- *    back to USB serial core.
- * 
- * 4. The USB serial core determines number of ports in this USB device using end points information (some devices 
- *    may have more endpoint pairs than ports) to find out number of serial ports available in this USB device and 
- *    creates the struct usb_serial_port structure for every port found in this device. This will be one port, typically.
- *    
- * 5. The USB serial core calls driver's attach function if driver for this device has defined it. After the attach 
- *    function returns, individual usb_serial_port structures are registered with the kernel driver core. The 
- *    kernel driver core calls back into the USB serial core for every individual port.
- *    
- * 6. The USB serial core calls port_probe function for every port if driver has defined it. Typically, individual 
- *    port specific task like allocating and initializing data private to a port is done here by USB device driver.
- *    The USB serial core then registers ports with the tty layer.
- * 
- * This function decides whether this driver will drive the given USB interface or not. If this
- * driver wishes to handle the given USB interface it should return 0 otherwise -ENODEV. if genuine IO 
- * errors occurred, an appropriate negative errno value is returned. This function is called if the 
- * driver has registered a probe function for this device with usb-serial core.
+/*
+ * Tells how many steps of a GPIO waveform have completed so far.
  *
- * @serial: serial instance for this device
- * @id: USB VID Aand PID
+ * @wave: waveform being streamed
  *
- * @return 0 on success otherwise negative error code on failure.
+ * @return number of completed steps.
  */
-static int sp_cp210x_probe(struct usb_serial *serial, const struct usb_device_id *id)
+static unsigned int cp210x_wave_done(struct cp210x_wave *wave)
 {
-    int ret;
-    struct cp210x_products_quirk *quirk = (struct cp210x_products_quirk *) id->driver_info;
+    unsigned int done;
 
-    /* If this device has a product specific probe defined by this driver, call it. */
-    if (quirk && quirk->probe) {
-        ret = quirk->probe(serial);
-        if (ret != 0)
-            return ret;
-    }
+    spin_lock_irq(&wave->lock);
+    done = wave->done;
+    spin_unlock_irq(&wave->lock);
 
-    /* Save driver_info as private data in USB device structure. When port is probed, port's probe function will
-     * check if product's port specific probe function has been defined by this driver. If defined, that specific
-     * probe function will get called. */
-    usb_set_serial_data(serial, (void *)id->driver_info);
+    return done;
+}
 
-    return 0;
+/*
+ * Invoked by USB core when latch write of a waveform step completes. Completion time of step is recorded,
+ * control requests complete in the order they were submitted.
+ *
+ * @urb: control URB which has been completed.
+ */
+static void cp210x_wave_callback(struct urb *urb)
+{
+    int x = 0;
+    unsigned long flags;
+    struct cp210x_wave *wave = urb->context;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(wave->port);
+
+    for (x = 0; x < CP210X_WAVE_SLOTS; x++) {
+        if (wave->urb[x] == urb)
+            break;
+    }
+
+    spin_lock_irqsave(&wave->lock, flags);
+    wave->done_at[wave->slot_step[x]] = ktime_get();
+    if (urb->status && (wave->error == 0))
+        wave->error = urb->status;
+    wave->done++;
+    spin_unlock_irqrestore(&wave->lock, flags);
+
+    cp210x_stat_ctrl(port_priv, CP210X_VENDOR_SPECIFIC, wave->req[x]->start, urb->status);
+    trace_cp210x_ctrl(wave->port, wave->req[x]->setup.bRequestType, CP210X_VENDOR_SPECIFIC, CP210X_WRITE_LATCH,
+            le16_to_cpu(wave->req[x]->setup.wIndex), urb->transfer_buffer_length, wave->req[x]->start,
+            urb->status ? urb->status : urb->actual_length);
+    wake_up(&wave->wait);
 }
 
 /*
- * Invoked by the USB serial core when the struct usb_serial structure is fully set up.
- * The driver may do any local initialization of the device and allocte memory.
+ * Streams a sequence of GPIO latch changes. Steps without delay are submitted back to back so that host
+ * controller executes them in consecutive control transfers, at most CP210X_WAVE_SLOTS are queued at a time.
+ * When a step has a delay, the next step is submitted that many microseconds after the step has been
+ * completed by the device. Achieved timing is returned to the caller.
  *
- * @serial: usb_serial instance for cp210x device
+ * @port: serial port
+ * @arg: user space address of struct cp210x_gpio_wave
  *
  * @return 0 on success otherwise negative error code on failure.
  */
-static int sp_cp210x_startup(struct usb_serial *serial)
+static int stream_cp210x_gpio_wave(struct usb_serial_port *port, unsigned long arg)
 {
     int x = 0;
     int result = 0;
-    int clean = 0;
-    int num_allocation = 0;
-    unsigned int part_num;
-    struct cp210x_port_private *port_priv;
+    int size = 0;
+    unsigned int i = 0;
+    unsigned int n = 0;
+    unsigned int submitted = 0;
+    u64 gap = 0;
+    u64 stamp = 0;
+    ktime_t expires;
+    struct urb *urb;
+    struct cp210x_ctrl_req *req;
+    struct cp210x_wave *wave;
+    struct cp210x_gpio_step *steps;
+    struct cp210x_gpio_wave uwave;
+    struct usb_device *usbdev = port->serial->dev;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
-    for (x = 0; x < serial->num_ports; x++) {
+    if (copy_from_user(&uwave, (void __user *)arg, sizeof(uwave)))
+        return -EFAULT;
 
-        /* Allocate memory to hold data private to a port and set its pointer for later retrieval. */
-        port_priv = kzalloc(sizeof(struct cp210x_port_private), GFP_KERNEL);
-        if (!port_priv) {
+    n = uwave.num_steps;
+    if ((n == 0) || (n > CP210X_MAX_WAVE_STEPS))
+        return -EINVAL;
+
+    steps = memdup_user((void __user *)(uintptr_t)uwave.steps, n * sizeof(struct cp210x_gpio_step));
+    if (IS_ERR(steps))
+        return PTR_ERR(steps);
+
+    wave = kzalloc(sizeof(struct cp210x_wave), GFP_KERNEL);
+    if (!wave) {
+        kfree(steps);
+        return -ENOMEM;
+    }
+    wave->port = port;
+    init_usb_anchor(&wave->anchor);
+    init_waitqueue_head(&wave->wait);
+    spin_lock_init(&wave->lock);
+
+    wave->done_at = kcalloc(n, sizeof(ktime_t), GFP_KERNEL);
+    if (!wave->done_at) {
+        result = -ENOMEM;
+        goto free_wave;
+    }
+
+    for (x = 0; x < CP210X_WAVE_SLOTS; x++) {
+        wave->urb[x] = usb_alloc_urb(0, GFP_KERNEL);
+        wave->req[x] = kmalloc(sizeof(struct cp210x_ctrl_req), GFP_KERNEL);
+        if (!wave->urb[x] || !wave->req[x]) {
             result = -ENOMEM;
-            clean = 1;
+            goto free_wave;
+        }
+    }
+
+    /* One waveform at a time per port, otherwise steps of two waveforms get interleaved. */
+    if (mutex_lock_interruptible(&port_priv->wave_mutex)) {
+        result = -ERESTARTSYS;
+        goto free_wave;
+    }
+
+    for (i = 0; i < n; i++) {
+        x = i % CP210X_WAVE_SLOTS;
+
+        /* Slot is free once the step which used it last has completed. */
+        if (i >= CP210X_WAVE_SLOTS) {
+            result = wait_event_interruptible(wave->wait, cp210x_wave_done(wave) > (i - CP210X_WAVE_SLOTS));
+            if (result < 0)
+                break;
+        }
+
+        spin_lock_irq(&wave->lock);
+        result = wave->error;
+        spin_unlock_irq(&wave->lock);
+        if (result < 0)
+            break;
+
+        req = wave->req[x];
+        urb = wave->urb[x];
+        size = fill_cp210x_latch_request(port_priv, &req->setup, req->data, steps[i].mask, steps[i].value);
+        if (size < 0) {
+            result = size;
             break;
         }
+        req->port = port;
+        wave->slot_step[x] = i;
 
-        /* Determine CP210X chip type so that device specific task like IOCTL can be executed. */
-        result = read_cp210x_register(serial->port[x], CP210X_VENDOR_SPECIFIC, REQTYPE_DEVICE_TO_HOST,
-                CP210X_GET_PARTNUM,
-                serial->interface->cur_altsetting->desc.bInterfaceNumber, &part_num, 1);
+        usb_fill_control_urb(urb, usbdev, usb_sndctrlpipe(usbdev, 0), (unsigned char *)&req->setup,
+                size ? req->data : NULL, size, cp210x_wave_callback, wave);
+        usb_anchor_urb(urb, &wave->anchor);
+
+        req->start = ktime_get();
+        if (i == 0)
+            wave->start = req->start;
+
+        result = usb_submit_urb(urb, GFP_KERNEL);
         if (result < 0) {
-            clean = 1;
+            dev_dbg(&port->dev, "%s - usb_submit_urb failed for step %u: %d\n", __func__, i, result);
+            usb_unanchor_urb(urb);
             break;
         }
+        submitted++;
 
-        port_priv->cp210x_chip_type = part_num & 0x000000FF;
+        if (steps[i].delay_us == 0)
+            continue;
 
-        usb_set_serial_port_data(serial->port[x], port_priv);
-        num_allocation++;
+        /* Delay is measured from the moment device has executed this step. */
+        result = wait_event_interruptible(wave->wait, cp210x_wave_done(wave) > i);
+        if (result < 0)
+            break;
+
+        expires = ktime_add_us(wave->done_at[i], steps[i].delay_us);
+        while (ktime_before(ktime_get(), expires)) {
+            set_current_state(TASK_INTERRUPTIBLE);
+            schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+            if (signal_pending(current)) {
+                result = -ERESTARTSYS;
+                break;
+            }
+        }
+        __set_current_state(TASK_RUNNING);
+        if (result < 0)
+            break;
     }
 
-    if (clean == 1) {
-        for (x = 0; x < num_allocation; x++) {
-            port_priv = usb_get_serial_port_data(serial->port[x]);
-            kfree(port_priv);
+    if (result == 0) {
+        if (!wait_event_timeout(wave->wait, cp210x_wave_done(wave) == submitted,
+                msecs_to_jiffies(USB_CTRL_SET_TIMEOUT)))
+            result = -ETIMEDOUT;
+    }
+
+    /* Whatever is still pending after an error or a signal is cancelled. */
+    usb_kill_anchored_urbs(&wave->anchor);
+    mutex_unlock(&port_priv->wave_mutex);
+
+    /* Steps complete in order, latch is left as set by the last completed one. */
+    for (i = 0; i < wave->done; i++)
+        remember_cp210x_latch(port_priv, steps[i].mask, steps[i].value);
+
+    if ((result == 0) && wave->error)
+        result = wave->error;
+
+    /* Restarting would play waveform once more, let application decide. */
+    if (result == -ERESTARTSYS)
+        result = -EINTR;
+
+    /* Report achieved timing of steps which have completed. */
+    uwave.steps_done = wave->done;
+    uwave.elapsed_ns = 0;
+    uwave.min_gap_ns = 0;
+    uwave.max_gap_ns = 0;
+    for (i = 0; i < wave->done; i++) {
+        stamp = ktime_to_ns(ktime_sub(wave->done_at[i], wave->start));
+        if (uwave.timestamps && put_user(stamp, (u64 __user *)(uintptr_t)uwave.timestamps + i)) {
+            result = -EFAULT;
+            goto free_wave;
         }
-        return result;
+        if (i == 0)
+            continue;
+        gap = ktime_to_ns(ktime_sub(wave->done_at[i], wave->done_at[i - 1]));
+        if ((i == 1) || (gap < uwave.min_gap_ns))
+            uwave.min_gap_ns = gap;
+        if (gap > uwave.max_gap_ns)
+            uwave.max_gap_ns = gap;
+    }
+    uwave.elapsed_ns = stamp;
+
+    if (copy_to_user((void __user *)arg, &uwave, sizeof(uwave)))
+        result = -EFAULT;
+
+free_wave:
+    for (x = 0; x < CP210X_WAVE_SLOTS; x++) {
+        usb_free_urb(wave->urb[x]);
+        kfree(wave->req[x]);
     }
+    kfree(wave->done_at);
+    kfree(wave);
+    kfree(steps);
+    return result;
+}
+
+#ifdef CONFIG_GPIOLIB
+
+static int cp210x_gpio_get(struct gpio_chip *gc, unsigned offset)
+{
+    int result = 0;
+    u16 latch = 0;
+    struct cp210x_port_private *port_priv = container_of(gc, struct cp210x_port_private, gc);
+
+    result = read_cp210x_gpio_latch(port_priv->port, &latch);
+    if (result < 0)
+        return result;
+
+    return !!(latch & BIT(offset));
+}
+
+static void cp210x_gpio_set(struct gpio_chip *gc, unsigned offset, int value)
+{
+    struct cp210x_port_private *port_priv = container_of(gc, struct cp210x_port_private, gc);
+
+    write_cp210x_gpio_latch(port_priv->port, BIT(offset), value ? BIT(offset) : 0);
+}
 
+static void cp210x_gpio_set_multiple(struct gpio_chip *gc, unsigned long *mask, unsigned long *bits)
+{
+    struct cp210x_port_private *port_priv = container_of(gc, struct cp210x_port_private, gc);
+
+    write_cp210x_gpio_latch(port_priv->port, mask[0] & 0xFFFF, bits[0] & 0xFFFF);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 15, 0)
+static int cp210x_gpio_get_multiple(struct gpio_chip *gc, unsigned long *mask, unsigned long *bits)
+{
+    int result = 0;
+    u16 latch = 0;
+    struct cp210x_port_private *port_priv = container_of(gc, struct cp210x_port_private, gc);
+
+    result = read_cp210x_gpio_latch(port_priv->port, &latch);
+    if (result < 0)
+        return result;
+
+    bits[0] = (bits[0] & ~mask[0]) | (latch & mask[0]);
     return 0;
 }
+#endif
 
-/*
- * Invoked by the USB serial core when the usb_serial data structure is about to be destroyed.
- *
- * @serial: usb_serial instance corresponding to the device.
- */
-static void sp_cp210x_shutdown(struct usb_serial *serial)
+static int cp210x_gpio_get_direction(struct gpio_chip *gc, unsigned offset)
 {
-    int x = 0;
-    struct cp210x_port_private *port_priv;
+    struct cp210x_port_private *port_priv = container_of(gc, struct cp210x_port_private, gc);
+    return test_bit(offset, &port_priv->gpio_input) ? 1 : 0;
+}
 
-    for (x = 0; x < serial->num_ports; x++) {
-        port_priv = usb_get_serial_port_data(serial->port[x]);
-        kfree(port_priv);
-    }
+/* Pins are open-drain or push-pull as programmed in device's OTP. An open-drain pin is used as input by
+ * releasing it (latch 1), this is all that can be done here. */
+static int cp210x_gpio_direction_input(struct gpio_chip *gc, unsigned offset)
+{
+    struct cp210x_port_private *port_priv = container_of(gc, struct cp210x_port_private, gc);
+
+    set_bit(offset, &port_priv->gpio_input);
+    return write_cp210x_gpio_latch(port_priv->port, BIT(offset), BIT(offset));
+}
+
+static int cp210x_gpio_direction_output(struct gpio_chip *gc, unsigned offset, int value)
+{
+    struct cp210x_port_private *port_priv = container_of(gc, struct cp210x_port_private, gc);
+
+    clear_bit(offset, &port_priv->gpio_input);
+    return write_cp210x_gpio_latch(port_priv->port, BIT(offset), value ? BIT(offset) : 0);
 }
 
 /*
- * Host sends requests to the cp210x device via the control pipe in order to write to cp210x's registers, configure 
- * and control the port etc. Different USB request as defined for cp210x device may require different size of data.
- * The 'size' is specified in bytes and values less than 16 bits wide are sent as is to cp210x device.
+ * Registers a gpio_chip for GPIO pins of cp210x so that standard GPIO interfaces (character device
+ * /dev/gpiochipN, sysfs, in-kernel consumers) can be used. Multiple lines get/set through these interfaces
+ * results in one read or write of latch. CP2103/CP2104 have 4 GPIOs, CP2105 2 on ECI (interface 0) and 3 on
+ * SCI (interface 1), CP2108 16 which are shared by all 4 interfaces, hence registered only for interface 0.
  *
- * @port: port corresponding to the cp210x device
- * @request: command/request to be sent to cp210x firmware
- * @requestType: define direction and two end in communication
- * @value: details as specified in app note
- * @index: generally usb interface number or 0
- * @data: data to be sent to cp210x device
- * @size: define length of data
+ * @port: serial port
  *
- * @return 0 on success otherwise negative error code on failure.
+ * @return 0 on success or if device has no GPIO otherwise negative error code on failure.
  */
-static int write_cp210x_register(struct usb_serial_port *port, u8 request, u8 requestType, int value, 
-        int index, unsigned int *data, int size)
+static int register_cp210x_gpio_chip(struct usb_serial_port *port)
 {
-    __le32 *buf = NULL;
-    int result, x, length = 0;
-
-    if (size) {
-        /* Number of integers required to contain the array */
-        length = (((size - 1) | 3) + 1) / 4;
-
-        buf = kmalloc(length * sizeof(__le32), GFP_KERNEL);
-        if (!buf) {
-            dev_err(&port->dev, "%s - out of memory.\n", __func__);
-            return -ENOMEM;
-        }
+    int result = 0;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+    struct gpio_chip *gc = &port_priv->gc;
 
-        /* Array of integers into bytes */
-        for (x = 0; x < length; x++)
-            buf[x] = cpu_to_le32(data[x]);
+    switch (port_priv->cp210x_chip_type) {
+    case PART_CP2103:
+    case PART_CP2104:
+        gc->ngpio = 4;
+        break;
+    case PART_CP2105:
+        gc->ngpio = is_cp210x_eci(port_priv) ? 2 : 3;
+        break;
+    case PART_CP2108:
+        if (port_priv->ifnum != 0)
+            return 0;
+        gc->ngpio = 16;
+        break;
+    default:
+        return 0;
     }
 
-    /* Send a simple control message to a specified endpoint and waits for the message to complete,
-     * or timeout (5000 milliseconds). */
-    result = usb_control_msg(port->serial->dev, usb_sndctrlpipe(port->serial->dev, 0), request, requestType,
-            value, index, buf, size, USB_CTRL_SET_TIMEOUT);
+    gc->label = "sp_cp210x";
+    gc->owner = THIS_MODULE;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 5, 0)
+    gc->parent = &port->serial->interface->dev;
+#else
+    gc->dev = &port->serial->interface->dev;
+#endif
+    gc->base = -1;
+    gc->can_sleep = true;
+    gc->get_direction = cp210x_gpio_get_direction;
+    gc->direction_input = cp210x_gpio_direction_input;
+    gc->direction_output = cp210x_gpio_direction_output;
+    gc->get = cp210x_gpio_get;
+    gc->set = cp210x_gpio_set;
+    gc->set_multiple = cp210x_gpio_set_multiple;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 15, 0)
+    gc->get_multiple = cp210x_gpio_get_multiple;
+#endif
+
+    result = gpiochip_add(gc);
+    if (result < 0) {
+        dev_err(&port->dev, "%s - failed to register gpio chip: %d\n", __func__, result);
+        return result;
+    }
 
-    if (buf)
-        kfree(buf);
+    port_priv->gpio_registered = 1;
+    return 0;
+}
 
-    if (result != size) {
-        dev_dbg(&port->dev, "%s - Unable to write register, request=0x%x size=%d result=%d\n", __func__,
-                request, size, result);
-        if (result > 0)
-            return -EPROTO;
+/*
+ * Unregisters gpio_chip registered by register_cp210x_gpio_chip, if any.
+ *
+ * @port: serial port
+ */
+static void unregister_cp210x_gpio_chip(struct usb_serial_port *port)
+{
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
-        return result;
+    if (port_priv->gpio_registered) {
+        gpiochip_remove(&port_priv->gc);
+        port_priv->gpio_registered = 0;
     }
+}
+
+#else
 
+static int register_cp210x_gpio_chip(struct usb_serial_port *port)
+{
     return 0;
 }
 
+static void unregister_cp210x_gpio_chip(struct usb_serial_port *port)
+{
+}
+
+#endif /* CONFIG_GPIOLIB */
+
 /* 
- * This function reads value(s) from cp210x device using simple USB control message via the control pipe.
+ * Invoked when user space application read sysfs file tx_coalesce_bytes.
  *
- * @port: port corresponding to the cp210x device
- * @request: command/request to be sent to cp210x firmware
- * @requestType: define direction and two end in communication
- * @value: details as specified in app note
- * @index: generally usb interface number or 0
- * @data: data read from cp210x device
- * @size: define length of data
+ * @dev: device to be queried
+ * @attr: sysfs attribute for this device
+ * @buf: memory where result will be placed
  *
- * @return 0 on success otherwise negative error code on failure.
+ * @return number of bytes that make writes to be sent without waiting for flush deadline.
  */
-static int read_cp210x_register(struct usb_serial_port *port, u8 request, u8 requestType, int value, 
-        int index, unsigned int *data, int size)
+static ssize_t tx_coalesce_bytes_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    __le32 *buf = NULL;
-    int result, x, length = 0;
-
-    /* Number of integers required to contain the array */
-    length = (((size - 1) | 3) + 1) / 4;
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
-    buf = kcalloc(length, sizeof(__le32), GFP_KERNEL);
-    if (!buf) {
-        dev_err(&port->dev, "%s - out of memory.\n", __func__);
-        return -ENOMEM;
-    }
+    return sprintf(buf, "%u\n", port_priv->tx_coalesce_bytes);
+}
 
-    result = usb_control_msg(port->serial->dev, usb_rcvctrlpipe(port->serial->dev, 0), request, requestType,
-            value, port->serial->interface->cur_altsetting->desc.bInterfaceNumber, buf, size,
-            USB_CTRL_GET_TIMEOUT);
+/* 
+ * Invoked when user space application write to sysfs file tx_coalesce_bytes. Once this many bytes are
+ * pending they are sent at once, value can be 1 to bulk-OUT buffer size (256).
+ *
+ * @dev: device whose value is to be set
+ * @attr: sysfs attribute for this device
+ * @valbuf: data to be written to device
+ * @count: number of chars in valbuf
+ *
+ * @return number of chars written or negative error code on failure.
+ */
+static ssize_t tx_coalesce_bytes_store(struct device *dev, struct device_attribute *attr, const char *valbuf, 
+        size_t count)
+{
+    int result = 0;
+    unsigned int val = 0;
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
-    /* Convert data into an array of integers */
-    for (x = 0; x < length; x++)
-        data[x] = le32_to_cpu(buf[x]);
+    result = kstrtouint(valbuf, 10, &val);
+    if (result != 0)
+        return result;
 
-    kfree(buf);
+    if ((val < 1) || (val > port->bulk_out_size))
+        return -EINVAL;
 
-    if (result != size) {
-        dev_dbg(&port->dev, "%s - Unable to read resister, request=0x%x size=%d result=%d\n", __func__,
-                request, size, result);
-        if (result > 0)
-            return -EPROTO;
+    port_priv->tx_coalesce_bytes = val;
+    return count;
+}
 
-        return result;
-    }
+/* 
+ * Invoked when user space application read sysfs file tx_coalesce_usecs.
+ *
+ * @dev: device to be queried
+ * @attr: sysfs attribute for this device
+ * @buf: memory where result will be placed
+ *
+ * @return flush deadline in microseconds, 0 if coalescing is disabled.
+ */
+static ssize_t tx_coalesce_usecs_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
-    return 0;
+    return sprintf(buf, "%u\n", port_priv->tx_coalesce_usecs);
 }
 
 /* 
- * Invoked whenever serial port settings are to be updated. The old_termios contains currently 
- * active settings and tty->termios contains new settings to be applied. Typically, if a particular
- * value/setting specified in tty->termios is not supported by cp210x device/driver, it will be set 
- * to nearest supported value. For exammple if application asks for 7 data bits and device does
- * not support it, it will be set to 8 data bits. It is for this reason application should check
- * whether their is a difference between termios structure it sent and the setting in termios structure
- * when this function returns.
+ * Invoked when user space application write to sysfs file tx_coalesce_usecs. Data written by application
+ * is held for at most this many microseconds (0 to 100000) waiting for more data; 0 disables coalescing.
  *
- * @tty: tty device for this port
- * @port: serial port
- * @old_termios: previous/current termios settings
+ * @dev: device whose value is to be set
+ * @attr: sysfs attribute for this device
+ * @valbuf: data to be written to device
+ * @count: number of chars in valbuf
  *
- * @return 0 on success otherwise negative error code on failure.
+ * @return number of chars written or negative error code on failure.
  */
-static void sp_cp210x_set_termios(struct tty_struct *tty, struct usb_serial_port *port, 
-        struct ktermios *old_termios)
+static ssize_t tx_coalesce_usecs_store(struct device *dev, struct device_attribute *attr, const char *valbuf, 
+        size_t count)
 {
     int result = 0;
-    u32 baud = 0;
-    unsigned int bits = 0;
-    int update_data_size = 0;
+    unsigned int val = 0;
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
-    unsigned char splchar[6];
+    result = kstrtouint(valbuf, 10, &val);
+    if (result != 0)
+        return result;
 
-    /* Each variable is 4 bytes (32 bits) in size and ordered with offset as shown below.
-     * <--ulXoffLimit--><--ulXonLimit--><--ulFlowReplace--><--ulControlHandshake--> */
-    unsigned int flowctrl[4];
+    if (val > CP210X_MAX_TX_USECS)
+        return -EINVAL;
 
-    struct usb_device *usbdev = port->serial->dev;
-    struct usb_interface *interface = port->serial->interface;
-    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+    port_priv->tx_coalesce_usecs = val;
 
-    /* B0, is used to terminate the connection.  If B0 is specified, the modem control lines shall
-       no longer be asserted. No flow control and drop DTR, RTS. It is also used to wakeup some 
-       modems for example Siemens MC35i. */
-    if ((tty->termios.c_cflag & CBAUD) == B0 ) {
-        flowctrl[0] |= 0x01;
-        flowctrl[1]  = 0x40;
-        result = write_cp210x_register(port, CP210X_SET_FLOW, REQTYPE_HOST_TO_INTERFACE, 0,
-                port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-                flowctrl, 0x0010);
-        update_cp210x_mctrl_lines(port, 0, TIOCM_DTR | TIOCM_RTS);
-        return;
+    /* If coalescing has been turned off, send whatever is pending now. */
+    if (val == 0) {
+        hrtimer_cancel(&port_priv->tx_timer);
+        usb_serial_generic_write_start(port, GFP_KERNEL);
+    }
+
+    return count;
+}
+
+/* 
+ * Invoked when user space application read sysfs file tx_stats. The format is bytes#transfers#average
+ * where average is mean number of bytes sent per bulk-OUT transfer.
+ *
+ * @dev: device to be queried
+ * @attr: sysfs attribute for this device
+ * @buf: memory where result will be placed
+ *
+ * @return number of characters placed in buf.
+ */
+static ssize_t tx_stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    u64 bytes, transfers, average = 0;
+    unsigned long flags;
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    spin_lock_irqsave(&port_priv->stats_lock, flags);
+    bytes = port_priv->stats[CP210X_STAT_TX_BYTES];
+    transfers = port_priv->stats[CP210X_STAT_TX_URBS];
+    spin_unlock_irqrestore(&port_priv->stats_lock, flags);
+
+    if (transfers)
+        average = div64_u64(bytes, transfers);
+
+    return sprintf(buf, "%llu#%llu#%llu\n", bytes, transfers, average);
+}
+
+/* 
+ * Invoked when user space application write to sysfs file tx_stats. Writing 0 resets statistics.
+ *
+ * @dev: device whose value is to be set
+ * @attr: sysfs attribute for this device
+ * @valbuf: data to be written to device
+ * @count: number of chars in valbuf
+ *
+ * @return number of chars written or negative error code on failure.
+ */
+static ssize_t tx_stats_store(struct device *dev, struct device_attribute *attr, const char *valbuf, 
+        size_t count)
+{
+    int result = 0;
+    unsigned int val = 0;
+    unsigned long flags;
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    result = kstrtouint(valbuf, 10, &val);
+    if (result != 0)
+        return result;
+
+    if (val != 0)
+        return -EINVAL;
+
+    spin_lock_irqsave(&port_priv->stats_lock, flags);
+    port_priv->stats[CP210X_STAT_TX_BYTES] = 0;
+    port_priv->stats[CP210X_STAT_TX_URBS] = 0;
+    spin_unlock_irqrestore(&port_priv->stats_lock, flags);
+
+    return count;
+}
+
+/* 
+ * Invoked when user space application read sysfs file xon_limit.
+ *
+ * @dev: device to be queried
+ * @attr: sysfs attribute for this device
+ * @buf: memory where result will be placed
+ *
+ * @return XON limit set by user, 0 if chip default is used.
+ */
+static ssize_t xon_limit_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    return sprintf(buf, "%u\n", port_priv->xon_limit);
+}
+
+/* 
+ * Invoked when user space application write to sysfs file xon_limit. XON is sent (or RTS raised) when
+ * receive buffer holds fewer than this many bytes. Value 0 selects chip default (500, CP2105 ECI 280 for
+ * software flow control). Takes effect at next termios update.
+ *
+ * @dev: device whose value is to be set
+ * @attr: sysfs attribute for this device
+ * @valbuf: data to be written to device
+ * @count: number of chars in valbuf
+ *
+ * @return number of chars written or negative error code on failure.
+ */
+static ssize_t xon_limit_store(struct device *dev, struct device_attribute *attr, const char *valbuf, 
+        size_t count)
+{
+    int result = 0;
+    unsigned int val = 0;
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    result = kstrtouint(valbuf, 10, &val);
+    if (result != 0)
+        return result;
+
+    if (val > CP210X_MAX_FLOW_LIMIT)
+        return -EINVAL;
+
+    port_priv->xon_limit = val;
+    return count;
+}
+
+/* 
+ * Invoked when user space application read sysfs file xoff_limit.
+ *
+ * @dev: device to be queried
+ * @attr: sysfs attribute for this device
+ * @buf: memory where result will be placed
+ *
+ * @return XOFF limit set by user, 0 if chip default is used.
+ */
+static ssize_t xoff_limit_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    return sprintf(buf, "%u\n", port_priv->xoff_limit);
+}
+
+/* 
+ * Invoked when user space application write to sysfs file xoff_limit. XOFF is sent (or RTS dropped) when
+ * free space in receive buffer falls below this many bytes. Value 0 selects chip default. Takes effect at
+ * next termios update.
+ *
+ * @dev: device whose value is to be set
+ * @attr: sysfs attribute for this device
+ * @valbuf: data to be written to device
+ * @count: number of chars in valbuf
+ *
+ * @return number of chars written or negative error code on failure.
+ */
+static ssize_t xoff_limit_store(struct device *dev, struct device_attribute *attr, const char *valbuf, 
+        size_t count)
+{
+    int result = 0;
+    unsigned int val = 0;
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    result = kstrtouint(valbuf, 10, &val);
+    if (result != 0)
+        return result;
+
+    if (val > CP210X_MAX_FLOW_LIMIT)
+        return -EINVAL;
+
+    port_priv->xoff_limit = val;
+    return count;
+}
+
+/* 
+ * Invoked when user space application read sysfs file flow_handshake.
+ *
+ * @dev: device to be queried
+ * @attr: sysfs attribute for this device
+ * @buf: memory where result will be placed
+ *
+ * @return extra ulControlHandshake bits in hex.
+ */
+static ssize_t flow_handshake_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    return sprintf(buf, "0x%02x\n", port_priv->flow_handshake);
+}
+
+/* 
+ * Invoked when user space application write to sysfs file flow_handshake. Value is OR'ed into ulControlHandshake
+ * whatever flow control termios selects: 0x10 holds transmission while DSR is low, 0x20 while DCD is low and
+ * 0x40 discards received data while DSR is low. Takes effect at next termios update.
+ *
+ * @dev: device whose value is to be set
+ * @attr: sysfs attribute for this device
+ * @valbuf: data to be written to device
+ * @count: number of chars in valbuf
+ *
+ * @return number of chars written or negative error code on failure.
+ */
+static ssize_t flow_handshake_store(struct device *dev, struct device_attribute *attr, const char *valbuf, 
+        size_t count)
+{
+    int result = 0;
+    unsigned int val = 0;
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    result = kstrtouint(valbuf, 0, &val);
+    if (result != 0)
+        return result;
+
+    if (val & ~CP210X_USER_HANDSHAKE_MASK)
+        return -EINVAL;
+
+    port_priv->flow_handshake = val;
+    return count;
+}
+
+/* 
+ * Invoked when user space application read sysfs file flow_ctl. The format is handshake#replace#xon#xoff
+ * showing flow control words last applied to the device, all 0 if nothing has been applied since open.
+ *
+ * @dev: device to be queried
+ * @attr: sysfs attribute for this device
+ * @buf: memory where result will be placed
+ *
+ * @return number of characters placed in buf.
+ */
+static ssize_t flow_ctl_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_serial_port *port = to_usb_serial_port(dev);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if (!(port_priv->cached & CP210X_CACHED_FLOW))
+        return sprintf(buf, "0x00#0x00#0#0\n");
+
+    return sprintf(buf, "0x%02x#0x%02x#%u#%u\n", port_priv->cached_flow[0], port_priv->cached_flow[1],
+            port_priv->cached_flow[2], port_priv->cached_flow[3]);
+}
+
+/* 
+ * Invoked when a USB core finds a matching device (product) and it's port is probed.
+ *
+ * @port: port corresponding to the end device.
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int xyz_product_port_probe(struct usb_serial_port *port) 
+{
+    /*
+     * Let us assume that the CP2104 based product is a temperature monitor product. It senses ambient temperature
+     * and send that value to computer through cp2104 IC, The board uses a LDO (low drop out) voltage regulator
+     * to power temperature sensor. The LDO takes power from Vbus pin of USB port and step down it and supply
+     * power to sensor. In order to save power, this LDO is turned on when this port is probed and turned off when
+     * this port is released. A GPIO_0 pin of cp2104 connects to LDO's enable pin to turn on/off it.
+     *
+     * int result = 0;
+     * struct usb_device *usbdev = port->serial->dev;
+     * struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+     *
+     * if (usbdev->manufacturer && !strcmp(usbdev->manufacturer, "company name")) {
+     *     if (usbdev->product && !strcmp(usbdev->product, "product name")) {
+     *         result = write_cp210x_register(port, CP210X_IFC_ENABLE, REQTYPE_HOST_TO_INTERFACE, UART_ENABLE,
+     *                               serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+     *         if (result != 0)
+     *             return result;
+     *
+     *         result = write_cp210x_gpio_latch(port, 0x01, 0x01);
+     *         if (result != 0) {
+     *             write_cp210x_register(port, CP210X_IFC_ENABLE, REQTYPE_HOST_TO_INTERFACE, UART_DISABLE,
+     *                                   serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+     *         }
+     *         return result;
+     *      }
+     *
+     *      port_priv->interface_enabled = 1;
+     *  }
+     */
+    return 0;
+}
+
+/*
+ * Invoked when a USB core finds a matching device and a port in this device is probed.
+ *
+ * @port: port corresponding to the usb interface.
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int sp_cp210x_port_probe(struct usb_serial_port *port) 
+{
+    int ret;
+    struct cp210x_products_quirk *quirk = usb_get_serial_data(port->serial);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    /* If this device has a product specific port probe defined by this driver, call it. */
+    if (quirk && quirk->port_probe) {
+        ret = quirk->port_probe(port);
+        if (ret != 0)
+            return ret;
+    }
+
+    /* Allocate bulk-IN URBs used for reception. */
+    ret = alloc_cp210x_read_urbs(port);
+    if (ret != 0)
+        return ret;
+
+    /* Write coalescing is disabled to start with. */
+    port_priv->port = port;
+    hrtimer_init(&port_priv->tx_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    port_priv->tx_timer.function = cp210x_tx_flush_timer;
+    port_priv->tx_coalesce_bytes = port->bulk_out_size;
+    port_priv->tx_coalesce_usecs = 0;
+
+    /* Create sysfs entries */
+    create_cp210x_sysfs_attrs(port);
+
+    /* Export GPIOs through gpiolib, driver works without it too. */
+    register_cp210x_gpio_chip(port);
+
+    /* Statistics for field diagnostics, optional too. */
+    create_cp210x_debugfs(port);
+
+    return 0;
+}
+
+/*
+ * Invoked by USB serial core when port is to be removed.
+ *
+ * @port: port removed
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int sp_cp210x_port_remove(struct usb_serial_port *port)
+{
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    remove_cp210x_debugfs(port);
+    unregister_cp210x_gpio_chip(port);
+    remove_cp210x_sysfs_attrs(port);
+    hrtimer_cancel(&port_priv->tx_timer);
+    free_cp210x_read_urbs(port);
+    usb_kill_anchored_urbs(&port_priv->ctrl_anchor);
+    return 0;
+}
+
+/* 
+ * Invoked when a USB core finds a matching device and it is probed if this device 
+ * represent a particular product.
+ *
+ * @serial: usb_serial instance for this matching device.
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int xyz_product_probe(struct usb_serial *serial) 
+{
+    /*
+     * 1. On a dual/quad serial port devices, a particular port may be dedicated for a particular functionality
+     *    and may be driven from user space driver. This is typically the case with JTAG adapters where usually
+     *    1st serial port will be used for JTAG purpose while others will be used for regular serial communication.
+     *
+     * The code given below makes this driver ignore 1st serial port and hence available for user space driver.
+     *
+     *  struct usb_device *usbdev = serial->dev;
+     *  struct usb_interface *interface = serial->interface;
+     *  if (usbdev->manufacturer && !strcmp(usbdev->manufacturer, "company name")) {
+     *      if (interface == usbdev->actconfig->interface[0]) {
+     *          dev_info(&usbdev->dev, "Ignoring usb-serial first port reserved for JTAG usage.\n");
+     *          return -ENODEV;
+     *      }
+     *  }
+     *
+     * 2. Product specific initialization can be done like setting latency related parameters or a
+     *    particular GPIO pin can be configured.
+     *
+     * The code given below sends a configuration control message to the given USB device.
+     *
+     * struct usb_device *usbdev = serial->dev;
+     * int result = 0;
+     * int latency = 2;
+     * dev_info(&usbdev->dev, Setting latency value for usb-serial device : %d\n", latency);
+     * result = write_cp210x_register(serial->port, XYZ_REQUEST, REQTYPE_HOST_TO_INTERFACE, latency,
+     *                                serial->interface->cur_altsetting->desc.bInterfaceNumber,
+     *                                NULL, 0);
+     * if (result != 0) {
+     *     return result;
+     * }
+     * return 0;
+     *
+     * 3. For non-standard or device firmware specific task such as identification of end points and then
+     *    configuring something may be done here. Drivers usually need to detect endpoint addresses and
+     *    buffer sizes.
+     *
+     * 4. For some USB devices, firmware is loaded into them when probed.
+     */
+    return 0;
+}
+
+/* 
+ * 1. User inserts a CP210x device in system. USB host controller IC detects this device and if valid USB
+ *    device is found, USB hub driver detects a new USB device. Hub driver fetches some basic information from
+ *    USB device and populates some structures to represent this device and associated interfaces etc.
+ * 
+ * 2. The USB core than takes this device and registers USB interfaces with the kernel driver core. The kernel 
+ *    driver core browse through the currently registered list of USB drivers to determine if any of them will
+ *    be able to take this device and drive it.
+ * 
+ * 3. The cp210x driver has registered with usb core via usbserial driver for cp210x device and therefore USB 
+ *    serial core accepts control of cp210x device from kernel driver core and builds up a usb_serial structure 
+ *    and calls this (probe) function. After this driver initialize or do whatever is required, control is given
+ *    back to USB serial core.
+ * 
+ * 4. The USB serial core determines number of ports in this USB device using end points information (some devices 
+ *    may have more endpoint pairs than ports) to find out number of serial ports available in this USB device and 
+ *    creates the struct usb_serial_port structure for every port found in this device. This will be one port, typically.
+ *    
+ * 5. The USB serial core calls driver's attach function if driver for this device has defined it. After the attach 
+ *    function returns, individual usb_serial_port structures are registered with the kernel driver core. The 
+ *    kernel driver core calls back into the USB serial core for every individual port.
+ *    
+ * 6. The USB serial core calls port_probe function for every port if driver has defined it. Typically, individual 
+ *    port specific task like allocating and initializing data private to a port is done here by USB device driver.
+ *    The USB serial core then registers ports with the tty layer.
+ * 
+ * This function decides whether this driver will drive the given USB interface or not. If this
+ * driver wishes to handle the given USB interface it should return 0 otherwise -ENODEV. if genuine IO 
+ * errors occurred, an appropriate negative errno value is returned. This function is called if the 
+ * driver has registered a probe function for this device with usb-serial core.
+ *
+ * @serial: serial instance for this device
+ * @id: USB VID Aand PID
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int sp_cp210x_probe(struct usb_serial *serial, const struct usb_device_id *id)
+{
+    int ret;
+    struct cp210x_products_quirk *quirk = (struct cp210x_products_quirk *) id->driver_info;
+
+    /* If this device has a product specific probe defined by this driver, call it. */
+    if (quirk && quirk->probe) {
+        ret = quirk->probe(serial);
+        if (ret != 0)
+            return ret;
+    }
+
+    /* Save driver_info as private data in USB device structure. When port is probed, port's probe function will
+     * check if product's port specific probe function has been defined by this driver. If defined, that specific
+     * probe function will get called. */
+    usb_set_serial_data(serial, (void *)id->driver_info);
+
+    return 0;
+}
+
+/*
+ * Invoked by the USB serial core when the struct usb_serial structure is fully set up.
+ * The driver may do any local initialization of the device and allocte memory.
+ *
+ * @serial: usb_serial instance for cp210x device
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int sp_cp210x_startup(struct usb_serial *serial)
+{
+    int x = 0;
+    int result = 0;
+    int clean = 0;
+    int num_allocation = 0;
+    u8 part_num = 0;
+    struct cp210x_port_private *port_priv;
+
+    for (x = 0; x < serial->num_ports; x++) {
+
+        /* Allocate memory to hold data private to a port and set its pointer for later retrieval. */
+        port_priv = kzalloc(sizeof(struct cp210x_port_private), GFP_KERNEL);
+        if (!port_priv) {
+            result = -ENOMEM;
+            clean = 1;
+            break;
+        }
+
+        /* Control transfer buffer is allocated separately so that it does not share cache line
+         * with anything else and hence can be used for DMA. */
+        port_priv->ctrl_buf = kmalloc(CP210X_CTRL_BUF_SIZE, GFP_KERNEL);
+        if (!port_priv->ctrl_buf) {
+            kfree(port_priv);
+            result = -ENOMEM;
+            clean = 1;
+            break;
+        }
+        mutex_init(&port_priv->ctrl_mutex);
+        init_usb_anchor(&port_priv->ctrl_anchor);
+        init_waitqueue_head(&port_priv->ctrl_wait);
+        spin_lock_init(&port_priv->ctrl_lock);
+        atomic_set(&port_priv->ctrl_inflight, 0);
+        spin_lock_init(&port_priv->stats_lock);
+        mutex_init(&port_priv->wave_mutex);
+
+        usb_set_serial_port_data(serial->port[x], port_priv);
+        num_allocation++;
+
+        /* Determine CP210X chip type so that device specific task like IOCTL can be executed. This is the only
+         * control transfer during attach, it is skipped if this device has been seen before. Interface holds
+         * one reference on cache entry, recorded in its first port. */
+        if (x == 0) {
+            if (lookup_cp210x_partnum(serial->dev, &part_num) == 0) {
+                port_priv->partnum_ref = 1;
+            }else {
+                result = read_cp210x_register(serial->port[x], CP210X_VENDOR_SPECIFIC, REQTYPE_DEVICE_TO_HOST,
+                        CP210X_GET_PARTNUM,
+                        serial->interface->cur_altsetting->desc.bInterfaceNumber, &part_num, 1);
+                if (result < 0) {
+                    clean = 1;
+                    break;
+                }
+                if (cache_cp210x_partnum(serial->dev, part_num) == 0)
+                    port_priv->partnum_ref = 1;
+            }
+        }
+
+        port_priv->cp210x_chip_type = part_num;
+        port_priv->ifnum = serial->interface->cur_altsetting->desc.bInterfaceNumber;
+        init_cp210x_baud_limits(port_priv);
+
+        dev_dbg(&serial->interface->dev, "%s - part number 0x%02x, interface %d\n", __func__,
+                part_num, port_priv->ifnum);
+    }
+
+    if (clean == 1) {
+        for (x = 0; x < num_allocation; x++) {
+            port_priv = usb_get_serial_port_data(serial->port[x]);
+            if (port_priv->partnum_ref)
+                forget_cp210x_partnum(serial->dev);
+            kfree(port_priv->ctrl_buf);
+            kfree(port_priv);
+            usb_set_serial_port_data(serial->port[x], NULL);
+        }
+        return result;
+    }
+
+    /* USB serial core keeps interface awake while a port is open, so only idle devices get suspended. By
+     * default autosuspend policy is left to user space (power/control and power/autosuspend_delay_ms). */
+    if (autosuspend_ms >= 0) {
+        pm_runtime_set_autosuspend_delay(&serial->dev->dev, autosuspend_ms);
+        usb_enable_autosuspend(serial->dev);
+    }
+
+    return 0;
+}
+
+/*
+ * Invoked by the USB serial core when the usb_serial data structure is about to be destroyed.
+ *
+ * @serial: usb_serial instance corresponding to the device.
+ */
+static void sp_cp210x_shutdown(struct usb_serial *serial)
+{
+    int x = 0;
+    struct cp210x_port_private *port_priv;
+
+    for (x = 0; x < serial->num_ports; x++) {
+        port_priv = usb_get_serial_port_data(serial->port[x]);
+        if (port_priv->partnum_ref)
+            forget_cp210x_partnum(serial->dev);
+        kfree(port_priv->ctrl_buf);
+        kfree(port_priv);
+    }
+}
+
+/*
+ * Host sends requests to the cp210x device via the control pipe in order to write to cp210x's registers, configure 
+ * and control the port etc. Different USB request as defined for cp210x device may require different size of data.
+ * The 'size' is specified in bytes and data is sent as is, so multi-byte values must already be in little endian
+ * order. Data is staged in port's preallocated control buffer, no memory is allocated per call.
+ *
+ * @port: port corresponding to the cp210x device
+ * @request: command/request to be sent to cp210x firmware
+ * @requestType: define direction and two end in communication
+ * @value: details as specified in app note
+ * @index: generally usb interface number or 0
+ * @data: data to be sent to cp210x device
+ * @size: define length of data (at most CP210X_CTRL_BUF_SIZE)
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int write_cp210x_register(struct usb_serial_port *port, u8 request, u8 requestType, int value, 
+        int index, void *data, int size)
+{
+    int result = 0;
+    ktime_t start;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if (size > CP210X_CTRL_BUF_SIZE)
+        return -EINVAL;
+
+    mutex_lock(&port_priv->ctrl_mutex);
+
+    if (size)
+        memcpy(port_priv->ctrl_buf, data, size);
+
+    /* Send a simple control message to a specified endpoint and waits for the message to complete,
+     * or timeout (5000 milliseconds). */
+    start = ktime_get();
+    result = usb_control_msg(port->serial->dev, usb_sndctrlpipe(port->serial->dev, 0), request, requestType,
+            value, index, size ? port_priv->ctrl_buf : NULL, size, USB_CTRL_SET_TIMEOUT);
+    cp210x_stat_ctrl(port_priv, request, start, result != size);
+    trace_cp210x_ctrl(port, requestType, request, value, index, size, start, result);
+
+    mutex_unlock(&port_priv->ctrl_mutex);
+
+    if (result != size) {
+        dev_dbg(&port->dev, "%s - Unable to write register, request=0x%x size=%d result=%d\n", __func__,
+                request, size, result);
+        if (result >= 0)
+            return -EPROTO;
+
+        return result;
+    }
+
+    return 0;
+}
+
+/* 
+ * This function reads value(s) from cp210x device using simple USB control message via the control pipe.
+ * Data is returned as is (little endian order for multi-byte values) through port's preallocated control
+ * buffer.
+ *
+ * @port: port corresponding to the cp210x device
+ * @request: command/request to be sent to cp210x firmware
+ * @requestType: define direction and two end in communication
+ * @value: details as specified in app note
+ * @index: generally usb interface number or 0
+ * @data: data read from cp210x device
+ * @size: define length of data (at most CP210X_CTRL_BUF_SIZE)
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int read_cp210x_register(struct usb_serial_port *port, u8 request, u8 requestType, int value, 
+        int index, void *data, int size)
+{
+    int result = 0;
+    ktime_t start;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if (size > CP210X_CTRL_BUF_SIZE)
+        return -EINVAL;
+
+    mutex_lock(&port_priv->ctrl_mutex);
+
+    start = ktime_get();
+    result = usb_control_msg(port->serial->dev, usb_rcvctrlpipe(port->serial->dev, 0), request, requestType,
+            value, port->serial->interface->cur_altsetting->desc.bInterfaceNumber, port_priv->ctrl_buf, size,
+            USB_CTRL_GET_TIMEOUT);
+    cp210x_stat_ctrl(port_priv, request, start, result != size);
+    trace_cp210x_ctrl(port, requestType, request, value,
+            port->serial->interface->cur_altsetting->desc.bInterfaceNumber, size, start, result);
+
+    if (result > 0)
+        memcpy(data, port_priv->ctrl_buf, min(result, size));
+
+    mutex_unlock(&port_priv->ctrl_mutex);
+
+    if (result != size) {
+        dev_dbg(&port->dev, "%s - Unable to read resister, request=0x%x size=%d result=%d\n", __func__,
+                request, size, result);
+        if (result >= 0)
+            return -EPROTO;
+
+        return result;
+    }
+
+    return 0;
+}
+
+/*
+ * Tells whether the port is the Enhanced Communications Interface of a CP2105. ECI is interface 0, the
+ * Standard Communications Interface (SCI) is interface 1.
+ *
+ * @port_priv: private data of port whose chip type and interface number are already known
+ *
+ * @return 1 if port is CP2105 ECI otherwise 0.
+ */
+static int is_cp210x_eci(struct cp210x_port_private *port_priv)
+{
+    return ((port_priv->cp210x_chip_type == PART_CP2105) && (port_priv->ifnum == 0)) ? 1 : 0;
+}
+
+/*
+ * Decides range of baudrates supported by the port and how a requested baudrate maps to the one device
+ * will actually generate. Parts which derive baudrate from a 48 MHz clock with a free divider (CP2104,
+ * CP2105 ECI and CP2102N) can generate any rate 48 MHz / (2 * prescaler * divider). Older parts support
+ * only the discrete rates listed in AN205 below 1 Mbaud.
+ *
+ * @port_priv: private data of port whose chip type and interface number are already known
+ */
+static void init_cp210x_baud_limits(struct cp210x_port_private *port_priv)
+{
+    port_priv->min_baud = 300;
+    port_priv->use_actual_rate = 0;
+
+    switch (port_priv->cp210x_chip_type) {
+    case PART_CP2101:
+        port_priv->max_baud = 921600;
+        break;
+    case PART_CP2102:
+    case PART_CP2103:
+        port_priv->max_baud = 1000000;
+        break;
+    case PART_CP2104:
+        port_priv->use_actual_rate = 1;
+        port_priv->max_baud = 2000000;
+        break;
+    case PART_CP2105:
+        if (is_cp210x_eci(port_priv)) {
+            port_priv->use_actual_rate = 1;
+            port_priv->max_baud = 2000000;
+        }else {
+            port_priv->min_baud = 2400;
+            port_priv->max_baud = 921600;
+        }
+        break;
+    case PART_CP2102N_QFN28:
+    case PART_CP2102N_QFN24:
+    case PART_CP2102N_QFN20:
+        port_priv->use_actual_rate = 1;
+        port_priv->max_baud = 3000000;
+        break;
+    case PART_CP2108:
+    default:
+        port_priv->max_baud = 2000000;
+        break;
+    }
+}
+
+/*
+ * Maps requested baudrate to the rate cp210x will actually use. Rate is first clamped to the range
+ * supported by the part, then it is either computed from the divider the part will choose or looked up
+ * in AN205 table. Rates of 1 Mbaud and above are passed as is to parts without free divider, they
+ * generate them directly.
+ *
+ * @port_priv: private data of port
+ * @baud: requested baudrate (any value, BOTHER included)
+ *
+ * @return baudrate to be sent to device and reported back to application.
+ */
+static u32 get_cp210x_actual_baudrate(struct cp210x_port_private *port_priv, u32 baud)
+{
+    int x = 0;
+    u32 prescale = 1;
+    u32 div = 0;
+
+    baud = clamp(baud, port_priv->min_baud, port_priv->max_baud);
+
+    if (port_priv->use_actual_rate) {
+        if (baud <= 365)
+            prescale = 4;
+        div = DIV_ROUND_CLOSEST(CP210X_BAUD_CLOCK, 2 * prescale * baud);
+        return CP210X_BAUD_CLOCK / (2 * prescale * div);
+    }
+
+    if (baud >= 1000000)
+        return baud;
+
+    for (x = 0; x < ARRAY_SIZE(an205_baud_table) - 1; x++) {
+        if (baud <= an205_baud_table[x].upto)
+            break;
+    }
+
+    return an205_baud_table[x].rate;
+}
+
+/*
+ * Forgets line settings cached for the port, so that next set_termios sends all of them to the device.
+ * Used whenever device state may no longer match cache, for example after interface has been enabled or
+ * disabled.
+ *
+ * @port: serial port
+ */
+static void invalidate_cp210x_line_cache(struct usb_serial_port *port)
+{
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+    port_priv->cached = 0;
+}
+
+/*
+ * Sets baudrate if it differs from the one applied last time successfully.
+ *
+ * @port: serial port
+ * @baud: baudrate to be set
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int apply_cp210x_baudrate(struct usb_serial_port *port, u32 baud)
+{
+    int result = 0;
+    __le32 val = cpu_to_le32(baud);
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if ((port_priv->cached & CP210X_CACHED_BAUD) && (port_priv->cached_baud == baud))
+        return 0;
+
+    result = write_cp210x_register(port, CP210X_SET_BAUDRATE, REQTYPE_HOST_TO_INTERFACE, 0,
+            port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
+            &val, 4);
+    if (result < 0) {
+        port_priv->cached &= ~CP210X_CACHED_BAUD;
+        return result;
+    }
+
+    port_priv->cached_baud = baud;
+    port_priv->cached |= CP210X_CACHED_BAUD;
+    return 0;
+}
+
+/*
+ * Sets data bits, stop bits and parity if they differ from the ones applied last time successfully.
+ *
+ * @port: serial port
+ * @bits: value for CP210X_SET_LINE_CTL request
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int apply_cp210x_line_ctl(struct usb_serial_port *port, unsigned int bits)
+{
+    int result = 0;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if ((port_priv->cached & CP210X_CACHED_LINE) && (port_priv->cached_bits == bits))
+        return 0;
+
+    result = write_cp210x_register(port, CP210X_SET_LINE_CTL, REQTYPE_HOST_TO_INTERFACE, bits,
+            port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
+            NULL, 0);
+    if (result < 0) {
+        port_priv->cached &= ~CP210X_CACHED_LINE;
+        return result;
+    }
+
+    port_priv->cached_bits = bits;
+    port_priv->cached |= CP210X_CACHED_LINE;
+    return 0;
+}
+
+/*
+ * Sets flow control (16 bytes as per AN571) if it differs from the one applied last time successfully.
+ *
+ * @port: serial port
+ * @flowctrl: ulControlHandshake, ulFlowReplace, ulXonLimit and ulXoffLimit in this order
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int apply_cp210x_flow(struct usb_serial_port *port, unsigned int *flowctrl)
+{
+    int result = 0;
+    __le32 buf[4];
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if ((port_priv->cached & CP210X_CACHED_FLOW) && !memcmp(port_priv->cached_flow, flowctrl,
+            sizeof(port_priv->cached_flow)))
+        return 0;
+
+    buf[0] = cpu_to_le32(flowctrl[0]);
+    buf[1] = cpu_to_le32(flowctrl[1]);
+    buf[2] = cpu_to_le32(flowctrl[2]);
+    buf[3] = cpu_to_le32(flowctrl[3]);
+
+    result = write_cp210x_register(port, CP210X_SET_FLOW, REQTYPE_HOST_TO_INTERFACE, 0,
+            port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
+            buf, sizeof(buf));
+    if (result < 0) {
+        port_priv->cached &= ~CP210X_CACHED_FLOW;
+        return result;
+    }
+
+    memcpy(port_priv->cached_flow, flowctrl, sizeof(port_priv->cached_flow));
+    port_priv->cached |= CP210X_CACHED_FLOW;
+    return 0;
+}
+
+/*
+ * Sets special characters (6 bytes; EOF, error, break, event, XON, XOFF) if they differ from the ones
+ * applied last time successfully.
+ *
+ * @port: serial port
+ * @splchar: special characters
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int apply_cp210x_chars(struct usb_serial_port *port, unsigned char *splchar)
+{
+    int result = 0;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if ((port_priv->cached & CP210X_CACHED_CHARS) && !memcmp(port_priv->cached_chars, splchar,
+            sizeof(port_priv->cached_chars)))
+        return 0;
+
+    result = write_cp210x_register(port, CP210X_SET_CHARS, REQTYPE_HOST_TO_INTERFACE, 0,
+            port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
+            splchar, 0x0006);
+    if (result < 0) {
+        port_priv->cached &= ~CP210X_CACHED_CHARS;
+        return result;
+    }
+
+    memcpy(port_priv->cached_chars, splchar, sizeof(port_priv->cached_chars));
+    port_priv->cached |= CP210X_CACHED_CHARS;
+    return 0;
+}
+
+/* 
+ * Invoked whenever serial port settings are to be updated. The old_termios contains currently 
+ * active settings and tty->termios contains new settings to be applied. Typically, if a particular
+ * value/setting specified in tty->termios is not supported by cp210x device/driver, it will be set 
+ * to nearest supported value. For exammple if application asks for 7 data bits and device does
+ * not support it, it will be set to 8 data bits. It is for this reason application should check
+ * whether their is a difference between termios structure it sent and the setting in termios structure
+ * when this function returns.
+ *
+ * Settings applied successfully are cached per port and a control transfer is sent only for the
+ * settings (baudrate, line control, flow control, special characters) which have actually changed.
+ *
+ * @tty: tty device for this port
+ * @port: serial port
+ * @old_termios: previous/current termios settings
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static void sp_cp210x_set_termios(struct tty_struct *tty, struct usb_serial_port *port, 
+        struct ktermios *old_termios)
+{
+    int result = 0;
+    u32 baud = 0;
+    unsigned int bits = 0;
+    int update_data_size = 0;
+
+    unsigned char splchar[6] = {0};
+
+    /* Each variable is 4 bytes (32 bits) in size and ordered with offset as shown below.
+     * <--ulXoffLimit--><--ulXonLimit--><--ulFlowReplace--><--ulControlHandshake--> */
+    unsigned int flowctrl[4] = {0};
+
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    /* B0, is used to terminate the connection.  If B0 is specified, the modem control lines shall
+       no longer be asserted. No flow control and drop DTR, RTS. It is also used to wakeup some 
+       modems for example Siemens MC35i. */
+    if ((tty->termios.c_cflag & CBAUD) == B0 ) {
+        flowctrl[0] |= 0x01;
+        flowctrl[1]  = 0x40;
+        apply_cp210x_flow(port, flowctrl);
+        update_cp210x_mctrl_lines(port, 0, TIOCM_DTR | TIOCM_RTS);
+        trace_cp210x_set_termios(port, 0, 0, flowctrl[0], flowctrl[1]);
+        return;
     }
 
     /* If spring back to life from B0, raise DTR and RTS. This might get overridden in next steps. */
@@ -850,463 +2453,1782 @@ static void sp_cp210x_set_termios(struct tty_struct *tty, struct usb_serial_port
         update_cp210x_mctrl_lines(port, TIOCM_DTR | TIOCM_RTS, 0);
     }
 
-    /* Update baudrate (as per AN205 app note) */
-    baud = tty_get_baud_rate(tty);
-    if (!baud) {
-        baud = 9600;
+    /* Update baudrate (as per part's capability and AN205 app note) */
+    baud = tty_get_baud_rate(tty);
+    if (!baud) {
+        baud = 9600;
+    }
+
+    baud = get_cp210x_actual_baudrate(port_priv, baud);
+
+    result = apply_cp210x_baudrate(port, baud);
+    if(result < 0) {
+        dev_dbg(&port->dev, "%s - failed to set baudrate with err code: %d\n", __func__, result);
+        if (old_termios != NULL)
+            baud = tty_termios_baud_rate(old_termios);
+        else
+            baud = 0;
+    }
+
+    tty_encode_baud_rate(tty, baud, baud);
+
+    /* Number and size of read URBs queued depends upon baudrate */
+    update_cp210x_rx_policy(port, baud);
+
+    /* Update flow control (AN571 app note). */
+    flowctrl[0] &= ~0x7B;
+
+    if (tty->termios.c_cflag & CRTSCTS) {
+        /* hardware (RTS/CTS) flow control, DTR will always be on. RTS is dropped/raised at the
+         * same thresholds as XOFF/XON would be sent, device defaults are used unless tuned. */
+        flowctrl[0] &= ~0x7B;
+        flowctrl[0] |=  0x09;
+        flowctrl[1]  =  0x80;
+        flowctrl[2]  =  port_priv->xon_limit;
+        flowctrl[3]  =  port_priv->xoff_limit;
+    }
+    else if((tty->termios.c_iflag & IXON) || (tty->termios.c_iflag & IXOFF)) {
+        /* software flow control */
+        flowctrl[0] |= 0x01;
+        flowctrl[1] |= 0x07;
+
+        /* set xon/xoff limit based on chip type unless tuned through sysfs */
+        if (is_cp210x_eci(port_priv)) {
+            flowctrl[2] = CP210X_XONXOFF_LIMIT_ECI;
+            flowctrl[3] = CP210X_XONXOFF_LIMIT_ECI;
+        }else {
+            /* SCI */
+            flowctrl[2] = CP210X_XONXOFF_LIMIT_SCI;
+            flowctrl[3] = CP210X_XONXOFF_LIMIT_SCI;
+        }
+        if (port_priv->xon_limit)
+            flowctrl[2] = port_priv->xon_limit;
+        if (port_priv->xoff_limit)
+            flowctrl[3] = port_priv->xoff_limit;
+
+        splchar[4] = tty->termios.c_cc[VSTART];
+        splchar[5] = tty->termios.c_cc[VSTOP];
+
+        result = apply_cp210x_chars(port, splchar);
+        if (result < 0) {
+            dev_dbg(&port->dev, "%s - failed with err code: %d\n", __func__, result);
+        }
+    }
+    else {
+        /* no flow control */
+        flowctrl[0] &= ~0x7B;
+        flowctrl[0] |=  0x01;
+        flowctrl[1]  =  0x40;
+    }
+
+    /* DSR/DCD handshake requested by user */
+    flowctrl[0] |= port_priv->flow_handshake;
+
+    apply_cp210x_flow(port, flowctrl);
+
+    /* Update number of data bits in UART frame */
+    bits &= ~BITS_DATA_MASK; /* reset */
+
+    switch (tty->termios.c_cflag & CSIZE) {
+    case CS5: bits |= BITS_DATA_5;
+    if(baud >= 921600) {
+        bits |= BITS_DATA_8;
+        tty->termios.c_cflag |= CS8;
+        update_data_size = 1;
+        dev_dbg(&port->dev, "for baudrate >= 921600, only 7/8 data bits are supported.");
+    }
+    break;
+
+    case CS6: bits |= BITS_DATA_6;
+    if(baud >= 921600) {
+        bits |= BITS_DATA_8;
+        tty->termios.c_cflag |= CS8;
+        update_data_size = 1;
+        dev_dbg(&port->dev, "for baudrate >= 921600, only 7/8 data bits are supported.");
+    }
+    break;
+
+    case CS7: bits |= BITS_DATA_7;
+    break;
+
+    case CS8: bits |= BITS_DATA_8;
+    break;
+
+    default:  bits |= BITS_DATA_8;
+    tty->termios.c_cflag |= CS8;
+    update_data_size = 1;
+    dev_dbg(&port->dev, "cp210x device supports only 5,6,7,8 number of data bits.\n");
+    }
+
+    /* Update number of stop bits */
+    bits &= ~BITS_STOP_MASK;
+
+    if (tty->termios.c_cflag & CSTOPB)
+        bits |= BITS_STOP_2;
+    else
+        bits |= BITS_STOP_1;
+
+    /* Update parity type */
+    bits &= ~BITS_PARITY_MASK;
+
+    if (tty->termios.c_cflag & PARENB) {
+        if (tty->termios.c_cflag & CMSPAR) {
+            if (tty->termios.c_cflag & PARODD)
+                bits |= BITS_PARITY_MARK;
+            else
+                bits |= BITS_PARITY_SPACE;
+        }else {
+            if (tty->termios.c_cflag & PARODD)
+                bits |= BITS_PARITY_ODD;
+            else
+                bits |= BITS_PARITY_EVEN;
+        }
+    }
+
+    result = apply_cp210x_line_ctl(port, bits);
+    if(result < 0) {
+        /* If failed revert back settings */
+        if(update_data_size == 1)
+            tty->termios.c_cflag |= (old_termios->c_cflag & CSIZE);
+        dev_dbg(&port->dev, "%s - failed with err code: %d\n", __func__, result);
+    }
+
+    trace_cp210x_set_termios(port, baud, bits, flowctrl[0], flowctrl[1]);
+}
+
+/* 
+ * Invoked by tty layer when application invokes device/driver specific IOCTL command.
+ *
+ * @tty: tty device
+ * @cmd: command to be executed
+ * @arg: arguments to be passed to this command
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int sp_cp210x_ioctl(struct tty_struct *tty, unsigned int cmd, unsigned long arg)
+{
+    int result = 0;
+    u16 mask = 0;
+    u16 state = 0;
+    u8 latch_buf[4];
+    struct usb_serial_port *port = tty->driver_data;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    switch (cmd) {
+
+    case IOCTL_GPIOSET:
+
+        /* User space gives mask followed by state, as bytes (CP2103/4/5) or little endian 16 bit words (CP2108). */
+        if (PART_CP2108 == port_priv->cp210x_chip_type) {
+            if (copy_from_user(latch_buf, (void __user *)arg, 4))
+                return -EFAULT;
+            mask = get_unaligned_le16(&latch_buf[0]);
+            state = get_unaligned_le16(&latch_buf[2]);
+        }
+        else {
+            if (copy_from_user(latch_buf, (void __user *)arg, 2))
+                return -EFAULT;
+            mask = latch_buf[0];
+            state = latch_buf[1];
+        }
+        return write_cp210x_gpio_latch(port, mask, state);
+
+    case IOCTL_GPIOGET:
+
+        result = read_cp210x_gpio_latch(port, &state);
+        if (result != 0)
+            return result;
+        if (PART_CP2108 == port_priv->cp210x_chip_type) {
+            put_unaligned_le16(state, &latch_buf[0]);
+            if (copy_to_user((void __user *)arg, latch_buf, 2))
+                return -EFAULT;
+        }
+        else {
+            latch_buf[0] = state & 0xFF;
+            if (copy_to_user((void __user *)arg, latch_buf, 1))
+                return -EFAULT;
+        }
+        return 0;
+
+    case IOCTL_CTRLFENCE:
+
+        /* Wait till modem line, break and GPIO requests issued so far have been executed by device. */
+        return fence_cp210x_ctrl_requests(port);
+
+    case IOCTL_GPIOWAVE:
+
+        /* Stream a sequence of GPIO changes, returns after last one has been executed by device. */
+        return stream_cp210x_gpio_wave(port, arg);
+
+    default:
+        break;
+    }
+
+    return -ENOIOCTLCMD;
+}
+
+/* 
+ * Invoked when application issue TIOCMGET IOCTL command.
+ *
+ * @tty: tty device
+ *
+ * @return bit mask of line/modem's status on success otherwise negative error code on failure.
+ */
+static int sp_cp210x_tiocmget(struct tty_struct *tty)
+{
+    struct usb_serial_port *port = tty->driver_data;
+    u8 control = 0;
+    int result;
+
+    result = read_cp210x_register(port, CP210X_GET_MDMSTS, REQTYPE_INTERFACE_TO_HOST, CP210X_GET_PARTNUM,
+            0, &control, 1);
+    if (result < 0)
+        return result;
+
+    result= ((control & CONTROL_DTR)  ? TIOCM_DTR : 0) |
+            ((control & CONTROL_RTS)  ? TIOCM_RTS : 0) |
+            ((control & CONTROL_CTS)  ? TIOCM_CTS : 0) |
+            ((control & CONTROL_DSR)  ? TIOCM_DSR : 0) |
+            ((control & CONTROL_RING) ? TIOCM_RI  : 0) |
+            ((control & CONTROL_DCD)  ? TIOCM_CD  : 0);
+    return result;
+}
+
+/* 
+ * This function sets the modem handshaking states for the selected CP210x interface according 
+ * to the value of bit mask set. DTR and RTS values can be set only if the current handshaking 
+ * state of the interface allows direct control of the modem control lines.
+ *
+ * @port: serial port
+ * @set: bit mask of lines to be asserted
+ * @clear: bit mask of lines to be de-asserted
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int update_cp210x_mctrl_lines(struct usb_serial_port *port, unsigned int set, unsigned int clear)
+{
+    int result = 0;
+    unsigned int control = 0;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if (set & TIOCM_RTS) {
+        control |= CONTROL_RTS;
+        control |= CONTROL_WRITE_RTS;
+    }
+    if (set & TIOCM_DTR) {
+        control |= CONTROL_DTR;
+        control |= CONTROL_WRITE_DTR;
+    }
+    if (clear & TIOCM_RTS) {
+        control &= ~CONTROL_RTS;
+        control |= CONTROL_WRITE_RTS;
+    }
+    if (clear & TIOCM_DTR) {
+        control &= ~CONTROL_DTR;
+        control |= CONTROL_WRITE_DTR;
+    }
+
+    result = write_cp210x_register_async(port, CP210X_SET_MHS, REQTYPE_HOST_TO_INTERFACE, control,
+            port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+    if (result < 0)
+        return result;
+
+    spin_lock_irq(&port_priv->ctrl_lock);
+    port_priv->mctrl = (port_priv->mctrl | set) & ~clear;
+    port_priv->mctrl_written |= (set | clear) & (TIOCM_DTR | TIOCM_RTS);
+    spin_unlock_irq(&port_priv->ctrl_lock);
+
+    return 0;
+}
+
+/* 
+ * Invoked when application issue TIOCMSET (TIOCMBIC,TIOCMBIS) IOCTL command.
+ *
+ * @tty: tty device
+ * @set: bit mask of lines to be asserted
+ * @clear: bit mask of lines to be de-asserted
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int sp_cp210x_tiocmset(struct tty_struct *tty, unsigned int set, unsigned int clear)
+{
+    return update_cp210x_mctrl_lines(tty->driver_data, set, clear);
+}
+
+/* 
+ * Invoked by tty layer when RTS/DTR lines need to be set/reset.
+ *
+ * @port: serial port
+ * @on: 0 for de-assertion and 1 for assertion of DTR and RTS lines.
+ */
+static void sp_cp210x_dtr_rts(struct usb_serial_port *port, int on)
+{
+    if (on)
+        update_cp210x_mctrl_lines(port, TIOCM_DTR | TIOCM_RTS, 0);
+    else
+        update_cp210x_mctrl_lines(port, 0, TIOCM_DTR | TIOCM_RTS);
+}
+
+/* 
+ * Invoked by tty layer to turn on or off BREAK condition on port.
+ *
+ * @tty: tty device
+ * @break_state: 0 to turn off break and non zero to set break condition unconditionally
+ */
+static void sp_cp210x_break_ctl(struct tty_struct *tty, int break_state)
+{
+    int result = 0;
+    unsigned int state = 0;
+    struct usb_serial_port *port = tty->driver_data;
+
+    if (break_state == 0)
+        state = BREAK_OFF;
+    else
+        state = BREAK_ON;
+
+    result = write_cp210x_register_async(port, CP210X_SET_BREAK, REQTYPE_HOST_TO_INTERFACE, state,
+            port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+    if (result != 0)
+        dev_dbg(&port->dev, "%s - failed with err code: %d\n", __func__, result);
+}
+
+/*
+ * 1. After the tty device node has been bound to individual serial port, when application opens
+ *    serial port, kernel finds that this node is registered with it and it then call tty layer's
+ *    open function. 
+ *
+ * 2. Because USB serial core has registered this node with tty layer, USB serial core's open
+ *    function gets called. This function determines which specific driver is managing this node
+ *    and it then call open function of that specific driver of USB-UART interface. This specific
+ *    driver typically initialize interface for communication and allocate memory if needed.
+ *
+ * 3. The module count for the specified USB serial driver is incremented in order prevent it from 
+ *    being unloaded when an application is using it.
+ *
+ * @port: serial port
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int sp_cp210x_open(struct tty_struct *tty, struct usb_serial_port *port)
+{
+    int result = 0;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    /* Enabling interface may reset its line settings. */
+    invalidate_cp210x_line_cache(port);
+
+    /* If the interface is not enabled, enable it. */
+    if(port_priv->interface_enabled == 0) {
+        result = write_cp210x_register(port, CP210X_IFC_ENABLE, REQTYPE_HOST_TO_INTERFACE, UART_ENABLE,
+                port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+        if (result < 0) {
+            trace_cp210x_open(port, result);
+            return result;
+        }
+    }
+
+    /* Have line errors and modem status changes reported inline with data, if firmware does not support
+     * it data is received as is. */
+    if (embed_events) {
+        result = set_cp210x_embed_events(port, 1);
+        if (result < 0)
+            dev_dbg(&port->dev, "%s - embedded events not available: %d\n", __func__, result);
+    }else {
+        port_priv->evt_enabled = 0;
+    }
+
+    /* The usbserial driver initializes default termios settings in usb_serial_init function
+     * (9600 8N1 raw mode). We apply them to a cp210x device as is, to start with a sane state. */
+    if (tty)
+        sp_cp210x_set_termios(tty, port, NULL);
+
+    /* Clear throttle, and submit read urbs (issue asynchronous transfer requests for bulk-IN
+     * endpoint). */
+    spin_lock_irq(&port_priv->rx_lock);
+    port_priv->rx_throttled = 0;
+    port_priv->rx_stopped = 0;
+    spin_unlock_irq(&port_priv->rx_lock);
+
+    result = submit_cp210x_read_urbs(port, GFP_KERNEL);
+    if (result < 0)
+        kill_cp210x_read_urbs(port);
+
+    trace_cp210x_open(port, result);
+    return result;
+}
+
+/* 
+ * 1. The application call close system call on serial port's device node. This causes tty_release function
+ *    in tty core to be invoked.
+ *
+ * 2. The tty_release function determines if this is the last reference held on this device node as same
+ *    device node can be opened many times (non-exclusive mode). If it is last reference then close function
+ *    of USB serial core is called.
+ *
+ * 3. The USB serial core calls close function of specific USB interface driver and possibly cancel pending
+ *    USB transfers if any.
+ *
+ * 4. The USB serial core then decrements the module count for the USB serial driver and if count reaches
+ *    zero, it may be unloaded.
+ *
+ * @port: serial port
+ */
+static void sp_cp210x_close(struct usb_serial_port *port)
+{	
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    trace_cp210x_close(port);
+
+    kill_cp210x_read_urbs(port);
+    hrtimer_cancel(&port_priv->tx_timer);
+    usb_serial_generic_close(port);
+
+    /* if close is invoked by application immediately after sending data and data is unsent physically from
+     * cp210x, purge it. */
+    write_cp210x_register(port, CP210X_PURGE, REQTYPE_HOST_TO_INTERFACE, 0x000F,
+            port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+
+    write_cp210x_register(port, CP210X_IFC_ENABLE, REQTYPE_HOST_TO_INTERFACE, UART_DISABLE,
+            port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+
+    invalidate_cp210x_line_cache(port);
+}
+
+/*
+ * Allocates bulk-IN URBs and their buffers for the given port. The number of URBs and size of buffers are
+ * decided once here (rx_urbs and rx_urb_size module parameters or driver defaults); how many of them are
+ * actually kept queued and how much each one may transfer is decided later as per baudrate.
+ *
+ * @port: port for which URBs are to be allocated.
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int alloc_cp210x_read_urbs(struct usb_serial_port *port)
+{
+    int x = 0;
+    int maxp = 0;
+    unsigned char *buf;
+    struct urb *urb;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if (!port->bulk_in_endpointAddress)
+        return -ENODEV;
+
+    spin_lock_init(&port_priv->rx_lock);
+    port_priv->rx_stopped = 1;
+
+    port_priv->rx_num_urbs = (rx_urbs > 0) ? rx_urbs : CP210X_DEF_RX_URBS;
+    if (port_priv->rx_num_urbs > CP210X_MAX_RX_URBS)
+        port_priv->rx_num_urbs = CP210X_MAX_RX_URBS;
+
+    /* Buffer must be multiple of max packet size, otherwise device may babble. */
+    maxp = usb_maxpacket(port->serial->dev, usb_rcvbulkpipe(port->serial->dev,
+            port->bulk_in_endpointAddress), 0);
+    if (maxp <= 0)
+        maxp = CP210X_MIN_RX_SIZE;
+
+    port_priv->rx_buf_size = (rx_urb_size > 0) ? rx_urb_size : CP210X_DEF_RX_SIZE;
+    port_priv->rx_buf_size = clamp(port_priv->rx_buf_size, CP210X_MIN_RX_SIZE, CP210X_MAX_RX_SIZE);
+    port_priv->rx_buf_size = roundup(port_priv->rx_buf_size, maxp);
+
+    for (x = 0; x < port_priv->rx_num_urbs; x++) {
+        urb = usb_alloc_urb(0, GFP_KERNEL);
+        if (!urb)
+            goto failed;
+
+        buf = kmalloc(port_priv->rx_buf_size, GFP_KERNEL);
+        if (!buf) {
+            usb_free_urb(urb);
+            goto failed;
+        }
+
+        port_priv->rx_slot[x].port = port;
+        port_priv->rx_slot[x].index = x;
+        usb_fill_bulk_urb(urb, port->serial->dev, usb_rcvbulkpipe(port->serial->dev,
+                port->bulk_in_endpointAddress), buf, port_priv->rx_buf_size,
+                sp_cp210x_read_bulk_callback, &port_priv->rx_slot[x]);
+
+        port_priv->rx_urb[x] = urb;
+        set_bit(x, &port_priv->rx_urbs_free);
+    }
+
+    port_priv->rx_active = port_priv->rx_num_urbs;
+    port_priv->rx_xfer_len = port_priv->rx_buf_size;
+
+    return 0;
+
+failed:
+    port_priv->rx_num_urbs = x;
+    free_cp210x_read_urbs(port);
+    return -ENOMEM;
+}
+
+/*
+ * Releases all bulk-IN URBs and their buffers. Any URB in flight is killed first.
+ *
+ * @port: port whose URBs are to be released.
+ */
+static void free_cp210x_read_urbs(struct usb_serial_port *port)
+{
+    int x = 0;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    kill_cp210x_read_urbs(port);
+
+    for (x = 0; x < port_priv->rx_num_urbs; x++) {
+        kfree(port_priv->rx_urb[x]->transfer_buffer);
+        usb_free_urb(port_priv->rx_urb[x]);
+        port_priv->rx_urb[x] = NULL;
+    }
+
+    port_priv->rx_num_urbs = 0;
+    port_priv->rx_urbs_free = 0;
+}
+
+/*
+ * Queues free bulk-IN URBs until rx_active URBs are in flight. Nothing is queued if port is throttled or
+ * reception has been stopped.
+ *
+ * @port: port for which URBs are to be submitted.
+ * @mem_flags: GFP_KERNEL if caller can sleep, GFP_ATOMIC otherwise.
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int submit_cp210x_read_urbs(struct usb_serial_port *port, gfp_t mem_flags)
+{
+    int x = 0;
+    int result = 0;
+    unsigned long flags;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    for (x = 0; x < port_priv->rx_num_urbs; x++) {
+
+        spin_lock_irqsave(&port_priv->rx_lock, flags);
+        if (port_priv->rx_stopped || port_priv->rx_throttled ||
+                (port_priv->rx_inflight >= port_priv->rx_active)) {
+            spin_unlock_irqrestore(&port_priv->rx_lock, flags);
+            break;
+        }
+        if (!test_and_clear_bit(x, &port_priv->rx_urbs_free)) {
+            spin_unlock_irqrestore(&port_priv->rx_lock, flags);
+            continue;
+        }
+        port_priv->rx_inflight++;
+        port_priv->rx_urb[x]->transfer_buffer_length = port_priv->rx_xfer_len;
+        spin_unlock_irqrestore(&port_priv->rx_lock, flags);
+
+        result = usb_submit_urb(port_priv->rx_urb[x], mem_flags);
+        if (result < 0) {
+            spin_lock_irqsave(&port_priv->rx_lock, flags);
+            port_priv->rx_inflight--;
+            set_bit(x, &port_priv->rx_urbs_free);
+            spin_unlock_irqrestore(&port_priv->rx_lock, flags);
+            cp210x_stat_add(port_priv, CP210X_STAT_RX_SUBMIT_ERRORS, 1);
+            if (result != -EPERM)
+                dev_err(&port->dev, "%s - usb_submit_urb failed: %d\n", __func__, result);
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Stops reception and cancels all bulk-IN URBs in flight. Waits for completion handlers to finish.
+ *
+ * @port: port whose URBs are to be killed.
+ */
+static void kill_cp210x_read_urbs(struct usb_serial_port *port)
+{
+    int x = 0;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    spin_lock_irq(&port_priv->rx_lock);
+    port_priv->rx_stopped = 1;
+    spin_unlock_irq(&port_priv->rx_lock);
+
+    for (x = 0; x < port_priv->rx_num_urbs; x++)
+        usb_kill_urb(port_priv->rx_urb[x]);
+}
+
+/*
+ * Decides how many bulk-IN URBs are kept queued and how many bytes each one may transfer for the given
+ * baudrate. At 115200 baud a 256 byte transfer holds more than 20 ms worth of data, while at 3 Mbaud cp210x
+ * may deliver more than 4 KB between two consecutive completions of the same URB. If rx_urbs or rx_urb_size
+ * module parameter has been given, that value is used as is. If the port is open and more URBs are needed now
+ * they are queued immediately, surplus URBs are retired as they complete.
+ *
+ * @port: serial port
+ * @baud: baudrate which has been applied to the device
+ */
+static void update_cp210x_rx_policy(struct usb_serial_port *port, u32 baud)
+{
+    int maxp = 0;
+    int active = 0;
+    int xfer_len = 0;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if (baud <= 115200) {
+        active = 2;
+        xfer_len = 256;
+    }else if (baud <= 921600) {
+        active = 4;
+        xfer_len = 1024;
+    }else {
+        active = CP210X_DEF_RX_URBS;
+        xfer_len = CP210X_DEF_RX_SIZE;
+    }
+
+    /* Transfer length must be multiple of max packet size as well (512 at high speed), otherwise
+     * a full packet overflows the URB. Buffers are already rounded so this never exceeds them. */
+    maxp = usb_maxpacket(port->serial->dev, usb_rcvbulkpipe(port->serial->dev,
+            port->bulk_in_endpointAddress), 0);
+    if (maxp > 0)
+        xfer_len = roundup(xfer_len, maxp);
+
+    if ((rx_urbs > 0) || (active > port_priv->rx_num_urbs))
+        active = port_priv->rx_num_urbs;
+    if ((rx_urb_size > 0) || (xfer_len > port_priv->rx_buf_size))
+        xfer_len = port_priv->rx_buf_size;
+
+    spin_lock_irq(&port_priv->rx_lock);
+    port_priv->rx_active = active;
+    port_priv->rx_xfer_len = xfer_len;
+    spin_unlock_irq(&port_priv->rx_lock);
+
+    dev_dbg(&port->dev, "%s - baud %u, %d read urbs of %d bytes\n", __func__, baud, active, xfer_len);
+
+    submit_cp210x_read_urbs(port, GFP_KERNEL);
+}
+
+/*
+ * Invoked by USB core when a bulk-IN URB completes. Received data is pushed to the tty layer and the URB is
+ * queued again unless port is throttled, reception is stopped or fewer URBs are needed at current baudrate.
+ *
+ * @urb: URB which has been completed.
+ */
+static void sp_cp210x_read_bulk_callback(struct urb *urb)
+{
+    int result = 0;
+    unsigned long flags;
+    struct cp210x_rx_slot *slot = urb->context;
+    struct usb_serial_port *port = slot->port;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+    int x = slot->index;
+
+    trace_cp210x_read_urb(port, urb);
+
+    switch (urb->status) {
+    case 0:
+        break;
+    case -ENOENT:
+    case -ECONNRESET:
+    case -ESHUTDOWN:
+        dev_dbg(&port->dev, "%s - urb stopped: %d\n", __func__, urb->status);
+        goto retire;
+    case -EPIPE:
+        dev_err(&port->dev, "%s - urb stopped: %d\n", __func__, urb->status);
+        cp210x_stat_add(port_priv, CP210X_STAT_RX_URB_ERRORS, 1);
+        goto retire;
+    default:
+        dev_dbg(&port->dev, "%s - nonzero urb status: %d\n", __func__, urb->status);
+        cp210x_stat_add(port_priv, CP210X_STAT_RX_URB_ERRORS, 1);
+        goto resubmit;
+    }
+
+    spin_lock_irqsave(&port_priv->stats_lock, flags);
+    port_priv->stats[CP210X_STAT_RX_URBS]++;
+    port_priv->stats[CP210X_STAT_RX_BYTES] += urb->actual_length;
+    spin_unlock_irqrestore(&port_priv->stats_lock, flags);
+
+    if (urb->actual_length) {
+        if (port_priv->evt_enabled)
+            process_cp210x_rx_events(port, urb->transfer_buffer, urb->actual_length);
+        else
+            tty_insert_flip_string(&port->port, urb->transfer_buffer, urb->actual_length);
+        tty_flip_buffer_push(&port->port);
+    }
+
+resubmit:
+    spin_lock_irqsave(&port_priv->rx_lock, flags);
+    if (port_priv->rx_stopped || port_priv->rx_throttled ||
+            (port_priv->rx_inflight > port_priv->rx_active)) {
+        spin_unlock_irqrestore(&port_priv->rx_lock, flags);
+        goto retire;
+    }
+    urb->transfer_buffer_length = port_priv->rx_xfer_len;
+    spin_unlock_irqrestore(&port_priv->rx_lock, flags);
+
+    result = usb_submit_urb(urb, GFP_ATOMIC);
+    if (result == 0) {
+        cp210x_stat_add(port_priv, CP210X_STAT_RX_RESUBMITS, 1);
+        return;
+    }
+    cp210x_stat_add(port_priv, CP210X_STAT_RX_SUBMIT_ERRORS, 1);
+    if (result != -EPERM)
+        dev_err(&port->dev, "%s - usb_submit_urb failed: %d\n", __func__, result);
+
+retire:
+    spin_lock_irqsave(&port_priv->rx_lock, flags);
+    port_priv->rx_inflight--;
+    set_bit(x, &port_priv->rx_urbs_free);
+    spin_unlock_irqrestore(&port_priv->rx_lock, flags);
+}
+
+/*
+ * Enables or disables embedding of line status and modem status events in received data stream. When
+ * enabled, cp210x inserts CP210X_ESCCHAR followed by event type in data stream as described in AN571:
+ *
+ * ESC 0x00           : data byte equal to ESC itself
+ * ESC 0x01 LSR DATA  : data byte received with error indicated in LSR
+ * ESC 0x02 LSR       : line status change without data (overrun, break)
+ * ESC 0x03 MSR       : modem status change
+ *
+ * @port: serial port
+ * @enable: 1 to enable, 0 to disable
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int set_cp210x_embed_events(struct usb_serial_port *port, int enable)
+{
+    int result = 0;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    result = write_cp210x_register(port, CP210X_EMBED_EVENTS, REQTYPE_HOST_TO_INTERFACE,
+            enable ? CP210X_ESCCHAR : 0,
+            port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+
+    port_priv->evt_enabled = (result == 0) ? enable : 0;
+    port_priv->evt_state = CP210X_ES_DATA;
+    return result;
+}
+
+/*
+ * Accounts line status errors in icount and converts them to tty flag for the data byte.
+ *
+ * @port: serial port
+ * @lsr: line status as received in event
+ *
+ * @return TTY_NORMAL, TTY_BREAK, TTY_PARITY or TTY_FRAME.
+ */
+static char process_cp210x_lsr(struct usb_serial_port *port, u8 lsr)
+{
+    char flag = TTY_NORMAL;
+
+    if (lsr & CP210X_LSR_BREAK) {
+        port->icount.brk++;
+        flag = TTY_BREAK;
+    }else if (lsr & CP210X_LSR_PARITY) {
+        port->icount.parity++;
+        flag = TTY_PARITY;
+    }else if (lsr & CP210X_LSR_FRAME) {
+        port->icount.frame++;
+        flag = TTY_FRAME;
+    }
+
+    if (lsr & CP210X_LSR_OVERRUN)
+        port->icount.overrun++;
+
+    return flag;
+}
+
+/*
+ * Accounts modem status changes in icount, wakes up applications waiting in TIOCMIWAIT and handles
+ * carrier change (hangup when carrier is lost and CLOCAL is not set).
+ *
+ * @port: serial port
+ * @msr: modem status as received in event, lower nibble gives changes, upper nibble current state
+ */
+static void process_cp210x_msr(struct usb_serial_port *port, u8 msr)
+{
+    struct tty_struct *tty;
+
+    if (!(msr & CP210X_MSR_DELTA_MASK))
+        return;
+
+    if (msr & CP210X_MSR_DELTA_CTS)
+        port->icount.cts++;
+    if (msr & CP210X_MSR_DELTA_DSR)
+        port->icount.dsr++;
+    if (msr & CP210X_MSR_DELTA_RI)
+        port->icount.rng++;
+    if (msr & CP210X_MSR_DELTA_DCD) {
+        port->icount.dcd++;
+        tty = tty_port_tty_get(&port->port);
+        if (tty) {
+            usb_serial_handle_dcd_change(port, tty, msr & CP210X_MSR_DCD);
+            tty_kref_put(tty);
+        }
+    }
+
+    wake_up_interruptible(&port->port.delta_msr_wait);
+}
+
+/*
+ * Scans received data for embedded events and pushes data to tty flip buffer. Runs of plain data between
+ * escape characters are located with memchr and inserted as a whole, so cost per byte stays close to that
+ * of plain reception. Escape sequence may be split across URBs, scanner state is therefore kept per port.
+ *
+ * @port: serial port
+ * @data: received data
+ * @len: number of bytes in data
+ */
+static void process_cp210x_rx_events(struct usb_serial_port *port, unsigned char *data, int len)
+{
+    int run = 0;
+    char flag;
+    unsigned char *esc;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    while (len > 0) {
+        switch (port_priv->evt_state) {
+        case CP210X_ES_DATA:
+            esc = memchr(data, CP210X_ESCCHAR, len);
+            run = esc ? (esc - data) : len;
+            if (run)
+                tty_insert_flip_string(&port->port, data, run);
+            if (!esc)
+                return;
+            data += run + 1;
+            len -= run + 1;
+            port_priv->evt_state = CP210X_ES_ESCAPE;
+            continue;
+
+        case CP210X_ES_ESCAPE:
+            switch (*data) {
+            case CP210X_ESCSEQ_DATA:
+                tty_insert_flip_char(&port->port, CP210X_ESCCHAR, TTY_NORMAL);
+                port_priv->evt_state = CP210X_ES_DATA;
+                break;
+            case CP210X_ESCSEQ_LSR_DATA:
+                port_priv->evt_state = CP210X_ES_LSR_DATA_0;
+                break;
+            case CP210X_ESCSEQ_LSR:
+                port_priv->evt_state = CP210X_ES_LSR;
+                break;
+            case CP210X_ESCSEQ_MSR:
+                port_priv->evt_state = CP210X_ES_MSR;
+                break;
+            default:
+                dev_dbg(&port->dev, "%s - unexpected escape sequence 0x%02x\n", __func__, *data);
+                port_priv->evt_state = CP210X_ES_DATA;
+                break;
+            }
+            break;
+
+        case CP210X_ES_LSR_DATA_0:
+            port_priv->evt_lsr = *data;
+            port_priv->evt_state = CP210X_ES_LSR_DATA_1;
+            break;
+
+        case CP210X_ES_LSR_DATA_1:
+            flag = process_cp210x_lsr(port, port_priv->evt_lsr);
+            tty_insert_flip_char(&port->port, *data, flag);
+            if (port_priv->evt_lsr & CP210X_LSR_OVERRUN)
+                tty_insert_flip_char(&port->port, 0, TTY_OVERRUN);
+            port_priv->evt_state = CP210X_ES_DATA;
+            break;
+
+        case CP210X_ES_LSR:
+            flag = process_cp210x_lsr(port, *data);
+            if (flag == TTY_BREAK)
+                tty_insert_flip_char(&port->port, 0, TTY_BREAK);
+            if (*data & CP210X_LSR_OVERRUN)
+                tty_insert_flip_char(&port->port, 0, TTY_OVERRUN);
+            port_priv->evt_state = CP210X_ES_DATA;
+            break;
+
+        case CP210X_ES_MSR:
+            process_cp210x_msr(port, *data);
+            port_priv->evt_state = CP210X_ES_DATA;
+            break;
+        }
+
+        data++;
+        len--;
+    }
+}
+
+/* 
+ * Invoked by tty layer when its input buffers are getting full. URBs in flight are allowed to complete
+ * but are not queued again, cp210x then asserts flow control as its FIFO fills.
+ *
+ * @tty: tty device
+ */
+static void sp_cp210x_throttle(struct tty_struct *tty)
+{
+    struct usb_serial_port *port = tty->driver_data;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    spin_lock_irq(&port_priv->rx_lock);
+    port_priv->rx_throttled = 1;
+    spin_unlock_irq(&port_priv->rx_lock);
+
+    cp210x_stat_add(port_priv, CP210X_STAT_THROTTLES, 1);
+}
+
+/* 
+ * Invoked by tty layer when it is ready to accept data again.
+ *
+ * @tty: tty device
+ */
+static void sp_cp210x_unthrottle(struct tty_struct *tty)
+{
+    struct usb_serial_port *port = tty->driver_data;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    spin_lock_irq(&port_priv->rx_lock);
+    port_priv->rx_throttled = 0;
+    spin_unlock_irq(&port_priv->rx_lock);
+
+    cp210x_stat_add(port_priv, CP210X_STAT_UNTHROTTLES, 1);
+    submit_cp210x_read_urbs(port, GFP_KERNEL);
+}
+
+/* 
+ * Invoked by USB serial core when application writes data to the port. Data is queued in port's write fifo.
+ * When coalescing is disabled or tx_coalesce_bytes or more bytes are pending, a bulk-OUT transfer is started
+ * immediately. Otherwise flush timer is armed so that pending data is sent after tx_coalesce_usecs at the
+ * latest. If a transfer is in progress, its completion sends whatever has been queued meanwhile.
+ *
+ * @tty: tty device
+ * @port: serial port
+ * @buf: data to be sent
+ * @count: number of bytes in buf
+ *
+ * @return number of bytes queued on success otherwise negative error code on failure.
+ */
+static int sp_cp210x_write(struct tty_struct *tty, struct usb_serial_port *port, const unsigned char *buf, int count)
+{
+    int result = 0;
+    unsigned int usecs;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    usecs = port_priv->tx_coalesce_usecs;
+    if (usecs == 0)
+        return usb_serial_generic_write(tty, port, buf, count);
+
+    if (!count)
+        return 0;
+
+    count = kfifo_in_locked(&port->write_fifo, buf, count, &port->lock);
+
+    if (kfifo_len(&port->write_fifo) >= port_priv->tx_coalesce_bytes) {
+        hrtimer_try_to_cancel(&port_priv->tx_timer);
+        result = usb_serial_generic_write_start(port, GFP_ATOMIC);
+        if (result < 0)
+            return result;
+    }
+    else if (!hrtimer_active(&port_priv->tx_timer)) {
+        hrtimer_start(&port_priv->tx_timer, ns_to_ktime((u64)usecs * NSEC_PER_USEC), HRTIMER_MODE_REL);
     }
 
-    if (baud <= 300)
-        baud = 300;
-    else if (baud <= 600)     baud = 600;
-    else if (baud <= 1200)    baud = 1200;
-    else if (baud <= 1800)    baud = 1800;
-    else if (baud <= 2400)    baud = 2400;
-    else if (baud <= 4000)    baud = 4000;
-    else if (baud <= 4803)    baud = 4800;
-    else if (baud <= 7207)    baud = 7200;
-    else if (baud <= 9612)    baud = 9600;
-    else if (baud <= 14428)   baud = 14400;
-    else if (baud <= 16062)   baud = 16000;
-    else if (baud <= 19250)   baud = 19200;
-    else if (baud <= 28912)   baud = 28800;
-    else if (baud <= 38601)   baud = 38400;
-    else if (baud <= 51558)   baud = 51200;
-    else if (baud <= 56280)   baud = 56000;
-    else if (baud <= 58053)   baud = 57600;
-    else if (baud <= 64111)   baud = 64000;
-    else if (baud <= 77608)   baud = 76800;
-    else if (baud <= 117028)  baud = 115200;
-    else if (baud <= 129347)  baud = 128000;
-    else if (baud <= 156868)  baud = 153600;
-    else if (baud <= 237832)  baud = 230400;
-    else if (baud <= 254234)  baud = 250000;
-    else if (baud <= 273066)  baud = 256000;
-    else if (baud <= 491520)  baud = 460800;
-    else if (baud <= 567138)  baud = 500000;
-    else if (baud <= 670254)  baud = 576000;
-    else if (baud < 1000000)
-        baud = 921600;
-    else if (baud > 2000000)
-        baud = 2000000;
-    else {
-        baud = 9600;
+    return count;
+}
+
+/* 
+ * Invoked when flush deadline of coalesced data expires, sends whatever is pending.
+ *
+ * @timer: tx_timer of the port
+ *
+ * @return HRTIMER_NORESTART always.
+ */
+static enum hrtimer_restart cp210x_tx_flush_timer(struct hrtimer *timer)
+{
+    struct cp210x_port_private *port_priv = container_of(timer, struct cp210x_port_private, tx_timer);
+
+    usb_serial_generic_write_start(port_priv->port, GFP_ATOMIC);
+    return HRTIMER_NORESTART;
+}
+
+/* 
+ * Invoked by USB serial core to fill bulk-OUT URB's buffer from write fifo. Accounts bytes and transfers
+ * so that average transfer size can be seen through tx_stats sysfs file and debugfs.
+ *
+ * @port: serial port
+ * @dest: URB's transfer buffer
+ * @size: size of transfer buffer
+ *
+ * @return number of bytes placed in dest.
+ */
+static int sp_cp210x_prepare_write_buffer(struct usb_serial_port *port, void *dest, size_t size)
+{
+    int count;
+    unsigned long flags;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    count = usb_serial_generic_prepare_write_buffer(port, dest, size);
+
+    spin_lock_irqsave(&port_priv->stats_lock, flags);
+    port_priv->stats[CP210X_STAT_TX_BYTES] += count;
+    port_priv->stats[CP210X_STAT_TX_URBS]++;
+    spin_unlock_irqrestore(&port_priv->stats_lock, flags);
+
+    return count;
+}
+
+/* 
+ * Invoked by USB core when a bulk-OUT URB completes. Failed transfers are accounted before handing URB
+ * over to USB serial core which returns it to the pool and sends whatever is pending in write fifo.
+ *
+ * @urb: URB which has been completed.
+ */
+static void sp_cp210x_write_bulk_callback(struct urb *urb)
+{
+    struct usb_serial_port *port = urb->context;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    trace_cp210x_write_urb(port, urb);
+
+    if (urb->status)
+        cp210x_stat_add(port_priv, CP210X_STAT_TX_URB_ERRORS, 1);
+
+    usb_serial_generic_write_bulk_callback(urb);
+}
+
+/*
+ * Queues a control request to cp210x and returns without waiting for it to complete. Requests are sent
+ * through default control endpoint whose queue is processed in order by host controller, so requests
+ * issued this way (and any synchronous request issued after them) reach the device in the order they were
+ * issued. A caller which needs to know when they have been executed uses fence_cp210x_ctrl_requests().
+ * If async_ctrl module parameter is false this behaves exactly like write_cp210x_register().
+ *
+ * At most CP210X_MAX_CTRL_INFLIGHT requests may be pending per port, caller sleeps if more are issued.
+ *
+ * @port: port corresponding to the cp210x device
+ * @request: command/request to be sent to cp210x firmware
+ * @requestType: define direction and two end in communication
+ * @value: details as specified in app note
+ * @index: generally usb interface number or 0
+ * @data: data to be sent to cp210x device (copied, caller may free it on return)
+ * @size: define length of data (at most CP210X_CTRL_REQ_DATA)
+ *
+ * @return 0 if request has been queued otherwise negative error code on failure.
+ */
+static int write_cp210x_register_async(struct usb_serial_port *port, u8 request, u8 requestType, int value,
+        int index, void *data, int size)
+{
+    int result = 0;
+    struct urb *urb;
+    struct cp210x_ctrl_req *req;
+    struct usb_device *usbdev = port->serial->dev;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if (!async_ctrl)
+        return write_cp210x_register(port, request, requestType, value, index, data, size);
+
+    if (size > CP210X_CTRL_REQ_DATA)
+        return -EINVAL;
+
+    result = wait_event_interruptible(port_priv->ctrl_wait,
+            atomic_read(&port_priv->ctrl_inflight) < CP210X_MAX_CTRL_INFLIGHT);
+    if (result < 0)
+        return result;
+
+    req = kmalloc(sizeof(struct cp210x_ctrl_req), GFP_KERNEL);
+    if (!req)
+        return -ENOMEM;
+
+    urb = usb_alloc_urb(0, GFP_KERNEL);
+    if (!urb) {
+        kfree(req);
+        return -ENOMEM;
     }
 
-    result = write_cp210x_register(port, CP210X_SET_BAUDRATE, REQTYPE_HOST_TO_INTERFACE, 0,
-            port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-            &baud, 4);
-    if(result < 0) {
-        dev_dbg(&port->dev, "%s - failed to set baudrate with err code: %d\n", __func__, result);
-        if (old_termios != NULL)
-            baud = tty_termios_baud_rate(old_termios);
-        else
-            baud = 0;
+    req->port = port;
+    req->start = ktime_get();
+    req->setup.bRequestType = requestType;
+    req->setup.bRequest = request;
+    req->setup.wValue = cpu_to_le16(value);
+    req->setup.wIndex = cpu_to_le16(index);
+    req->setup.wLength = cpu_to_le16(size);
+    if (size)
+        memcpy(req->data, data, size);
+
+    usb_fill_control_urb(urb, usbdev, usb_sndctrlpipe(usbdev, 0), (unsigned char *)&req->setup,
+            size ? req->data : NULL, size, cp210x_ctrl_callback, req);
+    usb_anchor_urb(urb, &port_priv->ctrl_anchor);
+
+    spin_lock_irq(&port_priv->ctrl_lock);
+    atomic_inc(&port_priv->ctrl_inflight);
+    port_priv->ctrl_issued++;
+    spin_unlock_irq(&port_priv->ctrl_lock);
+
+    result = usb_submit_urb(urb, GFP_KERNEL);
+    if (result < 0) {
+        dev_dbg(&port->dev, "%s - usb_submit_urb failed, request=0x%x result=%d\n", __func__, request, result);
+        usb_unanchor_urb(urb);
+        kfree(req);
+
+        /* Account it as completed so that fences do not wait for it. */
+        spin_lock_irq(&port_priv->ctrl_lock);
+        atomic_dec(&port_priv->ctrl_inflight);
+        port_priv->ctrl_done++;
+        spin_unlock_irq(&port_priv->ctrl_lock);
+        wake_up_all(&port_priv->ctrl_wait);
     }
 
-    tty_encode_baud_rate(tty, baud, baud);
+    /* Anchor and USB core hold their own references */
+    usb_free_urb(urb);
+    return result;
+}
 
-    /* Update flow control (AN571 app note). */
-    flowctrl[0] &= ~0x7B;
+/*
+ * Invoked by USB core when an asynchronous control request completes. First failure since last fence is
+ * remembered so that it can be reported to the application.
+ *
+ * @urb: control URB which has been completed.
+ */
+static void cp210x_ctrl_callback(struct urb *urb)
+{
+    unsigned long flags;
+    struct cp210x_ctrl_req *req = urb->context;
+    struct usb_serial_port *port = req->port;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
-    if (tty->termios.c_cflag & CRTSCTS) {
-        /* hardware (RTS/CTS) flow control, DTR will always be on. */
-        flowctrl[0] &= ~0x7B;
-        flowctrl[0] |=  0x09;
-        flowctrl[1]  =  0x80;
+    spin_lock_irqsave(&port_priv->ctrl_lock, flags);
+    if (urb->status) {
+        dev_dbg(&port->dev, "%s - request=0x%x failed: %d\n", __func__, req->setup.bRequest, urb->status);
+        if (port_priv->ctrl_error == 0)
+            port_priv->ctrl_error = urb->status;
     }
-    else if((tty->termios.c_iflag & IXON) || (tty->termios.c_iflag & IXOFF)) {
-        /* software flow control */
-        flowctrl[0] |= 0x01;
-        flowctrl[1] |= 0x07;
+    atomic_dec(&port_priv->ctrl_inflight);
+    port_priv->ctrl_done++;
+    spin_unlock_irqrestore(&port_priv->ctrl_lock, flags);
+
+    cp210x_stat_ctrl(port_priv, req->setup.bRequest, req->start, urb->status);
+    trace_cp210x_ctrl(port, req->setup.bRequestType, req->setup.bRequest, le16_to_cpu(req->setup.wValue),
+            le16_to_cpu(req->setup.wIndex), le16_to_cpu(req->setup.wLength), req->start,
+            urb->status ? urb->status : urb->actual_length);
+    wake_up_all(&port_priv->ctrl_wait);
+    kfree(req);
+}
 
-        /* set xon/xoff limit based on chip type */
-        if ((PART_CP2105 == port_priv->cp210x_chip_type) && (interface == usbdev->actconfig->interface[1])) {
-            /* ECI */
-            flowctrl[2] |= 280;
-            flowctrl[3] |= 280;
-        }else {
-            /* SCI */
-            flowctrl[2] |= 500;
-            flowctrl[3] |= 500;
-        }
+/*
+ * Tells whether all asynchronous control requests issued up to the given sequence number have completed.
+ *
+ * @port_priv: private data of port
+ * @seq: value of ctrl_issued when fence was requested
+ *
+ * @return true if completed otherwise false.
+ */
+static bool cp210x_ctrl_fence_done(struct cp210x_port_private *port_priv, u32 seq)
+{
+    bool done;
 
-        splchar[4] = tty->termios.c_cc[VSTART];
-        splchar[5] = tty->termios.c_cc[VSTOP];
+    spin_lock_irq(&port_priv->ctrl_lock);
+    done = ((s32)(port_priv->ctrl_done - seq) >= 0);
+    spin_unlock_irq(&port_priv->ctrl_lock);
 
-        result = usb_control_msg(port->serial->dev, usb_sndctrlpipe(port->serial->dev, 0), CP210X_SET_CHARS,
-                REQTYPE_HOST_TO_INTERFACE, 0,
-                port->serial->interface->cur_altsetting->desc.bInterfaceNumber, splchar,
-                0x0006, USB_CTRL_SET_TIMEOUT);
-        if (result != 0x0006) {
-            dev_dbg(&port->dev, "%s - failed with err code: %d\n", __func__, result);
-        }
+    return done;
+}
+
+/*
+ * Waits until every asynchronous control request issued on this port before this call has been executed
+ * by the device. Requests issued by others after this call do not delay it.
+ *
+ * @port: serial port
+ *
+ * @return 0 if all requests succeeded, error of first failed request since last fence if any failed,
+ *         -ETIMEDOUT or -ERESTARTSYS if waiting did not finish.
+ */
+static int fence_cp210x_ctrl_requests(struct usb_serial_port *port)
+{
+    u32 seq;
+    long ret = 0;
+    int result = 0;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    spin_lock_irq(&port_priv->ctrl_lock);
+    seq = port_priv->ctrl_issued;
+    spin_unlock_irq(&port_priv->ctrl_lock);
+
+    ret = wait_event_interruptible_timeout(port_priv->ctrl_wait, cp210x_ctrl_fence_done(port_priv, seq),
+            msecs_to_jiffies(USB_CTRL_SET_TIMEOUT));
+    if (ret < 0)
+        return ret;
+    if (ret == 0)
+        return -ETIMEDOUT;
+
+    spin_lock_irq(&port_priv->ctrl_lock);
+    result = port_priv->ctrl_error;
+    port_priv->ctrl_error = 0;
+    spin_unlock_irq(&port_priv->ctrl_lock);
+
+    return result;
+}
+
+/*
+ * Adds val to a statistics counter of the port. Callable from any context.
+ *
+ * @port_priv: private data of port
+ * @stat: one of CP210X_STAT_XXX
+ * @val: value to be added
+ */
+static void cp210x_stat_add(struct cp210x_port_private *port_priv, int stat, u64 val)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&port_priv->stats_lock, flags);
+    port_priv->stats[stat] += val;
+    spin_unlock_irqrestore(&port_priv->stats_lock, flags);
+}
+
+/*
+ * Accounts a completed control request and how long it took in the histogram of its request type.
+ *
+ * @port_priv: private data of port
+ * @request: CP210X_XXX request code
+ * @start: time at which request was handed over to USB core
+ * @error: non zero if request failed
+ */
+static void cp210x_stat_ctrl(struct cp210x_port_private *port_priv, u8 request, ktime_t start, int error)
+{
+    int idx = 0;
+    int bucket = 0;
+    s64 usecs = ktime_us_delta(ktime_get(), start);
+    unsigned long flags;
+
+    if (request <= CP210X_SET_BAUDRATE)
+        idx = request;
+    else if (request == CP210X_VENDOR_SPECIFIC)
+        idx = CP210X_CTRL_STAT_VENDOR;
+    else
+        idx = CP210X_CTRL_STAT_OTHER;
+
+    if (usecs > 0)
+        bucket = min(fls64(usecs), CP210X_HIST_BUCKETS - 1);
+
+    spin_lock_irqsave(&port_priv->stats_lock, flags);
+    port_priv->ctrl_count[idx]++;
+    if (error)
+        port_priv->ctrl_errors[idx]++;
+    port_priv->ctrl_hist[idx][bucket]++;
+    spin_unlock_irqrestore(&port_priv->stats_lock, flags);
+}
+
+/*
+ * Shows bulk transfer, URB and tty flow control counters of the port, one "name value" pair per line,
+ * followed by number of bulk-IN URBs and asynchronous control requests in flight right now.
+ */
+static int cp210x_debugfs_stats_show(struct seq_file *s, void *unused)
+{
+    int x = 0;
+    u64 stats[CP210X_NUM_STATS];
+    struct usb_serial_port *port = s->private;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    spin_lock_irq(&port_priv->stats_lock);
+    memcpy(stats, port_priv->stats, sizeof(stats));
+    spin_unlock_irq(&port_priv->stats_lock);
+
+    for (x = 0; x < CP210X_NUM_STATS; x++)
+        seq_printf(s, "%-18s %llu\n", cp210x_stat_names[x], stats[x]);
+
+    seq_printf(s, "%-18s %d\n", "rx_urbs_inflight", port_priv->rx_inflight);
+    seq_printf(s, "%-18s %d\n", "ctrl_inflight", atomic_read(&port_priv->ctrl_inflight));
+    return 0;
+}
+
+/*
+ * Shows number of requests, number of failed requests and latency histogram for every control request
+ * type issued at least once. Column "<N" counts requests completed in less than N microseconds (and not
+ * counted in a column to its left), last column counts requests which took longer.
+ */
+static int cp210x_debugfs_ctrl_show(struct seq_file *s, void *unused)
+{
+    int x = 0;
+    int y = 0;
+    char label[16];
+    struct usb_serial_port *port = s->private;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    seq_printf(s, "%-16s %8s %6s", "request", "count", "errors");
+    for (y = 0; y < (CP210X_HIST_BUCKETS - 1); y++) {
+        snprintf(label, sizeof(label), "<%uus", 1U << y);
+        seq_printf(s, " %9s", label);
     }
-    else {
-        /* no flow control */
-        flowctrl[0] &= ~0x7B;
-        flowctrl[0] |=  0x01;
-        flowctrl[1]  =  0x40;
+    snprintf(label, sizeof(label), ">=%uus", 1U << (CP210X_HIST_BUCKETS - 2));
+    seq_printf(s, " %9s\n", label);
+
+    spin_lock_irq(&port_priv->stats_lock);
+    for (x = 0; x < CP210X_CTRL_STAT_REQS; x++) {
+        if (!port_priv->ctrl_count[x])
+            continue;
+        if (cp210x_ctrl_names[x])
+            seq_printf(s, "%-16s", cp210x_ctrl_names[x]);
+        else
+            seq_printf(s, "0x%02x            ", x);
+        seq_printf(s, " %8u %6u", port_priv->ctrl_count[x], port_priv->ctrl_errors[x]);
+        for (y = 0; y < CP210X_HIST_BUCKETS; y++)
+            seq_printf(s, " %9u", port_priv->ctrl_hist[x][y]);
+        seq_puts(s, "\n");
     }
+    spin_unlock_irq(&port_priv->stats_lock);
 
-    result = write_cp210x_register(port, CP210X_SET_FLOW, REQTYPE_HOST_TO_INTERFACE, 0,
-            port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-            flowctrl, 0x0010);
+    return 0;
+}
 
-    /* Update number of data bits in UART frame */
-    bits &= ~BITS_DATA_MASK; /* reset */
+static int cp210x_debugfs_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, cp210x_debugfs_stats_show, inode->i_private);
+}
 
-    switch (tty->termios.c_cflag & CSIZE) {
-    case CS5: bits |= BITS_DATA_5;
-    if(baud >= 921600) {
-        bits |= BITS_DATA_8;
-        tty->termios.c_cflag |= CS8;
-        update_data_size = 1;
-        dev_dbg(&port->dev, "for baudrate >= 921600, only 7/8 data bits are supported.");
-    }
-    break;
+static int cp210x_debugfs_ctrl_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, cp210x_debugfs_ctrl_show, inode->i_private);
+}
 
-    case CS6: bits |= BITS_DATA_6;
-    if(baud >= 921600) {
-        bits |= BITS_DATA_8;
-        tty->termios.c_cflag |= CS8;
-        update_data_size = 1;
-        dev_dbg(&port->dev, "for baudrate >= 921600, only 7/8 data bits are supported.");
+static const struct file_operations cp210x_debugfs_stats_fops = {
+        .owner   = THIS_MODULE,
+        .open    = cp210x_debugfs_stats_open,
+        .read    = seq_read,
+        .llseek  = seq_lseek,
+        .release = single_release,
+};
+
+static const struct file_operations cp210x_debugfs_ctrl_fops = {
+        .owner   = THIS_MODULE,
+        .open    = cp210x_debugfs_ctrl_open,
+        .read    = seq_read,
+        .llseek  = seq_lseek,
+        .release = single_release,
+};
+
+/*
+ * Creates /sys/kernel/debug/sp_cp210x/<port name>/ with files stats and ctrl_latency. Failure is not fatal,
+ * port just goes without statistics.
+ *
+ * @port: serial port
+ */
+static void create_cp210x_debugfs(struct usb_serial_port *port)
+{
+    struct dentry *dir;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    if (!cp210x_debugfs_root)
+        return;
+
+    dir = debugfs_create_dir(dev_name(&port->dev), cp210x_debugfs_root);
+    if (IS_ERR_OR_NULL(dir)) {
+        dev_dbg(&port->dev, "%s - can not create debugfs directory\n", __func__);
+        return;
     }
-    break;
 
-    case CS7: bits |= BITS_DATA_7;
-    break;
+    debugfs_create_file("stats", S_IRUGO, dir, port, &cp210x_debugfs_stats_fops);
+    debugfs_create_file("ctrl_latency", S_IRUGO, dir, port, &cp210x_debugfs_ctrl_fops);
+    port_priv->debugfs_dir = dir;
+}
 
-    case CS8: bits |= BITS_DATA_8;
-    break;
+/*
+ * Removes debugfs directory of the port along with its files.
+ *
+ * @port: serial port
+ */
+static void remove_cp210x_debugfs(struct usb_serial_port *port)
+{
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
-    default:  bits |= BITS_DATA_8;
-    tty->termios.c_cflag |= CS8;
-    update_data_size = 1;
-    dev_dbg(&port->dev, "cp210x device supports only 5,6,7,8 number of data bits.\n");
+    debugfs_remove_recursive(port_priv->debugfs_dir);
+    port_priv->debugfs_dir = NULL;
+}
+
+/*
+ * Invoked by USB serial core when device is being suspended. USB serial core kills only its own URBs, so
+ * driver's bulk-IN URBs are killed here. Coalesced data still pending is sent on resume.
+ *
+ * @serial: usb_serial instance for cp210x device
+ * @message: type of power management transition
+ *
+ * @return 0 always.
+ */
+static int sp_cp210x_suspend(struct usb_serial *serial, pm_message_t message)
+{
+    int x = 0;
+    struct cp210x_port_private *port_priv;
+
+    for (x = 0; x < serial->num_ports; x++) {
+        port_priv = usb_get_serial_port_data(serial->port[x]);
+        kill_cp210x_read_urbs(serial->port[x]);
+        hrtimer_cancel(&port_priv->tx_timer);
+
+        /* Let queued control requests finish, device must not be suspended half way through them. */
+        if (!usb_wait_anchor_empty_timeout(&port_priv->ctrl_anchor, USB_CTRL_SET_TIMEOUT))
+            usb_kill_anchored_urbs(&port_priv->ctrl_anchor);
     }
 
-    /* Update number of stop bits */
-    bits &= ~BITS_STOP_MASK;
+    return 0;
+}
 
-    if (tty->termios.c_cflag & CSTOPB)
-        bits |= BITS_STOP_2;
-    else
-        bits |= BITS_STOP_1;
+/*
+ * Invoked by USB serial core when system resumes. The generic resume handler would submit usbserial's own
+ * read URBs which this driver does not use, so reception is restarted here using driver's URBs.
+ *
+ * @serial: usb_serial instance for cp210x device
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int sp_cp210x_resume(struct usb_serial *serial)
+{
+    int x = 0;
+    int result = 0;
+    int c = 0;
+    struct usb_serial_port *port;
+    struct cp210x_port_private *port_priv;
 
-    /* Update parity type */
-    bits &= ~BITS_PARITY_MASK;
+    for (x = 0; x < serial->num_ports; x++) {
+        port = serial->port[x];
+        if (!test_bit(ASYNCB_INITIALIZED, &port->port.flags))
+            continue;
+
+        port_priv = usb_get_serial_port_data(port);
+        spin_lock_irq(&port_priv->rx_lock);
+        port_priv->rx_stopped = 0;
+        spin_unlock_irq(&port_priv->rx_lock);
+
+        result = submit_cp210x_read_urbs(port, GFP_NOIO);
+        if (result < 0)
+            c++;
 
-    if (tty->termios.c_cflag & PARENB) {
-        if (tty->termios.c_cflag & CMSPAR) {
-            if (tty->termios.c_cflag & PARODD)
-                bits |= BITS_PARITY_MARK;
-            else
-                bits |= BITS_PARITY_SPACE;
-        }else {
-            if (tty->termios.c_cflag & PARODD)
-                bits |= BITS_PARITY_ODD;
-            else
-                bits |= BITS_PARITY_EVEN;
+        if (port->bulk_out_size) {
+            result = usb_serial_generic_write_start(port, GFP_NOIO);
+            if (result < 0)
+                c++;
         }
     }
 
-    result = write_cp210x_register(port, CP210X_SET_LINE_CTL, REQTYPE_HOST_TO_INTERFACE, bits,
-            port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-            NULL, 0);
-    if(result < 0) {
-        /* If failed revert back settings */
-        if(update_data_size == 1)
-            tty->termios.c_cflag |= (old_termios->c_cflag & CSIZE);
-        dev_dbg(&port->dev, "%s - failed with err code: %d\n", __func__, result);
-    }
+    return c ? -EIO : 0;
 }
 
-/* 
- * Invoked by tty layer when application invokes device/driver specific IOCTL command.
+/*
+ * Invoked by USB serial core when device has been reset or has lost power while suspended, all of its
+ * configuration is gone. Instead of letting the device be re-enumerated (which would remove the tty) state of
+ * every port is written again from driver's cache and reception is restarted.
  *
- * @tty: tty device
- * @cmd: command to be executed
- * @arg: arguments to be passed to this command
+ * @serial: usb_serial instance for cp210x device
  *
  * @return 0 on success otherwise negative error code on failure.
  */
-static int sp_cp210x_ioctl(struct tty_struct *tty, unsigned int cmd, unsigned long arg)
+static int sp_cp210x_reset_resume(struct usb_serial *serial)
 {
+    int x = 0;
     int result = 0;
-    unsigned long latch_buf = 0;
-    struct usb_serial_port *port = tty->driver_data;
-    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+    int c = 0;
 
-    switch (cmd) {
+    for (x = 0; x < serial->num_ports; x++) {
+        result = restore_cp210x_port(serial->port[x]);
+        if (result < 0) {
+            dev_err(&serial->port[x]->dev, "%s - failed to restore port state: %d\n", __func__, result);
+            c++;
+        }
+    }
 
-    case IOCTL_GPIOSET:
+    result = sp_cp210x_resume(serial);
+    if (c)
+        return -EIO;
 
-        if ((PART_CP2103 == port_priv->cp210x_chip_type) || (PART_CP2104 == port_priv->cp210x_chip_type)) {
-            if (copy_from_user(&latch_buf, (unsigned int*)arg, 2))
-                return -EFAULT;
-            result = write_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_HOST_TO_DEVICE,
-                    CP210X_WRITE_LATCH, latch_buf, NULL, 0);
-            if (result != 0)
-                return result;
-            return 0;
-        }
-        else if (PART_CP2105 == port_priv->cp210x_chip_type) {
-            if (copy_from_user(&latch_buf, (unsigned int*)arg, 2))
-                return -EFAULT;
-            result = write_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_HOST_TO_INTERFACE,
-                    CP210X_WRITE_LATCH,
-                    port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-                    (unsigned int*)&latch_buf, 2);
-            return result;
-        }
-        else if (PART_CP2108 == port_priv->cp210x_chip_type) {
-            if (copy_from_user(&latch_buf, (unsigned int*)arg, 4))
-                return -EFAULT;
-            result = write_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_HOST_TO_DEVICE,
-                    CP210X_WRITE_LATCH,
-                    port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-                    (unsigned int*)&latch_buf, 4);
+    return result;
+}
+
+/*
+ * Writes cached state of port to the device in one pass: interface enable, embedded events, baudrate, special
+ * characters, flow control and line control (same order as set_termios), then modem lines and GPIO latch. Only
+ * GPIO latch is restored for a closed port, everything else is set up again by next open. Synchronous control
+ * transfers are used as this runs from resume where memory allocation must not start I/O.
+ *
+ * @port: serial port
+ *
+ * @return 0 on success otherwise negative error code of first request which failed.
+ */
+static int restore_cp210x_port(struct usb_serial_port *port)
+{
+    int size = 0;
+    int cached = 0;
+    int result = 0;
+    u32 baud = 0;
+    unsigned int bits = 0;
+    unsigned int flowctrl[4];
+    unsigned char splchar[6];
+    unsigned int mctrl = 0;
+    unsigned int mctrl_written = 0;
+    unsigned int control = 0;
+    u16 latch_state = 0;
+    u16 latch_mask = 0;
+    u8 data[4];
+    ktime_t start = ktime_get();
+    struct usb_ctrlrequest setup;
+    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
+
+    cached = port_priv->cached;
+    baud = port_priv->cached_baud;
+    bits = port_priv->cached_bits;
+    memcpy(flowctrl, port_priv->cached_flow, sizeof(flowctrl));
+    memcpy(splchar, port_priv->cached_chars, sizeof(splchar));
+    invalidate_cp210x_line_cache(port);
+
+    spin_lock_irq(&port_priv->ctrl_lock);
+    mctrl = port_priv->mctrl;
+    mctrl_written = port_priv->mctrl_written;
+    latch_state = port_priv->latch_state;
+    latch_mask = port_priv->latch_mask;
+    spin_unlock_irq(&port_priv->ctrl_lock);
+
+    if (test_bit(ASYNCB_INITIALIZED, &port->port.flags)) {
+        result = write_cp210x_register(port, CP210X_IFC_ENABLE, REQTYPE_HOST_TO_INTERFACE, UART_ENABLE,
+                port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+        if (result < 0)
             return result;
-        }
-        else {
-            return -ENOTSUPP;
-        }
-        break;
 
-    case IOCTL_GPIOGET:
+        if (port_priv->evt_enabled)
+            set_cp210x_embed_events(port, 1);
 
-        if ((PART_CP2103 == port_priv->cp210x_chip_type) || (PART_CP2104 == port_priv->cp210x_chip_type)) {
-            result = read_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_HOST_TO_DEVICE,
-                    CP210X_READ_LATCH, 0, (unsigned int*)&latch_buf, 1);
-            if (result != 0)
+        if (cached & CP210X_CACHED_BAUD) {
+            result = apply_cp210x_baudrate(port, baud);
+            if (result < 0)
                 return result;
-            if (copy_to_user((unsigned int*)arg, &latch_buf, 1))
-                return -EFAULT;
-            return 0;
         }
-        else if (PART_CP2105 == port_priv->cp210x_chip_type) {
-            result = read_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_INTERFACE_TO_HOST,
-                    CP210X_READ_LATCH,
-                    port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-                    (unsigned int*)&latch_buf, 1);
-            if (result != 0)
+        if (cached & CP210X_CACHED_CHARS) {
+            result = apply_cp210x_chars(port, splchar);
+            if (result < 0)
                 return result;
-            if (copy_to_user((unsigned int*)arg, &latch_buf, 1))
-                return -EFAULT;
-            return 0;
         }
-        else if (PART_CP2108 == port_priv->cp210x_chip_type) {
-            result = read_cp210x_register(port, CP210X_VENDOR_SPECIFIC, REQTYPE_DEVICE_TO_HOST,
-                    CP210X_READ_LATCH,
-                    port->serial->interface->cur_altsetting->desc.bInterfaceNumber,
-                    (unsigned int*)&latch_buf, 2);
-            if (result != 0)
+        if (cached & CP210X_CACHED_FLOW) {
+            result = apply_cp210x_flow(port, flowctrl);
+            if (result < 0)
                 return result;
-            if (copy_to_user((unsigned int*)arg, &latch_buf, 2))
-                return -EFAULT;
-            return 0;
         }
-        else {
-            return -ENOTSUPP;
+        if (cached & CP210X_CACHED_LINE) {
+            result = apply_cp210x_line_ctl(port, bits);
+            if (result < 0)
+                return result;
         }
-        break;
 
-    default:
-        break;
+        if (mctrl_written) {
+            if (mctrl_written & TIOCM_DTR)
+                control |= CONTROL_WRITE_DTR | ((mctrl & TIOCM_DTR) ? CONTROL_DTR : 0);
+            if (mctrl_written & TIOCM_RTS)
+                control |= CONTROL_WRITE_RTS | ((mctrl & TIOCM_RTS) ? CONTROL_RTS : 0);
+            result = write_cp210x_register(port, CP210X_SET_MHS, REQTYPE_HOST_TO_INTERFACE, control,
+                    port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+            if (result < 0)
+                return result;
+        }
     }
 
-    return -ENOIOCTLCMD;
+    if (latch_mask) {
+        size = fill_cp210x_latch_request(port_priv, &setup, data, latch_mask, latch_state);
+        if (size >= 0) {
+            result = write_cp210x_register(port, setup.bRequest, setup.bRequestType, le16_to_cpu(setup.wValue),
+                    le16_to_cpu(setup.wIndex), data, size);
+            if (result < 0)
+                return result;
+        }
+    }
+
+    dev_dbg(&port->dev, "%s - state restored in %lld us\n", __func__,
+            ktime_to_us(ktime_sub(ktime_get(), start)));
+    return 0;
 }
 
-/* 
- * Invoked when application issue TIOCMGET IOCTL command.
+/*
+ * Tells whether device has a serial number which can identify it again after replug.
  *
- * @tty: tty device
+ * @usbdev: USB device
  *
- * @return bit mask of line/modem's status on success otherwise negative error code on failure.
+ * @return 1 if device can be remembered across replug otherwise 0.
  */
-static int sp_cp210x_tiocmget(struct tty_struct *tty)
+static int has_cp210x_serial(struct usb_device *usbdev)
 {
-    struct usb_serial_port *port = tty->driver_data;
-    unsigned int control;
-    int result;
-
-    result = read_cp210x_register(port, CP210X_GET_MDMSTS, REQTYPE_INTERFACE_TO_HOST, CP210X_GET_PARTNUM,
-            0, &control, 1);
-    if (result < 0)
-        return result;
-
-    result= ((control & CONTROL_DTR)  ? TIOCM_DTR : 0) |
-            ((control & CONTROL_RTS)  ? TIOCM_RTS : 0) |
-            ((control & CONTROL_CTS)  ? TIOCM_CTS : 0) |
-            ((control & CONTROL_DSR)  ? TIOCM_DSR : 0) |
-            ((control & CONTROL_RING) ? TIOCM_RI  : 0) |
-            ((control & CONTROL_DCD)  ? TIOCM_CD  : 0);
-    return result;
+    return ((usbdev->serial != NULL) && (usbdev->serial[0] != '\0')) ? 1 : 0;
 }
 
-/* 
- * This function sets the modem handshaking states for the selected CP210x interface according 
- * to the value of bit mask set. DTR and RTS values can be set only if the current handshaking 
- * state of the interface allows direct control of the modem control lines.
+/*
+ * Finds part number of a device seen earlier and takes a reference on its entry for the interface being
+ * attached, which is dropped by forget_cp210x_partnum(). Multi interface parts (CP2105/CP2108) find the entry
+ * added while attaching their first interface, so the part number is read only once per device. Entries of
+ * detached devices are matched only if partnum_cache is set, as VID, PID, bcdDevice and serial number (often
+ * "0001" or the same for a whole batch) may not tell apart different parts.
  *
- * @port: serial port
- * @set: bit mask of lines to be asserted
- * @clear: bit mask of lines to be de-asserted
+ * @usbdev: USB device being attached
+ * @part_num: set to cached part number if found
  *
- * @return 0 on success otherwise negative error code on failure.
+ * @return 0 if found otherwise -ENOENT.
  */
-static int update_cp210x_mctrl_lines(struct usb_serial_port *port, unsigned int set, unsigned int clear)
+static int lookup_cp210x_partnum(struct usb_device *usbdev, u8 *part_num)
 {
-    unsigned int control = 0;
-
-    if (set & TIOCM_RTS) {
-        control |= CONTROL_RTS;
-        control |= CONTROL_WRITE_RTS;
-    }
-    if (set & TIOCM_DTR) {
-        control |= CONTROL_DTR;
-        control |= CONTROL_WRITE_DTR;
-    }
-    if (clear & TIOCM_RTS) {
-        control &= ~CONTROL_RTS;
-        control |= CONTROL_WRITE_RTS;
-    }
-    if (clear & TIOCM_DTR) {
-        control &= ~CONTROL_DTR;
-        control |= CONTROL_WRITE_DTR;
+    int result = -ENOENT;
+    struct cp210x_partnum_entry *entry;
+
+    mutex_lock(&cp210x_partnum_mutex);
+    list_for_each_entry(entry, &cp210x_partnum_list, list) {
+        if ((entry->usbdev == usbdev) || (partnum_cache && (entry->usbdev == NULL) && has_cp210x_serial(usbdev)
+                && (entry->vid == le16_to_cpu(usbdev->descriptor.idVendor))
+                && (entry->pid == le16_to_cpu(usbdev->descriptor.idProduct))
+                && (entry->bcd == le16_to_cpu(usbdev->descriptor.bcdDevice))
+                && (strncmp(entry->serial, usbdev->serial, CP210X_SERIAL_LEN) == 0))) {
+            *part_num = entry->part_num;
+            entry->usbdev = usbdev;
+            entry->users++;
+            list_move(&entry->list, &cp210x_partnum_list);
+            result = 0;
+            break;
+        }
     }
+    mutex_unlock(&cp210x_partnum_mutex);
 
-    return write_cp210x_register(port, CP210X_SET_MHS, REQTYPE_HOST_TO_INTERFACE, control,
-            port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+    if (result == 0)
+        dev_dbg(&usbdev->dev, "%s - part number 0x%02x from cache\n", __func__, *part_num);
+
+    return result;
 }
 
-/* 
- * Invoked when application issue TIOCMSET (TIOCMBIC,TIOCMBIS) IOCTL command.
+/*
+ * Remembers part number read from device and takes a reference on the entry for the interface being attached.
+ * If a sibling interface attaching at the same time has added an entry already, that one is used. When cache
+ * is full least recently used entry of a detached device is dropped. Failure is not an error, device will be
+ * queried again next time.
  *
- * @tty: tty device
- * @set: bit mask of lines to be asserted
- * @clear: bit mask of lines to be de-asserted
+ * @usbdev: USB device being attached
+ * @part_num: part number read from the device
  *
- * @return 0 on success otherwise negative error code on failure.
+ * @return 0 if a reference has been taken otherwise negative error code.
  */
-static int sp_cp210x_tiocmset(struct tty_struct *tty, unsigned int set, unsigned int clear)
+static int cache_cp210x_partnum(struct usb_device *usbdev, u8 part_num)
 {
-    return update_cp210x_mctrl_lines(tty->driver_data, set, clear);
+    struct cp210x_partnum_entry *entry;
+    struct cp210x_partnum_entry *old;
+
+    entry = kzalloc(sizeof(struct cp210x_partnum_entry), GFP_KERNEL);
+    if (!entry)
+        return -ENOMEM;
+
+    entry->usbdev = usbdev;
+    entry->users = 1;
+    entry->vid = le16_to_cpu(usbdev->descriptor.idVendor);
+    entry->pid = le16_to_cpu(usbdev->descriptor.idProduct);
+    entry->bcd = le16_to_cpu(usbdev->descriptor.bcdDevice);
+    entry->part_num = part_num;
+    if (has_cp210x_serial(usbdev))
+        strlcpy(entry->serial, usbdev->serial, CP210X_SERIAL_LEN);
+
+    mutex_lock(&cp210x_partnum_mutex);
+    list_for_each_entry(old, &cp210x_partnum_list, list) {
+        if (old->usbdev == usbdev) {
+            old->users++;
+            mutex_unlock(&cp210x_partnum_mutex);
+            kfree(entry);
+            return 0;
+        }
+    }
+    if (cp210x_partnum_count >= CP210X_PARTNUM_CACHE_SIZE) {
+        list_for_each_entry_reverse(old, &cp210x_partnum_list, list) {
+            if (old->users == 0)
+                break;
+        }
+        if (&old->list == &cp210x_partnum_list) {
+            /* Every entry belongs to an attached device */
+            mutex_unlock(&cp210x_partnum_mutex);
+            kfree(entry);
+            return -ENOSPC;
+        }
+        list_del(&old->list);
+        kfree(old);
+        cp210x_partnum_count--;
+    }
+    list_add(&entry->list, &cp210x_partnum_list);
+    cp210x_partnum_count++;
+    mutex_unlock(&cp210x_partnum_mutex);
+    return 0;
 }
 
-/* 
- * Invoked by tty layer when RTS/DTR lines need to be set/reset.
+/*
+ * Drops reference taken for an interface going away. When last interface of the device goes, entry is detached
+ * from it so that a new device at the same address never matches it, and dropped unless partnum_cache is set and
+ * device has a serial number to be recognized by on replug.
  *
- * @port: serial port
- * @on: 0 for de-assertion and 1 for assertion of DTR and RTS lines.
+ * @usbdev: USB device whose interface is being released
  */
-static void sp_cp210x_dtr_rts(struct usb_serial_port *port, int on)
+static void forget_cp210x_partnum(struct usb_device *usbdev)
 {
-    if (on)
-        update_cp210x_mctrl_lines(port, TIOCM_DTR | TIOCM_RTS, 0);
-    else
-        update_cp210x_mctrl_lines(port, 0, TIOCM_DTR | TIOCM_RTS);
+    struct cp210x_partnum_entry *entry;
+
+    mutex_lock(&cp210x_partnum_mutex);
+    list_for_each_entry(entry, &cp210x_partnum_list, list) {
+        if (entry->usbdev != usbdev)
+            continue;
+        if (--entry->users == 0) {
+            entry->usbdev = NULL;
+            if (!partnum_cache || (entry->serial[0] == '\0')) {
+                list_del(&entry->list);
+                kfree(entry);
+                cp210x_partnum_count--;
+            }
+        }
+        break;
+    }
+    mutex_unlock(&cp210x_partnum_mutex);
 }
 
-/* 
- * Invoked by tty layer to turn on or off BREAK condition on port.
- *
- * @tty: tty device
- * @break_state: 0 to turn off break and non zero to set break condition unconditionally
+/*
+ * Frees all entries of part number cache, invoked when module is unloaded.
  */
-static void sp_cp210x_break_ctl(struct tty_struct *tty, int break_state)
+static void free_cp210x_partnum_cache(void)
 {
-    int result = 0;
-    unsigned int state = 0;
-    struct usb_serial_port *port = tty->driver_data;
-
-    if (break_state == 0)
-        state = BREAK_OFF;
-    else
-        state = BREAK_ON;
+    struct cp210x_partnum_entry *entry, *tmp;
 
-    result = write_cp210x_register(port, CP210X_SET_BREAK, REQTYPE_HOST_TO_INTERFACE, state,
-            port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
-    if (result != 0)
-        dev_dbg(&port->dev, "%s - failed with err code: %d\n", __func__, result);
+    mutex_lock(&cp210x_partnum_mutex);
+    list_for_each_entry_safe(entry, tmp, &cp210x_partnum_list, list) {
+        list_del(&entry->list);
+        kfree(entry);
+    }
+    cp210x_partnum_count = 0;
+    mutex_unlock(&cp210x_partnum_mutex);
 }
 
-/*
- * 1. After the tty device node has been bound to individual serial port, when application opens
- *    serial port, kernel finds that this node is registered with it and it then call tty layer's
- *    open function. 
- *
- * 2. Because USB serial core has registered this node with tty layer, USB serial core's open
- *    function gets called. This function determines which specific driver is managing this node
- *    and it then call open function of that specific driver of USB-UART interface. This specific
- *    driver typically initialize interface for communication and allocate memory if needed.
- *
- * 3. The module count for the specified USB serial driver is incremented in order prevent it from 
- *    being unloaded when an application is using it.
- *
- * @port: serial port
+/* 
+ * Invoked when module is loaded. Creates debugfs root and registers usb-serial driver. This basically registers
+ * a USB interface driver with the USB core. The list of unattached interfaces will be rescanned whenever a new
+ * driver is added, allowing the new driver to be attached to any recognized interfaces.
  *
  * @return 0 on success otherwise negative error code on failure.
  */
-static int sp_cp210x_open(struct tty_struct *tty, struct usb_serial_port *port)
+static int __init sp_cp210x_init(void)
 {
     int result = 0;
-    struct cp210x_port_private *port_priv = usb_get_serial_port_data(port);
 
-    /* If the interface is not enabled, enable it. */
-    if(port_priv->interface_enabled == 0) {
-        result = write_cp210x_register(port, CP210X_IFC_ENABLE, REQTYPE_HOST_TO_INTERFACE, UART_ENABLE,
-                port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
-        if (result < 0)
-            return result;
+    /* Statistics are optional, driver works even if debugfs is not available. */
+    cp210x_debugfs_root = debugfs_create_dir("sp_cp210x", NULL);
+    if (IS_ERR(cp210x_debugfs_root))
+        cp210x_debugfs_root = NULL;
+
+    result = usb_serial_register_drivers(serial_drivers, KBUILD_MODNAME, id_table);
+    if (result != 0) {
+        debugfs_remove_recursive(cp210x_debugfs_root);
+        return result;
     }
 
-    /* The usbserial driver initializes default termios settings in usb_serial_init function
-     * (9600 8N1 raw mode). We apply them to a cp210x device as is, to start with a sane state. */
-    if (tty)
-        sp_cp210x_set_termios(tty, port, NULL);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,2,0)
+    /* Interface driver is allocated by usb-serial core, so it can be marked for asynchronous probing only after
+     * registration. Devices plugged in or re-enumerated from now on are probed without holding up the hub
+     * thread; to probe devices already present at load time asynchronously use sp_cp210x.async_probe=1. */
+    sp_cp210x_device.usb_driver->drvwrap.driver.probe_type = PROBE_PREFER_ASYNCHRONOUS;
+#endif
 
-    /* This will clear throttle, and submit read urb (issue an asynchronous transfer request
-     * for an endpoint). */
-    return usb_serial_generic_open(tty, port);
+    return 0;
 }
 
 /* 
- * 1. The application call close system call on serial port's device node. This causes tty_release function
- *    in tty core to be invoked.
- *
- * 2. The tty_release function determines if this is the last reference held on this device node as same
- *    device node can be opened many times (non-exclusive mode). If it is last reference then close function
- *    of USB serial core is called.
- *
- * 3. The USB serial core calls close function of specific USB interface driver and possibly cancel pending
- *    USB transfers if any.
- *
- * 4. The USB serial core then decrements the module count for the USB serial driver and if count reaches
- *    zero, it may be unloaded.
- *
- * @port: serial port
+ * Invoked when module is unloaded. Deregisters usb-serial driver, removes debugfs root and frees part number cache.
  */
-static void sp_cp210x_close(struct usb_serial_port *port)
-{	
-    usb_serial_generic_close(port);
-
-    /* if close is invoked by application immediately after sending data and data is unsent physically from
-     * cp210x, purge it. */
-    write_cp210x_register(port, CP210X_PURGE, REQTYPE_HOST_TO_INTERFACE, 0x000F,
-            port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
-
-    write_cp210x_register(port, CP210X_IFC_ENABLE, REQTYPE_HOST_TO_INTERFACE, UART_DISABLE,
-            port->serial->interface->cur_altsetting->desc.bInterfaceNumber, NULL, 0);
+static void __exit sp_cp210x_exit(void)
+{
+    usb_serial_deregister_drivers(serial_drivers);
+    debugfs_remove_recursive(cp210x_debugfs_root);
+    free_cp210x_partnum_cache();
 }
 
-/* Helper macro for registering a usb-serial driver (module_init/module_exit). This basically registers a 
- * USB interface driver with the USB core. The list of unattached interfaces will be rescanned whenever a 
- * new driver is added, allowing the new driver to be attached to any recognized interfaces. */
-module_usb_serial_driver(serial_drivers, id_table);
+module_init(sp_cp210x_init);
+module_exit(sp_cp210x_exit);
 
 MODULE_AUTHOR("Rishi Gupta");
 MODULE_DESCRIPTION("CP210x USB-UART device's driver - v1.0");
@@ -1314,3 +4236,21 @@ MODULE_LICENSE("GPL");
 
 module_param(dbg, bool, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(dbg, "Debuging enabled or not");
+
+module_param(rx_urbs, int, S_IRUGO);
+MODULE_PARM_DESC(rx_urbs, "Number of bulk-IN URBs kept queued per port, 1 to 16 (default: as per baudrate, max 8)");
+
+module_param(rx_urb_size, int, S_IRUGO);
+MODULE_PARM_DESC(rx_urb_size, "Size of each bulk-IN URB buffer in bytes, 64 to 16384 (default: as per baudrate, max 4096)");
+
+module_param(embed_events, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(embed_events, "Report line errors and modem status changes inline with data (default: true, applies at next open)");
+
+module_param(async_ctrl, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(async_ctrl, "Queue modem line, break and GPIO requests without waiting for them (default: true)");
+
+module_param(partnum_cache, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(partnum_cache, "Remember part number by VID, PID and serial number to skip its query on replug, only if these identify the part (default: false)");
+
+module_param(autosuspend_ms, int, S_IRUGO);
+MODULE_PARM_DESC(autosuspend_ms, "Enable runtime autosuspend of idle devices after this many milliseconds (default: -1, left to user space)");
@@ -0,0 +1,147 @@
+/************************************************************************************************
+ * This file is part of SerialPundit.
+ *
+ * Copyright (C) 2014-2016, Rishi Gupta. All rights reserved.
+ *
+ * The SerialPundit is DUAL LICENSED. It is made available under the terms of the GNU Affero
+ * General Public License (AGPL) v3.0 for non-commercial use and under the terms of a commercial
+ * license for commercial use of this software.
+ *
+ * The SerialPundit is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ ************************************************************************************************/
+
+/*
+ * Tracepoints of sp_cp210x driver. They cost nothing while disabled and can be enabled at run time:
+ * echo 1 > /sys/kernel/debug/tracing/events/sp_cp210x/enable
+ * perf record -e 'sp_cp210x:*' -a
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM sp_cp210x
+
+#if !defined(SP_CP210X_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define SP_CP210X_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+#include <linux/usb/serial.h>
+
+/* Control request to cp210x; duration is from submission to completion, result is number of bytes in data
+ * stage or negative error code. */
+TRACE_EVENT(cp210x_ctrl,
+        TP_PROTO(struct usb_serial_port *port, u8 requestType, u8 request, u16 value, u16 index, u16 size,
+                ktime_t start, int result),
+        TP_ARGS(port, requestType, request, value, index, size, start, result),
+        TP_STRUCT__entry(
+                __string(dev, dev_name(&port->dev))
+                __field(u8, requestType)
+                __field(u8, request)
+                __field(u16, value)
+                __field(u16, index)
+                __field(u16, size)
+                __field(s64, duration_ns)
+                __field(int, result)
+        ),
+        TP_fast_assign(
+                __assign_str(dev, dev_name(&port->dev));
+                __entry->requestType = requestType;
+                __entry->request = request;
+                __entry->value = value;
+                __entry->index = index;
+                __entry->size = size;
+                __entry->duration_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+                __entry->result = result;
+        ),
+        TP_printk("%s type=0x%02x request=0x%02x value=0x%04x index=%u size=%u duration=%lldns result=%d",
+                __get_str(dev), __entry->requestType, __entry->request, __entry->value, __entry->index,
+                __entry->size, __entry->duration_ns, __entry->result)
+);
+
+/* Completion of bulk-IN or bulk-OUT URB */
+DECLARE_EVENT_CLASS(cp210x_urb,
+        TP_PROTO(struct usb_serial_port *port, struct urb *urb),
+        TP_ARGS(port, urb),
+        TP_STRUCT__entry(
+                __string(dev, dev_name(&port->dev))
+                __field(u32, length)
+                __field(u32, actual)
+                __field(int, status)
+        ),
+        TP_fast_assign(
+                __assign_str(dev, dev_name(&port->dev));
+                __entry->length = urb->transfer_buffer_length;
+                __entry->actual = urb->actual_length;
+                __entry->status = urb->status;
+        ),
+        TP_printk("%s length=%u actual=%u status=%d", __get_str(dev), __entry->length, __entry->actual,
+                __entry->status)
+);
+
+DEFINE_EVENT(cp210x_urb, cp210x_read_urb,
+        TP_PROTO(struct usb_serial_port *port, struct urb *urb),
+        TP_ARGS(port, urb)
+);
+
+DEFINE_EVENT(cp210x_urb, cp210x_write_urb,
+        TP_PROTO(struct usb_serial_port *port, struct urb *urb),
+        TP_ARGS(port, urb)
+);
+
+TRACE_EVENT(cp210x_open,
+        TP_PROTO(struct usb_serial_port *port, int result),
+        TP_ARGS(port, result),
+        TP_STRUCT__entry(
+                __string(dev, dev_name(&port->dev))
+                __field(int, result)
+        ),
+        TP_fast_assign(
+                __assign_str(dev, dev_name(&port->dev));
+                __entry->result = result;
+        ),
+        TP_printk("%s result=%d", __get_str(dev), __entry->result)
+);
+
+TRACE_EVENT(cp210x_close,
+        TP_PROTO(struct usb_serial_port *port),
+        TP_ARGS(port),
+        TP_STRUCT__entry(
+                __string(dev, dev_name(&port->dev))
+        ),
+        TP_fast_assign(
+                __assign_str(dev, dev_name(&port->dev));
+        ),
+        TP_printk("%s", __get_str(dev))
+);
+
+/* Line settings after termios update; bits is CP210X_SET_LINE_CTL value, handshake/replace are flow words. */
+TRACE_EVENT(cp210x_set_termios,
+        TP_PROTO(struct usb_serial_port *port, u32 baud, unsigned int bits, unsigned int handshake,
+                unsigned int replace),
+        TP_ARGS(port, baud, bits, handshake, replace),
+        TP_STRUCT__entry(
+                __string(dev, dev_name(&port->dev))
+                __field(u32, baud)
+                __field(unsigned int, bits)
+                __field(unsigned int, handshake)
+                __field(unsigned int, replace)
+        ),
+        TP_fast_assign(
+                __assign_str(dev, dev_name(&port->dev));
+                __entry->baud = baud;
+                __entry->bits = bits;
+                __entry->handshake = handshake;
+                __entry->replace = replace;
+        ),
+        TP_printk("%s baud=%u line=0x%04x handshake=0x%02x replace=0x%02x", __get_str(dev), __entry->baud,
+                __entry->bits, __entry->handshake, __entry->replace)
+);
+
+#endif /* SP_CP210X_TRACE_H_ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE sp_cp210x_trace
+#include <trace/define_trace.h>
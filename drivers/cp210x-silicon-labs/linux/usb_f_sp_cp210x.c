@@ -0,0 +1,1049 @@
+/************************************************************************************************
+ * This file is part of SerialPundit.
+ *
+ * Copyright (C) 2014-2016, Rishi Gupta. All rights reserved.
+ *
+ * The SerialPundit is DUAL LICENSED. It is made available under the terms of the GNU Affero
+ * General Public License (AGPL) v3.0 for non-commercial use and under the terms of a commercial
+ * license for commercial use of this software.
+ *
+ * The SerialPundit is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ ************************************************************************************************/
+
+/*
+ * USB gadget function emulating a single interface CP210x (CP2101/2/3/4, CP2109, CP2102N) so that sp_cp210x
+ * can be exercised without Silicon Labs hardware. Together with dummy_hcd the gadget appears on the same
+ * machine as a USB device 10c4:ea60 and sp_cp210x binds to it like to a real part.
+ *
+ * The function answers vendor control requests used by sp_cp210x and keeps track of line settings, flow
+ * control, modem lines and GPIO latch just like the device does. Data written by the host is either looped
+ * back (as if TX was wired to RX) or sunk. Modem lines are looped back as a null modem cable would do i.e.
+ * RTS drives CTS and DTR drives DSR and DCD. When host has enabled embedded events, ESC characters in looped
+ * back data are escaped and break and modem line changes are reported as in-band events. Data is moved as
+ * fast as USB allows, baudrate is accepted but not emulated.
+ *
+ * The function must be the only one in its configuration, because cp210x addresses some requests to the
+ * device rather than to the interface.
+ *
+ * mkdir /sys/kernel/config/usb_gadget/g1/functions/sp_cp210x.0
+ * Attributes: partnum (part number reported to host), loopback (1 loop back, 0 sink), qlen (bulk requests
+ * queued) and buflen (size of each bulk request).
+ */
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/usb/composite.h>
+#include <asm/unaligned.h>
+
+#define PART_CP2101  0x01
+#define PART_CP2102  0x02
+#define PART_CP2103  0x03
+#define PART_CP2104  0x04
+#define PART_CP2109  0x09
+#define PART_CP2102N_QFN28  0x20
+#define PART_CP2102N_QFN24  0x21
+#define PART_CP2102N_QFN20  0x22
+
+/* Config/Commands request codes */
+#define CP210X_IFC_ENABLE       0x00
+#define CP210X_SET_BAUDDIV      0x01
+#define CP210X_GET_BAUDDIV      0x02
+#define CP210X_SET_LINE_CTL     0x03
+#define CP210X_GET_LINE_CTL     0x04
+#define CP210X_SET_BREAK        0x05
+#define CP210X_IMM_CHAR         0x06
+#define CP210X_SET_MHS          0x07
+#define CP210X_GET_MDMSTS       0x08
+#define CP210X_SET_XON          0x09
+#define CP210X_SET_XOFF         0x0A
+#define CP210X_SET_EVENTMASK    0x0B
+#define CP210X_GET_EVENTMASK    0x0C
+#define CP210X_SET_CHAR         0x0D
+#define CP210X_GET_CHARS        0x0E
+#define CP210X_GET_PROPS        0x0F
+#define CP210X_GET_COMM_STATUS  0x10
+#define CP210X_RESET            0x11
+#define CP210X_PURGE            0x12
+#define CP210X_SET_FLOW         0x13
+#define CP210X_GET_FLOW         0x14
+#define CP210X_EMBED_EVENTS     0x15
+#define CP210X_GET_EVENTSTATE   0x16
+#define CP210X_SET_CHARS        0x19
+#define CP210X_GET_BAUDRATE     0x1D
+#define CP210X_SET_BAUDRATE     0x1E
+#define CP210X_VENDOR_SPECIFIC  0xFF
+
+/* CP210X_VENDOR_SPECIFIC */
+#define CP210X_WRITE_LATCH  0x37E1
+#define CP210X_READ_LATCH   0x00C2
+#define CP210X_GET_PARTNUM  0x370B
+
+/* CP210X_SET_MHS and CP210X_GET_MDMSTS bits */
+#define CONTROL_DTR        0x0001
+#define CONTROL_RTS        0x0002
+#define CONTROL_CTS        0x0010
+#define CONTROL_DSR        0x0020
+#define CONTROL_RING       0x0040
+#define CONTROL_DCD        0x0080
+#define CONTROL_WRITE_DTR  0x0100
+#define CONTROL_WRITE_RTS  0x0200
+
+/* Embedded events (AN571) */
+#define CP210X_ESCSEQ_LSR   0x02
+#define CP210X_ESCSEQ_MSR   0x03
+#define CP210X_LSR_BREAK    0x10
+#define CP210X_MSR_DELTA_CTS   0x01
+#define CP210X_MSR_DELTA_DSR   0x02
+#define CP210X_MSR_DELTA_DCD   0x08
+
+/* Largest data stage of any request, CP210X_GET_COMM_STATUS returns 19 bytes. */
+#define CP210X_EP0_MAX  19
+
+/* Room for ESC 0x02 LSR followed by ESC 0x03 MSR */
+#define CP210X_EVT_BUF_SIZE  6
+
+#define CP210X_DEF_QLEN    8
+#define CP210X_DEF_BUFLEN  4096
+#define CP210X_MAX_QLEN    64
+#define CP210X_MAX_BUFLEN  65536
+
+struct f_sp_cp210x_opts {
+    struct usb_function_instance func_inst;
+    struct mutex lock;
+    int refcnt;
+    u8 partnum;
+    bool loopback;
+    unsigned int qlen;
+    unsigned int buflen;
+};
+
+struct f_sp_cp210x {
+    struct usb_function function;
+    u8 intf;
+    struct usb_ep *in_ep;
+    struct usb_ep *out_ep;
+
+    u8 partnum;
+    bool loopback;
+    unsigned int qlen;
+    unsigned int buflen;
+
+    /* Bulk requests; in_req[x] carries data received by out_req[x], only one of them is queued at a time. */
+    struct usb_request **out_req;
+    struct usb_request **in_req;
+
+    /* In-band event request, pending_lsr/pending_msr hold events which could not be sent yet. */
+    struct usb_request *evt_req;
+    int evt_busy;
+    u8 pending_lsr;
+    u8 pending_msr;
+
+    /* Emulated device state, protected by lock */
+    spinlock_t lock;
+    u16 ifc_enabled;
+    u32 baudrate;
+    u16 line_ctl;
+    u16 mhs;
+    u16 break_state;
+    u8 flow[16];
+    u8 chars[6];
+    u16 latch;
+    u8 esc_char;
+
+    /* Request whose OUT data stage is in progress */
+    u8 ep0_request;
+    u16 ep0_value;
+};
+
+static inline struct f_sp_cp210x *func_to_cp210x(struct usb_function *f)
+{
+    return container_of(f, struct f_sp_cp210x, function);
+}
+
+static inline struct f_sp_cp210x_opts *to_f_sp_cp210x_opts(struct config_item *item)
+{
+    return container_of(to_config_group(item), struct f_sp_cp210x_opts, func_inst.group);
+}
+
+static struct usb_interface_descriptor cp210x_intf = {
+        .bLength            = sizeof(cp210x_intf),
+        .bDescriptorType    = USB_DT_INTERFACE,
+        .bNumEndpoints      = 2,
+        .bInterfaceClass    = USB_CLASS_VENDOR_SPEC,
+        .bInterfaceSubClass = 0,
+        .bInterfaceProtocol = 0,
+};
+
+static struct usb_endpoint_descriptor cp210x_fs_in_desc = {
+        .bLength          = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType  = USB_DT_ENDPOINT,
+        .bEndpointAddress = USB_DIR_IN,
+        .bmAttributes     = USB_ENDPOINT_XFER_BULK,
+        .wMaxPacketSize   = cpu_to_le16(64),
+};
+
+static struct usb_endpoint_descriptor cp210x_fs_out_desc = {
+        .bLength          = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType  = USB_DT_ENDPOINT,
+        .bEndpointAddress = USB_DIR_OUT,
+        .bmAttributes     = USB_ENDPOINT_XFER_BULK,
+        .wMaxPacketSize   = cpu_to_le16(64),
+};
+
+static struct usb_descriptor_header *cp210x_fs_function[] = {
+        (struct usb_descriptor_header *) &cp210x_intf,
+        (struct usb_descriptor_header *) &cp210x_fs_in_desc,
+        (struct usb_descriptor_header *) &cp210x_fs_out_desc,
+        NULL,
+};
+
+static struct usb_string cp210x_string_defs[] = {
+        [0].s = "CP210x emulator",
+        {  }
+};
+
+static struct usb_gadget_strings cp210x_string_table = {
+        .language = 0x0409,
+        .strings  = cp210x_string_defs,
+};
+
+static struct usb_gadget_strings *cp210x_strings[] = {
+        &cp210x_string_table,
+        NULL,
+};
+
+/*
+ * Queues an in-band event for the host built from pending line status and modem status events. If event
+ * request is already in flight, events stay pending and are sent when it completes. Caller holds lock.
+ *
+ * @cp: emulated device
+ */
+static void cp210x_send_events(struct f_sp_cp210x *cp)
+{
+    int len = 0;
+    u8 *buf = cp->evt_req->buf;
+
+    if (cp->evt_busy || !cp->esc_char || !(cp->pending_lsr || cp->pending_msr))
+        return;
+
+    if (cp->pending_lsr) {
+        buf[len++] = cp->esc_char;
+        buf[len++] = CP210X_ESCSEQ_LSR;
+        buf[len++] = cp->pending_lsr;
+    }
+    if (cp->pending_msr) {
+        buf[len++] = cp->esc_char;
+        buf[len++] = CP210X_ESCSEQ_MSR;
+        buf[len++] = cp->pending_msr;
+    }
+
+    cp->evt_req->length = len;
+    if (usb_ep_queue(cp->in_ep, cp->evt_req, GFP_ATOMIC) == 0) {
+        cp->evt_busy = 1;
+        cp->pending_lsr = 0;
+        cp->pending_msr = 0;
+    }
+}
+
+static void cp210x_evt_complete(struct usb_ep *ep, struct usb_request *req)
+{
+    unsigned long flags;
+    struct f_sp_cp210x *cp = ep->driver_data;
+
+    spin_lock_irqsave(&cp->lock, flags);
+    cp->evt_busy = 0;
+    if (req->status == 0)
+        cp210x_send_events(cp);
+    spin_unlock_irqrestore(&cp->lock, flags);
+}
+
+/*
+ * Gives modem status as seen by the host, output lines are looped back as a null modem cable does.
+ *
+ * @mhs: DTR/RTS state set by host
+ *
+ * @return value reported by CP210X_GET_MDMSTS.
+ */
+static u8 cp210x_modem_status(u16 mhs)
+{
+    u8 status = mhs & (CONTROL_DTR | CONTROL_RTS);
+
+    if (mhs & CONTROL_RTS)
+        status |= CONTROL_CTS;
+    if (mhs & CONTROL_DTR)
+        status |= (CONTROL_DSR | CONTROL_DCD);
+
+    return status;
+}
+
+/*
+ * Applies CP210X_SET_MHS and reports resulting CTS/DSR/DCD changes as modem status event. Caller holds lock.
+ *
+ * @cp: emulated device
+ * @value: wValue of request
+ */
+static void cp210x_set_mhs(struct f_sp_cp210x *cp, u16 value)
+{
+    u8 old_status = cp210x_modem_status(cp->mhs);
+    u8 new_status = 0;
+    u8 msr = 0;
+
+    if (value & CONTROL_WRITE_DTR)
+        cp->mhs = (cp->mhs & ~CONTROL_DTR) | (value & CONTROL_DTR);
+    if (value & CONTROL_WRITE_RTS)
+        cp->mhs = (cp->mhs & ~CONTROL_RTS) | (value & CONTROL_RTS);
+
+    new_status = cp210x_modem_status(cp->mhs);
+    if (new_status == old_status)
+        return;
+
+    if ((new_status ^ old_status) & CONTROL_CTS)
+        msr |= CP210X_MSR_DELTA_CTS;
+    if ((new_status ^ old_status) & CONTROL_DSR)
+        msr |= CP210X_MSR_DELTA_DSR;
+    if ((new_status ^ old_status) & CONTROL_DCD)
+        msr |= CP210X_MSR_DELTA_DCD;
+
+    /* MSR has CTS/DSR/RI/DCD in upper nibble, same bit positions as modem status */
+    cp->pending_msr |= msr;
+    cp->pending_msr = (cp->pending_msr & 0x0F) | (new_status & 0xF0);
+    cp210x_send_events(cp);
+}
+
+/*
+ * Copies data received from host into IN buffer escaping ESC characters if host enabled embedded events.
+ *
+ * @cp: emulated device
+ * @dst: IN buffer (twice the size of OUT buffer)
+ * @src: data received from host
+ * @len: number of bytes in src
+ *
+ * @return number of bytes placed in dst.
+ */
+static int cp210x_loop_data(struct f_sp_cp210x *cp, u8 *dst, const u8 *src, int len)
+{
+    int x = 0;
+    int n = 0;
+    u8 esc = cp->esc_char;
+
+    if (!esc) {
+        memcpy(dst, src, len);
+        return len;
+    }
+
+    for (x = 0; x < len; x++) {
+        dst[n++] = src[x];
+        if (src[x] == esc)
+            dst[n++] = 0x00;
+    }
+
+    return n;
+}
+
+static void cp210x_in_complete(struct usb_ep *ep, struct usb_request *req)
+{
+    struct f_sp_cp210x *cp = ep->driver_data;
+    struct usb_request *out_req = req->context;
+
+    /* Request has been dequeued because endpoint is being disabled, disable frees it. */
+    if (req->status == -ESHUTDOWN || req->status == -ECONNRESET || req->status == -ECONNABORTED)
+        return;
+
+    if (usb_ep_queue(cp->out_ep, out_req, GFP_ATOMIC) != 0)
+        ERROR(cp->function.config->cdev, "%s: can not queue OUT request\n", __func__);
+}
+
+static void cp210x_out_complete(struct usb_ep *ep, struct usb_request *req)
+{
+    int result = 0;
+    int enabled = 0;
+    struct f_sp_cp210x *cp = ep->driver_data;
+    struct usb_request *in_req = req->context;
+
+    switch (req->status) {
+    case 0:
+        break;
+    case -ESHUTDOWN:
+    case -ECONNRESET:
+    case -ECONNABORTED:
+        return;
+    default:
+        goto requeue;
+    }
+
+    /* A disabled UART drops whatever it receives. */
+    spin_lock(&cp->lock);
+    enabled = cp->ifc_enabled;
+    if (enabled && cp->loopback && req->actual)
+        in_req->length = cp210x_loop_data(cp, in_req->buf, req->buf, req->actual);
+    spin_unlock(&cp->lock);
+
+    if (enabled && cp->loopback && req->actual) {
+        result = usb_ep_queue(cp->in_ep, in_req, GFP_ATOMIC);
+        if (result == 0)
+            return;
+        ERROR(cp->function.config->cdev, "%s: can not queue IN request: %d\n", __func__, result);
+    }
+
+requeue:
+    if (usb_ep_queue(cp->out_ep, req, GFP_ATOMIC) != 0)
+        ERROR(cp->function.config->cdev, "%s: can not queue OUT request\n", __func__);
+}
+
+/*
+ * Invoked when OUT data stage of a control request completes, the data is applied to emulated state.
+ */
+static void cp210x_ep0_complete(struct usb_ep *ep, struct usb_request *req)
+{
+    u16 mask, state;
+    u8 *data = req->buf;
+    unsigned long flags;
+    struct f_sp_cp210x *cp = ep->driver_data;
+
+    if (req->status != 0)
+        return;
+
+    spin_lock_irqsave(&cp->lock, flags);
+
+    switch (cp->ep0_request) {
+    case CP210X_SET_BAUDRATE:
+        if (req->actual == 4)
+            cp->baudrate = get_unaligned_le32(data);
+        break;
+    case CP210X_SET_FLOW:
+        if (req->actual == sizeof(cp->flow))
+            memcpy(cp->flow, data, sizeof(cp->flow));
+        break;
+    case CP210X_SET_CHARS:
+        if (req->actual == sizeof(cp->chars))
+            memcpy(cp->chars, data, sizeof(cp->chars));
+        break;
+    case CP210X_VENDOR_SPECIFIC:
+        /* CP2105 style latch write with mask and state in data stage */
+        if ((cp->ep0_value == CP210X_WRITE_LATCH) && (req->actual == 2)) {
+            mask = data[0];
+            state = data[1];
+            cp->latch = (cp->latch & ~mask) | (state & mask);
+        }
+        break;
+    default:
+        break;
+    }
+
+    spin_unlock_irqrestore(&cp->lock, flags);
+}
+
+/*
+ * Handles vendor control requests sent by host. Requests without data stage are applied immediately, requests
+ * with OUT data stage are applied in cp210x_ep0_complete() and requests with IN data stage are answered from
+ * emulated state.
+ *
+ * @return number of bytes in data stage or negative error code to stall the request.
+ */
+static int sp_cp210x_setup(struct usb_function *f, const struct usb_ctrlrequest *ctrl)
+{
+    int value = -EOPNOTSUPP;
+    u16 mask, state;
+    unsigned long flags;
+    u16 w_value = le16_to_cpu(ctrl->wValue);
+    u16 w_index = le16_to_cpu(ctrl->wIndex);
+    u16 w_length = le16_to_cpu(ctrl->wLength);
+    struct f_sp_cp210x *cp = func_to_cp210x(f);
+    struct usb_composite_dev *cdev = f->config->cdev;
+    struct usb_request *req = cdev->req;
+    u8 *buf = req->buf;
+
+    if ((ctrl->bRequestType & USB_TYPE_MASK) != USB_TYPE_VENDOR)
+        return -EOPNOTSUPP;
+
+    if (w_length > CP210X_EP0_MAX)
+        return -EOPNOTSUPP;
+
+    spin_lock_irqsave(&cp->lock, flags);
+
+    if (ctrl->bRequestType & USB_DIR_IN) {
+        switch (ctrl->bRequest) {
+        case CP210X_GET_BAUDRATE:
+            put_unaligned_le32(cp->baudrate, buf);
+            value = 4;
+            break;
+        case CP210X_GET_LINE_CTL:
+            put_unaligned_le16(cp->line_ctl, buf);
+            value = 2;
+            break;
+        case CP210X_GET_MDMSTS:
+            buf[0] = cp210x_modem_status(cp->mhs);
+            value = 1;
+            break;
+        case CP210X_GET_FLOW:
+            memcpy(buf, cp->flow, sizeof(cp->flow));
+            value = sizeof(cp->flow);
+            break;
+        case CP210X_GET_CHARS:
+            memcpy(buf, cp->chars, sizeof(cp->chars));
+            value = sizeof(cp->chars);
+            break;
+        case CP210X_GET_COMM_STATUS:
+            /* No errors, nothing held and queues empty */
+            memset(buf, 0, CP210X_EP0_MAX);
+            value = CP210X_EP0_MAX;
+            break;
+        case CP210X_VENDOR_SPECIFIC:
+            if (w_value == CP210X_GET_PARTNUM) {
+                buf[0] = cp->partnum;
+                value = 1;
+            }else if ((w_value == CP210X_READ_LATCH) && (cp->partnum == PART_CP2103 ||
+                    cp->partnum == PART_CP2104)) {
+                buf[0] = cp->latch & 0xFF;
+                value = 1;
+            }
+            break;
+        default:
+            break;
+        }
+        if (value > w_length)
+            value = w_length;
+    }else {
+        switch (ctrl->bRequest) {
+        case CP210X_IFC_ENABLE:
+            cp->ifc_enabled = w_value;
+            value = 0;
+            break;
+        case CP210X_SET_LINE_CTL:
+            cp->line_ctl = w_value;
+            value = 0;
+            break;
+        case CP210X_SET_MHS:
+            cp210x_set_mhs(cp, w_value);
+            value = 0;
+            break;
+        case CP210X_SET_BREAK:
+            /* Looped back RX sees the break */
+            if (w_value && !cp->break_state) {
+                cp->pending_lsr |= CP210X_LSR_BREAK;
+                cp210x_send_events(cp);
+            }
+            cp->break_state = w_value;
+            value = 0;
+            break;
+        case CP210X_EMBED_EVENTS:
+            cp->esc_char = w_value & 0xFF;
+            value = 0;
+            break;
+        case CP210X_SET_XON:
+        case CP210X_SET_XOFF:
+        case CP210X_IMM_CHAR:
+        case CP210X_SET_EVENTMASK:
+        case CP210X_PURGE:
+            value = 0;
+            break;
+        case CP210X_SET_BAUDRATE:
+        case CP210X_SET_FLOW:
+        case CP210X_SET_CHARS:
+            value = w_length;
+            break;
+        case CP210X_VENDOR_SPECIFIC:
+            if (w_value != CP210X_WRITE_LATCH)
+                break;
+            if (w_length == 0) {
+                /* CP2103/CP2104 style, mask in low and state in high byte of wIndex */
+                mask = w_index & 0xFF;
+                state = (w_index >> 8) & 0xFF;
+                cp->latch = (cp->latch & ~mask) | (state & mask);
+                value = 0;
+            }else {
+                value = w_length;
+            }
+            break;
+        default:
+            break;
+        }
+
+        if (value > 0) {
+            cp->ep0_request = ctrl->bRequest;
+            cp->ep0_value = w_value;
+            cdev->gadget->ep0->driver_data = cp;
+            req->complete = cp210x_ep0_complete;
+        }
+    }
+
+    spin_unlock_irqrestore(&cp->lock, flags);
+
+    if (value < 0)
+        VDBG(cdev, "unsupported request 0x%02x.%02x v%04x i%04x l%u\n", ctrl->bRequestType, ctrl->bRequest,
+                w_value, w_index, w_length);
+
+    /* Composite core queues data or status stage */
+    return value;
+}
+
+/*
+ * Frees every bulk and event request. Endpoints have been disabled, so none of them is queued.
+ */
+static void cp210x_free_requests(struct f_sp_cp210x *cp)
+{
+    unsigned int x = 0;
+
+    for (x = 0; x < cp->qlen; x++) {
+        if (cp->out_req && cp->out_req[x]) {
+            kfree(cp->out_req[x]->buf);
+            usb_ep_free_request(cp->out_ep, cp->out_req[x]);
+        }
+        if (cp->in_req && cp->in_req[x]) {
+            kfree(cp->in_req[x]->buf);
+            usb_ep_free_request(cp->in_ep, cp->in_req[x]);
+        }
+    }
+    kfree(cp->out_req);
+    kfree(cp->in_req);
+    cp->out_req = NULL;
+    cp->in_req = NULL;
+
+    if (cp->evt_req) {
+        kfree(cp->evt_req->buf);
+        usb_ep_free_request(cp->in_ep, cp->evt_req);
+        cp->evt_req = NULL;
+    }
+}
+
+/*
+ * Allocates bulk request pairs and event request. IN buffers are twice as large as OUT buffers so that
+ * data consisting of ESC characters only still fits after escaping.
+ *
+ * @return 0 on success otherwise -ENOMEM.
+ */
+static int cp210x_alloc_requests(struct f_sp_cp210x *cp)
+{
+    unsigned int x = 0;
+    struct usb_request *req;
+
+    cp->out_req = kcalloc(cp->qlen, sizeof(struct usb_request *), GFP_ATOMIC);
+    cp->in_req = kcalloc(cp->qlen, sizeof(struct usb_request *), GFP_ATOMIC);
+    if (!cp->out_req || !cp->in_req)
+        goto fail;
+
+    for (x = 0; x < cp->qlen; x++) {
+        req = usb_ep_alloc_request(cp->out_ep, GFP_ATOMIC);
+        if (!req)
+            goto fail;
+        cp->out_req[x] = req;
+        req->buf = kmalloc(cp->buflen, GFP_ATOMIC);
+        if (!req->buf)
+            goto fail;
+        req->length = cp->buflen;
+        req->complete = cp210x_out_complete;
+
+        req = usb_ep_alloc_request(cp->in_ep, GFP_ATOMIC);
+        if (!req)
+            goto fail;
+        cp->in_req[x] = req;
+        req->buf = kmalloc(cp->buflen * 2, GFP_ATOMIC);
+        if (!req->buf)
+            goto fail;
+        req->complete = cp210x_in_complete;
+
+        cp->out_req[x]->context = cp->in_req[x];
+        cp->in_req[x]->context = cp->out_req[x];
+    }
+
+    cp->evt_req = usb_ep_alloc_request(cp->in_ep, GFP_ATOMIC);
+    if (!cp->evt_req)
+        goto fail;
+    cp->evt_req->buf = kmalloc(CP210X_EVT_BUF_SIZE, GFP_ATOMIC);
+    if (!cp->evt_req->buf)
+        goto fail;
+    cp->evt_req->complete = cp210x_evt_complete;
+
+    return 0;
+
+fail:
+    cp210x_free_requests(cp);
+    return -ENOMEM;
+}
+
+static void cp210x_disable_endpoints(struct f_sp_cp210x *cp)
+{
+    usb_ep_disable(cp->in_ep);
+    usb_ep_disable(cp->out_ep);
+    cp210x_free_requests(cp);
+    cp->evt_busy = 0;
+}
+
+/*
+ * Invoked when host selects configuration (or alternate setting) of this function. Emulated device returns
+ * to power on state, endpoints are enabled and all OUT requests are queued.
+ */
+static int sp_cp210x_set_alt(struct usb_function *f, unsigned intf, unsigned alt)
+{
+    int result = 0;
+    unsigned int x = 0;
+    unsigned long flags;
+    struct f_sp_cp210x *cp = func_to_cp210x(f);
+    struct usb_composite_dev *cdev = f->config->cdev;
+
+    if (cp->out_req)
+        cp210x_disable_endpoints(cp);
+
+    spin_lock_irqsave(&cp->lock, flags);
+    cp->ifc_enabled = 0;
+    cp->baudrate = 9600;
+    cp->line_ctl = 0x0800;
+    cp->mhs = 0;
+    cp->break_state = 0;
+    memset(cp->flow, 0, sizeof(cp->flow));
+    memset(cp->chars, 0, sizeof(cp->chars));
+    cp->latch = 0xFFFF;
+    cp->esc_char = 0;
+    cp->pending_lsr = 0;
+    cp->pending_msr = 0;
+    spin_unlock_irqrestore(&cp->lock, flags);
+
+    result = config_ep_by_speed(cdev->gadget, f, cp->in_ep);
+    if (result == 0)
+        result = config_ep_by_speed(cdev->gadget, f, cp->out_ep);
+    if (result != 0)
+        return result;
+
+    result = usb_ep_enable(cp->in_ep);
+    if (result != 0)
+        return result;
+    cp->in_ep->driver_data = cp;
+
+    result = usb_ep_enable(cp->out_ep);
+    if (result != 0) {
+        usb_ep_disable(cp->in_ep);
+        return result;
+    }
+    cp->out_ep->driver_data = cp;
+
+    result = cp210x_alloc_requests(cp);
+    if (result != 0) {
+        usb_ep_disable(cp->in_ep);
+        usb_ep_disable(cp->out_ep);
+        return result;
+    }
+
+    for (x = 0; x < cp->qlen; x++) {
+        result = usb_ep_queue(cp->out_ep, cp->out_req[x], GFP_ATOMIC);
+        if (result != 0) {
+            ERROR(cdev, "%s: can not queue OUT request: %d\n", __func__, result);
+            cp210x_disable_endpoints(cp);
+            return result;
+        }
+    }
+
+    DBG(cdev, "%s: enabled, part 0x%02x, %s\n", f->name, cp->partnum, cp->loopback ? "loopback" : "sink");
+    return 0;
+}
+
+static void sp_cp210x_disable(struct usb_function *f)
+{
+    struct f_sp_cp210x *cp = func_to_cp210x(f);
+
+    if (cp->out_req)
+        cp210x_disable_endpoints(cp);
+}
+
+static int sp_cp210x_bind(struct usb_configuration *c, struct usb_function *f)
+{
+    int id = 0;
+    int result = 0;
+    struct usb_string *us;
+    struct usb_composite_dev *cdev = c->cdev;
+    struct f_sp_cp210x *cp = func_to_cp210x(f);
+
+    us = usb_gstrings_attach(cdev, cp210x_strings, ARRAY_SIZE(cp210x_string_defs));
+    if (IS_ERR(us))
+        return PTR_ERR(us);
+    cp210x_intf.iInterface = us[0].id;
+
+    id = usb_interface_id(c, f);
+    if (id < 0)
+        return id;
+    cp210x_intf.bInterfaceNumber = id;
+    cp->intf = id;
+
+    cp->in_ep = usb_ep_autoconfig(cdev->gadget, &cp210x_fs_in_desc);
+    if (!cp->in_ep)
+        return -ENODEV;
+
+    cp->out_ep = usb_ep_autoconfig(cdev->gadget, &cp210x_fs_out_desc);
+    if (!cp->out_ep)
+        return -ENODEV;
+
+    /* Real CP210x are full speed only devices with 64 byte bulk endpoints, so no high speed descriptors */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,6,0)
+    result = usb_assign_descriptors(f, cp210x_fs_function, NULL, NULL, NULL);
+#else
+    result = usb_assign_descriptors(f, cp210x_fs_function, NULL, NULL);
+#endif
+    if (result != 0)
+        return result;
+
+    DBG(cdev, "%s: IN/%s OUT/%s\n", f->name, cp->in_ep->name, cp->out_ep->name);
+    return 0;
+}
+
+static void sp_cp210x_unbind(struct usb_configuration *c, struct usb_function *f)
+{
+    usb_free_all_descriptors(f);
+}
+
+static void sp_cp210x_free_func(struct usb_function *f)
+{
+    struct f_sp_cp210x_opts *opts = container_of(f->fi, struct f_sp_cp210x_opts, func_inst);
+
+    mutex_lock(&opts->lock);
+    opts->refcnt--;
+    mutex_unlock(&opts->lock);
+
+    kfree(func_to_cp210x(f));
+}
+
+static struct usb_function *sp_cp210x_alloc(struct usb_function_instance *fi)
+{
+    struct f_sp_cp210x *cp;
+    struct f_sp_cp210x_opts *opts = container_of(fi, struct f_sp_cp210x_opts, func_inst);
+
+    cp = kzalloc(sizeof(struct f_sp_cp210x), GFP_KERNEL);
+    if (!cp)
+        return ERR_PTR(-ENOMEM);
+
+    mutex_lock(&opts->lock);
+    opts->refcnt++;
+    cp->partnum = opts->partnum;
+    cp->loopback = opts->loopback;
+    cp->qlen = opts->qlen;
+    cp->buflen = opts->buflen;
+    mutex_unlock(&opts->lock);
+
+    spin_lock_init(&cp->lock);
+
+    cp->function.name = "sp_cp210x";
+    cp->function.bind = sp_cp210x_bind;
+    cp->function.unbind = sp_cp210x_unbind;
+    cp->function.set_alt = sp_cp210x_set_alt;
+    cp->function.disable = sp_cp210x_disable;
+    cp->function.setup = sp_cp210x_setup;
+    cp->function.free_func = sp_cp210x_free_func;
+
+    return &cp->function;
+}
+
+/* configfs attributes; values can not be changed while function is linked into a configuration */
+
+static ssize_t f_sp_cp210x_opts_partnum_show(struct config_item *item, char *page)
+{
+    int result = 0;
+    struct f_sp_cp210x_opts *opts = to_f_sp_cp210x_opts(item);
+
+    mutex_lock(&opts->lock);
+    result = sprintf(page, "0x%02x\n", opts->partnum);
+    mutex_unlock(&opts->lock);
+
+    return result;
+}
+
+static ssize_t f_sp_cp210x_opts_partnum_store(struct config_item *item, const char *page, size_t len)
+{
+    int result = 0;
+    u8 num = 0;
+    struct f_sp_cp210x_opts *opts = to_f_sp_cp210x_opts(item);
+
+    result = kstrtou8(page, 0, &num);
+    if (result != 0)
+        return result;
+
+    /* Only single interface parts are emulated. */
+    switch (num) {
+    case PART_CP2101:
+    case PART_CP2102:
+    case PART_CP2103:
+    case PART_CP2104:
+    case PART_CP2109:
+    case PART_CP2102N_QFN28:
+    case PART_CP2102N_QFN24:
+    case PART_CP2102N_QFN20:
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    mutex_lock(&opts->lock);
+    if (opts->refcnt) {
+        mutex_unlock(&opts->lock);
+        return -EBUSY;
+    }
+    opts->partnum = num;
+    mutex_unlock(&opts->lock);
+
+    return len;
+}
+
+static ssize_t f_sp_cp210x_opts_loopback_show(struct config_item *item, char *page)
+{
+    int result = 0;
+    struct f_sp_cp210x_opts *opts = to_f_sp_cp210x_opts(item);
+
+    mutex_lock(&opts->lock);
+    result = sprintf(page, "%d\n", opts->loopback ? 1 : 0);
+    mutex_unlock(&opts->lock);
+
+    return result;
+}
+
+static ssize_t f_sp_cp210x_opts_loopback_store(struct config_item *item, const char *page, size_t len)
+{
+    int result = 0;
+    bool val = false;
+    struct f_sp_cp210x_opts *opts = to_f_sp_cp210x_opts(item);
+
+    result = strtobool(page, &val);
+    if (result != 0)
+        return result;
+
+    mutex_lock(&opts->lock);
+    if (opts->refcnt) {
+        mutex_unlock(&opts->lock);
+        return -EBUSY;
+    }
+    opts->loopback = val;
+    mutex_unlock(&opts->lock);
+
+    return len;
+}
+
+static ssize_t f_sp_cp210x_opts_qlen_show(struct config_item *item, char *page)
+{
+    int result = 0;
+    struct f_sp_cp210x_opts *opts = to_f_sp_cp210x_opts(item);
+
+    mutex_lock(&opts->lock);
+    result = sprintf(page, "%u\n", opts->qlen);
+    mutex_unlock(&opts->lock);
+
+    return result;
+}
+
+static ssize_t f_sp_cp210x_opts_qlen_store(struct config_item *item, const char *page, size_t len)
+{
+    int result = 0;
+    unsigned int val = 0;
+    struct f_sp_cp210x_opts *opts = to_f_sp_cp210x_opts(item);
+
+    result = kstrtouint(page, 0, &val);
+    if (result != 0)
+        return result;
+    if ((val == 0) || (val > CP210X_MAX_QLEN))
+        return -EINVAL;
+
+    mutex_lock(&opts->lock);
+    if (opts->refcnt) {
+        mutex_unlock(&opts->lock);
+        return -EBUSY;
+    }
+    opts->qlen = val;
+    mutex_unlock(&opts->lock);
+
+    return len;
+}
+
+static ssize_t f_sp_cp210x_opts_buflen_show(struct config_item *item, char *page)
+{
+    int result = 0;
+    struct f_sp_cp210x_opts *opts = to_f_sp_cp210x_opts(item);
+
+    mutex_lock(&opts->lock);
+    result = sprintf(page, "%u\n", opts->buflen);
+    mutex_unlock(&opts->lock);
+
+    return result;
+}
+
+static ssize_t f_sp_cp210x_opts_buflen_store(struct config_item *item, const char *page, size_t len)
+{
+    int result = 0;
+    unsigned int val = 0;
+    struct f_sp_cp210x_opts *opts = to_f_sp_cp210x_opts(item);
+
+    result = kstrtouint(page, 0, &val);
+    if (result != 0)
+        return result;
+    if ((val < 64) || (val > CP210X_MAX_BUFLEN))
+        return -EINVAL;
+
+    mutex_lock(&opts->lock);
+    if (opts->refcnt) {
+        mutex_unlock(&opts->lock);
+        return -EBUSY;
+    }
+    opts->buflen = val;
+    mutex_unlock(&opts->lock);
+
+    return len;
+}
+
+CONFIGFS_ATTR(f_sp_cp210x_opts_, partnum);
+CONFIGFS_ATTR(f_sp_cp210x_opts_, loopback);
+CONFIGFS_ATTR(f_sp_cp210x_opts_, qlen);
+CONFIGFS_ATTR(f_sp_cp210x_opts_, buflen);
+
+static struct configfs_attribute *sp_cp210x_attrs[] = {
+        &f_sp_cp210x_opts_attr_partnum,
+        &f_sp_cp210x_opts_attr_loopback,
+        &f_sp_cp210x_opts_attr_qlen,
+        &f_sp_cp210x_opts_attr_buflen,
+        NULL,
+};
+
+static void sp_cp210x_attr_release(struct config_item *item)
+{
+    struct f_sp_cp210x_opts *opts = to_f_sp_cp210x_opts(item);
+
+    usb_put_function_instance(&opts->func_inst);
+}
+
+static struct configfs_item_operations sp_cp210x_item_ops = {
+        .release = sp_cp210x_attr_release,
+};
+
+static struct config_item_type sp_cp210x_func_type = {
+        .ct_item_ops = &sp_cp210x_item_ops,
+        .ct_attrs    = sp_cp210x_attrs,
+        .ct_owner    = THIS_MODULE,
+};
+
+static void sp_cp210x_free_instance(struct usb_function_instance *fi)
+{
+    kfree(container_of(fi, struct f_sp_cp210x_opts, func_inst));
+}
+
+static struct usb_function_instance *sp_cp210x_alloc_inst(void)
+{
+    struct f_sp_cp210x_opts *opts;
+
+    opts = kzalloc(sizeof(struct f_sp_cp210x_opts), GFP_KERNEL);
+    if (!opts)
+        return ERR_PTR(-ENOMEM);
+
+    mutex_init(&opts->lock);
+    opts->func_inst.free_func_inst = sp_cp210x_free_instance;
+    opts->partnum = PART_CP2104;
+    opts->loopback = true;
+    opts->qlen = CP210X_DEF_QLEN;
+    opts->buflen = CP210X_DEF_BUFLEN;
+
+    config_group_init_type_name(&opts->func_inst.group, "", &sp_cp210x_func_type);
+
+    return &opts->func_inst;
+}
+
+DECLARE_USB_FUNCTION_INIT(sp_cp210x, sp_cp210x_alloc_inst, sp_cp210x_alloc);
+
+MODULE_AUTHOR("Rishi Gupta");
+MODULE_DESCRIPTION("CP210x emulating USB gadget function for testing sp_cp210x - v1.0");
+MODULE_LICENSE("GPL");
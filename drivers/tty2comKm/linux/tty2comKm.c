@@ -39,7 +39,33 @@
 #include <linux/mutex.h>
 #include <asm/uaccess.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <linux/device.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/kref.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/file.h>
+#include <linux/miscdevice.h>
+#include <linux/kfifo.h>
+#include <linux/kthread.h>
+#include <linux/fs.h>
+#include <linux/termios.h>
+#include <linux/delay.h>
+#include <linux/rcupdate.h>
+#include <linux/version.h>
+#ifdef CONFIG_BPF_SYSCALL
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/pkt_cls.h>
+#endif
+
+#include "tty2comKm.h"
 
 /* Module information */
 #define DRIVER_VERSION "v1.0"
@@ -94,6 +120,63 @@
 #define CNM 0x0002
 #define SLB 0x0003
 #define CLB 0x0004
+#define RLY 0x0005
+
+/* Number of unplug/replug transitions remembered per device for hotplug timing analysis */
+#define SP_HP_TRACE_LEN 64
+
+/* Maximum time in milliseconds a device stays unplugged/plugged during hotplug emulation */
+#define SP_HP_MAX_INTERVAL 60000
+
+/* Interval in milliseconds at which replug checks whether hung up tty of the device has been released */
+#define SP_HP_RELEASE_POLL 10
+
+/* Number of receive timestamp records kept per device, oldest are dropped when full */
+#define SP_RXTS_LEN 1024
+
+/* Bytes staged per device when a USB-UART personality is emulated and the largest packet size */
+#define SP_PERSONA_FIFO_SIZE 4096
+#define SP_PERSONA_MAX_PACKET 64
+
+/* Bytes queued for transmission to real tty by relay, and maximum length of real tty's path */
+#define SP_RELAY_FIFO_SIZE 4096
+#define SP_RELAY_PATH_LEN 64
+
+/* Latency timer limits in milliseconds, same as FTDI chips */
+#define SP_PERSONA_MIN_LATENCY 1
+#define SP_PERSONA_MAX_LATENCY 255
+
+/* Reception behaviour of a USB-UART bridge. Received data is handed to tty layer in chunks of
+ * packet_size bytes; a partial chunk is handed over when latency_ms has elapsed since the previous
+ * chunk. Modem status changes become visible msr_delay_ms later. A packet_size of 0 means data is
+ * delivered as soon as it is written by the sender. */
+struct sp_personality {
+    const char *name;
+    unsigned int packet_size;
+    unsigned int latency_ms;
+    unsigned int msr_delay_ms;
+};
+
+/* A single hotplug transition; type is 'U' for unplug and 'R' for replug, tstamp is CLOCK_MONOTONIC
+ * time in nanoseconds at which the corresponding uevent was emitted. */
+struct sp_hp_event {
+    char type;
+    s64 tstamp;
+};
+
+/* Binding between a loop back device and a real tty device. Data written to virtual device is queued
+ * in tx_fifo and written to real tty by tx_thread, data read from real tty by rx_thread is delivered to
+ * virtual device. The filp is the real tty opened in raw mode. */
+struct sp_relay {
+    struct vtty_dev *vttydev;
+    struct file *filp;
+    struct task_struct *rx_thread;
+    struct task_struct *tx_thread;
+    struct kfifo tx_fifo;
+    wait_queue_head_t tx_wait;
+    int saved_odevtyp;
+    char path[SP_RELAY_PATH_LEN];
+};
 
 /* Represent a virtual tty device in this virtual card. The peer_index will contain own 
  * index if this device is loop back configured device (peer_index == own_index). */
@@ -116,9 +199,59 @@ struct vtty_dev {
     int faulty_cable;
     struct tty_struct *own_tty;
     struct tty_struct *peer_tty;
+    int open_count; /* open() calls not yet matched by close(), protected by lock */
     struct serial_struct serial;
     struct async_icount icount;
     struct device *device;
+    int unplugged;
+    struct delayed_work hp_work;
+    spinlock_t hp_lock;
+    int hp_active;
+    unsigned int hp_remaining;
+    unsigned int hp_interval;
+    unsigned int hp_cycles;
+    unsigned int hp_tnext;
+    struct sp_hp_event hp_trace[SP_HP_TRACE_LEN];
+    spinlock_t rxts_lock;
+    struct sp_rxts_record *rxts;
+    u64 rxts_offset;
+    u64 rxts_dropped;
+    unsigned int rxts_head;
+    unsigned int rxts_tail;
+    const struct sp_personality *persona;
+    unsigned int latency;
+    spinlock_t rx_lock;
+    struct kfifo rx_fifo;
+    unsigned long rx_deadline;
+    struct delayed_work rx_work;
+    struct delayed_work msr_work;
+    int msr_pending;
+    int msr_shown;
+    int msr_wakeup_open;
+    struct async_icount msr_delta;
+    struct mutex relay_mutex;
+    spinlock_t relay_lock;
+    struct sp_relay *relay;
+#ifdef CONFIG_BPF_SYSCALL
+    struct bpf_prog __rcu *filter;
+#endif
+    unsigned int filter_pass;
+    unsigned int filter_drop;
+};
+
+/* Shared memory receive ring of a /dev/tty2com_ring open instance. The mem is mapped into user space
+ * as is; first page is struct sp_ring_hdr followed by data area. A ring is referenced by the file
+ * which created it and by the line discipline it is attached to. */
+struct sp_ring {
+    struct kref kref;
+    struct tty_struct *tty;
+    int hup;
+    wait_queue_head_t wait;
+    void *mem;
+    unsigned long memlen;
+    struct sp_ring_hdr *hdr;
+    unsigned char *data;
+    unsigned int size;
 };
 
 /* Current driver design is such that the vtty_info for a device with index x will be placed at
@@ -171,11 +304,68 @@ static ssize_t sp_odevtyp_show(struct device *dev, struct device_attribute *attr
 static ssize_t sp_odtropn_show(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t sp_pdtropn_show(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t sp_ostats_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t sp_hotplug_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t sp_hotplug_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t sp_hptrace_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static int sp_register_vttydev(struct vtty_dev *vttydev);
+static void sp_unregister_vttydev(struct vtty_dev *vttydev);
+static void sp_free_vttydev(struct vtty_dev *vttydev);
+static void sp_deliver_rx(struct tty_struct *tty_to_write, struct vtty_dev *rx_vttydev, const unsigned char *data, int count);
+static void sp_rxts_record(struct vtty_dev *vttydev, int count, s64 tstamp);
+static int sp_rxts_enable(struct vtty_dev *vttydev, unsigned long arg);
+static int sp_rxts_get(struct vtty_dev *vttydev, unsigned long arg);
+static int sp_filter_attach(struct vtty_dev *vttydev, int fd);
+#ifdef CONFIG_BPF_SYSCALL
+static struct sk_buff *sp_filter_run(struct vtty_dev *vttydev, const unsigned char *data, int count, int *drop);
+#endif
+static void sp_hotplug_record(struct vtty_dev *vttydev, char type);
+static void sp_hotplug_work(struct work_struct *work);
+static ssize_t sp_personality_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t sp_personality_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t sp_latency_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t sp_latency_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static void sp_persona_rx_work(struct work_struct *work);
+static void sp_persona_msr_work(struct work_struct *work);
+static void sp_publish_msr(struct vtty_dev *vttydev, struct async_icount *delta, int wakeup_blocked_open);
+static int sp_visible_msr(struct vtty_dev *vttydev);
+static void sp_change_msr(struct vtty_dev *vttydev, int msr_state_reg, struct async_icount *delta, int wakeup_blocked_open);
+static ssize_t sp_relay_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t sp_relay_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static long sp_relay_ioctl(struct sp_relay *relay, unsigned int cmd, unsigned long arg);
+static int sp_relay_bind(struct vtty_dev *vttydev, const char *path);
+static void sp_relay_unbind(struct vtty_dev *vttydev);
+static int sp_relay_rx_thread(void *data);
+static int sp_relay_tx_thread(void *data);
+static int sp_relay_write(struct vtty_dev *vttydev, const unsigned char *buf, int count);
+static int sp_relay_modem_lines(struct vtty_dev *vttydev, unsigned int set, unsigned int clear);
+static void sp_relay_set_termios(struct vtty_dev *vttydev, struct ktermios *termios);
 
 static int sp_vcard_proc_open(struct inode *inode, struct  file *file);
 static int sp_vcard_proc_close(struct inode *inode, struct file *file);
 static ssize_t sp_vcard_proc_read(struct file *file, char __user *buf, size_t size, loff_t *ppos);
 static ssize_t sp_vcard_proc_write(struct file *file, const char __user *buf, size_t length, loff_t * ppos);
+static void *sp_vcard_info_start(struct seq_file *m, loff_t *pos);
+static void *sp_vcard_info_next(struct seq_file *m, void *v, loff_t *pos);
+static void sp_vcard_info_stop(struct seq_file *m, void *v);
+static int sp_vcard_info_show(struct seq_file *m, void *v);
+static int sp_vcard_info_open(struct inode *inode, struct file *file);
+
+static struct sp_ring *sp_ring_get_attached(struct tty_struct *tty);
+static void sp_ring_release_kref(struct kref *kref);
+static int sp_ring_ldisc_open(struct tty_struct *tty);
+static void sp_ring_ldisc_close(struct tty_struct *tty);
+static ssize_t sp_ring_ldisc_write(struct tty_struct *tty, struct file *file, const unsigned char *buf, size_t nr);
+static int sp_ring_ldisc_ioctl(struct tty_struct *tty, struct file *file, unsigned int cmd, unsigned long arg);
+static unsigned int sp_ring_ldisc_poll(struct tty_struct *tty, struct file *file, poll_table *wait);
+static int sp_ring_receive_buf2(struct tty_struct *tty, const unsigned char *cp, char *fp, int count);
+static int sp_ring_attach(struct tty_struct *tty, unsigned int fd);
+static void sp_ring_detach(struct tty_struct *tty);
+static int sp_ring_open(struct inode *inode, struct file *file);
+static int sp_ring_release(struct inode *inode, struct file *file);
+static int sp_ring_mmap(struct file *file, struct vm_area_struct *vma);
+static unsigned int sp_ring_poll(struct file *file, poll_table *wait);
+static long sp_ring_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
 
 static int sp_port_carrier_raised(struct tty_port *port);
 static void sp_port_shutdown(struct tty_port *port);
@@ -189,6 +379,28 @@ static ushort max_num_vtty_dev = DEFAULT_VTTY_DEV_MAX;
 static ushort init_num_nm_pair = 0;
 static ushort init_num_lb_dev  = 0;
 
+/* Line discipline number for the shared memory ring line discipline and size of each ring. The
+ * default line discipline number is N_DEVELOPMENT in newer kernels and unused in older ones. */
+static int ring_ldisc = 29;
+static uint ring_size = 1024 * 1024;
+static int sp_ring_registered = 0;
+
+#ifdef CONFIG_BPF_SYSCALL
+/* Never registered network device given as skb->dev to tc classifier filter programs, helpers like
+ * bpf_clone_redirect() expect one. Allocated when first such program is attached. */
+static struct net_device *sp_filter_netdev;
+static DEFINE_MUTEX(sp_filter_mutex);
+#endif
+
+/* USB-UART bridges whose reception timing can be emulated, first entry is the default. The values
+ * are typical ones; FTDI chips use 64 byte packets carrying 2 status bytes and a 16 ms latency timer
+ * and report modem status only in those packets, CP210x use 64 byte packets without status bytes. */
+static const struct sp_personality sp_personalities[] = {
+        { "none",   0,  0,  0  },
+        { "ftdi",   62, 16, 16 },
+        { "cp210x", 64, 8,  8  },
+};
+
 static ushort total_nm_pair = 0;
 static ushort total_lb_devs = 0;
 static int last_lbdev_idx   = -1;
@@ -200,6 +412,7 @@ static struct tty_driver *spvtty_driver;
 
 /* Used when creating or destroying virtual tty devices */
 static DEFINE_MUTEX(adaptlock);           /*  atomically create/destroy tty devices  */
+static DEFINE_SPINLOCK(sp_ring_lock);     /*  attach/detach ring and line discipline   */
 struct vtty_info *index_manager = NULL;   /*  keep track of indexes in use currently */
 
 /* Per device sysfs entries to emulate frame, parity and overrun error events during data
@@ -221,6 +434,11 @@ static DEVICE_ATTR(odevtyp, S_IRUGO, sp_odevtyp_show, NULL);
 static DEVICE_ATTR(odtropn, S_IRUGO, sp_odtropn_show, NULL);
 static DEVICE_ATTR(pdtropn, S_IRUGO, sp_pdtropn_show, NULL);
 static DEVICE_ATTR(ostats,  S_IRUGO, sp_ostats_show, NULL);
+static DEVICE_ATTR(hotplug, (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP), sp_hotplug_show, sp_hotplug_store);
+static DEVICE_ATTR(hptrace, S_IRUGO, sp_hptrace_show, NULL);
+static DEVICE_ATTR(personality, (S_IRUGO | S_IWUSR | S_IWGRP), sp_personality_show, sp_personality_store);
+static DEVICE_ATTR(latency, (S_IRUGO | S_IWUSR | S_IWGRP), sp_latency_show, sp_latency_store);
+static DEVICE_ATTR(relay, (S_IRUGO | S_IWUSR | S_IWGRP), sp_relay_show, sp_relay_store);
 
 static struct attribute *spvtty_info_attrs[] = {
         &dev_attr_evt.attr,
@@ -235,6 +453,11 @@ static struct attribute *spvtty_info_attrs[] = {
         &dev_attr_odtropn.attr,
         &dev_attr_pdtropn.attr,
         &dev_attr_ostats.attr,
+        &dev_attr_hotplug.attr,
+        &dev_attr_hptrace.attr,
+        &dev_attr_personality.attr,
+        &dev_attr_latency.attr,
+        &dev_attr_relay.attr,
         NULL,
 };
 
@@ -615,1678 +838,3696 @@ static ssize_t sp_pdtropn_show(struct device *dev, struct device_attribute *attr
     return sprintf(buf, "%u\n", local_vttydev->set_pdtr_at_open);
 }
 
-/* 
- * Update modem control and modem status registers according to the bit mask(s) provided. The 
- * DTR and RTS values can be set only if the current handshaking state of the tty device allows 
- * direct control of the modem control lines. Update honours pin mappings.
+/*
+ * Emulates a USB-UART device being repeatedly removed and inserted again. Each cycle hangs up the
+ * tty device, unregisters it (udev receives 'remove' uevent), waits for given interval, registers it
+ * again (udev receives 'add' uevent) and waits for given interval before next cycle. Index, pin
+ * mappings and other settings of the device are retained across cycles. The format is count#interval
+ * where interval is in milliseconds. Writing 0 stops an ongoing emulation after the current cycle.
  *
- * Caller holds the lock associated with the given tty's virtual tty info.
- * 
- * @tty: tty device whose modem control register is to be updated with given value(s)
- * @set: bit mask of signals which should be asserted
- * @clear: bit mask of signals which should be de-asserted
- * 
- * @return 0 on success otherwise negative error code on failure
+ * 1. Unplug and replug tty2com0, 1000 times, 250 milliseconds apart:
+ * $ echo "1000#250" > /sys/devices/virtual/tty/tty2com0/hotplug
+ *
+ * 2. Stop emulation:
+ * $ echo "0" > /sys/devices/virtual/tty/tty2com0/hotplug
+ *
+ * The sysfs files of the device disappear while it is unplugged, so the stop command takes effect
+ * only when the device is present.
+ *
+ * @dev: device associated with given sysfs entry
+ * @attr: sysfs attribute corresponding to this function
+ * @buf: hotplug command passed from user space to kernel via this sysfs attribute
+ * @count: number of characters in buf
+ *
+ * @return number of bytes consumed from buf on success or negative error code on error
  */
-static int sp_update_modem_lines(struct tty_struct *tty, unsigned int set, unsigned int clear)
+static ssize_t sp_hotplug_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    int ctsint = 0;
-    int dcdint = 0;
-    int dsrint = 0;
-    int rngint = 0;
-    int rts_mappings = 0;
-    int dtr_mappings = 0;
-    int mcr_ctrl_reg = 0;
-    int msr_state_reg = 0;
-    int wakeup_blocked_open = 0;
-    struct async_icount *evicount;
-    struct vtty_dev *vttydev = NULL;
+    int start = 0;
+    unsigned long flags;
+    unsigned int repeat = 0;
+    unsigned int interval = 0;
     struct vtty_dev *local_vttydev = NULL;
-    struct vtty_dev *remote_vttydev = NULL;
 
-    local_vttydev = index_manager[tty->index].vttydev;
-    if(tty->index != local_vttydev->peer_index)
-        remote_vttydev = index_manager[local_vttydev->peer_index].vttydev;
+    if(!buf || (count <= 0))
+        return -EINVAL;
 
-    /* Read modify write MSR register */
-    if(remote_vttydev != NULL) {
-        msr_state_reg = remote_vttydev->msr_reg;
-        vttydev = remote_vttydev;
-    }
-    else {
-        msr_state_reg = local_vttydev->msr_reg;
-        vttydev = local_vttydev;
-    }
+    if(sscanf(buf, "%u#%u", &repeat, &interval) < 1)
+        return -EINVAL;
+    if(interval > SP_HP_MAX_INTERVAL)
+        return -EINVAL;
 
-    rts_mappings = local_vttydev->rts_mappings;
-    dtr_mappings = local_vttydev->dtr_mappings;
+    local_vttydev = (struct vtty_dev *) dev_get_drvdata(dev);
 
-    if(set & TIOCM_RTS) {
-        mcr_ctrl_reg |= SP_MCR_RTS;
-        if((rts_mappings & SP_CON_CTS) == SP_CON_CTS) {
-            msr_state_reg |= SP_MSR_CTS;
-            ctsint++;
-        }
-        if((rts_mappings & SP_CON_DCD) == SP_CON_DCD) {
-            msr_state_reg |= SP_MSR_DCD;
-            dcdint++;
-            wakeup_blocked_open = 1;
-        }
-        if((rts_mappings & SP_CON_DSR) == SP_CON_DSR) {
-            msr_state_reg |= SP_MSR_DSR;
-            dsrint++;
-        }
-        if((rts_mappings & SP_CON_RI) == SP_CON_RI) {
-            msr_state_reg |= SP_MSR_RI;
-            rngint++;
-        }
+    /* The worker removes this very sysfs file while unplugging device, so it must never wait for
+     * anything the worker holds at that time; only the spinlock is taken here. */
+    spin_lock_irqsave(&local_vttydev->hp_lock, flags);
+    local_vttydev->hp_remaining = repeat;
+    local_vttydev->hp_interval = interval;
+    if((repeat > 0) && (local_vttydev->hp_active == 0)) {
+        local_vttydev->hp_active = 1;
+        local_vttydev->hp_cycles = 0;
+        start = 1;
     }
+    spin_unlock_irqrestore(&local_vttydev->hp_lock, flags);
 
-    if(set & TIOCM_DTR) {
-        mcr_ctrl_reg |= SP_MCR_DTR;
-        if((dtr_mappings & SP_CON_CTS) == SP_CON_CTS) {
-            msr_state_reg |= SP_MSR_CTS;
-            ctsint++;
-        }
-        if((dtr_mappings & SP_CON_DCD) == SP_CON_DCD) {
-            msr_state_reg |= SP_MSR_DCD;
-            dcdint++;
-            wakeup_blocked_open = 1;
-        }
-        if((dtr_mappings & SP_CON_DSR) == SP_CON_DSR) {
-            msr_state_reg |= SP_MSR_DSR;
-            dsrint++;
-        }
-        if((dtr_mappings & SP_CON_RI) == SP_CON_RI) {
-            msr_state_reg |= SP_MSR_RI;
-            rngint++;
-        }
-    }
+    if(start)
+        schedule_delayed_work(&local_vttydev->hp_work, 0);
 
-    if(clear & TIOCM_RTS) {
-        mcr_ctrl_reg &= ~SP_MCR_RTS;
-        if((rts_mappings & SP_CON_CTS) == SP_CON_CTS) {
-            msr_state_reg &= ~SP_MSR_CTS;
-            ctsint++;
-        }
-        if((rts_mappings & SP_CON_DCD) == SP_CON_DCD) {
-            msr_state_reg &= ~SP_MSR_DCD;
-            dcdint++;
-        }
-        if((rts_mappings & SP_CON_DSR) == SP_CON_DSR) {
-            msr_state_reg &= ~SP_MSR_DSR;
-            dsrint++;
-        }
-        if((rts_mappings & SP_CON_RI) == SP_CON_RI) {
-            msr_state_reg &= ~SP_MSR_RI;
-            rngint++;
-        }
-    }
+    return count;
+}
 
-    if (clear & TIOCM_DTR) {
-        mcr_ctrl_reg &= ~SP_MCR_DTR;
-        if((dtr_mappings & SP_CON_CTS) == SP_CON_CTS) {
-            msr_state_reg &= ~SP_MSR_CTS;
-            ctsint++;
-        }
-        if((dtr_mappings & SP_CON_DCD) == SP_CON_DCD) {
-            msr_state_reg &= ~SP_MSR_DCD;
-            dcdint++;
-        }
-        if((dtr_mappings & SP_CON_DSR) == SP_CON_DSR) {
-            msr_state_reg &= ~SP_MSR_DSR;
-            dsrint++;
-        }
-        if((dtr_mappings & SP_CON_RI) == SP_CON_RI) {
-            msr_state_reg &= ~SP_MSR_RI;
-            rngint++;
-        }
-    }
+/*
+ * Gives state of hotplug emulation in the format active#remaining#completed#interval.
+ *
+ * $ cat /sys/devices/virtual/tty/tty2com0/hotplug
+ *
+ * @dev: tty device
+ * @attr: sysfs attributes
+ * @buf: memory where result of invoking this function will be returned to caller.
+ *
+ * @return hotplug emulation state on success otherwise negative error code.
+ */
+static ssize_t sp_hotplug_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    ssize_t ret = 0;
+    unsigned long flags;
+    struct vtty_dev *local_vttydev = (struct vtty_dev *) dev_get_drvdata(dev);
 
-    local_vttydev->mcr_reg = mcr_ctrl_reg;
-    vttydev->msr_reg = msr_state_reg;
+    if(!buf)
+        return -EINVAL;
 
-    evicount = &vttydev->icount;
-    evicount->cts += ctsint;
-    evicount->dsr += dsrint;
-    evicount->dcd += dcdint;
-    evicount->rng += rngint;
+    spin_lock_irqsave(&local_vttydev->hp_lock, flags);
+    ret = sprintf(buf, "%d#%u#%u#%u\n", local_vttydev->hp_active, local_vttydev->hp_remaining,
+            local_vttydev->hp_cycles, local_vttydev->hp_interval);
+    spin_unlock_irqrestore(&local_vttydev->hp_lock, flags);
 
-    if(vttydev->own_tty && vttydev->own_tty->port) {
+    return ret;
+}
 
-        /* Wake up process blocked on TIOCMIWAIT ioctl */
-        if((vttydev->waiting_msr_chg == 1) && (vttydev->own_tty->port->count > 0)) {
-            wake_up_interruptible(&vttydev->own_tty->port->delta_msr_wait);
-        }
+/*
+ * Gives the last SP_HP_TRACE_LEN unplug (U) and replug (R) transitions, oldest first, one per line
+ * in the format type#timestamp. Timestamp is CLOCK_MONOTONIC in nanoseconds at which the uevent for
+ * the transition was emitted, so it can be compared directly with clock_gettime(CLOCK_MONOTONIC)
+ * taken by the application when it detects and recovers from the hotplug event.
+ *
+ * $ cat /sys/devices/virtual/tty/tty2com0/hptrace
+ *
+ * @dev: tty device
+ * @attr: sysfs attributes
+ * @buf: memory where result of invoking this function will be returned to caller.
+ *
+ * @return transition records on success otherwise negative error code.
+ */
+static ssize_t sp_hptrace_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    ssize_t len = 0;
+    unsigned int x = 0;
+    unsigned int first = 0;
+    unsigned long flags;
+    struct sp_hp_event *evt = NULL;
+    struct vtty_dev *local_vttydev = (struct vtty_dev *) dev_get_drvdata(dev);
 
-        /* Wake up application blocked on carrier detect signal */
-        if((wakeup_blocked_open == 1) && (vttydev->own_tty->port->blocked_open > 0)) {
-            wake_up_interruptible(&vttydev->own_tty->port->open_wait);
-        }
+    if(!buf)
+        return -EINVAL;
+
+    spin_lock_irqsave(&local_vttydev->hp_lock, flags);
+    if(local_vttydev->hp_tnext > SP_HP_TRACE_LEN)
+        first = local_vttydev->hp_tnext - SP_HP_TRACE_LEN;
+    for(x = first; x < local_vttydev->hp_tnext; x++) {
+        evt = &local_vttydev->hp_trace[x % SP_HP_TRACE_LEN];
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%c#%lld\n", evt->type, (long long) evt->tstamp);
     }
+    spin_unlock_irqrestore(&local_vttydev->hp_lock, flags);
 
-    return 0;
+    return len;
 }
 
 /*
- * Invoked when user space process opens a serial port. Tty core calls this to install tty and
- * initialize the required resources.
+ * Selects USB-UART bridge whose reception behaviour is to be emulated by this device. Latency timer
+ * is set to default value of selected personality. For example to make tty2com1 behave as FTDI:
  *
- * @driver: this driver.
- * @tty: the tty being created.
+ * $ echo ftdi > /sys/devices/virtual/tty/tty2com1/personality
  *
- * @return 0 on success otherwise negative error code on failure.
+ * @dev: device associated with given sysfs entry
+ * @attr: sysfs attribute corresponding to this function
+ * @buf: one of none, ftdi or cp210x
+ * @count: number of characters in buf
+ *
+ * @return number of bytes consumed from buf on success or negative error code on error
  */
-static int sp_install(struct tty_driver *driver, struct tty_struct *tty)
+static ssize_t sp_personality_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
     int ret = 0;
-    struct tty_port *port = NULL;
+    int x = 0;
+    unsigned int num = 0;
+    unsigned long flags;
+    unsigned char packet[SP_PERSONA_MAX_PACKET];
+    const struct sp_personality *persona = NULL;
+    struct tty_struct *tty = NULL;
+    struct vtty_dev *local_vttydev = NULL;
 
-    port = (struct tty_port *) kcalloc(1, sizeof(struct tty_port), GFP_KERNEL);
-    if(port == NULL)
-        return -ENOMEM;
+    if(!buf || (count <= 0))
+        return -EINVAL;
 
-    /* First initialize and then set port operations */
-    tty_port_init(port);
-    port->ops = &spvtty_port_ops;
+    for(x = 0; x < ARRAY_SIZE(sp_personalities); x++) {
+        if(sysfs_streq(buf, sp_personalities[x].name)) {
+            persona = &sp_personalities[x];
+            break;
+        }
+    }
+    if(persona == NULL)
+        return -EINVAL;
 
-    ret = tty_port_install(port, driver, tty);
-    if (ret) {
-        kfree(port);
-        return ret;
+    local_vttydev = (struct vtty_dev *) dev_get_drvdata(dev);
+
+    mutex_lock(&local_vttydev->lock);
+    if((persona->packet_size != 0) && !kfifo_initialized(&local_vttydev->rx_fifo)) {
+        ret = kfifo_alloc(&local_vttydev->rx_fifo, SP_PERSONA_FIFO_SIZE, GFP_KERNEL);
+        if(ret < 0) {
+            mutex_unlock(&local_vttydev->lock);
+            return ret;
+        }
     }
 
-    return 0;
+    if((persona->packet_size == 0) && local_vttydev->own_tty && local_vttydev->own_tty->port)
+        tty = tty_port_tty_get(local_vttydev->own_tty->port);
+
+    spin_lock_irqsave(&local_vttydev->rx_lock, flags);
+    if((persona->packet_size == 0) && kfifo_initialized(&local_vttydev->rx_fifo)) {
+        /* Hand over staged data before leaving packet mode, data delivered directly from now on must
+         * not overtake it; lost if receiving end is closed */
+        while((num = kfifo_out(&local_vttydev->rx_fifo, packet, sizeof(packet))) > 0) {
+            if(tty != NULL)
+                tty_insert_flip_string(tty->port, packet, num);
+        }
+    }
+    local_vttydev->persona = persona;
+    local_vttydev->latency = persona->latency_ms;
+    spin_unlock_irqrestore(&local_vttydev->rx_lock, flags);
+    mutex_unlock(&local_vttydev->lock);
+
+    if(tty != NULL) {
+        tty_flip_buffer_push(tty->port);
+        tty_kref_put(tty);
+    }
+
+    /* Deliver anything staged as per new personality */
+    mod_delayed_work(system_wq, &local_vttydev->rx_work, 0);
+
+    return count;
 }
 
 /*
- * Invoked when there exist no user process or tty is to be released explicitly for whatever reason.
+ * Gives name of USB-UART bridge being emulated.
  *
- * @tty: the tty being destroyed.
+ * $ cat /sys/devices/virtual/tty/tty2com1/personality
+ *
+ * @dev: tty device
+ * @attr: sysfs attributes
+ * @buf: memory where result of invoking this function will be returned to caller.
+ *
+ * @return name of personality on success otherwise negative error code.
  */
-static void sp_cleanup(struct tty_struct *tty)
+static ssize_t sp_personality_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    tty_port_put(tty->port);
+    struct vtty_dev *local_vttydev = (struct vtty_dev *) dev_get_drvdata(dev);
+
+    if(!buf)
+        return -EINVAL;
+
+    return sprintf(buf, "%s\n", local_vttydev->persona->name);
 }
 
 /*
- * Invoked when open() is called on a serial port's device node. The tty layer will allocate a 
- * 'struct tty_struct' for this device and setup various structures and line disc and call this 
- * function.
- * 
- * When a tty device file (/dev/ttyXX) is opened, tty core finds the tty device driver serving this
- * device file and the index in this driver for this device file (now kernel device). The tty core
- * then checks if tty structure have been already allocated for this or not. If not allocated, 
- * allocation happens otherwise a re-open happens.
- * 
- * If the same serial port is opened more than once, the tty structure passed to this function will 
- * be same but filp structure will be different every time. Caller holds tty lock.
- * 
- * @tty: tty structure corresponding to filp file.
- * @filp: file pointer for handle to tty.
- * 
- * @return 0 on success or negative error code on failure.
+ * Sets latency timer (in milliseconds, 1 to 255) of emulated USB-UART bridge. A partial packet is
+ * given to application when this much time has elapsed since last packet.
+ *
+ * $ echo 2 > /sys/devices/virtual/tty/tty2com1/latency
+ *
+ * @dev: device associated with given sysfs entry
+ * @attr: sysfs attribute corresponding to this function
+ * @buf: latency value
+ * @count: number of characters in buf
+ *
+ * @return number of bytes consumed from buf on success or negative error code on error
  */
-static int sp_open(struct tty_struct *tty, struct file *filp)
-{    
+static ssize_t sp_latency_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
     int ret = 0;
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
-    struct vtty_dev *remote_vttydev = NULL;
-
-    local_vttydev->own_tty = tty;
-
-    /* If this device is one end of a null modem connection, provide its address to remote end */
-    if (tty->index != local_vttydev->peer_index) {
-        remote_vttydev = index_manager[local_vttydev->peer_index].vttydev;
-        remote_vttydev->peer_tty = tty;
-    }
-
-    memset(&local_vttydev->serial, 0, sizeof(struct serial_struct));
-    memset(&local_vttydev->icount, 0, sizeof(struct async_icount));
+    unsigned int latency = 0;
+    unsigned long flags;
+    struct vtty_dev *local_vttydev = NULL;
 
-    /* Handle DTR raising logic ourselve instead of tty_port helpers doing it. */
-    if (local_vttydev->set_odtr_at_open == 1) {
-        sp_update_modem_lines(tty, TIOCM_DTR | TIOCM_RTS, 0);
-    }
+    if(!buf || (count <= 0))
+        return -EINVAL;
 
-    /* Associate tty with port and do port level opening. */
-    ret = tty_port_open(tty->port, tty, filp);
-    if (ret < 0) 
+    ret = kstrtouint(buf, 10, &latency);
+    if(ret != 0)
         return ret;
+    if((latency < SP_PERSONA_MIN_LATENCY) || (latency > SP_PERSONA_MAX_LATENCY))
+        return -EINVAL;
 
-    tty->port->close_delay  = 0;
-    tty->port->closing_wait = ASYNC_CLOSING_WAIT_NONE;
-    tty->port->drain_delay  = 0;
+    local_vttydev = (struct vtty_dev *) dev_get_drvdata(dev);
+    if(local_vttydev->persona->packet_size == 0)
+        return -EPERM;
 
-    return ret;
+    spin_lock_irqsave(&local_vttydev->rx_lock, flags);
+    local_vttydev->latency = latency;
+    spin_unlock_irqrestore(&local_vttydev->rx_lock, flags);
+
+    return count;
 }
 
 /*
- * Invoked by tty layer when release() is called on the file pointer that was previously created with a 
- * call to open().
- * 
- * @tty: tty structure corresponding to filp file.
- * @filp: file pointer for handle to tty.
- * 
- * @return 0 on success or negative error code on failure.
+ * Gives latency timer value in milliseconds of emulated USB-UART bridge.
+ *
+ * $ cat /sys/devices/virtual/tty/tty2com1/latency
+ *
+ * @dev: tty device
+ * @attr: sysfs attributes
+ * @buf: memory where result of invoking this function will be returned to caller.
+ *
+ * @return latency timer value on success otherwise negative error code.
  */
-static void sp_close(struct tty_struct *tty, struct file *filp)
+static ssize_t sp_latency_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    if(test_bit(TTY_IO_ERROR, &tty->flags))
-        return;
+    struct vtty_dev *local_vttydev = (struct vtty_dev *) dev_get_drvdata(dev);
 
-    if(tty && filp && tty->port && (tty->port->count > 0))
-        tty_port_close(tty->port, tty, filp);
+    if(!buf)
+        return -EINVAL;
 
-    if(tty && C_HUPCL(tty) && tty->port && (tty->port->count < 1))
-        sp_update_modem_lines(tty, 0, TIOCM_DTR | TIOCM_RTS);
+    return sprintf(buf, "%u\n", local_vttydev->latency);
 }
 
-/* 
- * Invoked by tty layer via the line discipline when data is to be sent to tty device may be 
- * as a response to write() call in user space. The data bytes are inserted into the tty buffer and get
- * scheduled to be sent to receiver. This function will construct correct UART frame before sending.
- * 
- * @tty: tty device who will send given data.
- * @buf: data to be sent.
- * @count: number of data bytes in buf.
- * 
- * @return number of characters sent or negative error code on failure.
+/*
+ * Binds a loop back device to a real tty device, for example /dev/ttyUSB0, or unbinds it when "none"
+ * is written. Data, modem control/status lines and line settings are then relayed between the two
+ * inside the kernel while faulty cable, personality and timestamp features keep working on received
+ * data. Device type (odevtyp) becomes RLY while bound.
+ *
+ * $ echo /dev/ttyUSB0 > /sys/devices/virtual/tty/tty2com2/relay
+ *
+ * @dev: device associated with given sysfs entry
+ * @attr: sysfs attribute corresponding to this function
+ * @buf: path of real tty device or none
+ * @count: number of characters in buf
+ *
+ * @return number of bytes consumed from buf on success or negative error code on error
  */
-static int sp_write(struct tty_struct *tty, const unsigned char *buf, int count)
+static ssize_t sp_relay_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    int x = 0;
-    unsigned char *data = NULL;
-    struct tty_struct *tty_to_write = NULL;
-    struct vtty_dev *rx_vttydev = NULL;
-    struct vtty_dev *tx_vttydev = index_manager[tty->index].vttydev;
-
-    if (tx_vttydev->tx_paused || !tty || tty->stopped || (count < 1) || !buf || tty->hw_stopped)
-        return 0;
+    int ret = 0;
+    char *path = NULL;
+    char data[SP_RELAY_PATH_LEN];
+    struct vtty_dev *local_vttydev = NULL;
 
-    if (tx_vttydev->is_break_on == 1) {
-        dev_dbg(tty->dev, "break condition is on !");
-        return -EIO;
-    }
+    if(!buf || (count <= 0) || (count >= SP_RELAY_PATH_LEN))
+        return -EINVAL;
 
-    if(tx_vttydev->faulty_cable == 1)
-        return count;
+    memcpy(data, buf, count);
+    data[count] = '\0';
+    path = strim(data);
 
-    if (tty->index != tx_vttydev->peer_index) {
-        /* null modem */
-        tty_to_write = tx_vttydev->peer_tty;
-        rx_vttydev = index_manager[tx_vttydev->peer_index].vttydev;
+    local_vttydev = (struct vtty_dev *) dev_get_drvdata(dev);
 
-        if((tx_vttydev->baud != rx_vttydev->baud) || (tx_vttydev->uart_frame != rx_vttydev->uart_frame)) {
-            /* Emulate data sent but not received */
-            dev_dbg(tty->dev, "mismatched serial port settings !");
-            tx_vttydev->icount.tx++;
-            return count;
-        }
-    }
-    else {
-        /* loop back */
-        tty_to_write = tty;
-        rx_vttydev = tx_vttydev;
+    if(sysfs_streq(path, "none")) {
+        sp_relay_unbind(local_vttydev);
+        return count;
     }
 
-    if (tty_to_write != NULL) {
-
-        /* The UART hardware receiver samples received electrical signals at the middle of a bit in uart frame.
-         * Emulate correct number/size of data bits and hence uart frame. */
-        if((tty_to_write->termios.c_cflag & CSIZE) == CS8) {
-            data = (unsigned char *)buf;
-        }
-        else {
-            data = (unsigned char *) kcalloc(count, sizeof(unsigned char), GFP_KERNEL);
-            if(data == NULL)
-                return -ENOMEM;
-
-            switch (tty_to_write->termios.c_cflag & CSIZE) {
-            case CS7:
-                for(x=0; x < count; x++) {
-                    data[x] = buf[x] & 0x7F;
-                }
-                break;
-            case CS6:
-                for(x=0; x < count; x++) {
-                    data[x] = buf[x] & 0x3F;
-                }
-                break;
-            case CS5:
-                for(x=0; x < count; x++) {
-                    data[x] = buf[x] & 0x1F;
-                }
-                break;
-            default:
-                data = (unsigned char *)buf;
-            }
-        }
-
-        tty_insert_flip_string(tty_to_write->port, data, count);
-        tty_flip_buffer_push(tty_to_write->port);
-        tx_vttydev->icount.tx++;
-        rx_vttydev->icount.rx++;
-
-        if(data != buf)
-            kfree(data);
-    }else {
-        /* Other end is still not opened, emulate transmission from local end
-           but don't make other end receive it as is the case in real world. */
-        tx_vttydev->icount.tx++;
-    }
+    ret = sp_relay_bind(local_vttydev, path);
+    if(ret < 0)
+        return ret;
 
     return count;
 }
 
 /*
- * Invoked by tty layer when a single character is to be sent to the tty device. This character may be
- * ignored if there is no room in the device for the character to be sent.
+ * Gives path of real tty device this device is relayed to or none.
  *
- * @tty: tty device who will send given data.
- * @buf: data to be sent.
- * @count: number of data bytes in buf.
+ * $ cat /sys/devices/virtual/tty/tty2com2/relay
  *
- * @return number of characters sent or negative error code on failure.
+ * @dev: tty device
+ * @attr: sysfs attributes
+ * @buf: memory where result of invoking this function will be returned to caller.
+ *
+ * @return path on success otherwise negative error code.
  */
-static int sp_put_char(struct tty_struct *tty, unsigned char ch)
+static ssize_t sp_relay_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    unsigned char data;
-    struct tty_struct *tty_to_write = NULL;
-    struct vtty_dev *rx_vttydev = NULL;
-    struct vtty_dev *tx_vttydev = index_manager[tty->index].vttydev;
-
-    if (tx_vttydev->tx_paused || !tty || tty->stopped || tty->hw_stopped)
-        return 0;
-
-    if (tx_vttydev->is_break_on == 1)
-        return -EIO;
-
-    if(tx_vttydev->faulty_cable == 1)
-        return 1;
+    ssize_t ret = 0;
+    struct vtty_dev *local_vttydev = (struct vtty_dev *) dev_get_drvdata(dev);
 
-    if (tty->index != tx_vttydev->peer_index) {
-        tty_to_write = tx_vttydev->peer_tty;
-        rx_vttydev = index_manager[tx_vttydev->peer_index].vttydev;
-        if((tx_vttydev->baud != rx_vttydev->baud) || (tx_vttydev->uart_frame != rx_vttydev->uart_frame)) {
-            tx_vttydev->icount.tx++;
-            return 1;
-        }
-    }
-    else {
-        tty_to_write = tty;
-        rx_vttydev = tx_vttydev;
-    }
+    if(!buf)
+        return -EINVAL;
 
-    if(tty_to_write != NULL) {
-        switch (tty_to_write->termios.c_cflag & CSIZE) {
-        case CS8:
-            data = ch;
-            break;
-        case CS7:
-            data = ch & 0x7F;
-            break;
-        case CS6:
-            data = ch & 0x3F;
-            break;
-        case CS5:
-            data = ch & 0x1F;
-            break;
-        default:
-            data = ch;
-        }
-        tty_insert_flip_string(tty_to_write->port, &data, 1);
-        tty_flip_buffer_push(tty_to_write->port);
-        tx_vttydev->icount.tx++;
-        rx_vttydev->icount.rx++;
-    }else {
-        tx_vttydev->icount.tx++;
-    }
+    mutex_lock(&local_vttydev->relay_mutex);
+    if(local_vttydev->relay != NULL)
+        ret = sprintf(buf, "%s\n", local_vttydev->relay->path);
+    else
+        ret = sprintf(buf, "none\n");
+    mutex_unlock(&local_vttydev->relay_mutex);
 
-    return 1;
+    return ret;
 }
 
 /*
- * Invoked by tty layer indicating that the driver should inform tty device to start transmitting data out
- * of serial port physically. This tty device already transmit data as soon as it receive it.
+ * Executes ioctl on the real tty with a kernel space argument.
  *
- * @tty: tty device who should start transmission.
+ * @relay: relay whose real tty is to be operated upon.
+ * @cmd: ioctl command.
+ * @arg: pointer to kernel memory or value as required by command.
+ *
+ * @return as returned by real tty's ioctl handler.
  */
-static void sp_flush_chars(struct tty_struct *tty)
+static long sp_relay_ioctl(struct sp_relay *relay, unsigned int cmd, unsigned long arg)
 {
+    long ret = 0;
+    mm_segment_t oldfs = get_fs();
+
+    if(!relay->filp->f_op->unlocked_ioctl)
+        return -ENOTTY;
+
+    set_fs(KERNEL_DS);
+    ret = relay->filp->f_op->unlocked_ioctl(relay->filp, cmd, arg);
+    set_fs(oldfs);
+
+    return ret;
 }
 
 /*
- * Provides port specific information to the caller as a result of executing  TIOCGSERIAL
- * ioctl command.
+ * Opens the real tty, puts it in raw mode with 100 ms read timeout and starts relay threads.
  *
- * @tty: tty device associated with port in question.
- * @arg: user space buffer for returning information.
+ * @vttydev: loop back device to be bound.
+ * @path: path of the real tty device node.
  *
- * @return 0 on success otherwise a negative error code on failure.
+ * @return 0 on success or negative error code on failure.
  */
-static int sp_get_serial_info(struct tty_struct *tty, unsigned long arg)
+static int sp_relay_bind(struct vtty_dev *vttydev, const char *path)
 {
-    struct serial_struct info;
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
-    struct serial_struct serial = local_vttydev->serial;
+    int ret = 0;
+    unsigned long flags;
+    struct termios tios;
+    struct sp_relay *relay = NULL;
 
-    if (!arg)
-        return -EFAULT;
+    if(vttydev->own_index != vttydev->peer_index)
+        return -EPERM;
 
-    memset(&info, 0, sizeof(info));
+    mutex_lock(&vttydev->relay_mutex);
 
-    info.type           = PORT_UNKNOWN;
-    info.line           = serial.line;
-    info.port           = tty->index;
-    info.irq            = 0;
-    info.flags          = tty->port->flags;
-    info.xmit_fifo_size = 0;
-    info.baud_base      = 0;
-    info.close_delay    = tty->port->close_delay;
-    info.closing_wait   = tty->port->closing_wait;
-    info.custom_divisor = 0;
-    info.hub6           = 0;
-    info.io_type        = SERIAL_IO_MEM;
+    if(vttydev->relay != NULL) {
+        ret = -EBUSY;
+        goto fail_busy;
+    }
 
-    return (copy_to_user((void __user *)arg, &info, sizeof(struct serial_struct))) ? -EFAULT : 0;
+    relay = kzalloc(sizeof(struct sp_relay), GFP_KERNEL);
+    if(relay == NULL) {
+        ret = -ENOMEM;
+        goto fail_busy;
+    }
+    relay->vttydev = vttydev;
+    strlcpy(relay->path, path, SP_RELAY_PATH_LEN);
+    init_waitqueue_head(&relay->tx_wait);
+
+    ret = kfifo_alloc(&relay->tx_fifo, SP_RELAY_FIFO_SIZE, GFP_KERNEL);
+    if(ret < 0)
+        goto fail_fifo;
+
+    relay->filp = filp_open(path, O_RDWR | O_NOCTTY, 0);
+    if(IS_ERR(relay->filp)) {
+        ret = PTR_ERR(relay->filp);
+        goto fail_open;
+    }
+
+    /* Relaying to one of our own devices would make tty locks nest */
+    if(imajor(file_inode(relay->filp)) == spvtty_driver->major) {
+        ret = -EINVAL;
+        goto fail_tty;
+    }
+
+    ret = sp_relay_ioctl(relay, TCGETS, (unsigned long) &tios);
+    if(ret < 0) {
+        ret = -ENOTTY;
+        goto fail_tty;
+    }
+    tios.c_iflag = 0;
+    tios.c_oflag = 0;
+    tios.c_lflag = 0;
+    tios.c_cflag |= CREAD | CLOCAL;
+    tios.c_cc[VMIN]  = 0;
+    tios.c_cc[VTIME] = 1;
+    ret = sp_relay_ioctl(relay, TCSETS, (unsigned long) &tios);
+    if(ret < 0)
+        goto fail_tty;
+
+    relay->rx_thread = kthread_run(sp_relay_rx_thread, relay, "sp_relay_rx/%u", vttydev->own_index);
+    if(IS_ERR(relay->rx_thread)) {
+        ret = PTR_ERR(relay->rx_thread);
+        goto fail_tty;
+    }
+    relay->tx_thread = kthread_run(sp_relay_tx_thread, relay, "sp_relay_tx/%u", vttydev->own_index);
+    if(IS_ERR(relay->tx_thread)) {
+        ret = PTR_ERR(relay->tx_thread);
+        goto fail_thread;
+    }
+
+    spin_lock_irqsave(&vttydev->relay_lock, flags);
+    relay->saved_odevtyp = vttydev->odevtyp;
+    vttydev->relay = relay;
+    vttydev->odevtyp = RLY;
+    spin_unlock_irqrestore(&vttydev->relay_lock, flags);
+
+    mutex_unlock(&vttydev->relay_mutex);
+    return 0;
+
+    fail_thread:
+    kthread_stop(relay->rx_thread);
+    fail_tty:
+    filp_close(relay->filp, NULL);
+    fail_open:
+    kfifo_free(&relay->tx_fifo);
+    fail_fifo:
+    kfree(relay);
+    fail_busy:
+    mutex_unlock(&vttydev->relay_mutex);
+    return ret;
 }
 
 /*
- * Return the number of bytes that can be queued to this device at the present time. The result should be
- * treated as a guarantee and the driver cannot offer a value it later shrinks by more than the number of
- * bytes written.
- *
- * @tty: tty device enquired.
+ * Stops relay threads and closes the real tty. Data not yet written to real tty is discarded.
  *
- * @return number of bytes that can be queued to this device at the present time.
+ * @vttydev: device to be unbound, nothing is done if it is not bound.
  */
-static int sp_write_room(struct tty_struct *tty)
+static void sp_relay_unbind(struct vtty_dev *vttydev)
 {
-    struct vtty_dev *tx_vttydev = index_manager[tty->index].vttydev;
+    unsigned long flags;
+    struct sp_relay *relay = NULL;
 
-    if (tx_vttydev->tx_paused || !tty || tty->stopped || tty->hw_stopped)
-        return 0;
+    mutex_lock(&vttydev->relay_mutex);
 
-    return 2048;
+    spin_lock_irqsave(&vttydev->relay_lock, flags);
+    relay = vttydev->relay;
+    if(relay != NULL) {
+        vttydev->relay = NULL;
+        vttydev->odevtyp = relay->saved_odevtyp;
+    }
+    spin_unlock_irqrestore(&vttydev->relay_lock, flags);
+
+    if(relay != NULL) {
+        kthread_stop(relay->rx_thread);
+        /* Let a write blocked due to flow control on real tty return */
+        sp_relay_ioctl(relay, TCFLSH, TCOFLUSH);
+        sp_relay_ioctl(relay, TCXONC, TCOON);
+        kthread_stop(relay->tx_thread);
+        filp_close(relay->filp, NULL);
+        kfifo_free(&relay->tx_fifo);
+        kfree(relay);
+    }
+
+    mutex_unlock(&vttydev->relay_mutex);
 }
 
 /*
- * Invoked when the termios structure (terminal settings) for this tty device is changed. The old_termios
- * contains currently active settings and tty->termios contains new settings to be applied.
+ * Reads data from real tty and delivers it to virtual device; also reflects modem status lines of
+ * real tty on virtual device. Read returns at least every 100 ms so status is sampled as often.
  *
- * @tty: tty device whose line settings is to be updated.
- * @old_termios: currently applied serial line settings.
+ * @data: relay this thread serves.
+ *
+ * @return 0 when stopped.
  */
-static void sp_set_termios(struct tty_struct *tty, struct ktermios *old_termios)
+static int sp_relay_rx_thread(void *data)
 {
-    u32 baud = 0;
-    int uart_frame_settings = 0;
-    unsigned int rts_mappings = 0;
-    unsigned int dtr_mappings = 0;
-    unsigned int mask = TIOCM_DTR;
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
-    struct vtty_dev *remote_vttydev = NULL;
+    int ret = 0;
+    int tiocm = 0;
+    int old_tiocm = 0;
+    int msr = 0;
+    int wakeup_open = 0;
+    struct async_icount delta;
+    struct tty_struct *tty = NULL;
+    unsigned char buf[256];
+    struct sp_relay *relay = data;
+    struct vtty_dev *vttydev = relay->vttydev;
+
+    sp_relay_ioctl(relay, TIOCMGET, (unsigned long) &old_tiocm);
+    old_tiocm = ~old_tiocm;
+
+    while(!kthread_should_stop()) {
+        ret = kernel_read(relay->filp, 0, buf, sizeof(buf));
+        if(ret > 0) {
+            tty = NULL;
+            if (vttydev->own_tty && vttydev->own_tty->port)
+                tty = tty_port_tty_get(vttydev->own_tty->port);
+            if(tty != NULL) {
+                sp_deliver_rx(tty, vttydev, buf, ret);
+                vttydev->icount.rx++;
+                tty_kref_put(tty);
+            }
+        }else if(((ret < 0) && (ret != -EAGAIN) && (ret != -EINTR)) || tty_hung_up_p(relay->filp)) {
+            /* Real device went away or failed (hung up tty reads 0 at once), wait till we are unbound */
+            msleep_interruptible(100);
+            continue;
+        }
 
-    rts_mappings = local_vttydev->rts_mappings;
-    dtr_mappings = local_vttydev->dtr_mappings;
+        if(sp_relay_ioctl(relay, TIOCMGET, (unsigned long) &tiocm) < 0) {
+            msleep_interruptible(100);
+            continue;
+        }
+        if(tiocm == old_tiocm)
+            continue;
+
+        memset(&delta, 0, sizeof(struct async_icount));
+        delta.cts = ((tiocm ^ old_tiocm) & TIOCM_CTS) ? 1 : 0;
+        delta.dsr = ((tiocm ^ old_tiocm) & TIOCM_DSR) ? 1 : 0;
+        delta.dcd = ((tiocm ^ old_tiocm) & TIOCM_CAR) ? 1 : 0;
+        delta.rng = ((tiocm ^ old_tiocm) & TIOCM_RNG) ? 1 : 0;
+        wakeup_open = ((tiocm & TIOCM_CAR) && !(old_tiocm & TIOCM_CAR)) ? 1 : 0;
+        msr = ((tiocm & TIOCM_CTS) ? SP_MSR_CTS : 0) | ((tiocm & TIOCM_DSR) ? SP_MSR_DSR : 0) |
+                ((tiocm & TIOCM_CAR) ? SP_MSR_DCD : 0) | ((tiocm & TIOCM_RNG) ? SP_MSR_RI : 0);
+        old_tiocm = tiocm;
+
+        sp_change_msr(vttydev, msr, &delta, wakeup_open);
+    }
 
-    if(tty->index != local_vttydev->peer_index)
-        remote_vttydev = index_manager[local_vttydev->peer_index].vttydev;
+    return 0;
+}
 
-    mutex_lock(&local_vttydev->lock);
+/*
+ * Writes data queued by application on virtual device to real tty.
+ *
+ * @data: relay this thread serves.
+ *
+ * @return 0 when stopped.
+ */
+static int sp_relay_tx_thread(void *data)
+{
+    int ret = 0;
+    int failed = 0;
+    unsigned int num = 0;
+    unsigned int done = 0;
+    struct tty_struct *tty = NULL;
+    unsigned char buf[256];
+    struct sp_relay *relay = data;
+    struct vtty_dev *vttydev = relay->vttydev;
+
+    while(!kthread_should_stop()) {
+        wait_event_interruptible(relay->tx_wait, kthread_should_stop() || !kfifo_is_empty(&relay->tx_fifo));
+
+        while(!kthread_should_stop()) {
+            num = kfifo_out_spinlocked(&relay->tx_fifo, buf, sizeof(buf), &vttydev->relay_lock);
+            if(num == 0)
+                break;
 
-    /* Typically B0 is used to terminate the connection. Drop RTS and DTR. */
-    if ((tty->termios.c_cflag & CBAUD) == B0 ) {
-        sp_update_modem_lines(tty, 0, TIOCM_DTR | TIOCM_RTS);
-        mutex_unlock(&local_vttydev->lock);
-        return;
-    }
+            /* Write whole chunk, a blocking write comes back short only if interrupted */
+            done = 0;
+            while((done < num) && !kthread_should_stop()) {
+                ret = kernel_write(relay->filp, buf + done, num - done, 0);
+                if(ret > 0) {
+                    done += ret;
+                    failed = 0;
+                }else if((ret == -EAGAIN) || (ret == -EINTR) || (ret == 0)) {
+                    msleep_interruptible(10);
+                }else {
+                    /* Real device went away or failed, drop data till we are unbound */
+                    if(failed == 0)
+                        pr_warning("Can't write to %s (%d), dropping data\n", relay->path, ret);
+                    failed = 1;
+                    msleep_interruptible(100);
+                    break;
+                }
+            }
 
-    /* If coming out of B0, raise DTR and RTS. This might get overridden in next steps. Applications like
-     * minicom when opens a serial port, may drop speed to B0 and then back to normal speed again. */
-    if (!old_termios || (old_termios->c_cflag & CBAUD) == B0) {
-        if (!(tty->termios.c_cflag & CRTSCTS) || !test_bit(TTY_THROTTLED, &tty->flags)) {
-            mask |= TIOCM_RTS;
-            sp_update_modem_lines(tty, mask, 0);
+            /* Room got freed, let application write more */
+            tty = NULL;
+            if (vttydev->own_tty && vttydev->own_tty->port)
+                tty = tty_port_tty_get(vttydev->own_tty->port);
+            if(tty != NULL) {
+                tty_wakeup(tty);
+                tty_kref_put(tty);
+            }
         }
     }
 
-    baud = tty_get_baud_rate(tty);
-    if (!baud) {
-        baud = 9600;
-    }
-    tty_encode_baud_rate(tty, baud, baud);
+    return 0;
+}
 
-    local_vttydev->baud = baud;
+/*
+ * Queues data written by application on relayed virtual device for transmission to real tty.
+ *
+ * @vttydev: relayed virtual device.
+ * @buf: data to be sent.
+ * @count: number of bytes in buf.
+ *
+ * @return number of bytes queued.
+ */
+static int sp_relay_write(struct vtty_dev *vttydev, const unsigned char *buf, int count)
+{
+    int done = 0;
+    unsigned long flags;
 
-    if (tty->termios.c_cflag & CRTSCTS) {
-        uart_frame_settings |= SP_CRTSCTS;
-    }else if((tty->termios.c_iflag & IXON) || (tty->termios.c_iflag & IXOFF)) {
-        uart_frame_settings |= SP_XON;
-    }else {
-        uart_frame_settings |= SP_NONE;
+    spin_lock_irqsave(&vttydev->relay_lock, flags);
+    if(vttydev->relay != NULL) {
+        done = kfifo_in(&vttydev->relay->tx_fifo, buf, count);
+        wake_up_interruptible(&vttydev->relay->tx_wait);
     }
+    spin_unlock_irqrestore(&vttydev->relay_lock, flags);
 
-    switch (tty->termios.c_cflag & CSIZE) {
-    case CS8: uart_frame_settings |= SP_DATA_8;
-    case CS7: uart_frame_settings |= SP_DATA_7;
-    case CS6: uart_frame_settings |= SP_DATA_6;
-    case CS5: uart_frame_settings |= SP_DATA_5;
-    default:  uart_frame_settings |= SP_DATA_8;
-    }
+    if(done > 0)
+        vttydev->icount.tx++;
 
-    if (tty->termios.c_cflag & CSTOPB)
-        uart_frame_settings |= SP_STOP_2;
-    else
-        uart_frame_settings |= SP_STOP_1;
+    return done;
+}
 
-    if (tty->termios.c_cflag & PARENB) {
-        if (tty->termios.c_cflag & CMSPAR) {
-            if (tty->termios.c_cflag & PARODD)
-                uart_frame_settings |= SP_PARITY_MARK;
-            else
-                uart_frame_settings |= SP_PARITY_SPACE;
-        }else {
-            if (tty->termios.c_cflag & PARODD)
-                uart_frame_settings |= SP_PARITY_ODD;
-            else
-                uart_frame_settings |= SP_PARITY_EVEN;
-        }
-    }else {
-        uart_frame_settings |= SP_PARITY_NONE;
+/*
+ * Sets/clears DTR and RTS of the real tty as asked by application on relayed virtual device.
+ * Caller holds the lock associated with the virtual device.
+ *
+ * @vttydev: relayed virtual device.
+ * @set: bit mask of signals which should be asserted
+ * @clear: bit mask of signals which should be de-asserted
+ *
+ * @return 0 on success otherwise negative error code.
+ */
+static int sp_relay_modem_lines(struct vtty_dev *vttydev, unsigned int set, unsigned int clear)
+{
+    int ret = 0;
+    int bits = 0;
+
+    mutex_lock(&vttydev->relay_mutex);
+    if(vttydev->relay == NULL) {
+        mutex_unlock(&vttydev->relay_mutex);
+        return 0;
     }
 
-    local_vttydev->uart_frame = uart_frame_settings;
+    bits = set & (TIOCM_DTR | TIOCM_RTS);
+    if(bits)
+        ret = sp_relay_ioctl(vttydev->relay, TIOCMBIS, (unsigned long) &bits);
+    bits = clear & (TIOCM_DTR | TIOCM_RTS);
+    if(bits && (ret == 0))
+        ret = sp_relay_ioctl(vttydev->relay, TIOCMBIC, (unsigned long) &bits);
+
+    if(ret == 0) {
+        if(set & TIOCM_DTR)
+            vttydev->mcr_reg |= SP_MCR_DTR;
+        if(set & TIOCM_RTS)
+            vttydev->mcr_reg |= SP_MCR_RTS;
+        if(clear & TIOCM_DTR)
+            vttydev->mcr_reg &= ~SP_MCR_DTR;
+        if(clear & TIOCM_RTS)
+            vttydev->mcr_reg &= ~SP_MCR_RTS;
+    }
 
-    mutex_unlock(&local_vttydev->lock);
+    mutex_unlock(&vttydev->relay_mutex);
+    return ret;
 }
 
 /*
- * Return the number of bytes of data in the device private output queue to be sent out. Invoked 
- * when ioctl command TIOCOUTQ is executed or by tty layer as and when required (tty_wait_until_sent()).
+ * Applies baud rate, data bits, stop bits, parity and hardware flow control set by application on
+ * relayed virtual device to the real tty, keeping the real tty in raw mode.
+ * Caller holds the lock associated with the virtual device.
  *
- * @tty: tty device enquired.
- *
- * @return number of bytes of data in the device private output queue.
+ * @vttydev: relayed virtual device.
+ * @termios: settings of virtual device.
  */
-static int sp_chars_in_buffer(struct tty_struct *tty)
+static void sp_relay_set_termios(struct vtty_dev *vttydev, struct ktermios *termios)
 {
-    return 0;
+    struct termios tios;
+    tcflag_t mask = CBAUD | CBAUDEX | CSIZE | CSTOPB | PARENB | PARODD | CMSPAR | CRTSCTS;
+
+    mutex_lock(&vttydev->relay_mutex);
+    if(vttydev->relay != NULL) {
+        if(sp_relay_ioctl(vttydev->relay, TCGETS, (unsigned long) &tios) == 0) {
+            tios.c_cflag = (tios.c_cflag & ~mask) | (termios->c_cflag & mask) | CREAD | CLOCAL;
+            if(sp_relay_ioctl(vttydev->relay, TCSETS, (unsigned long) &tios) < 0)
+                pr_warning("Can't apply line settings to %s\n", vttydev->relay->path);
+        }
+    }
+    mutex_unlock(&vttydev->relay_mutex);
 }
 
 /*
- * Checks if any of the given signal line has changed based on interrupts.
+ * Records a hotplug transition of the given device with current monotonic time.
  *
- * @local_vttydev: vtty device for which check has to be made.
- * @mask: bit mask of TIOCM_RNG, TIOCM_DSR, TIOCM_CAR and TIOCM_CTS.
- * @prev: values of previous interrupts
- *.
- * @return 1 if changed otherwise 0 if unchanged.
+ * @vttydev: device which got unplugged or replugged.
+ * @type: 'U' for unplug and 'R' for replug.
  */
-static int sp_check_msr_delta(struct tty_struct *tty, struct vtty_dev *local_vttydev, unsigned long mask, struct async_icount *prev)
+static void sp_hotplug_record(struct vtty_dev *vttydev, char type)
 {
-    struct async_icount now;
-    int delta = 0;
-
-    /* Use tty-port initialised flag to detect all hangups including the disconnect(device destroy) event */
-    if (!test_bit(ASYNCB_INITIALIZED, &tty->port->flags))
-        return 1;
-
-    mutex_lock(&local_vttydev->lock);
-    now = local_vttydev->icount;
-    mutex_unlock(&local_vttydev->lock);
-    delta = ((mask & TIOCM_RNG && prev->rng != now.rng) ||
-            ( mask & TIOCM_DSR && prev->dsr != now.dsr) ||
-            ( mask & TIOCM_CAR && prev->dcd != now.dcd) ||
-            ( mask & TIOCM_CTS && prev->cts != now.cts));
-
-    *prev = now;
-    return delta;
+    unsigned long flags;
+    struct sp_hp_event *evt = NULL;
+
+    spin_lock_irqsave(&vttydev->hp_lock, flags);
+    evt = &vttydev->hp_trace[vttydev->hp_tnext % SP_HP_TRACE_LEN];
+    evt->type = type;
+    evt->tstamp = ktime_to_ns(ktime_get());
+    vttydev->hp_tnext++;
+    spin_unlock_irqrestore(&vttydev->hp_lock, flags);
 }
+
 /*
- * Sleeps until at-least one of the modem lines changes.
- *
- * @tty: tty device whose modem lines is to be monitored.
- * @mask: bit mask of TIOCM_RNG, TIOCM_DSR, TIOCM_CAR and TIOCM_CTS.
+ * Performs one step of hotplug emulation; alternately unplugs and replugs the device and schedules
+ * itself for the next step until requested number of cycles are done.
  *
- * @return -ERESTARTSYS if it was interrupted by a signal and 0 if modem line changed.
+ * @work: hotplug work item embedded in the virtual tty device.
  */
-static int sp_wait_msr_change(struct tty_struct *tty, unsigned long mask)
+static void sp_hotplug_work(struct work_struct *work)
 {
     int ret = 0;
-    struct async_icount prev;
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    int again = 0;
+    unsigned long flags;
+    struct vtty_dev *vttydev = container_of(to_delayed_work(work), struct vtty_dev, hp_work);
 
-    mutex_lock(&local_vttydev->lock);
-    local_vttydev->waiting_msr_chg = 1;
-    prev = local_vttydev->icount;
-    mutex_unlock(&local_vttydev->lock);
+    /* Device destroy path holds adaptlock while cancelling this work, so do not sleep on it. */
+    if(!mutex_trylock(&adaptlock)) {
+        schedule_delayed_work(&vttydev->hp_work, 1);
+        return;
+    }
 
-    ret = wait_event_interruptible(tty->port->delta_msr_wait, sp_check_msr_delta(tty, local_vttydev, mask, &prev));
+    if(vttydev->unplugged == 0) {
+        spin_lock_irqsave(&vttydev->hp_lock, flags);
+        if(vttydev->hp_remaining > 0) {
+            vttydev->hp_remaining--;
+            again = 1;
+        }else {
+            vttydev->hp_active = 0;
+        }
+        spin_unlock_irqrestore(&vttydev->hp_lock, flags);
 
-    local_vttydev->waiting_msr_chg = 0;
+        if(again) {
+            sp_unregister_vttydev(vttydev);
+            sp_hotplug_record(vttydev, 'U');
+        }
+    }else {
+        /* Old tty has not been released yet, try replugging a bit later. */
+        if(vttydev->own_tty != NULL) {
+            schedule_delayed_work(&vttydev->hp_work, msecs_to_jiffies(SP_HP_RELEASE_POLL));
+            mutex_unlock(&adaptlock);
+            return;
+        }
 
-    if (!ret && !test_bit(ASYNCB_INITIALIZED, &tty->port->flags))
-        ret = -EIO;
+        ret = sp_register_vttydev(vttydev);
+        spin_lock_irqsave(&vttydev->hp_lock, flags);
+        if(ret < 0) {
+            vttydev->hp_remaining = 0;
+        }else {
+            vttydev->hp_cycles++;
+        }
+        if(vttydev->hp_remaining > 0)
+            again = 1;
+        else
+            vttydev->hp_active = 0;
+        spin_unlock_irqrestore(&vttydev->hp_lock, flags);
 
-    return ret;
+        if(ret < 0)
+            pr_warning("Can't replug tty2com%u, error code: %d\n", vttydev->own_index, ret);
+        else
+            sp_hotplug_record(vttydev, 'R');
+    }
+
+    if(again)
+        schedule_delayed_work(&vttydev->hp_work, msecs_to_jiffies(vttydev->hp_interval));
+
+    mutex_unlock(&adaptlock);
 }
 
 /*
- * Invoked to execute standard and device/driver specific ioctl commands.
- *
- * If the requested command is not supported, this driver will return -ENOIOCTLCMD so that the tty layer
- * can invoke generic version of the givwn ioctl command if possible.
+ * Registers the given (previously unregistered) device with tty core and creates its sysfs files.
+ * Caller holds adaptlock.
  *
- * @tty: tty device for whom given ioctl command is to be executed.
- * @cmd: ioctl command to execute.
- * @arg: arguments accompanying the command.
+ * @vttydev: device to be made visible to the system.
  *
- * @return 0 on success otherwise a negative error code on failures.
+ * @return 0 on success or negative error code on failure.
  */
-static int sp_ioctl(struct tty_struct *tty, unsigned int cmd, unsigned long arg)
+static int sp_register_vttydev(struct vtty_dev *vttydev)
 {
-    switch (cmd) {
-    case TIOCGSERIAL:
-        return sp_get_serial_info(tty, arg);
-    case TIOCMIWAIT:
-        return sp_wait_msr_change(tty, arg);
+    int ret = 0;
+    struct device *device = NULL;
+
+    device = tty_register_device(spvtty_driver, vttydev->own_index, NULL);
+    if(IS_ERR(device))
+        return PTR_ERR(device);
+
+    vttydev->device = device;
+    dev_set_drvdata(device, vttydev);
+
+    ret = sysfs_create_group(&device->kobj, &sp_info_attr_group);
+    if(ret < 0) {
+        tty_unregister_device(spvtty_driver, vttydev->own_index);
+        vttydev->device = NULL;
+        return ret;
     }
 
-    return -ENOIOCTLCMD;
+    vttydev->unplugged = 0;
+    return 0;
 }
 
 /*
- * Invoked when tty layer's input buffers are about to get full.
- * 
- * When using RTS/CTS flow control, when RTS line is de-asserted, interrupt will be generated 
- * in hardware. The interrupt handler will raise a flag to indicate transmission should be stopped. 
- * This is achieved in this driver through tx_paused variable.
+ * Removes sysfs files of the given device, hangs up the application using it (if any) and unregisters
+ * it from tty core in the same way as a USB-UART device disappears when it is removed. The index and
+ * all settings are kept in index_manager. Caller holds adaptlock.
  *
- * @tty: tty device whose buffers are about to get full.
+ * @vttydev: device to be removed from the system.
  */
-static void sp_throttle(struct tty_struct *tty)
+static void sp_unregister_vttydev(struct vtty_dev *vttydev)
 {
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
-    struct vtty_dev *remote_vttydev = index_manager[local_vttydev->peer_index].vttydev;
+    struct tty_struct *tty = NULL;
 
-    if (tty->termios.c_cflag & CRTSCTS) {
-        mutex_lock(&local_vttydev->lock);
-        remote_vttydev->tx_paused = 1;
-        sp_update_modem_lines(tty, 0, TIOCM_RTS);
-        mutex_unlock(&local_vttydev->lock);
-    }
-    else if((tty->termios.c_iflag & IXON) || (tty->termios.c_iflag & IXOFF)) {
-        sp_put_char(tty, STOP_CHAR(tty));
-    }
-    else {
+    if(vttydev->unplugged == 1)
+        return;
+
+    sysfs_remove_group(&vttydev->device->kobj, &sp_info_attr_group);
+
+    if (vttydev->own_tty && vttydev->own_tty->port) {
+        tty = tty_port_tty_get(vttydev->own_tty->port);
+        if (tty) {
+            tty_vhangup(tty);
+            tty_kref_put(tty);
+        }
     }
+
+    /* Hangup detached all files, their close() returns early and must not be counted */
+    mutex_lock(&vttydev->lock);
+    vttydev->open_count = 0;
+    mutex_unlock(&vttydev->lock);
+
+    /* The hung up tty stays in tty core (and is reused by any open of this index) until application
+     * closes it; own_tty is cleared by sp_cleanup() when it is finally released. Index is kept reserved
+     * till then, replug waits for it as a USB-UART gets a new minor only after last close. */
+    if((vttydev->own_index != vttydev->peer_index) && (index_manager[vttydev->peer_index].index != -1))
+        index_manager[vttydev->peer_index].vttydev->peer_tty = NULL;
+
+    tty_unregister_device(spvtty_driver, vttydev->own_index);
+    vttydev->device = NULL;
+    vttydev->unplugged = 1;
 }
 
 /*
- * Invoked when the tty layer's input buffers have been emptied out, and it now can accept more data.
- *
- * Throttle/unthrottle is about notifying remote end to start or stop data as per the flow control.
+ * Stops all deferred work associated with the given device and frees it. Must be called after the
+ * device has been unregistered, so that nothing can schedule new work.
  *
- * Start/stop is about what action to take at local end itself to start or stop data as per the flow
- * control.
+ * @vttydev: device which is going to be destroyed.
+ */
+static void sp_free_vttydev(struct vtty_dev *vttydev)
+{
+    sp_relay_unbind(vttydev);
+    sp_filter_attach(vttydev, -1);
+    cancel_delayed_work_sync(&vttydev->hp_work);
+    cancel_delayed_work_sync(&vttydev->rx_work);
+    cancel_delayed_work_sync(&vttydev->msr_work);
+    kfifo_free(&vttydev->rx_fifo);
+    kfree(vttydev->rxts);
+    kfree(vttydev);
+}
+
+/* 
+ * Update modem control and modem status registers according to the bit mask(s) provided. The 
+ * DTR and RTS values can be set only if the current handshaking state of the tty device allows 
+ * direct control of the modem control lines. Update honours pin mappings.
  *
- * @tty: tty device which is ready to receive data.
+ * Caller holds the lock associated with the given tty's virtual tty info.
+ * 
+ * @tty: tty device whose modem control register is to be updated with given value(s)
+ * @set: bit mask of signals which should be asserted
+ * @clear: bit mask of signals which should be de-asserted
+ * 
+ * @return 0 on success otherwise negative error code on failure
  */
-static void sp_unthrottle(struct tty_struct *tty)
+static int sp_update_modem_lines(struct tty_struct *tty, unsigned int set, unsigned int clear)
 {
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
-    struct vtty_dev *remote_vttydev = index_manager[local_vttydev->peer_index].vttydev;
+    int ctsint = 0;
+    int dcdint = 0;
+    int dsrint = 0;
+    int rngint = 0;
+    int rts_mappings = 0;
+    int dtr_mappings = 0;
+    int mcr_ctrl_reg = 0;
+    int msr_state_reg = 0;
+    int wakeup_blocked_open = 0;
+    struct async_icount delta;
+    struct vtty_dev *vttydev = NULL;
+    struct vtty_dev *local_vttydev = NULL;
+    struct vtty_dev *remote_vttydev = NULL;
 
-    if (tty->termios.c_cflag & CRTSCTS) {
-        /* hardware (RTS/CTS) flow control */
-        mutex_lock(&local_vttydev->lock);
-        remote_vttydev->tx_paused = 0;
-        sp_update_modem_lines(tty, TIOCM_RTS, 0);
-        mutex_unlock(&local_vttydev->lock);
+    local_vttydev = index_manager[tty->index].vttydev;
 
-        if (remote_vttydev->own_tty && remote_vttydev->own_tty->port)
-            tty_port_tty_wakeup(remote_vttydev->own_tty->port);
-    }
-    else if((tty->termios.c_iflag & IXON) || (tty->termios.c_iflag & IXOFF)) {
-        /* software flow control */
-        sp_put_char(tty, START_CHAR(tty));
+    /* Modem control lines of a relayed device are those of the real device */
+    if(local_vttydev->odevtyp == RLY)
+        return sp_relay_modem_lines(local_vttydev, set, clear);
+    if(tty->index != local_vttydev->peer_index)
+        remote_vttydev = index_manager[local_vttydev->peer_index].vttydev;
+
+    /* Read modify write MSR register */
+    if(remote_vttydev != NULL) {
+        msr_state_reg = remote_vttydev->msr_reg;
+        vttydev = remote_vttydev;
     }
     else {
-        /* do nothing */
+        msr_state_reg = local_vttydev->msr_reg;
+        vttydev = local_vttydev;
+    }
+
+    rts_mappings = local_vttydev->rts_mappings;
+    dtr_mappings = local_vttydev->dtr_mappings;
+
+    if(set & TIOCM_RTS) {
+        mcr_ctrl_reg |= SP_MCR_RTS;
+        if((rts_mappings & SP_CON_CTS) == SP_CON_CTS) {
+            msr_state_reg |= SP_MSR_CTS;
+            ctsint++;
+        }
+        if((rts_mappings & SP_CON_DCD) == SP_CON_DCD) {
+            msr_state_reg |= SP_MSR_DCD;
+            dcdint++;
+            wakeup_blocked_open = 1;
+        }
+        if((rts_mappings & SP_CON_DSR) == SP_CON_DSR) {
+            msr_state_reg |= SP_MSR_DSR;
+            dsrint++;
+        }
+        if((rts_mappings & SP_CON_RI) == SP_CON_RI) {
+            msr_state_reg |= SP_MSR_RI;
+            rngint++;
+        }
+    }
+
+    if(set & TIOCM_DTR) {
+        mcr_ctrl_reg |= SP_MCR_DTR;
+        if((dtr_mappings & SP_CON_CTS) == SP_CON_CTS) {
+            msr_state_reg |= SP_MSR_CTS;
+            ctsint++;
+        }
+        if((dtr_mappings & SP_CON_DCD) == SP_CON_DCD) {
+            msr_state_reg |= SP_MSR_DCD;
+            dcdint++;
+            wakeup_blocked_open = 1;
+        }
+        if((dtr_mappings & SP_CON_DSR) == SP_CON_DSR) {
+            msr_state_reg |= SP_MSR_DSR;
+            dsrint++;
+        }
+        if((dtr_mappings & SP_CON_RI) == SP_CON_RI) {
+            msr_state_reg |= SP_MSR_RI;
+            rngint++;
+        }
+    }
+
+    if(clear & TIOCM_RTS) {
+        mcr_ctrl_reg &= ~SP_MCR_RTS;
+        if((rts_mappings & SP_CON_CTS) == SP_CON_CTS) {
+            msr_state_reg &= ~SP_MSR_CTS;
+            ctsint++;
+        }
+        if((rts_mappings & SP_CON_DCD) == SP_CON_DCD) {
+            msr_state_reg &= ~SP_MSR_DCD;
+            dcdint++;
+        }
+        if((rts_mappings & SP_CON_DSR) == SP_CON_DSR) {
+            msr_state_reg &= ~SP_MSR_DSR;
+            dsrint++;
+        }
+        if((rts_mappings & SP_CON_RI) == SP_CON_RI) {
+            msr_state_reg &= ~SP_MSR_RI;
+            rngint++;
+        }
+    }
+
+    if (clear & TIOCM_DTR) {
+        mcr_ctrl_reg &= ~SP_MCR_DTR;
+        if((dtr_mappings & SP_CON_CTS) == SP_CON_CTS) {
+            msr_state_reg &= ~SP_MSR_CTS;
+            ctsint++;
+        }
+        if((dtr_mappings & SP_CON_DCD) == SP_CON_DCD) {
+            msr_state_reg &= ~SP_MSR_DCD;
+            dcdint++;
+        }
+        if((dtr_mappings & SP_CON_DSR) == SP_CON_DSR) {
+            msr_state_reg &= ~SP_MSR_DSR;
+            dsrint++;
+        }
+        if((dtr_mappings & SP_CON_RI) == SP_CON_RI) {
+            msr_state_reg &= ~SP_MSR_RI;
+            rngint++;
+        }
     }
+
+    local_vttydev->mcr_reg = mcr_ctrl_reg;
+
+    memset(&delta, 0, sizeof(struct async_icount));
+    delta.cts = ctsint;
+    delta.dsr = dsrint;
+    delta.dcd = dcdint;
+    delta.rng = rngint;
+    sp_change_msr(vttydev, msr_state_reg, &delta, wakeup_blocked_open);
+
+    return 0;
 }
 
 /*
- * Invoked when this driver should stop sending data for example as a part of flow control mechanism.
- *
- * Line discipline n_tty calls this function if this device uses software flow control and an XOFF
- * character is received from other end.
+ * Updates modem status register of the given device and makes the change visible to application,
+ * either at once or later if an USB-UART personality is emulated.
  *
- * @tty: tty device who should stop sending data to other end.
+ * @vttydev: device whose modem status lines changed.
+ * @msr_state_reg: new value of modem status register.
+ * @delta: number of changes of each modem status line.
+ * @wakeup_blocked_open: 1 if carrier detect got raised.
  */
-static void sp_stop(struct tty_struct *tty)
+static void sp_change_msr(struct vtty_dev *vttydev, int msr_state_reg, struct async_icount *delta, int wakeup_blocked_open)
 {
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
-    mutex_lock(&local_vttydev->lock);
-    local_vttydev->tx_paused = 1;
-    mutex_unlock(&local_vttydev->lock);
+    unsigned long flags;
+    unsigned int msr_delay = 0;
+
+    spin_lock_irqsave(&vttydev->rx_lock, flags);
+    msr_delay = vttydev->persona->msr_delay_ms;
+    if(msr_delay != 0) {
+        /* Emulated USB-UART bridge reports the change later, accumulate till then */
+        if(vttydev->msr_pending == 0) {
+            vttydev->msr_shown = vttydev->msr_reg;
+            vttydev->msr_pending = 1;
+        }
+        vttydev->msr_delta.cts += delta->cts;
+        vttydev->msr_delta.dsr += delta->dsr;
+        vttydev->msr_delta.dcd += delta->dcd;
+        vttydev->msr_delta.rng += delta->rng;
+        vttydev->msr_wakeup_open |= wakeup_blocked_open;
+    }
+    vttydev->msr_reg = msr_state_reg;
+    spin_unlock_irqrestore(&vttydev->rx_lock, flags);
+
+    if(msr_delay != 0)
+        schedule_delayed_work(&vttydev->msr_work, msecs_to_jiffies(msr_delay));
+    else
+        sp_publish_msr(vttydev, delta, wakeup_blocked_open);
 }
 
 /*
- * Invoked when this driver should start sending data for example as a part of flow control mechanism.
+ * Invoked when user space process opens a serial port. Tty core calls this to install tty and
+ * initialize the required resources.
  *
- * Line discipline n_tty calls this function if this device uses software flow control and an XON
- * character is received from other end.
+ * @driver: this driver.
+ * @tty: the tty being created.
  *
- * @tty: tty device who should start sending data to other end.
+ * @return 0 on success otherwise negative error code on failure.
  */
-static void sp_start(struct tty_struct *tty)
+static int sp_install(struct tty_driver *driver, struct tty_struct *tty)
 {
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
-    mutex_lock(&local_vttydev->lock);
-    local_vttydev->tx_paused = 0;
-    mutex_unlock(&local_vttydev->lock);
+    int ret = 0;
+    struct tty_port *port = NULL;
 
-    if (tty && tty->port)
-        tty_port_tty_wakeup(tty->port);
+    port = (struct tty_port *) kcalloc(1, sizeof(struct tty_port), GFP_KERNEL);
+    if(port == NULL)
+        return -ENOMEM;
+
+    /* First initialize and then set port operations */
+    tty_port_init(port);
+    port->ops = &spvtty_port_ops;
+
+    ret = tty_port_install(port, driver, tty);
+    if (ret) {
+        kfree(port);
+        return ret;
+    }
+
+    return 0;
 }
 
 /*
- * Obtain the modem status bits for the given tty device. Invoked typically when ioctl command TIOCMGET
- * is executed on this tty device.
- *
- * @tty: tty device whose status is enquired.
+ * Invoked when there exist no user process or tty is to be released explicitly for whatever reason.
  *
- * @return bit mask (TIOCM_XXX) of modem control and modem status registers.
+ * @tty: the tty being destroyed.
  */
-static int sp_tiocmget(struct tty_struct *tty)
+static void sp_cleanup(struct tty_struct *tty)
 {
-    int status = 0;
-    int msr_reg = 0;
-    int mcr_reg = 0;
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    struct vtty_dev *vttydev = NULL;
 
-    mutex_lock(&local_vttydev->lock);
-    mcr_reg = local_vttydev->mcr_reg;
-    msr_reg = local_vttydev->msr_reg;
-    mutex_unlock(&local_vttydev->lock);
+    /* Runs from tty release work, never with adaptlock held by this driver. */
+    mutex_lock(&adaptlock);
+    if(index_manager[tty->index].index != -1) {
+        vttydev = index_manager[tty->index].vttydev;
+        if(vttydev && (vttydev->own_tty == tty))
+            vttydev->own_tty = NULL;
+    }
+    mutex_unlock(&adaptlock);
 
-    status= ((mcr_reg & SP_MCR_DTR)  ? TIOCM_DTR  : 0) |
-            ((mcr_reg & SP_MCR_RTS)  ? TIOCM_RTS  : 0) |
-            ((mcr_reg & SP_MCR_LOOP) ? TIOCM_LOOP : 0) |
-            ((msr_reg & SP_MSR_DCD)  ? TIOCM_CAR  : 0) |
-            ((msr_reg & SP_MSR_RI)   ? TIOCM_RI   : 0) |
-            ((msr_reg & SP_MSR_CTS)  ? TIOCM_CTS  : 0) |
-            ((msr_reg & SP_MSR_DSR)  ? TIOCM_DSR  : 0);
-    return status;
+    tty_port_put(tty->port);
 }
 
 /*
- * Set the modem status bits. Invoked typically when ioctl command TIOCMSET is executed on this tty
- * device.
- *
- * @tty: tty device whose modem control register is to be updated with given value.
- * @set: bit mask of signals which should be asserted.
- * @clear: bit mask of signals which should be de-asserted.
- *
- * @return 0 on success otherwise negative error code on failure.
- */
-static int sp_tiocmset(struct tty_struct *tty, unsigned int set, unsigned int clear)
-{
-    int ret = 0;
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
-    mutex_lock(&local_vttydev->lock);
-    ret = sp_update_modem_lines(tty, set, clear);
+ * Invoked when open() is called on a serial port's device node. The tty layer will allocate a 
+ * 'struct tty_struct' for this device and setup various structures and line disc and call this 
+ * function.
+ * 
+ * When a tty device file (/dev/ttyXX) is opened, tty core finds the tty device driver serving this
+ * device file and the index in this driver for this device file (now kernel device). The tty core
+ * then checks if tty structure have been already allocated for this or not. If not allocated, 
+ * allocation happens otherwise a re-open happens.
+ * 
+ * If the same serial port is opened more than once, the tty structure passed to this function will 
+ * be same but filp structure will be different every time. Caller holds tty lock.
+ * 
+ * @tty: tty structure corresponding to filp file.
+ * @filp: file pointer for handle to tty.
+ * 
+ * @return 0 on success or negative error code on failure.
+ */
+static int sp_open(struct tty_struct *tty, struct file *filp)
+{    
+    int ret = 0;
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    struct vtty_dev *remote_vttydev = NULL;
+
+    /* tty core calls close() even if this open fails, so count every call. */
+    mutex_lock(&local_vttydev->lock);
+    local_vttydev->open_count++;
     mutex_unlock(&local_vttydev->lock);
+
+    local_vttydev->own_tty = tty;
+
+    /* If this device is one end of a null modem connection, provide its address to remote end */
+    if (tty->index != local_vttydev->peer_index) {
+        remote_vttydev = index_manager[local_vttydev->peer_index].vttydev;
+        remote_vttydev->peer_tty = tty;
+    }
+
+    memset(&local_vttydev->serial, 0, sizeof(struct serial_struct));
+    memset(&local_vttydev->icount, 0, sizeof(struct async_icount));
+
+    /* Handle DTR raising logic ourselve instead of tty_port helpers doing it. */
+    if (local_vttydev->set_odtr_at_open == 1) {
+        sp_update_modem_lines(tty, TIOCM_DTR | TIOCM_RTS, 0);
+    }
+
+    /* Associate tty with port and do port level opening. */
+    ret = tty_port_open(tty->port, tty, filp);
+    if (ret < 0) 
+        return ret;
+
+    tty->port->close_delay  = 0;
+    tty->port->closing_wait = ASYNC_CLOSING_WAIT_NONE;
+    tty->port->drain_delay  = 0;
+
     return ret;
 }
 
 /*
- * Invoked by tty layer to turn break condition on and off for a tty device unconditionally.
- *
- * @tty: tty device who should set or reset given break condition on its output line.
- * @state: 1 if break is to be asserted or 0 for de-assertion.
- *
- * @return 0 on success otherwise negative error code on failure.
+ * Invoked by tty layer when release() is called on the file pointer that was previously created with a 
+ * call to open().
+ * 
+ * @tty: tty structure corresponding to filp file.
+ * @filp: file pointer for handle to tty.
+ * 
+ * @return 0 on success or negative error code on failure.
  */
-static int sp_break_ctl(struct tty_struct *tty, int break_state)
+static void sp_close(struct tty_struct *tty, struct file *filp)
+{
+    struct vtty_dev *local_vttydev = NULL;
+
+    /* Hung up tty; device may have been deleted already, open_count was reset when it was hung up */
+    if(test_bit(TTY_IO_ERROR, &tty->flags))
+        return;
+
+    local_vttydev = index_manager[tty->index].vttydev;
+    mutex_lock(&local_vttydev->lock);
+    if(local_vttydev->open_count > 0)
+        local_vttydev->open_count--;
+    mutex_unlock(&local_vttydev->lock);
+
+    if(tty && filp && tty->port && (tty->port->count > 0))
+        tty_port_close(tty->port, tty, filp);
+
+    if(tty && C_HUPCL(tty) && tty->port && (tty->port->count < 1))
+        sp_update_modem_lines(tty, 0, TIOCM_DTR | TIOCM_RTS);
+}
+
+/* 
+ * Invoked by tty layer via the line discipline when data is to be sent to tty device may be 
+ * as a response to write() call in user space. The data bytes are inserted into the tty buffer and get
+ * scheduled to be sent to receiver. This function will construct correct UART frame before sending.
+ * 
+ * @tty: tty device who will send given data.
+ * @buf: data to be sent.
+ * @count: number of data bytes in buf.
+ * 
+ * @return number of characters sent or negative error code on failure.
+ */
+static int sp_write(struct tty_struct *tty, const unsigned char *buf, int count)
 {
+    int x = 0;
+    unsigned char *data = NULL;
     struct tty_struct *tty_to_write = NULL;
-    struct vtty_dev *brk_rx_vttydev = NULL;
-    struct vtty_dev *brk_tx_vttydev = index_manager[tty->index].vttydev;
+    struct vtty_dev *rx_vttydev = NULL;
+    struct vtty_dev *tx_vttydev = index_manager[tty->index].vttydev;
 
-    if(tty->index != brk_tx_vttydev->peer_index) {
-        tty_to_write = brk_tx_vttydev->peer_tty;
-        brk_rx_vttydev = index_manager[brk_tx_vttydev->peer_index].vttydev;
+    if (tx_vttydev->tx_paused || !tty || tty->stopped || (count < 1) || !buf || tty->hw_stopped)
+        return 0;
+
+    if (tx_vttydev->is_break_on == 1) {
+        dev_dbg(tty->dev, "break condition is on !");
+        return -EIO;
+    }
+
+    if(tx_vttydev->faulty_cable == 1)
+        return count;
+
+    if(tx_vttydev->odevtyp == RLY)
+        return sp_relay_write(tx_vttydev, buf, count);
+
+    if (tty->index != tx_vttydev->peer_index) {
+        /* null modem */
+        tty_to_write = tx_vttydev->peer_tty;
+        rx_vttydev = index_manager[tx_vttydev->peer_index].vttydev;
+
+        if((tx_vttydev->baud != rx_vttydev->baud) || (tx_vttydev->uart_frame != rx_vttydev->uart_frame)) {
+            /* Emulate data sent but not received */
+            dev_dbg(tty->dev, "mismatched serial port settings !");
+            tx_vttydev->icount.tx++;
+            return count;
+        }
     }
     else {
+        /* loop back */
         tty_to_write = tty;
-        brk_rx_vttydev = brk_tx_vttydev;
+        rx_vttydev = tx_vttydev;
     }
 
-    mutex_lock(&brk_tx_vttydev->lock);
+    if (tty_to_write != NULL) {
 
-    if (break_state != 0) {
-        if(brk_tx_vttydev->is_break_on == 1)
-            return 0;
+        /* The UART hardware receiver samples received electrical signals at the middle of a bit in uart frame.
+         * Emulate correct number/size of data bits and hence uart frame. */
+        if((tty_to_write->termios.c_cflag & CSIZE) == CS8) {
+            data = (unsigned char *)buf;
+        }
+        else {
+            data = (unsigned char *) kcalloc(count, sizeof(unsigned char), GFP_KERNEL);
+            if(data == NULL)
+                return -ENOMEM;
 
-        brk_tx_vttydev->is_break_on = 1;
-        if(tty_to_write != NULL) {
-            tty_insert_flip_char(tty_to_write->port, 0, TTY_BREAK);
-            tty_flip_buffer_push(tty_to_write->port);
-            brk_rx_vttydev->icount.brk++;
+            switch (tty_to_write->termios.c_cflag & CSIZE) {
+            case CS7:
+                for(x=0; x < count; x++) {
+                    data[x] = buf[x] & 0x7F;
+                }
+                break;
+            case CS6:
+                for(x=0; x < count; x++) {
+                    data[x] = buf[x] & 0x3F;
+                }
+                break;
+            case CS5:
+                for(x=0; x < count; x++) {
+                    data[x] = buf[x] & 0x1F;
+                }
+                break;
+            default:
+                data = (unsigned char *)buf;
+            }
         }
-    }
-    else {
-        brk_tx_vttydev->is_break_on = 0;
+
+        sp_deliver_rx(tty_to_write, rx_vttydev, data, count);
+        tx_vttydev->icount.tx++;
+        rx_vttydev->icount.rx++;
+
+        if(data != buf)
+            kfree(data);
+    }else {
+        /* Other end is still not opened, emulate transmission from local end
+           but don't make other end receive it as is the case in real world. */
+        tx_vttydev->icount.tx++;
     }
 
-    mutex_unlock(&brk_tx_vttydev->lock);
-    return 0;
+    return count;
 }
 
 /*
- * Invoked by tty layer to inform this driver that it should hangup the tty device (lower
- * modem control lines after last process using tty devices closes the device or exited).
- *
- * Drop DTR/RTS if HUPCL is set. This causes any attached modem to hang up the line.
+ * Places data in receiving tty's flip buffer and pushes it to line discipline. If receive timestamps
+ * are enabled on receiving device, time at which the data was handed over is recorded.
  *
- * On the receiving end, if CLOCAL bit is set, DCD will be ignored otherwise SIGHUP may be
- * generated to indicate a line disconnect event.
- *
- * @tty: tty device that has hung up.
+ * @tty_to_write: tty which receives data.
+ * @rx_vttydev: virtual tty device of receiving tty.
+ * @data: data to be received.
+ * @count: number of bytes in data.
  */
-static void sp_hangup(struct tty_struct *tty)
+static void sp_deliver_rx(struct tty_struct *tty_to_write, struct vtty_dev *rx_vttydev, const unsigned char *data, int count)
 {
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    int done = 0;
+    int full = 0;
+    s64 tstamp = 0;
+    unsigned long flags;
+    unsigned int packet_size = 0;
+
+#ifdef CONFIG_BPF_SYSCALL
+    int drop = 0;
+    struct sk_buff *skb = NULL;
+
+    if(rcu_access_pointer(rx_vttydev->filter) != NULL) {
+        skb = sp_filter_run(rx_vttydev, data, count, &drop);
+        if(drop == 1)
+            return;
+        if(skb != NULL) {
+            /* Deliver data as modified by filter program */
+            data = skb->data;
+            count = skb->len;
+        }
+    }
+#endif
+
+    if(rx_vttydev->rxts != NULL)
+        tstamp = ktime_to_ns(ktime_get());
+
+    spin_lock_irqsave(&rx_vttydev->rx_lock, flags);
+    packet_size = rx_vttydev->persona->packet_size;
+    if(packet_size != 0) {
+        /* Stage data as USB-UART bridge would do in its receive buffer */
+        if(kfifo_is_empty(&rx_vttydev->rx_fifo))
+            rx_vttydev->rx_deadline = jiffies + msecs_to_jiffies(rx_vttydev->latency);
+        done = kfifo_in(&rx_vttydev->rx_fifo, data, count);
+        full = (kfifo_len(&rx_vttydev->rx_fifo) >= packet_size) ? 1 : 0;
+    }else {
+        /* Inserted under rx_lock so that it stays behind staged data handed over by rx work or when
+         * personality is changed to none */
+        done = tty_insert_flip_string(tty_to_write->port, data, count);
+    }
+    spin_unlock_irqrestore(&rx_vttydev->rx_lock, flags);
 
-    mutex_lock(&local_vttydev->lock);
+    if(packet_size == 0) {
+        tty_flip_buffer_push(tty_to_write->port);
+    }else {
+        if(done < count)
+            rx_vttydev->icount.buf_overrun++;
+        if(full)
+            mod_delayed_work(system_wq, &rx_vttydev->rx_work, 0);
+        else
+            schedule_delayed_work(&rx_vttydev->rx_work, msecs_to_jiffies(rx_vttydev->latency));
+    }
 
-    /* Drops reference to tty */
-    tty_port_hangup(tty->port);
+    if((rx_vttydev->rxts != NULL) && (done > 0))
+        sp_rxts_record(rx_vttydev, done, tstamp);
 
-    if (tty && C_HUPCL(tty))
-        sp_update_modem_lines(tty, 0, TIOCM_DTR | TIOCM_RTS);
+#ifdef CONFIG_BPF_SYSCALL
+    if(skb != NULL)
+        consume_skb(skb);
+#endif
+}
 
-    mutex_unlock(&local_vttydev->lock);
+#ifdef CONFIG_BPF_SYSCALL
+/*
+ * Runs filter program attached to the receiving device on a chunk of data. The chunk is given to the
+ * program as packet data of a socket buffer (starting at mac header) and what the buffer holds after
+ * the program has run is delivered.
+ *
+ * A socket filter program can only read data; as with SO_ATTACH_BPF its return value is the number
+ * of bytes to keep from the start of the chunk and 0 drops the chunk. A tc classifier (sched_cls)
+ * program can also rewrite data with bpf_skb_store_bytes() (or direct packet access where kernel has
+ * it); TC_ACT_SHOT drops the chunk, TC_ACT_STOLEN and TC_ACT_REDIRECT mean the program took it over
+ * so it is not delivered either, any other verdict passes it on.
+ *
+ * @vttydev: device receiving data.
+ * @data: received data.
+ * @count: number of bytes in data.
+ * @drop: set to 1 if chunk is not to be delivered.
+ *
+ * @return socket buffer holding data to be delivered (caller frees it) or NULL if original data is to
+ *         be delivered.
+ */
+static struct sk_buff *sp_filter_run(struct vtty_dev *vttydev, const unsigned char *data, int count, int *drop)
+{
+    u32 res = 0;
+    int taken = 0;
+    struct bpf_prog *prog = NULL;
+    struct sk_buff *skb = NULL;
+
+    *drop = 0;
+
+    skb = alloc_skb(count, GFP_ATOMIC);
+    if(skb == NULL)
+        return NULL;
+    memcpy(skb_put(skb, count), data, count);
+    skb_reset_mac_header(skb);
+    skb_reset_network_header(skb);
+    skb->dev = sp_filter_netdev;
+
+    rcu_read_lock();
+    prog = rcu_dereference(vttydev->filter);
+    if(prog == NULL) {
+        rcu_read_unlock();
+        kfree_skb(skb);
+        return NULL;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,16,0)
+    bpf_compute_data_pointers(skb);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4,7,0)
+    bpf_compute_data_end(skb);
+#endif
+    preempt_disable();
+    res = bpf_prog_run_save_cb(prog, skb);
+    preempt_enable();
+
+    if(prog->type == BPF_PROG_TYPE_SOCKET_FILTER) {
+        if(res == 0)
+            taken = 1;
+        else if(res < skb->len)
+            skb_trim(skb, res);
+    }else {
+        if(((int) res == TC_ACT_SHOT) || ((int) res == TC_ACT_STOLEN))
+            taken = 1;
+#ifdef TC_ACT_REDIRECT
+        if((int) res == TC_ACT_REDIRECT)
+            taken = 1;
+#endif
+    }
+    rcu_read_unlock();
 
-    dev_dbg(tty->dev, "hanged up !");
+    if(taken || (skb->len == 0)) {
+        vttydev->filter_drop++;
+        kfree_skb(skb);
+        *drop = 1;
+        return NULL;
+    }
+
+    vttydev->filter_pass++;
+    return skb;
 }
+#endif
 
 /*
- * Invoked to execute ioctl command TIOCGICOUNT to get the number of interrupts. Both 1->0 and
- * 0->1 transitions are counted, except for RI, where only 0->1 transitions are counted.
+ * Attaches a BPF program of type BPF_PROG_TYPE_SOCKET_FILTER or BPF_PROG_TYPE_SCHED_CLS, loaded by
+ * application with bpf(2), to the delivery path of this device replacing previous program, or detaches
+ * program if fd is -1. The program sees every chunk of data received by this device.
  *
- * @tty: tty device whose interrupts information is to be collected.
- * @icount: memory location from which tty core will copy data to user space buffer.
+ * @vttydev: device receiving data to be filtered.
+ * @fd: file descriptor of loaded program or -1.
  *
- * @return 0 on success otherwise negative error code on failure.
+ * @return 0 on success or negative error code on failure.
  */
-static int sp_get_icount(struct tty_struct *tty, struct serial_icounter_struct *icount)
+static int sp_filter_attach(struct vtty_dev *vttydev, int fd)
 {
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
-    struct async_icount cnow;
+#ifdef CONFIG_BPF_SYSCALL
+    unsigned long flags;
+    struct bpf_prog *old = NULL;
+    struct bpf_prog *prog = NULL;
+
+    if(fd >= 0) {
+        prog = bpf_prog_get(fd);
+        if(IS_ERR(prog))
+            return PTR_ERR(prog);
+        if((prog->type != BPF_PROG_TYPE_SOCKET_FILTER) && (prog->type != BPF_PROG_TYPE_SCHED_CLS)) {
+            bpf_prog_put(prog);
+            return -EINVAL;
+        }
+        if(prog->type == BPF_PROG_TYPE_SCHED_CLS) {
+            mutex_lock(&sp_filter_mutex);
+            if(sp_filter_netdev == NULL)
+                sp_filter_netdev = alloc_netdev(0, "tty2com_bpf", NET_NAME_UNKNOWN, ether_setup);
+            mutex_unlock(&sp_filter_mutex);
+            if(sp_filter_netdev == NULL) {
+                bpf_prog_put(prog);
+                return -ENOMEM;
+            }
+        }
+    }
 
-    mutex_lock(&local_vttydev->lock);
-    cnow = local_vttydev->icount;
-    mutex_unlock(&local_vttydev->lock);
+    spin_lock_irqsave(&vttydev->rx_lock, flags);
+    old = rcu_dereference_protected(vttydev->filter, lockdep_is_held(&vttydev->rx_lock));
+    rcu_assign_pointer(vttydev->filter, prog);
+    vttydev->filter_pass = 0;
+    vttydev->filter_drop = 0;
+    spin_unlock_irqrestore(&vttydev->rx_lock, flags);
 
-    icount->cts = cnow.cts;
-    icount->dsr = cnow.dsr;
-    icount->rng = cnow.rng;
-    icount->dcd = cnow.dcd;
-    icount->tx = cnow.tx;
-    icount->rx = cnow.rx;
-    icount->frame = cnow.frame;
-    icount->parity = cnow.parity;
-    icount->overrun = cnow.overrun;
-    icount->brk = cnow.brk;
-    icount->buf_overrun = cnow.buf_overrun;
+    if(old != NULL) {
+        synchronize_rcu();
+        bpf_prog_put(old);
+    }
 
     return 0;
+#else
+    return (fd >= 0) ? -EOPNOTSUPP : 0;
+#endif
 }
 
 /*
- * Discard the internal output buffer for this tty device. Typically it may be called when executing IOCTL
- * TCOFLUSH, closing the serial port, when break is received in input stream (flushing is configured) or
- * when hangup occurs.
+ * Hands over data staged by the emulated USB-UART bridge to the tty layer. Every full packet is
+ * delivered as a separate chunk, a partial packet only when latency timer expired. If personality
+ * has been changed to none everything is delivered.
  *
- * On the other hand, when IOCTL command TCIFLUSH is invoked, tty flip buffer and line discipline queue gets
- * emptied without involvement of tty driver. The driver is generally expected not to keep data but send
- * it to tty layer as soon as possible when it receives data.
- *
- * The virtual tty device created by this driver does not have any local buffer.
- *
- * @tty: tty device whose buffer should be flushed.
- */
-static void sp_flush_buffer(struct tty_struct *tty)
-{
-}
-
-/*
- * Invoked by tty layer to execute TCIOFF and TCION IOCTL commands generally because user space process
- * called tcflow() function. It send a high priority character to the tty device end even if stopped.
- *
- * If this function (send_xchar) is defined by tty device driver, tty core will call this function. If
- * it is not specified then tty core will first instruct this driver to start transmission (start())
- * and then invoke write() of this driver passing character to be written and then it will call stop()
- * function of this driver.
- *
- * @tty: tty device who is sending this character.
- * @ch: character to be sent (typically it is XOFF or XON).
+ * @work: receive work item embedded in the virtual tty device.
  */
-static void sp_send_xchar(struct tty_struct *tty, char ch)
+static void sp_persona_rx_work(struct work_struct *work)
 {
-    int was_paused = 0;
-    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    unsigned int len = 0;
+    unsigned int num = 0;
+    unsigned long flags;
+    unsigned long now = 0;
+    unsigned int packet_size = 0;
+    struct tty_struct *tty = NULL;
+    unsigned char packet[SP_PERSONA_MAX_PACKET];
+    struct vtty_dev *vttydev = container_of(to_delayed_work(work), struct vtty_dev, rx_work);
+
+    if (vttydev->own_tty && vttydev->own_tty->port)
+        tty = tty_port_tty_get(vttydev->own_tty->port);
+
+    if(tty == NULL) {
+        /* Receiving end is closed, data is lost as it would be on real hardware */
+        spin_lock_irqsave(&vttydev->rx_lock, flags);
+        kfifo_reset(&vttydev->rx_fifo);
+        spin_unlock_irqrestore(&vttydev->rx_lock, flags);
+        return;
+    }
 
-    was_paused = local_vttydev->tx_paused;
-    if(was_paused)
-        local_vttydev->tx_paused = 0;
+    while(1) {
+        spin_lock_irqsave(&vttydev->rx_lock, flags);
+        now = jiffies;
+        len = kfifo_len(&vttydev->rx_fifo);
+        packet_size = vttydev->persona->packet_size;
+        if(len == 0) {
+            spin_unlock_irqrestore(&vttydev->rx_lock, flags);
+            break;
+        }
+        if((packet_size != 0) && (len < packet_size) && time_before(now, vttydev->rx_deadline)) {
+            spin_unlock_irqrestore(&vttydev->rx_lock, flags);
+            schedule_delayed_work(&vttydev->rx_work, vttydev->rx_deadline - now);
+            break;
+        }
+        if(packet_size == 0)
+            packet_size = SP_PERSONA_MAX_PACKET;
+        num = kfifo_out(&vttydev->rx_fifo, packet, min(len, packet_size));
+        /* Latency timer restarts whenever a packet is sent to host */
+        vttydev->rx_deadline = now + msecs_to_jiffies(vttydev->latency);
+        tty_insert_flip_string(tty->port, packet, num);
+        spin_unlock_irqrestore(&vttydev->rx_lock, flags);
+
+        tty_flip_buffer_push(tty->port);
+    }
 
-    sp_put_char(tty, ch);
-    if(was_paused)
-        local_vttydev->tx_paused = 1;
+    tty_kref_put(tty);
 }
 
 /*
- * Invoked by tty layer in response to tcdrain() call.
+ * Makes modem status changes held back by emulated USB-UART bridge visible to application.
  *
- * @tty: tty device who should try to empty its output buffer.
- * @timeout: timeout value.
+ * @work: modem status work item embedded in the virtual tty device.
  */
-static void sp_wait_until_sent(struct tty_struct *tty, int timeout)
+static void sp_persona_msr_work(struct work_struct *work)
 {
+    int wakeup_open = 0;
+    unsigned long flags;
+    struct async_icount delta;
+    struct vtty_dev *vttydev = container_of(to_delayed_work(work), struct vtty_dev, msr_work);
+
+    spin_lock_irqsave(&vttydev->rx_lock, flags);
+    delta = vttydev->msr_delta;
+    wakeup_open = vttydev->msr_wakeup_open;
+    memset(&vttydev->msr_delta, 0, sizeof(struct async_icount));
+    vttydev->msr_wakeup_open = 0;
+    vttydev->msr_pending = 0;
+    spin_unlock_irqrestore(&vttydev->rx_lock, flags);
+
+    sp_publish_msr(vttydev, &delta, wakeup_open);
 }
 
 /*
- * Asserts or de-asserts serial lines as specified by raise argument. It is handled by 
- * this driver exlicitly as of now because this will eventually become entirely internal 
- * to the tty port as per linux kernel development plan.
+ * Accounts modem status changes and wakes up processes waiting for them.
  *
- * @port serial port whose lines is to be updated
- * @raise 1 if line should be asserted, 0 if line should be de-asserted
-static void sp_port_dtr_rts(struct tty_port *port, int raise) 
+ * @vttydev: device whose modem status changed.
+ * @delta: number of changes of each modem status line.
+ * @wakeup_blocked_open: 1 if carrier detect got raised.
+ */
+static void sp_publish_msr(struct vtty_dev *vttydev, struct async_icount *delta, int wakeup_blocked_open)
 {
-    if(raise == 1)
-        sp_update_modem_lines(port->tty, TIOCM_DTR | TIOCM_RTS, 0);
-    else
-        sp_update_modem_lines(port->tty, 0, TIOCM_DTR | TIOCM_RTS);
+    struct async_icount *evicount = &vttydev->icount;
+
+    evicount->cts += delta->cts;
+    evicount->dsr += delta->dsr;
+    evicount->dcd += delta->dcd;
+    evicount->rng += delta->rng;
+
+    if(vttydev->own_tty && vttydev->own_tty->port) {
+
+        /* Wake up process blocked on TIOCMIWAIT ioctl */
+        if((vttydev->waiting_msr_chg == 1) && (vttydev->own_tty->port->count > 0)) {
+            wake_up_interruptible(&vttydev->own_tty->port->delta_msr_wait);
+        }
+
+        /* Wake up application blocked on carrier detect signal */
+        if((wakeup_blocked_open == 1) && (vttydev->own_tty->port->blocked_open > 0)) {
+            wake_up_interruptible(&vttydev->own_tty->port->open_wait);
+        }
+    }
 }
- */
 
 /*
- * Checks if the given port has received its carrier detect line raised.
+ * Gives modem status register as seen by application; while a change is held back by emulated
+ * USB-UART bridge the value before the change is given.
  *
- * @port: serial port whose carrier detect line is to be checked.
+ * @vttydev: device whose modem status is enquired.
  *
- * @return 1 if the carrier is raised otherwise 0.
+ * @return modem status register.
  */
-static int sp_port_carrier_raised(struct tty_port *port)
+static int sp_visible_msr(struct vtty_dev *vttydev)
 {
-    struct vtty_dev *local_vttydev = index_manager[port->tty->index].vttydev;
-    return (local_vttydev->msr_reg & SP_MSR_DCD) ? 1 : 0;
+    int msr = 0;
+    unsigned long flags;
+
+    spin_lock_irqsave(&vttydev->rx_lock, flags);
+    msr = (vttydev->msr_pending == 1) ? vttydev->msr_shown : vttydev->msr_reg;
+    spin_unlock_irqrestore(&vttydev->rx_lock, flags);
+
+    return msr;
 }
 
 /*
- * Shutdowns the given serial port, typically it is used to shutdown hardware.
+ * Appends a receive timestamp record for a chunk of data; the oldest record is dropped if no room.
  *
- * @port: tty port to shut down.
+ * @vttydev: device which received data.
+ * @count: number of bytes received.
+ * @tstamp: CLOCK_MONOTONIC time in nanoseconds at which data was received.
  */
-static void sp_port_shutdown(struct tty_port *port)
+static void sp_rxts_record(struct vtty_dev *vttydev, int count, s64 tstamp)
 {
+    unsigned long flags;
+    struct sp_rxts_record *rec = NULL;
+
+    spin_lock_irqsave(&vttydev->rxts_lock, flags);
+    if(vttydev->rxts != NULL) {
+        if((vttydev->rxts_head - vttydev->rxts_tail) == SP_RXTS_LEN) {
+            vttydev->rxts_tail++;
+            vttydev->rxts_dropped++;
+        }
+        rec = &vttydev->rxts[vttydev->rxts_head % SP_RXTS_LEN];
+        rec->offset = vttydev->rxts_offset;
+        rec->length = count;
+        rec->reserved = 0;
+        rec->tstamp = tstamp;
+        vttydev->rxts_head++;
+        vttydev->rxts_offset += count;
+    }
+    spin_unlock_irqrestore(&vttydev->rxts_lock, flags);
 }
 
 /*
- * Activate the given serial port as opposed to shutdown. Typically used to turn something on hardware.
+ * Enables or disables receive timestamping. Enabling discards any previous records and starts
+ * counting offsets from 0, so it should be done when there is no unread data in the tty.
  *
- * @port: tty port to activate.
- * @tty: tty corresponding to the given port.
- * @return 0 on success.
+ * @vttydev: device whose received data is to be timestamped.
+ * @arg: 1 to enable, 0 to disable.
+ *
+ * @return 0 on success or negative error code on failure.
  */
-static int sp_port_activate(struct tty_port *port, struct tty_struct *tty)
+static int sp_rxts_enable(struct vtty_dev *vttydev, unsigned long arg)
 {
+    unsigned long flags;
+    struct sp_rxts_record *rxts = NULL;
+    struct sp_rxts_record *old = NULL;
+
+    if(arg > 1)
+        return -EINVAL;
+
+    if(arg == 1) {
+        rxts = kcalloc(SP_RXTS_LEN, sizeof(struct sp_rxts_record), GFP_KERNEL);
+        if(rxts == NULL)
+            return -ENOMEM;
+    }
+
+    spin_lock_irqsave(&vttydev->rxts_lock, flags);
+    old = vttydev->rxts;
+    vttydev->rxts = rxts;
+    vttydev->rxts_head = 0;
+    vttydev->rxts_tail = 0;
+    vttydev->rxts_offset = 0;
+    vttydev->rxts_dropped = 0;
+    spin_unlock_irqrestore(&vttydev->rxts_lock, flags);
+
+    kfree(old);
     return 0;
 }
 
 /*
- * Invoked when tty is going to be destroyed and driver should release resources.
+ * Gives (offset, length, timestamp) records of received data not yet fetched, oldest first. The
+ * offset is position of first byte of the chunk in the byte stream received since timestamping was
+ * enabled, so application can match records with the data it consumed through read().
  *
- * @port: port which is going to be freed.
+ * @vttydev: device whose records are to be fetched.
+ * @arg: user space pointer to struct sp_rxts_req.
+ *
+ * @return 0 on success or negative error code on failure.
  */
-static void sp_port_destruct(struct tty_port *port)
+static int sp_rxts_get(struct vtty_dev *vttydev, unsigned long arg)
 {
-    //kfree(port);
+    int ret = 0;
+    unsigned int x = 0;
+    unsigned int num = 0;
+    unsigned long flags;
+    struct sp_rxts_req req;
+    struct sp_rxts_record *recs = NULL;
+
+    if(copy_from_user(&req, (void __user *) arg, sizeof(req)) != 0)
+        return -EFAULT;
+    if((req.max == 0) || (req.records == 0))
+        return -EINVAL;
+
+    req.max = min_t(unsigned int, req.max, SP_RXTS_LEN);
+    recs = kcalloc(req.max, sizeof(struct sp_rxts_record), GFP_KERNEL);
+    if(recs == NULL)
+        return -ENOMEM;
+
+    spin_lock_irqsave(&vttydev->rxts_lock, flags);
+    if(vttydev->rxts == NULL) {
+        spin_unlock_irqrestore(&vttydev->rxts_lock, flags);
+        kfree(recs);
+        return -EINVAL;
+    }
+    num = min_t(unsigned int, req.max, vttydev->rxts_head - vttydev->rxts_tail);
+    for(x = 0; x < num; x++) {
+        recs[x] = vttydev->rxts[vttydev->rxts_tail % SP_RXTS_LEN];
+        vttydev->rxts_tail++;
+    }
+    req.dropped = vttydev->rxts_dropped;
+    spin_unlock_irqrestore(&vttydev->rxts_lock, flags);
+
+    req.count = num;
+    if(copy_to_user((void __user *)(unsigned long) req.records, recs, num * sizeof(struct sp_rxts_record)) != 0)
+        ret = -EFAULT;
+    else if(copy_to_user((void __user *) arg, &req, sizeof(req)) != 0)
+        ret = -EFAULT;
+
+    kfree(recs);
+    return ret;
 }
 
 /*
- * Gives next available index and last used index for virtual tty devices created. Invoke as shown below:
- * $ head -c 52 /proc/sp_vmpscrdk
- * 
- * @file: file for proc file.
- * @buf: user space buffer that will contain data when this function returns.
- * @size: number of character returned in buf.
- * @ppos: offset position from where to read data.
+ * Invoked by tty layer when a single character is to be sent to the tty device. This character may be
+ * ignored if there is no room in the device for the character to be sent.
  *
- * @return number of bytes copied to user buffer on success or negative error code on error.
+ * @tty: tty device who will send given data.
+ * @buf: data to be sent.
+ * @count: number of data bytes in buf.
+ *
+ * @return number of characters sent or negative error code on failure.
  */
-static ssize_t sp_vcard_proc_read(struct file *file, char __user *buf, size_t size, loff_t *ppos)
+static int sp_put_char(struct tty_struct *tty, unsigned char ch)
 {
-    int x = 0;
-    int ret = 0;
-    int val = 0;
-    char data[64];
-    int first_avail_idx = -1;
-    int second_avail_idx = -1;
-    struct vtty_dev *lbvttydev = NULL;
-    struct vtty_dev *nm1vttydev = NULL;
-    struct vtty_dev *nm2vttydev = NULL;
+    unsigned char data;
+    struct tty_struct *tty_to_write = NULL;
+    struct vtty_dev *rx_vttydev = NULL;
+    struct vtty_dev *tx_vttydev = index_manager[tty->index].vttydev;
 
-    memset(data, '\0', 64);
+    if (tx_vttydev->tx_paused || !tty || tty->stopped || tty->hw_stopped)
+        return 0;
 
-    if(size != 52)
-        return -EINVAL;
+    if (tx_vttydev->is_break_on == 1)
+        return -EIO;
 
-    mutex_lock(&adaptlock);
+    if(tx_vttydev->faulty_cable == 1)
+        return 1;
 
-    /* Find next available free index */
-    for(x = 0; x < max_num_vtty_dev; x++) {
-        if(index_manager[x].index == -1) {
-            if(first_avail_idx == -1) {
-                first_avail_idx = x;
-            }else {
-                second_avail_idx = x;
-                break;
-            }
+    if(tx_vttydev->odevtyp == RLY)
+        return sp_relay_write(tx_vttydev, &ch, 1);
+
+    if (tty->index != tx_vttydev->peer_index) {
+        tty_to_write = tx_vttydev->peer_tty;
+        rx_vttydev = index_manager[tx_vttydev->peer_index].vttydev;
+        if((tx_vttydev->baud != rx_vttydev->baud) || (tx_vttydev->uart_frame != rx_vttydev->uart_frame)) {
+            tx_vttydev->icount.tx++;
+            return 1;
         }
     }
-
-    if((first_avail_idx != -1) && (second_avail_idx != -1)) {
-        val = 2;
-    }else if((first_avail_idx != -1) && (second_avail_idx == -1)) {
-        val = 1;
-    }else if((first_avail_idx == -1) && (second_avail_idx == -1)) {
-        val = 0;
-    }else {
-        /* will not happen */
+    else {
+        tty_to_write = tty;
+        rx_vttydev = tx_vttydev;
     }
 
-    if(last_lbdev_idx == -1) {
-        if(last_nmdev1_idx == -1) {
-            snprintf(data, 64, "xxxxx#xxxxx-xxxxx#%05d-%05d#%d#x-x#x-x#x-x#x#x#x\r\n", first_avail_idx, second_avail_idx, val);
-        }else {
-            nm1vttydev = index_manager[last_nmdev1_idx].vttydev;
-            nm2vttydev = index_manager[last_nmdev2_idx].vttydev;
-            snprintf(data, 64, "xxxxx#%05d-%05d#%05d-%05d#%d#x-x#%d-%d#%d-%d#x#%d#%d\r\n", last_nmdev1_idx, last_nmdev2_idx,
-                    first_avail_idx, second_avail_idx, val, nm1vttydev->rts_mappings, nm1vttydev->dtr_mappings,
-                    nm2vttydev->rts_mappings, nm2vttydev->dtr_mappings, nm1vttydev->set_odtr_at_open, nm2vttydev->set_odtr_at_open);
+    if(tty_to_write != NULL) {
+        switch (tty_to_write->termios.c_cflag & CSIZE) {
+        case CS8:
+            data = ch;
+            break;
+        case CS7:
+            data = ch & 0x7F;
+            break;
+        case CS6:
+            data = ch & 0x3F;
+            break;
+        case CS5:
+            data = ch & 0x1F;
+            break;
+        default:
+            data = ch;
         }
+        sp_deliver_rx(tty_to_write, rx_vttydev, &data, 1);
+        tx_vttydev->icount.tx++;
+        rx_vttydev->icount.rx++;
     }else {
-        if(last_nmdev1_idx == -1) {
-            lbvttydev = index_manager[last_lbdev_idx].vttydev;
-            snprintf(data, 64, "%05d#xxxxx-xxxxx#%05d-%05d#%d#%d-%d#x-x#x-x#%d#x#x\r\n", last_lbdev_idx, first_avail_idx,
-                    second_avail_idx, val, lbvttydev->rts_mappings, lbvttydev->dtr_mappings, lbvttydev->set_odtr_at_open);
-        }else {
-            lbvttydev = index_manager[last_lbdev_idx].vttydev;
-            nm1vttydev = index_manager[last_nmdev1_idx].vttydev;
-            nm2vttydev = index_manager[last_nmdev2_idx].vttydev;
-            snprintf(data, 64, "%05d#%05d-%05d#%05d-%05d#%d#%d-%d#%d-%d#%d-%d#%d#%d#%d\r\n", last_lbdev_idx, last_nmdev1_idx,
-                    last_nmdev2_idx, first_avail_idx, second_avail_idx, val, lbvttydev->rts_mappings, lbvttydev->dtr_mappings,
-                    nm1vttydev->rts_mappings, nm1vttydev->dtr_mappings, nm2vttydev->rts_mappings, nm2vttydev->dtr_mappings, 
-                    lbvttydev->set_odtr_at_open, nm1vttydev->set_odtr_at_open, nm2vttydev->set_odtr_at_open);
-        }
+        tx_vttydev->icount.tx++;
     }
 
-    mutex_unlock(&adaptlock);
-
-    ret = copy_to_user(buf, &data, 52);
-    if(ret)
-        return -EFAULT;
+    return 1;
+}
 
-    return 52;
+/*
+ * Invoked by tty layer indicating that the driver should inform tty device to start transmitting data out
+ * of serial port physically. This tty device already transmit data as soon as it receive it.
+ *
+ * @tty: tty device who should start transmission.
+ */
+static void sp_flush_chars(struct tty_struct *tty)
+{
 }
 
 /*
- * Extract pin mappings from local to remote tty devices.
+ * Provides port specific information to the caller as a result of executing  TIOCGSERIAL
+ * ioctl command.
  *
- * @data: dat to be parsed.
- * @x: starting index in array for parsing.
- * 
- * @return 0 on success or negative error code on failure.
+ * @tty: tty device associated with port in question.
+ * @arg: user space buffer for returning information.
+ *
+ * @return 0 on success otherwise a negative error code on failure.
  */
-static int sp_extract_pin_mapping(char data[], int x) 
+static int sp_get_serial_info(struct tty_struct *tty, unsigned long arg)
 {
-    int i = 0;
-    int mapping = 0;
+    struct serial_struct info;
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    struct serial_struct serial = local_vttydev->serial;
 
-    for(i=0; i<8; i++) {
-        if(data[x] == '8') {
-            mapping |= SP_CON_CTS;
-        }else if(data[x] == '1') {
-            mapping |= SP_CON_DCD;
-        }else if(data[x] == '6') {
-            mapping |= SP_CON_DSR;
-        }else if(data[x] == '9') {
-            mapping |= SP_CON_RI;
-        }else if(data[x] == '#') {
-            break;
-        }else if((data[x] == 'x') || (data[x] == ',')) {
-        }else {
-            return -EINVAL;
-        }
-        x++;
-    }
+    if (!arg)
+        return -EFAULT;
 
-    return mapping;
+    memset(&info, 0, sizeof(info));
+
+    info.type           = PORT_UNKNOWN;
+    info.line           = serial.line;
+    info.port           = tty->index;
+    info.irq            = 0;
+    info.flags          = tty->port->flags;
+    info.xmit_fifo_size = 0;
+    info.baud_base      = 0;
+    info.close_delay    = tty->port->close_delay;
+    info.closing_wait   = tty->port->closing_wait;
+    info.custom_divisor = 0;
+    info.hub6           = 0;
+    info.io_type        = SERIAL_IO_MEM;
+
+    return (copy_to_user((void __user *)arg, &info, sizeof(struct serial_struct))) ? -EFAULT : 0;
 }
 
 /*
- * This function is equivalent to a typical 'probe' function in linux device driver model for this virtual
- * card.
- *
- * Standard DB9 pin assignment: 1 - DCD, 2 - RX, 3 - TX, 4 - DTR, 5 - GND, 6 - DSR, 7 - RTS, 8 - CTS, 9 - RI.
- *
- * Assignment 7-8 means connect local RTS pin to remote CTS pin. Assignment 4-1,6 means connect local DTR to
- * remote DSR and DCD pins. Assignment 7-x means leave local RTS pin unconnected. The 'y' at last will raise
- * remote DCD pin when local device is opened. When removing tty device, if the given device is one of the
- * device in a null modem pair, coupled device will also be deleted automatically. The command string is case
- * sensitive. The last and second last x/y defines if DTR should be raised or not when port is opened.
- *
- * 1. Create standard null modem connection:
- * $echo "gennm#vdev1#vdev2#7-8,x,x,x#4-1,6,x,x#7-8,x,x,x#4-1,6,x,x#y#y" > /proc/sp_vmpscrdk
- *
- * 2. Create standard loop back connection:
- * $echo "genlb#vdevt#xxxxx#7-8,x,x,x#4-1,6,x,x#x-x,x,x,x#x-x,x,x,x#y#x" > /proc/sp_vmpscrdk
- *
- * 3. Delete a particular tty device:
- * $echo "del#vdevt#xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx" > /proc/sp_vmpscrdk
+ * Return the number of bytes that can be queued to this device at the present time. The result should be
+ * treated as a guarantee and the driver cannot offer a value it later shrinks by more than the number of
+ * bytes written.
  *
- * 4. Delete all virtual tty devices in this card:
- * $echo "del#xxxxx#xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx" > /proc/sp_vmpscrdk
+ * @tty: tty device enquired.
  *
- * @file: file representing sp proc file.
- * @buf: command supplied by the caller.
- * @length: length of the command.
- * @ppos: offset in file.
+ * @return number of bytes that can be queued to this device at the present time.
+ */
+static int sp_write_room(struct tty_struct *tty)
+{
+    int room = 2048;
+    unsigned long flags;
+    struct vtty_dev *tx_vttydev = index_manager[tty->index].vttydev;
+
+    if (tx_vttydev->tx_paused || !tty || tty->stopped || tty->hw_stopped)
+        return 0;
+
+    spin_lock_irqsave(&tx_vttydev->relay_lock, flags);
+    if(tx_vttydev->relay != NULL)
+        room = kfifo_avail(&tx_vttydev->relay->tx_fifo);
+    spin_unlock_irqrestore(&tx_vttydev->relay_lock, flags);
+
+    return room;
+}
+
+/*
+ * Invoked when the termios structure (terminal settings) for this tty device is changed. The old_termios
+ * contains currently active settings and tty->termios contains new settings to be applied.
  *
- * @return number of bytes consumed by this function on success or negative error code on failure.
+ * @tty: tty device whose line settings is to be updated.
+ * @old_termios: currently applied serial line settings.
  */
-static ssize_t sp_vcard_proc_write(struct file *file, const char __user *buf, size_t length, loff_t * ppos)
+static void sp_set_termios(struct tty_struct *tty, struct ktermios *old_termios)
 {
-    int x = -1;
-    int y = -1;
-    int i = -1;
-    int ret = -1;
-    int create = -1;
-    int vdev1idx = -1;
-    int vdev2idx = -1;
-    int vdev1rts = 0;
-    int vdev2rts = 0;
-    int vdev1dtr = 0;
-    int vdev2dtr = 0;
-    int is_loopback = -1;
+    u32 baud = 0;
+    int uart_frame_settings = 0;
+    unsigned int rts_mappings = 0;
+    unsigned int dtr_mappings = 0;
+    unsigned int mask = TIOCM_DTR;
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    struct vtty_dev *remote_vttydev = NULL;
 
-    char tmp[8];
-    char data[64];
+    rts_mappings = local_vttydev->rts_mappings;
+    dtr_mappings = local_vttydev->dtr_mappings;
 
-    struct vtty_dev *vttydev1 = NULL;
-    struct vtty_dev *vttydev2 = NULL;
-    struct device *device1 = NULL;
-    struct device *device2 = NULL;
-    struct tty_struct *tty;
+    if(tty->index != local_vttydev->peer_index)
+        remote_vttydev = index_manager[local_vttydev->peer_index].vttydev;
 
-    if(length == 2) {
-        memcpy(data, "gennm#xxxxx#xxxxx#7-8,x,x,x#4-1,6,x,x#7-8,x,x,x#4-1,6,x,x#y#y", 61);
-    }else if(length == 3) {
-        memcpy(data, "genlb#xxxxx#xxxxx#7-8,x,x,x#4-1,6,x,x#x-x,x,x,x#x-x,x,x,x#y#x", 61);
-    }else if((length > 60) && (length < 63)) {
-        if(copy_from_user(data, buf, length) != 0) {
-            return -EFAULT;
-        }
-    }else {
-        return -EINVAL;
+    mutex_lock(&local_vttydev->lock);
+
+    /* Typically B0 is used to terminate the connection. Drop RTS and DTR. */
+    if ((tty->termios.c_cflag & CBAUD) == B0 ) {
+        sp_update_modem_lines(tty, 0, TIOCM_DTR | TIOCM_RTS);
+        mutex_unlock(&local_vttydev->lock);
+        return;
     }
-    data[62] = '\0';
 
-    /* Initial sanitization */
-    if((data[0] == 'g') && (data[1] == 'e') && (data[2] == 'n')) {
-        if((data[3] == 'n') && (data[4] == 'm')) {
-        }else if((data[3] == 'l') && (data[4] == 'b')) {
-            is_loopback = 1;
-        }else {
-            return -EINVAL;
+    /* If coming out of B0, raise DTR and RTS. This might get overridden in next steps. Applications like
+     * minicom when opens a serial port, may drop speed to B0 and then back to normal speed again. */
+    if (!old_termios || (old_termios->c_cflag & CBAUD) == B0) {
+        if (!(tty->termios.c_cflag & CRTSCTS) || !test_bit(TTY_THROTTLED, &tty->flags)) {
+            mask |= TIOCM_RTS;
+            sp_update_modem_lines(tty, mask, 0);
         }
-        create = 1;
-    }else if((data[0] == 'd') && (data[1] == 'e') && (data[2] == 'l')) {
-        create = -1;
-    }else {
-        return -EINVAL;
     }
 
-    if(create == 1) {
-        /* Create device(s) command sent */
-
-        /* Extract 1st device index (for both null modem and loop back) */
-        x = 6;
-        if(data[6] != 'x') {
-            memset(tmp, '\0', sizeof(tmp));
-            for(i=0; i<5; i++) {
-                tmp[i] = data[x];
-                x++;
-            }
-            ret = kstrtouint(tmp, 10, &vdev1idx);
-            if(ret != 0)
-                return ret;
-            if((vdev1idx < 0) || (vdev1idx > 65535))
-                return -EINVAL;
-        }
+    baud = tty_get_baud_rate(tty);
+    if (!baud) {
+        baud = 9600;
+    }
+    tty_encode_baud_rate(tty, baud, baud);
 
-        vttydev1 = (struct vtty_dev *) kcalloc(1, sizeof(struct vtty_dev), GFP_KERNEL);
-        if(vttydev1 == NULL)
-            return -ENOMEM;
+    local_vttydev->baud = baud;
 
-        /* Extract 2nd device index if null modem pair is to be created */
-        if(is_loopback != 1) {
-            x = 12;
-            if(data[x] != 'x') {
-                memset(tmp, '\0', sizeof(tmp));
-                i = 0;
-                for(i=0; i<5; i++) {
-                    tmp[i] = data[x];
-                    x++;
-                }
-                ret = kstrtouint(tmp, 10, &vdev2idx);
-                if(ret != 0)
-                    return ret;
-                if((vdev2idx < 0) || (vdev2idx > 65535)) {
-                    ret = -EINVAL;
-                    goto fail_arg;
-                }
+    if (tty->termios.c_cflag & CRTSCTS) {
+        uart_frame_settings |= SP_CRTSCTS;
+    }else if((tty->termios.c_iflag & IXON) || (tty->termios.c_iflag & IXOFF)) {
+        uart_frame_settings |= SP_XON;
+    }else {
+        uart_frame_settings |= SP_NONE;
+    }
 
-            }
+    switch (tty->termios.c_cflag & CSIZE) {
+    case CS8: uart_frame_settings |= SP_DATA_8;
+    case CS7: uart_frame_settings |= SP_DATA_7;
+    case CS6: uart_frame_settings |= SP_DATA_6;
+    case CS5: uart_frame_settings |= SP_DATA_5;
+    default:  uart_frame_settings |= SP_DATA_8;
+    }
 
-            vttydev2 = (struct vtty_dev *) kcalloc(1, sizeof(struct vtty_dev), GFP_KERNEL);
-            if(vttydev2 == NULL) {
-                ret = -ENOMEM;
-                goto fail_arg;
-            }
-        }
+    if (tty->termios.c_cflag & CSTOPB)
+        uart_frame_settings |= SP_STOP_2;
+    else
+        uart_frame_settings |= SP_STOP_1;
 
-        /* rts mappings (dev1) */
-        if((data[18] != '7') || (data[19] != '-')) {
-            ret = -EINVAL;
-            goto fail_arg;
+    if (tty->termios.c_cflag & PARENB) {
+        if (tty->termios.c_cflag & CMSPAR) {
+            if (tty->termios.c_cflag & PARODD)
+                uart_frame_settings |= SP_PARITY_MARK;
+            else
+                uart_frame_settings |= SP_PARITY_SPACE;
+        }else {
+            if (tty->termios.c_cflag & PARODD)
+                uart_frame_settings |= SP_PARITY_ODD;
+            else
+                uart_frame_settings |= SP_PARITY_EVEN;
         }
-        ret = sp_extract_pin_mapping(data, 20);
-        if(ret < 0)
-            goto fail_arg;
-        vdev1rts = ret;
+    }else {
+        uart_frame_settings |= SP_PARITY_NONE;
+    }
 
-        if((data[27] != '#') || (data[28] != '4') || (data[29] != '-'))
-            goto fail_arg;
+    local_vttydev->uart_frame = uart_frame_settings;
 
-        /* dtr mapping (dev1) */
-        ret = sp_extract_pin_mapping(data, 30);
-        if(ret < 0)
-            goto fail_arg;
-        vdev1dtr = ret;
+    if(local_vttydev->odevtyp == RLY)
+        sp_relay_set_termios(local_vttydev, &tty->termios);
 
-        if(data[37] != '#')
-            goto fail_arg;
+    mutex_unlock(&local_vttydev->lock);
+}
 
-        if(is_loopback != 1) {
-            /* rts mappings (dev2) */
-            if((data[38] != '7') || (data[39] != '-')) {
-                ret = -EINVAL;
+/*
+ * Return the number of bytes of data in the device private output queue to be sent out. Invoked 
+ * when ioctl command TIOCOUTQ is executed or by tty layer as and when required (tty_wait_until_sent()).
+ *
+ * @tty: tty device enquired.
+ *
+ * @return number of bytes of data in the device private output queue.
+ */
+static int sp_chars_in_buffer(struct tty_struct *tty)
+{
+    int len = 0;
+    unsigned long flags;
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+
+    spin_lock_irqsave(&local_vttydev->relay_lock, flags);
+    if(local_vttydev->relay != NULL)
+        len = kfifo_len(&local_vttydev->relay->tx_fifo);
+    spin_unlock_irqrestore(&local_vttydev->relay_lock, flags);
+
+    return len;
+}
+
+/*
+ * Checks if any of the given signal line has changed based on interrupts.
+ *
+ * @local_vttydev: vtty device for which check has to be made.
+ * @mask: bit mask of TIOCM_RNG, TIOCM_DSR, TIOCM_CAR and TIOCM_CTS.
+ * @prev: values of previous interrupts
+ *.
+ * @return 1 if changed otherwise 0 if unchanged.
+ */
+static int sp_check_msr_delta(struct tty_struct *tty, struct vtty_dev *local_vttydev, unsigned long mask, struct async_icount *prev)
+{
+    struct async_icount now;
+    int delta = 0;
+
+    /* Use tty-port initialised flag to detect all hangups including the disconnect(device destroy) event */
+    if (!test_bit(ASYNCB_INITIALIZED, &tty->port->flags))
+        return 1;
+
+    mutex_lock(&local_vttydev->lock);
+    now = local_vttydev->icount;
+    mutex_unlock(&local_vttydev->lock);
+    delta = ((mask & TIOCM_RNG && prev->rng != now.rng) ||
+            ( mask & TIOCM_DSR && prev->dsr != now.dsr) ||
+            ( mask & TIOCM_CAR && prev->dcd != now.dcd) ||
+            ( mask & TIOCM_CTS && prev->cts != now.cts));
+
+    *prev = now;
+    return delta;
+}
+/*
+ * Sleeps until at-least one of the modem lines changes.
+ *
+ * @tty: tty device whose modem lines is to be monitored.
+ * @mask: bit mask of TIOCM_RNG, TIOCM_DSR, TIOCM_CAR and TIOCM_CTS.
+ *
+ * @return -ERESTARTSYS if it was interrupted by a signal and 0 if modem line changed.
+ */
+static int sp_wait_msr_change(struct tty_struct *tty, unsigned long mask)
+{
+    int ret = 0;
+    struct async_icount prev;
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+
+    mutex_lock(&local_vttydev->lock);
+    local_vttydev->waiting_msr_chg = 1;
+    prev = local_vttydev->icount;
+    mutex_unlock(&local_vttydev->lock);
+
+    ret = wait_event_interruptible(tty->port->delta_msr_wait, sp_check_msr_delta(tty, local_vttydev, mask, &prev));
+
+    local_vttydev->waiting_msr_chg = 0;
+
+    if (!ret && !test_bit(ASYNCB_INITIALIZED, &tty->port->flags))
+        ret = -EIO;
+
+    return ret;
+}
+
+/*
+ * Invoked to execute standard and device/driver specific ioctl commands.
+ *
+ * If the requested command is not supported, this driver will return -ENOIOCTLCMD so that the tty layer
+ * can invoke generic version of the givwn ioctl command if possible.
+ *
+ * @tty: tty device for whom given ioctl command is to be executed.
+ * @cmd: ioctl command to execute.
+ * @arg: arguments accompanying the command.
+ *
+ * @return 0 on success otherwise a negative error code on failures.
+ */
+static int sp_ioctl(struct tty_struct *tty, unsigned int cmd, unsigned long arg)
+{
+    switch (cmd) {
+    case TIOCGSERIAL:
+        return sp_get_serial_info(tty, arg);
+    case TIOCMIWAIT:
+        return sp_wait_msr_change(tty, arg);
+    case SP_IOC_RXTS_ENABLE:
+        return sp_rxts_enable(index_manager[tty->index].vttydev, arg);
+    case SP_IOC_RXTS_GET:
+        return sp_rxts_get(index_manager[tty->index].vttydev, arg);
+    case SP_IOC_FILTER_ATTACH:
+        if(!capable(CAP_NET_ADMIN) && !capable(CAP_SYS_ADMIN))
+            return -EPERM;
+        return sp_filter_attach(index_manager[tty->index].vttydev, (int) arg);
+    }
+
+    return -ENOIOCTLCMD;
+}
+
+/*
+ * Invoked when tty layer's input buffers are about to get full.
+ * 
+ * When using RTS/CTS flow control, when RTS line is de-asserted, interrupt will be generated 
+ * in hardware. The interrupt handler will raise a flag to indicate transmission should be stopped. 
+ * This is achieved in this driver through tx_paused variable.
+ *
+ * @tty: tty device whose buffers are about to get full.
+ */
+static void sp_throttle(struct tty_struct *tty)
+{
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    struct vtty_dev *remote_vttydev = index_manager[local_vttydev->peer_index].vttydev;
+
+    if (tty->termios.c_cflag & CRTSCTS) {
+        mutex_lock(&local_vttydev->lock);
+        remote_vttydev->tx_paused = 1;
+        sp_update_modem_lines(tty, 0, TIOCM_RTS);
+        mutex_unlock(&local_vttydev->lock);
+    }
+    else if((tty->termios.c_iflag & IXON) || (tty->termios.c_iflag & IXOFF)) {
+        sp_put_char(tty, STOP_CHAR(tty));
+    }
+    else {
+    }
+}
+
+/*
+ * Invoked when the tty layer's input buffers have been emptied out, and it now can accept more data.
+ *
+ * Throttle/unthrottle is about notifying remote end to start or stop data as per the flow control.
+ *
+ * Start/stop is about what action to take at local end itself to start or stop data as per the flow
+ * control.
+ *
+ * @tty: tty device which is ready to receive data.
+ */
+static void sp_unthrottle(struct tty_struct *tty)
+{
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    struct vtty_dev *remote_vttydev = index_manager[local_vttydev->peer_index].vttydev;
+
+    if (tty->termios.c_cflag & CRTSCTS) {
+        /* hardware (RTS/CTS) flow control */
+        mutex_lock(&local_vttydev->lock);
+        remote_vttydev->tx_paused = 0;
+        sp_update_modem_lines(tty, TIOCM_RTS, 0);
+        mutex_unlock(&local_vttydev->lock);
+
+        if (remote_vttydev->own_tty && remote_vttydev->own_tty->port)
+            tty_port_tty_wakeup(remote_vttydev->own_tty->port);
+    }
+    else if((tty->termios.c_iflag & IXON) || (tty->termios.c_iflag & IXOFF)) {
+        /* software flow control */
+        sp_put_char(tty, START_CHAR(tty));
+    }
+    else {
+        /* do nothing */
+    }
+}
+
+/*
+ * Invoked when this driver should stop sending data for example as a part of flow control mechanism.
+ *
+ * Line discipline n_tty calls this function if this device uses software flow control and an XOFF
+ * character is received from other end.
+ *
+ * @tty: tty device who should stop sending data to other end.
+ */
+static void sp_stop(struct tty_struct *tty)
+{
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    mutex_lock(&local_vttydev->lock);
+    local_vttydev->tx_paused = 1;
+    mutex_unlock(&local_vttydev->lock);
+}
+
+/*
+ * Invoked when this driver should start sending data for example as a part of flow control mechanism.
+ *
+ * Line discipline n_tty calls this function if this device uses software flow control and an XON
+ * character is received from other end.
+ *
+ * @tty: tty device who should start sending data to other end.
+ */
+static void sp_start(struct tty_struct *tty)
+{
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    mutex_lock(&local_vttydev->lock);
+    local_vttydev->tx_paused = 0;
+    mutex_unlock(&local_vttydev->lock);
+
+    if (tty && tty->port)
+        tty_port_tty_wakeup(tty->port);
+}
+
+/*
+ * Obtain the modem status bits for the given tty device. Invoked typically when ioctl command TIOCMGET
+ * is executed on this tty device.
+ *
+ * @tty: tty device whose status is enquired.
+ *
+ * @return bit mask (TIOCM_XXX) of modem control and modem status registers.
+ */
+static int sp_tiocmget(struct tty_struct *tty)
+{
+    int status = 0;
+    int msr_reg = 0;
+    int mcr_reg = 0;
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+
+    mutex_lock(&local_vttydev->lock);
+    mcr_reg = local_vttydev->mcr_reg;
+    msr_reg = sp_visible_msr(local_vttydev);
+    mutex_unlock(&local_vttydev->lock);
+
+    status= ((mcr_reg & SP_MCR_DTR)  ? TIOCM_DTR  : 0) |
+            ((mcr_reg & SP_MCR_RTS)  ? TIOCM_RTS  : 0) |
+            ((mcr_reg & SP_MCR_LOOP) ? TIOCM_LOOP : 0) |
+            ((msr_reg & SP_MSR_DCD)  ? TIOCM_CAR  : 0) |
+            ((msr_reg & SP_MSR_RI)   ? TIOCM_RI   : 0) |
+            ((msr_reg & SP_MSR_CTS)  ? TIOCM_CTS  : 0) |
+            ((msr_reg & SP_MSR_DSR)  ? TIOCM_DSR  : 0);
+    return status;
+}
+
+/*
+ * Set the modem status bits. Invoked typically when ioctl command TIOCMSET is executed on this tty
+ * device.
+ *
+ * @tty: tty device whose modem control register is to be updated with given value.
+ * @set: bit mask of signals which should be asserted.
+ * @clear: bit mask of signals which should be de-asserted.
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int sp_tiocmset(struct tty_struct *tty, unsigned int set, unsigned int clear)
+{
+    int ret = 0;
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    mutex_lock(&local_vttydev->lock);
+    ret = sp_update_modem_lines(tty, set, clear);
+    mutex_unlock(&local_vttydev->lock);
+    return ret;
+}
+
+/*
+ * Invoked by tty layer to turn break condition on and off for a tty device unconditionally.
+ *
+ * @tty: tty device who should set or reset given break condition on its output line.
+ * @state: 1 if break is to be asserted or 0 for de-assertion.
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int sp_break_ctl(struct tty_struct *tty, int break_state)
+{
+    struct tty_struct *tty_to_write = NULL;
+    struct vtty_dev *brk_rx_vttydev = NULL;
+    struct vtty_dev *brk_tx_vttydev = index_manager[tty->index].vttydev;
+
+    if(tty->index != brk_tx_vttydev->peer_index) {
+        tty_to_write = brk_tx_vttydev->peer_tty;
+        brk_rx_vttydev = index_manager[brk_tx_vttydev->peer_index].vttydev;
+    }
+    else {
+        tty_to_write = tty;
+        brk_rx_vttydev = brk_tx_vttydev;
+    }
+
+    mutex_lock(&brk_tx_vttydev->lock);
+
+    if (break_state != 0) {
+        if(brk_tx_vttydev->is_break_on == 1)
+            return 0;
+
+        brk_tx_vttydev->is_break_on = 1;
+        if(tty_to_write != NULL) {
+            tty_insert_flip_char(tty_to_write->port, 0, TTY_BREAK);
+            tty_flip_buffer_push(tty_to_write->port);
+            brk_rx_vttydev->icount.brk++;
+        }
+    }
+    else {
+        brk_tx_vttydev->is_break_on = 0;
+    }
+
+    mutex_unlock(&brk_tx_vttydev->lock);
+    return 0;
+}
+
+/*
+ * Invoked by tty layer to inform this driver that it should hangup the tty device (lower
+ * modem control lines after last process using tty devices closes the device or exited).
+ *
+ * Drop DTR/RTS if HUPCL is set. This causes any attached modem to hang up the line.
+ *
+ * On the receiving end, if CLOCAL bit is set, DCD will be ignored otherwise SIGHUP may be
+ * generated to indicate a line disconnect event.
+ *
+ * @tty: tty device that has hung up.
+ */
+static void sp_hangup(struct tty_struct *tty)
+{
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+
+    mutex_lock(&local_vttydev->lock);
+
+    /* Drops reference to tty */
+    tty_port_hangup(tty->port);
+
+    if (tty && C_HUPCL(tty))
+        sp_update_modem_lines(tty, 0, TIOCM_DTR | TIOCM_RTS);
+
+    mutex_unlock(&local_vttydev->lock);
+
+    dev_dbg(tty->dev, "hanged up !");
+}
+
+/*
+ * Invoked to execute ioctl command TIOCGICOUNT to get the number of interrupts. Both 1->0 and
+ * 0->1 transitions are counted, except for RI, where only 0->1 transitions are counted.
+ *
+ * @tty: tty device whose interrupts information is to be collected.
+ * @icount: memory location from which tty core will copy data to user space buffer.
+ *
+ * @return 0 on success otherwise negative error code on failure.
+ */
+static int sp_get_icount(struct tty_struct *tty, struct serial_icounter_struct *icount)
+{
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+    struct async_icount cnow;
+
+    mutex_lock(&local_vttydev->lock);
+    cnow = local_vttydev->icount;
+    mutex_unlock(&local_vttydev->lock);
+
+    icount->cts = cnow.cts;
+    icount->dsr = cnow.dsr;
+    icount->rng = cnow.rng;
+    icount->dcd = cnow.dcd;
+    icount->tx = cnow.tx;
+    icount->rx = cnow.rx;
+    icount->frame = cnow.frame;
+    icount->parity = cnow.parity;
+    icount->overrun = cnow.overrun;
+    icount->brk = cnow.brk;
+    icount->buf_overrun = cnow.buf_overrun;
+
+    return 0;
+}
+
+/*
+ * Discard the internal output buffer for this tty device. Typically it may be called when executing IOCTL
+ * TCOFLUSH, closing the serial port, when break is received in input stream (flushing is configured) or
+ * when hangup occurs.
+ *
+ * On the other hand, when IOCTL command TCIFLUSH is invoked, tty flip buffer and line discipline queue gets
+ * emptied without involvement of tty driver. The driver is generally expected not to keep data but send
+ * it to tty layer as soon as possible when it receives data.
+ *
+ * The virtual tty device created by this driver does not have any local buffer.
+ *
+ * @tty: tty device whose buffer should be flushed.
+ */
+static void sp_flush_buffer(struct tty_struct *tty)
+{
+}
+
+/*
+ * Invoked by tty layer to execute TCIOFF and TCION IOCTL commands generally because user space process
+ * called tcflow() function. It send a high priority character to the tty device end even if stopped.
+ *
+ * If this function (send_xchar) is defined by tty device driver, tty core will call this function. If
+ * it is not specified then tty core will first instruct this driver to start transmission (start())
+ * and then invoke write() of this driver passing character to be written and then it will call stop()
+ * function of this driver.
+ *
+ * @tty: tty device who is sending this character.
+ * @ch: character to be sent (typically it is XOFF or XON).
+ */
+static void sp_send_xchar(struct tty_struct *tty, char ch)
+{
+    int was_paused = 0;
+    struct vtty_dev *local_vttydev = index_manager[tty->index].vttydev;
+
+    was_paused = local_vttydev->tx_paused;
+    if(was_paused)
+        local_vttydev->tx_paused = 0;
+
+    sp_put_char(tty, ch);
+    if(was_paused)
+        local_vttydev->tx_paused = 1;
+}
+
+/*
+ * Invoked by tty layer in response to tcdrain() call.
+ *
+ * @tty: tty device who should try to empty its output buffer.
+ * @timeout: timeout value.
+ */
+static void sp_wait_until_sent(struct tty_struct *tty, int timeout)
+{
+}
+
+/*
+ * Asserts or de-asserts serial lines as specified by raise argument. It is handled by 
+ * this driver exlicitly as of now because this will eventually become entirely internal 
+ * to the tty port as per linux kernel development plan.
+ *
+ * @port serial port whose lines is to be updated
+ * @raise 1 if line should be asserted, 0 if line should be de-asserted
+static void sp_port_dtr_rts(struct tty_port *port, int raise) 
+{
+    if(raise == 1)
+        sp_update_modem_lines(port->tty, TIOCM_DTR | TIOCM_RTS, 0);
+    else
+        sp_update_modem_lines(port->tty, 0, TIOCM_DTR | TIOCM_RTS);
+}
+ */
+
+/*
+ * Checks if the given port has received its carrier detect line raised.
+ *
+ * @port: serial port whose carrier detect line is to be checked.
+ *
+ * @return 1 if the carrier is raised otherwise 0.
+ */
+static int sp_port_carrier_raised(struct tty_port *port)
+{
+    struct vtty_dev *local_vttydev = index_manager[port->tty->index].vttydev;
+    return (sp_visible_msr(local_vttydev) & SP_MSR_DCD) ? 1 : 0;
+}
+
+/*
+ * Shutdowns the given serial port, typically it is used to shutdown hardware.
+ *
+ * @port: tty port to shut down.
+ */
+static void sp_port_shutdown(struct tty_port *port)
+{
+}
+
+/*
+ * Activate the given serial port as opposed to shutdown. Typically used to turn something on hardware.
+ *
+ * @port: tty port to activate.
+ * @tty: tty corresponding to the given port.
+ * @return 0 on success.
+ */
+static int sp_port_activate(struct tty_port *port, struct tty_struct *tty)
+{
+    return 0;
+}
+
+/*
+ * Invoked when tty is going to be destroyed and driver should release resources.
+ *
+ * @port: port which is going to be freed.
+ */
+static void sp_port_destruct(struct tty_port *port)
+{
+    //kfree(port);
+}
+
+/*
+ * Gives next available index and last used index for virtual tty devices created. Invoke as shown below:
+ * $ head -c 52 /proc/sp_vmpscrdk
+ * 
+ * @file: file for proc file.
+ * @buf: user space buffer that will contain data when this function returns.
+ * @size: number of character returned in buf.
+ * @ppos: offset position from where to read data.
+ *
+ * @return number of bytes copied to user buffer on success or negative error code on error.
+ */
+static ssize_t sp_vcard_proc_read(struct file *file, char __user *buf, size_t size, loff_t *ppos)
+{
+    int x = 0;
+    int ret = 0;
+    int val = 0;
+    char data[64];
+    int first_avail_idx = -1;
+    int second_avail_idx = -1;
+    struct vtty_dev *lbvttydev = NULL;
+    struct vtty_dev *nm1vttydev = NULL;
+    struct vtty_dev *nm2vttydev = NULL;
+
+    memset(data, '\0', 64);
+
+    if(size != 52)
+        return -EINVAL;
+
+    mutex_lock(&adaptlock);
+
+    /* Find next available free index */
+    for(x = 0; x < max_num_vtty_dev; x++) {
+        if(index_manager[x].index == -1) {
+            if(first_avail_idx == -1) {
+                first_avail_idx = x;
+            }else {
+                second_avail_idx = x;
+                break;
+            }
+        }
+    }
+
+    if((first_avail_idx != -1) && (second_avail_idx != -1)) {
+        val = 2;
+    }else if((first_avail_idx != -1) && (second_avail_idx == -1)) {
+        val = 1;
+    }else if((first_avail_idx == -1) && (second_avail_idx == -1)) {
+        val = 0;
+    }else {
+        /* will not happen */
+    }
+
+    if(last_lbdev_idx == -1) {
+        if(last_nmdev1_idx == -1) {
+            snprintf(data, 64, "xxxxx#xxxxx-xxxxx#%05d-%05d#%d#x-x#x-x#x-x#x#x#x\r\n", first_avail_idx, second_avail_idx, val);
+        }else {
+            nm1vttydev = index_manager[last_nmdev1_idx].vttydev;
+            nm2vttydev = index_manager[last_nmdev2_idx].vttydev;
+            snprintf(data, 64, "xxxxx#%05d-%05d#%05d-%05d#%d#x-x#%d-%d#%d-%d#x#%d#%d\r\n", last_nmdev1_idx, last_nmdev2_idx,
+                    first_avail_idx, second_avail_idx, val, nm1vttydev->rts_mappings, nm1vttydev->dtr_mappings,
+                    nm2vttydev->rts_mappings, nm2vttydev->dtr_mappings, nm1vttydev->set_odtr_at_open, nm2vttydev->set_odtr_at_open);
+        }
+    }else {
+        if(last_nmdev1_idx == -1) {
+            lbvttydev = index_manager[last_lbdev_idx].vttydev;
+            snprintf(data, 64, "%05d#xxxxx-xxxxx#%05d-%05d#%d#%d-%d#x-x#x-x#%d#x#x\r\n", last_lbdev_idx, first_avail_idx,
+                    second_avail_idx, val, lbvttydev->rts_mappings, lbvttydev->dtr_mappings, lbvttydev->set_odtr_at_open);
+        }else {
+            lbvttydev = index_manager[last_lbdev_idx].vttydev;
+            nm1vttydev = index_manager[last_nmdev1_idx].vttydev;
+            nm2vttydev = index_manager[last_nmdev2_idx].vttydev;
+            snprintf(data, 64, "%05d#%05d-%05d#%05d-%05d#%d#%d-%d#%d-%d#%d-%d#%d#%d#%d\r\n", last_lbdev_idx, last_nmdev1_idx,
+                    last_nmdev2_idx, first_avail_idx, second_avail_idx, val, lbvttydev->rts_mappings, lbvttydev->dtr_mappings,
+                    nm1vttydev->rts_mappings, nm1vttydev->dtr_mappings, nm2vttydev->rts_mappings, nm2vttydev->dtr_mappings, 
+                    lbvttydev->set_odtr_at_open, nm1vttydev->set_odtr_at_open, nm2vttydev->set_odtr_at_open);
+        }
+    }
+
+    mutex_unlock(&adaptlock);
+
+    ret = copy_to_user(buf, &data, 52);
+    if(ret)
+        return -EFAULT;
+
+    return 52;
+}
+
+/*
+ * Extract pin mappings from local to remote tty devices.
+ *
+ * @data: dat to be parsed.
+ * @x: starting index in array for parsing.
+ * 
+ * @return 0 on success or negative error code on failure.
+ */
+static int sp_extract_pin_mapping(char data[], int x) 
+{
+    int i = 0;
+    int mapping = 0;
+
+    for(i=0; i<8; i++) {
+        if(data[x] == '8') {
+            mapping |= SP_CON_CTS;
+        }else if(data[x] == '1') {
+            mapping |= SP_CON_DCD;
+        }else if(data[x] == '6') {
+            mapping |= SP_CON_DSR;
+        }else if(data[x] == '9') {
+            mapping |= SP_CON_RI;
+        }else if(data[x] == '#') {
+            break;
+        }else if((data[x] == 'x') || (data[x] == ',')) {
+        }else {
+            return -EINVAL;
+        }
+        x++;
+    }
+
+    return mapping;
+}
+
+/*
+ * This function is equivalent to a typical 'probe' function in linux device driver model for this virtual
+ * card.
+ *
+ * Standard DB9 pin assignment: 1 - DCD, 2 - RX, 3 - TX, 4 - DTR, 5 - GND, 6 - DSR, 7 - RTS, 8 - CTS, 9 - RI.
+ *
+ * Assignment 7-8 means connect local RTS pin to remote CTS pin. Assignment 4-1,6 means connect local DTR to
+ * remote DSR and DCD pins. Assignment 7-x means leave local RTS pin unconnected. The 'y' at last will raise
+ * remote DCD pin when local device is opened. When removing tty device, if the given device is one of the
+ * device in a null modem pair, coupled device will also be deleted automatically. The command string is case
+ * sensitive. The last and second last x/y defines if DTR should be raised or not when port is opened.
+ *
+ * 1. Create standard null modem connection:
+ * $echo "gennm#vdev1#vdev2#7-8,x,x,x#4-1,6,x,x#7-8,x,x,x#4-1,6,x,x#y#y" > /proc/sp_vmpscrdk
+ *
+ * 2. Create standard loop back connection:
+ * $echo "genlb#vdevt#xxxxx#7-8,x,x,x#4-1,6,x,x#x-x,x,x,x#x-x,x,x,x#y#x" > /proc/sp_vmpscrdk
+ *
+ * 3. Delete a particular tty device:
+ * $echo "del#vdevt#xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx" > /proc/sp_vmpscrdk
+ *
+ * 4. Delete all virtual tty devices in this card:
+ * $echo "del#xxxxx#xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx" > /proc/sp_vmpscrdk
+ *
+ * @file: file representing sp proc file.
+ * @buf: command supplied by the caller.
+ * @length: length of the command.
+ * @ppos: offset in file.
+ *
+ * @return number of bytes consumed by this function on success or negative error code on failure.
+ */
+static ssize_t sp_vcard_proc_write(struct file *file, const char __user *buf, size_t length, loff_t * ppos)
+{
+    int x = -1;
+    int y = -1;
+    int i = -1;
+    int ret = -1;
+    int create = -1;
+    int vdev1idx = -1;
+    int vdev2idx = -1;
+    int vdev1rts = 0;
+    int vdev2rts = 0;
+    int vdev1dtr = 0;
+    int vdev2dtr = 0;
+    int is_loopback = -1;
+
+    char tmp[8];
+    char data[64];
+
+    struct vtty_dev *vttydev1 = NULL;
+    struct vtty_dev *vttydev2 = NULL;
+    struct device *device1 = NULL;
+    struct device *device2 = NULL;
+
+    if(length == 2) {
+        memcpy(data, "gennm#xxxxx#xxxxx#7-8,x,x,x#4-1,6,x,x#7-8,x,x,x#4-1,6,x,x#y#y", 61);
+    }else if(length == 3) {
+        memcpy(data, "genlb#xxxxx#xxxxx#7-8,x,x,x#4-1,6,x,x#x-x,x,x,x#x-x,x,x,x#y#x", 61);
+    }else if((length > 60) && (length < 63)) {
+        if(copy_from_user(data, buf, length) != 0) {
+            return -EFAULT;
+        }
+    }else {
+        return -EINVAL;
+    }
+    data[62] = '\0';
+
+    /* Initial sanitization */
+    if((data[0] == 'g') && (data[1] == 'e') && (data[2] == 'n')) {
+        if((data[3] == 'n') && (data[4] == 'm')) {
+        }else if((data[3] == 'l') && (data[4] == 'b')) {
+            is_loopback = 1;
+        }else {
+            return -EINVAL;
+        }
+        create = 1;
+    }else if((data[0] == 'd') && (data[1] == 'e') && (data[2] == 'l')) {
+        create = -1;
+    }else {
+        return -EINVAL;
+    }
+
+    if(create == 1) {
+        /* Create device(s) command sent */
+
+        /* Extract 1st device index (for both null modem and loop back) */
+        x = 6;
+        if(data[6] != 'x') {
+            memset(tmp, '\0', sizeof(tmp));
+            for(i=0; i<5; i++) {
+                tmp[i] = data[x];
+                x++;
+            }
+            ret = kstrtouint(tmp, 10, &vdev1idx);
+            if(ret != 0)
+                return ret;
+            if((vdev1idx < 0) || (vdev1idx > 65535))
+                return -EINVAL;
+        }
+
+        vttydev1 = (struct vtty_dev *) kcalloc(1, sizeof(struct vtty_dev), GFP_KERNEL);
+        if(vttydev1 == NULL)
+            return -ENOMEM;
+
+        /* Extract 2nd device index if null modem pair is to be created */
+        if(is_loopback != 1) {
+            x = 12;
+            if(data[x] != 'x') {
+                memset(tmp, '\0', sizeof(tmp));
+                i = 0;
+                for(i=0; i<5; i++) {
+                    tmp[i] = data[x];
+                    x++;
+                }
+                ret = kstrtouint(tmp, 10, &vdev2idx);
+                if(ret != 0)
+                    return ret;
+                if((vdev2idx < 0) || (vdev2idx > 65535)) {
+                    ret = -EINVAL;
+                    goto fail_arg;
+                }
+
+            }
+
+            vttydev2 = (struct vtty_dev *) kcalloc(1, sizeof(struct vtty_dev), GFP_KERNEL);
+            if(vttydev2 == NULL) {
+                ret = -ENOMEM;
+                goto fail_arg;
+            }
+        }
+
+        /* rts mappings (dev1) */
+        if((data[18] != '7') || (data[19] != '-')) {
+            ret = -EINVAL;
+            goto fail_arg;
+        }
+        ret = sp_extract_pin_mapping(data, 20);
+        if(ret < 0)
+            goto fail_arg;
+        vdev1rts = ret;
+
+        if((data[27] != '#') || (data[28] != '4') || (data[29] != '-'))
+            goto fail_arg;
+
+        /* dtr mapping (dev1) */
+        ret = sp_extract_pin_mapping(data, 30);
+        if(ret < 0)
+            goto fail_arg;
+        vdev1dtr = ret;
+
+        if(data[37] != '#')
+            goto fail_arg;
+
+        if(is_loopback != 1) {
+            /* rts mappings (dev2) */
+            if((data[38] != '7') || (data[39] != '-')) {
+                ret = -EINVAL;
+                goto fail_arg;
+            }
+            ret = sp_extract_pin_mapping(data, 40);
+            if(ret < 0)
+                goto fail_arg;
+            vdev2rts = ret;
+
+            /* dtr mapping (dev2) */
+            if((data[47] != '#') || (data[48] != '4') || (data[49] != '-'))
+                goto fail_arg;
+
+            ret = sp_extract_pin_mapping(data, 50);
+            if(ret < 0)
+                goto fail_arg;
+            vdev2dtr = ret;
+
+            if(data[57] != '#')
                 goto fail_arg;
+        }
+
+        /* Create serial port (tty device) with lock taken to ensure correctness of index in use
+           and associated data */
+        mutex_lock(&adaptlock);
+
+        i = -1;
+        if(vdev1idx == -1) {
+            for(x=0; x < max_num_vtty_dev; x++) {
+                if(index_manager[x].index == -1) {
+                    i = x;
+                    break;
+                }
             }
-            ret = sp_extract_pin_mapping(data, 40);
-            if(ret < 0)
+        }else {
+            if(index_manager[vdev1idx].index == -1) {
+                i = vdev1idx;
+            }else {
+                ret = -EEXIST;
+                mutex_unlock(&adaptlock);
                 goto fail_arg;
-            vdev2rts = ret;
+            }
+        }
+        if(i == -1) {
+            ret = -ENOMEM;
+            mutex_unlock(&adaptlock);
+            goto fail_arg;
+        }
+
+        /* Initialize meta information and create 1st serial port */
+        if(data[58] == 'y')
+            vttydev1->set_odtr_at_open = 1;
+        else
+            vttydev1->set_odtr_at_open = 0;
+        vttydev1->own_tty = NULL;
+        vttydev1->peer_tty = NULL;
+        vttydev1->own_index = i;
+        vttydev1->peer_index = i;
+        vttydev1->rts_mappings = vdev1rts;
+        vttydev1->dtr_mappings = vdev1dtr;
+        vttydev1->msr_reg = 0;
+        vttydev1->mcr_reg = 0;
+        vttydev1->waiting_msr_chg = 0;
+        vttydev1->tx_paused = 0;
+        vttydev1->faulty_cable = 0;
+        index_manager[i].index = i;
+        index_manager[i].vttydev = vttydev1;
+        mutex_init(&vttydev1->lock);
+        spin_lock_init(&vttydev1->hp_lock);
+        INIT_DELAYED_WORK(&vttydev1->hp_work, sp_hotplug_work);
+        spin_lock_init(&vttydev1->rxts_lock);
+        spin_lock_init(&vttydev1->rx_lock);
+        INIT_DELAYED_WORK(&vttydev1->rx_work, sp_persona_rx_work);
+        INIT_DELAYED_WORK(&vttydev1->msr_work, sp_persona_msr_work);
+        vttydev1->persona = &sp_personalities[0];
+        mutex_init(&vttydev1->relay_mutex);
+        spin_lock_init(&vttydev1->relay_lock);
+
+        if(is_loopback != 1) {
+            y = -1;
+            if(vdev2idx == -1) {
+                for(x=0; x < max_num_vtty_dev; x++) {
+                    if(index_manager[x].index == -1) {
+                        y = x;
+                        break;
+                    }
+                }
+            }else {
+                if(index_manager[vdev2idx].index == -1) {
+                    y = vdev2idx;
+                }else {
+                    ret = -EEXIST;
+                    mutex_unlock(&adaptlock);
+                    goto fail_arg;
+                }
+            }
+            if(y == -1) {
+                ret = -ENOMEM;
+                mutex_unlock(&adaptlock);
+                goto fail_arg;
+            }
+
+            /* Initialize meta information and create 2nd serial port */
+            if(data[60] == 'y')
+                vttydev2->set_odtr_at_open = 1;
+            else
+                vttydev2->set_odtr_at_open = 0;
+            vttydev2->set_pdtr_at_open = vttydev1->set_odtr_at_open;
+            vttydev1->set_pdtr_at_open = vttydev2->set_odtr_at_open;
+            vttydev1->own_index = i;
+            vttydev1->peer_index = y;
+            vttydev2->own_index = y;
+            vttydev2->peer_index = i;
+            vttydev2->own_tty = NULL;
+            vttydev2->peer_tty = NULL;
+            vttydev2->rts_mappings = vdev2rts;
+            vttydev2->dtr_mappings = vdev2dtr;
+            vttydev2->msr_reg = 0;
+            vttydev2->mcr_reg = 0;
+            vttydev2->waiting_msr_chg = 0;
+            vttydev2->tx_paused = 0;
+            vttydev2->faulty_cable = 0;
+            index_manager[y].index = y;
+            index_manager[y].vttydev = vttydev2;
+            mutex_init(&vttydev2->lock);
+            spin_lock_init(&vttydev2->hp_lock);
+            INIT_DELAYED_WORK(&vttydev2->hp_work, sp_hotplug_work);
+            spin_lock_init(&vttydev2->rxts_lock);
+            spin_lock_init(&vttydev2->rx_lock);
+            INIT_DELAYED_WORK(&vttydev2->rx_work, sp_persona_rx_work);
+            INIT_DELAYED_WORK(&vttydev2->msr_work, sp_persona_msr_work);
+            vttydev2->persona = &sp_personalities[0];
+            mutex_init(&vttydev2->relay_mutex);
+            spin_lock_init(&vttydev2->relay_lock);
+        }
+
+        device1 = tty_register_device(spvtty_driver, i, NULL);
+        if(device1 == NULL) {
+            ret = -ENOMEM;
+            mutex_unlock(&adaptlock);
+            goto fail_arg;
+        }
+
+        vttydev1->device = device1;
+        dev_set_drvdata(device1, vttydev1);
+
+        x = sysfs_create_group(&device1->kobj, &sp_info_attr_group);
+        if(x < 0) {
+            tty_unregister_device(spvtty_driver, i);
+            mutex_unlock(&adaptlock);
+            goto fail_arg;
+        }
+
+        if(is_loopback != 1) {
+            device2 = tty_register_device(spvtty_driver, y, NULL);
+            if(device2 == NULL) {
+                ret = -ENOMEM;
+                mutex_unlock(&adaptlock);
+                goto fail_register;
+            }
+
+            vttydev2->device = device2;
+            dev_set_drvdata(device2, vttydev2);
+
+            x = sysfs_create_group(&device2->kobj, &sp_info_attr_group);
+            if(x < 0) {
+                tty_unregister_device(spvtty_driver, y);
+                index_manager[y].index = -1;
+                mutex_unlock(&adaptlock);
+                goto fail_register;
+            }
+
+            last_nmdev1_idx = i;
+            last_nmdev2_idx = y;
+            ++total_nm_pair;
+
+            if((vttydev1->dtr_mappings != (SP_CON_DSR | SP_CON_DCD)) || (vttydev1->rts_mappings != SP_CON_CTS)
+                    || (vttydev1->set_odtr_at_open != 1) || (vttydev2->dtr_mappings != (SP_CON_DSR | SP_CON_DCD))
+                    || (vttydev2->rts_mappings != SP_CON_CTS) || (vttydev2->set_odtr_at_open != 1)) {
+                vttydev1->odevtyp = CNM;
+                vttydev2->odevtyp = CNM;
+            }else {
+                vttydev1->odevtyp = SNM;
+                vttydev2->odevtyp = SNM;
+            }            
+        }else {
+            last_lbdev_idx = i;
+            ++total_lb_devs;
+
+            /* device type */
+            if((vttydev1->dtr_mappings != (SP_CON_DSR | SP_CON_DCD)) || (vttydev1->rts_mappings != SP_CON_CTS)
+                    || (vttydev1->set_odtr_at_open != 1)) {
+                vttydev1->odevtyp = CLB;
+            }else {
+                vttydev1->odevtyp = SLB;
+            }
+        }
+
+        mutex_unlock(&adaptlock);
+    }
+    else {
+        /* Destroy device command sent */
+
+        if((total_nm_pair <= 0) && (total_lb_devs <= 0))
+            return length;
+
+        /* An application may forget to close serial port or it might have been crashed resulting in
+         * unclosed port and hence leaked resources. We handle such scenarios as disconnected event
+         * as done in case of a plug and play for example usb device. Application is running, port
+         * is opened and then suddenly user removes tty device. */
+
+        if(data[8] == 'x') {
+
+            /* Delete all virtual devices */
+
+            mutex_lock(&adaptlock);
+
+            /* First tty must be released and than port. */
+            for(x=0; x < max_num_vtty_dev; x++) {
+                if (index_manager[x].index != -1) {
+
+                    vttydev1 = index_manager[x].vttydev;
+                    if (vttydev1 != NULL) {
+                        sp_unregister_vttydev(vttydev1);
+                        sp_free_vttydev(vttydev1);
+                    }
+                    index_manager[x].index = -1;
+                }
+            }
+
+            total_nm_pair = 0;
+            total_lb_devs = 0;
+            last_lbdev_idx  = -1;
+            last_nmdev1_idx = -1;
+            last_nmdev2_idx = -1;
+
+            mutex_unlock(&adaptlock);
+        }
+        else {
+
+            /* Delete a specific virtual device */
+
+            x = 4;
+            memset(tmp, '\0', sizeof(tmp));
+            i = 0;
+            for(i=0; i<5; i++) {
+                tmp[i] = data[x];
+                x++;
+            }
+
+            x = -1;
+            y = -1;
+
+            ret = kstrtouint(tmp, 10, &vdev1idx);
+            if(ret != 0)
+                return ret;
+
+            if((vdev1idx >= 0) && (vdev1idx <= 65535) && (index_manager[vdev1idx].index != -1)) {
+                mutex_lock(&adaptlock);
+
+                x = index_manager[vdev1idx].index;
+                vttydev1 = index_manager[x].vttydev;
+                sp_unregister_vttydev(vttydev1);
+
+                if (vttydev1->own_index != vttydev1->peer_index) {
+                    y = index_manager[vttydev1->peer_index].index;
+                    vttydev2 = index_manager[y].vttydev;
+                    sp_unregister_vttydev(vttydev2);
+                }
+
+                if (x != -1) {
+                    sp_free_vttydev(index_manager[x].vttydev);
+                    index_manager[x].index = -1;
+                }
+                if (y != -1) {
+                    sp_free_vttydev(index_manager[y].vttydev);
+                    index_manager[y].index = -1;
+                    --total_nm_pair;
+                }else {
+                    --total_lb_devs;
+                }
+
+                mutex_unlock(&adaptlock);
+
+            }else {
+                return -EINVAL;
+            }
+        }
+    }
+
+    return length;
+
+    fail_register:
+    sysfs_remove_group(&device1->kobj, &sp_info_attr_group);
+    tty_unregister_device(spvtty_driver, i);
+
+    fail_arg:
+    index_manager[i].index = -1;
 
-            /* dtr mapping (dev2) */
-            if((data[47] != '#') || (data[48] != '4') || (data[49] != '-'))
-                goto fail_arg;
+    if(vttydev2 != NULL)
+        kfree(vttydev2);
 
-            ret = sp_extract_pin_mapping(data, 50);
-            if(ret < 0)
-                goto fail_arg;
-            vdev2dtr = ret;
+    if(vttydev1 != NULL)
+        kfree(vttydev1);
 
-            if(data[57] != '#')
-                goto fail_arg;
-        }
+    return ret;
+}
 
-        /* Create serial port (tty device) with lock taken to ensure correctness of index in use
-           and associated data */
-        mutex_lock(&adaptlock);
+/*
+ * Invoked when user space process opens /proc/sp_vmpscrdk file to create/destroy
+ * virtual tty device(s).
+ *
+ * @inode: inode in file system corresponding to this file
+ * @file: file representing sp proc file
+ *
+ * @return 0 on success.
+ */
+static int sp_vcard_proc_open(struct inode *inode, struct  file *file)
+{
+    return 0;
+}
 
-        i = -1;
-        if(vdev1idx == -1) {
-            for(x=0; x < max_num_vtty_dev; x++) {
-                if(index_manager[x].index == -1) {
-                    i = x;
-                    break;
-                }
-            }
-        }else {
-            if(index_manager[vdev1idx].index == -1) {
-                i = vdev1idx;
-            }else {
-                ret = -EEXIST;
-                mutex_unlock(&adaptlock);
-                goto fail_arg;
-            }
-        }
-        if(i == -1) {
-            ret = -ENOMEM;
-            mutex_unlock(&adaptlock);
-            goto fail_arg;
+/*
+ * Invoked when user space process closes /proc/sp_vmpscrdk file.
+ *
+ * @inode: inode in file system corresponding to this file.
+ * @file: file representing sp proc file.
+ *
+ * @return 0 on success.
+ */
+static int sp_vcard_proc_close(struct inode *inode, struct file *file)
+{
+    return 0;
+}
+
+/*
+ * Finds the first existing device at or after the position given and starts the iteration over all
+ * devices. The adaptlock is held until sp_vcard_info_stop() is called, so devices can not be created or
+ * destroyed while a chunk of the listing is being generated. Position 0 is the header line.
+ *
+ * @m: seq file for /proc/sp_vmpscrdk_info.
+ * @pos: position from where to start; device index plus one.
+ *
+ * @return device's vtty_info, SEQ_START_TOKEN for header or NULL if there are no more devices.
+ */
+static void *sp_vcard_info_start(struct seq_file *m, loff_t *pos)
+{
+    loff_t x = 0;
+
+    mutex_lock(&adaptlock);
+
+    if(*pos == 0)
+        return SEQ_START_TOKEN;
+
+    for(x = *pos - 1; x < max_num_vtty_dev; x++) {
+        if(index_manager[x].index != -1) {
+            *pos = x + 1;
+            return &index_manager[x];
         }
+    }
 
-        /* Initialize meta information and create 1st serial port */
-        if(data[58] == 'y')
-            vttydev1->set_odtr_at_open = 1;
-        else
-            vttydev1->set_odtr_at_open = 0;
-        vttydev1->own_tty = NULL;
-        vttydev1->peer_tty = NULL;
-        vttydev1->own_index = i;
-        vttydev1->peer_index = i;
-        vttydev1->rts_mappings = vdev1rts;
-        vttydev1->dtr_mappings = vdev1dtr;
-        vttydev1->msr_reg = 0;
-        vttydev1->mcr_reg = 0;
-        vttydev1->waiting_msr_chg = 0;
-        vttydev1->tx_paused = 0;
-        vttydev1->faulty_cable = 0;
-        index_manager[i].index = i;
-        index_manager[i].vttydev = vttydev1;
-        mutex_init(&vttydev1->lock);
+    return NULL;
+}
 
-        if(is_loopback != 1) {
-            y = -1;
-            if(vdev2idx == -1) {
-                for(x=0; x < max_num_vtty_dev; x++) {
-                    if(index_manager[x].index == -1) {
-                        y = x;
-                        break;
-                    }
-                }
-            }else {
-                if(index_manager[vdev2idx].index == -1) {
-                    y = vdev2idx;
-                }else {
-                    ret = -EEXIST;
-                    mutex_unlock(&adaptlock);
-                    goto fail_arg;
-                }
-            }
-            if(y == -1) {
-                ret = -ENOMEM;
-                mutex_unlock(&adaptlock);
-                goto fail_arg;
-            }
+/*
+ * Advances to the next existing device.
+ *
+ * @m: seq file for /proc/sp_vmpscrdk_info.
+ * @v: current element.
+ * @pos: current position, updated to the position of next element.
+ *
+ * @return next device's vtty_info or NULL if there are no more devices.
+ */
+static void *sp_vcard_info_next(struct seq_file *m, void *v, loff_t *pos)
+{
+    loff_t x = 0;
 
-            /* Initialize meta information and create 2nd serial port */
-            if(data[60] == 'y')
-                vttydev2->set_odtr_at_open = 1;
-            else
-                vttydev2->set_odtr_at_open = 0;
-            vttydev2->set_pdtr_at_open = vttydev1->set_odtr_at_open;
-            vttydev1->set_pdtr_at_open = vttydev2->set_odtr_at_open;
-            vttydev1->own_index = i;
-            vttydev1->peer_index = y;
-            vttydev2->own_index = y;
-            vttydev2->peer_index = i;
-            vttydev2->own_tty = NULL;
-            vttydev2->peer_tty = NULL;
-            vttydev2->rts_mappings = vdev2rts;
-            vttydev2->dtr_mappings = vdev2dtr;
-            vttydev2->msr_reg = 0;
-            vttydev2->mcr_reg = 0;
-            vttydev2->waiting_msr_chg = 0;
-            vttydev2->tx_paused = 0;
-            vttydev2->faulty_cable = 0;
-            index_manager[y].index = y;
-            index_manager[y].vttydev = vttydev2;
-            mutex_init(&vttydev2->lock);
+    for(x = *pos; x < max_num_vtty_dev; x++) {
+        if(index_manager[x].index != -1) {
+            *pos = x + 1;
+            return &index_manager[x];
         }
+    }
 
-        device1 = tty_register_device(spvtty_driver, i, NULL);
-        if(device1 == NULL) {
-            ret = -ENOMEM;
-            mutex_unlock(&adaptlock);
-            goto fail_arg;
+    *pos = max_num_vtty_dev + 1;
+    return NULL;
+}
+
+/*
+ * Ends the iteration started by sp_vcard_info_start().
+ *
+ * @m: seq file for /proc/sp_vmpscrdk_info.
+ * @v: last element.
+ */
+static void sp_vcard_info_stop(struct seq_file *m, void *v)
+{
+    mutex_unlock(&adaptlock);
+}
+
+/*
+ * Prints one line per device; all values are '#' separated and the order of fields is given by
+ * the header line. New fields will only ever be appended at the end of line.
+ *
+ * idx#peer#devtyp#rtsmap#dtrmap#odtropn#pdtropn#opencnt#unplugged#baud#frame#mcr#msr#faultycable#
+ * tx#rx#cts#dcd#dsr#brk#rng#frame_err#parity_err#overrun#buf_overrun#personality#latency#filter_pass#filter_drop
+ *
+ * The frame, mcr and msr are bit masks as defined by SP_DATA_XX, SP_MCR_XX and SP_MSR_XX constants.
+ *
+ * @m: seq file for /proc/sp_vmpscrdk_info.
+ * @v: element to print.
+ *
+ * @return 0 always.
+ */
+static int sp_vcard_info_show(struct seq_file *m, void *v)
+{
+    struct vtty_info *info = v;
+    struct vtty_dev *vttydev = NULL;
+
+    if(v == SEQ_START_TOKEN) {
+        seq_puts(m, "idx#peer#devtyp#rtsmap#dtrmap#odtropn#pdtropn#opencnt#unplugged#baud#frame#mcr#msr#faultycable#"
+                "tx#rx#cts#dcd#dsr#brk#rng#frame_err#parity_err#overrun#buf_overrun#personality#latency#filter_pass#filter_drop\n");
+        return 0;
+    }
+
+    vttydev = info->vttydev;
+
+    seq_printf(m, "%05u#%05u#%d#%d#%d#%d#%d#%d#%d#%d#0x%04x#0x%02x#0x%02x#%d#", vttydev->own_index, vttydev->peer_index,
+            vttydev->odevtyp, vttydev->rts_mappings, vttydev->dtr_mappings, vttydev->set_odtr_at_open,
+            vttydev->set_pdtr_at_open, vttydev->open_count, vttydev->unplugged, vttydev->baud, vttydev->uart_frame,
+            vttydev->mcr_reg, vttydev->msr_reg, vttydev->faulty_cable);
+    seq_printf(m, "%u#%u#%u#%u#%u#%u#%u#%u#%u#%u#%u#", vttydev->icount.tx, vttydev->icount.rx, vttydev->icount.cts,
+            vttydev->icount.dcd, vttydev->icount.dsr, vttydev->icount.brk, vttydev->icount.rng, vttydev->icount.frame,
+            vttydev->icount.parity, vttydev->icount.overrun, vttydev->icount.buf_overrun);
+    seq_printf(m, "%s#%u#%u#%u\n", vttydev->persona->name, vttydev->latency, vttydev->filter_pass, vttydev->filter_drop);
+
+    return 0;
+}
+
+static const struct seq_operations sp_vcard_info_seq_ops = {
+        .start = sp_vcard_info_start,
+        .next  = sp_vcard_info_next,
+        .stop  = sp_vcard_info_stop,
+        .show  = sp_vcard_info_show,
+};
+
+/*
+ * Invoked when user space process opens /proc/sp_vmpscrdk_info file. All existing devices with their
+ * current state are given in a single read, one line per device. For example:
+ *
+ * $ cat /proc/sp_vmpscrdk_info
+ *
+ * @inode: inode in file system corresponding to this file.
+ * @file: file representing sp proc file.
+ *
+ * @return 0 on success or negative error code on failure.
+ */
+static int sp_vcard_info_open(struct inode *inode, struct file *file)
+{
+    return seq_open(file, &sp_vcard_info_seq_ops);
+}
+
+static const struct file_operations sp_vcard_info_fops = {
+        .owner   = THIS_MODULE,
+        .open    = sp_vcard_info_open,
+        .read    = seq_read,
+        .llseek  = seq_lseek,
+        .release = seq_release,
+};
+
+static const struct file_operations sp_vcard_proc_fops = {
+        .owner   = THIS_MODULE,
+        .open    = sp_vcard_proc_open,
+        .read    = sp_vcard_proc_read,
+        .write   = sp_vcard_proc_write,
+        .release = sp_vcard_proc_close,
+};
+
+static const struct file_operations sp_ring_fops = {
+        .owner          = THIS_MODULE,
+        .open           = sp_ring_open,
+        .release        = sp_ring_release,
+        .mmap           = sp_ring_mmap,
+        .poll           = sp_ring_poll,
+        .unlocked_ioctl = sp_ring_ioctl,
+};
+
+static struct miscdevice sp_ring_miscdev = {
+        .minor = MISC_DYNAMIC_MINOR,
+        .name  = "tty2com_ring",
+        .fops  = &sp_ring_fops,
+        .mode  = S_IRUGO | S_IWUGO,
+};
+
+/*
+ * Gives the ring attached to the given tty with a reference taken on it, caller must drop the
+ * reference using kref_put() when done.
+ *
+ * @tty: tty whose line discipline is tty2com ring line discipline.
+ *
+ * @return attached ring or NULL if no ring is attached.
+ */
+static struct sp_ring *sp_ring_get_attached(struct tty_struct *tty)
+{
+    struct sp_ring *ring = NULL;
+
+    spin_lock(&sp_ring_lock);
+    ring = tty->disc_data;
+    if(ring != NULL)
+        kref_get(&ring->kref);
+    spin_unlock(&sp_ring_lock);
+
+    return ring;
+}
+
+/*
+ * Frees the ring when last reference to it is dropped.
+ *
+ * @kref: reference counter embedded in the ring.
+ */
+static void sp_ring_release_kref(struct kref *kref)
+{
+    struct sp_ring *ring = container_of(kref, struct sp_ring, kref);
+
+    vfree(ring->mem);
+    kfree(ring);
+}
+
+/*
+ * Invoked when an application sets tty2com ring line discipline on a tty. Only devices created by
+ * this driver are accepted.
+ *
+ * $ ldattach 29 /dev/tty2com1  or  ioctl(fd, TIOCSETD, &ring_ldisc)
+ *
+ * @tty: tty whose line discipline is being changed.
+ *
+ * @return 0 on success or negative error code on failure.
+ */
+static int sp_ring_ldisc_open(struct tty_struct *tty)
+{
+    if(tty->driver != spvtty_driver)
+        return -EINVAL;
+
+    tty->disc_data = NULL;
+    tty->receive_room = 65536;
+    return 0;
+}
+
+/*
+ * Invoked when line discipline of tty is changed or tty is closed. Detaches ring (if any) and
+ * signals hangup to the application polling that ring.
+ *
+ * @tty: tty whose line discipline is being closed.
+ */
+static void sp_ring_ldisc_close(struct tty_struct *tty)
+{
+    sp_ring_detach(tty);
+}
+
+/*
+ * Passes data to be transmitted to the driver as is; blocks until all is written unless tty was
+ * opened in non-blocking mode.
+ *
+ * @tty: tty on which data is to be written.
+ * @file: file pointer of the open tty.
+ * @buf: kernel buffer containing data.
+ * @nr: number of bytes to write.
+ *
+ * @return number of bytes written or negative error code on failure.
+ */
+static ssize_t sp_ring_ldisc_write(struct tty_struct *tty, struct file *file, const unsigned char *buf, size_t nr)
+{
+    int ret = 0;
+    int written = 0;
+    const unsigned char *b = buf;
+    DECLARE_WAITQUEUE(wait, current);
+
+    add_wait_queue(&tty->write_wait, &wait);
+    while(1) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if(signal_pending(current)) {
+            ret = -ERESTARTSYS;
+            break;
+        }
+        if(tty_hung_up_p(file) || test_bit(TTY_IO_ERROR, &tty->flags)) {
+            ret = -EIO;
+            break;
+        }
+        written = tty->ops->write(tty, b, nr);
+        if(written < 0) {
+            ret = written;
+            break;
+        }
+        b  += written;
+        nr -= written;
+        if(nr == 0)
+            break;
+        if(file->f_flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            break;
         }
+        schedule();
+    }
+    __set_current_state(TASK_RUNNING);
+    remove_wait_queue(&tty->write_wait, &wait);
 
-        vttydev1->device = device1;
-        dev_set_drvdata(device1, vttydev1);
+    return (b - buf) ? (b - buf) : ret;
+}
 
-        x = sysfs_create_group(&device1->kobj, &sp_info_attr_group);
-        if(x < 0) {
-            tty_unregister_device(spvtty_driver, i);
-            mutex_unlock(&adaptlock);
-            goto fail_arg;
-        }
+/*
+ * Executes ring attach/detach commands issued on tty fd, everything else is handled as n_tty would.
+ *
+ * @tty: tty on which ioctl is issued.
+ * @file: file pointer of the open tty.
+ * @cmd: ioctl command to execute.
+ * @arg: arguments accompanying the command.
+ *
+ * @return 0 on success otherwise a negative error code on failures.
+ */
+static int sp_ring_ldisc_ioctl(struct tty_struct *tty, struct file *file, unsigned int cmd, unsigned long arg)
+{
+    switch (cmd) {
+    case SP_RING_IOC_ATTACH:
+        return sp_ring_attach(tty, (unsigned int) arg);
+    case SP_RING_IOC_DETACH:
+        sp_ring_detach(tty);
+        return 0;
+    }
 
-        if(is_loopback != 1) {
-            device2 = tty_register_device(spvtty_driver, y, NULL);
-            if(device2 == NULL) {
-                ret = -ENOMEM;
-                mutex_unlock(&adaptlock);
-                goto fail_register;
-            }
+    return n_tty_ioctl_helper(tty, file, cmd, arg);
+}
 
-            vttydev2->device = device2;
-            dev_set_drvdata(device2, vttydev2);
+/*
+ * Received data is polled on ring fd, only writability is reported for tty fd.
+ *
+ * @tty: tty being polled.
+ * @file: file pointer of the open tty.
+ * @wait: poll table.
+ *
+ * @return poll mask.
+ */
+static unsigned int sp_ring_ldisc_poll(struct tty_struct *tty, struct file *file, poll_table *wait)
+{
+    unsigned int mask = 0;
 
-            x = sysfs_create_group(&device2->kobj, &sp_info_attr_group);
-            if(x < 0) {
-                tty_unregister_device(spvtty_driver, y);
-                index_manager[y].index = -1;
-                mutex_unlock(&adaptlock);
-                goto fail_register;
-            }
+    poll_wait(file, &tty->write_wait, wait);
 
-            last_nmdev1_idx = i;
-            last_nmdev2_idx = y;
-            ++total_nm_pair;
+    if(tty_hung_up_p(file))
+        mask |= POLLHUP;
+    if(tty->ops->write_room(tty) > 0)
+        mask |= POLLOUT | POLLWRNORM;
 
-            if((vttydev1->dtr_mappings != (SP_CON_DSR | SP_CON_DCD)) || (vttydev1->rts_mappings != SP_CON_CTS)
-                    || (vttydev1->set_odtr_at_open != 1) || (vttydev2->dtr_mappings != (SP_CON_DSR | SP_CON_DCD))
-                    || (vttydev2->rts_mappings != SP_CON_CTS) || (vttydev2->set_odtr_at_open != 1)) {
-                vttydev1->odevtyp = CNM;
-                vttydev2->odevtyp = CNM;
-            }else {
-                vttydev1->odevtyp = SNM;
-                vttydev2->odevtyp = SNM;
-            }            
-        }else {
-            last_lbdev_idx = i;
-            ++total_lb_devs;
+    return mask;
+}
 
-            /* device type */
-            if((vttydev1->dtr_mappings != (SP_CON_DSR | SP_CON_DCD)) || (vttydev1->rts_mappings != SP_CON_CTS)
-                    || (vttydev1->set_odtr_at_open != 1)) {
-                vttydev1->odevtyp = CLB;
-            }else {
-                vttydev1->odevtyp = SLB;
+/*
+ * Invoked by tty core with data from flip buffers. Data is copied into attached ring as much as
+ * space permits. Data not consumed stays in flip buffers so that sender sees back pressure, which
+ * is released when application kicks the ring. If no ring is attached nothing is consumed.
+ *
+ * @tty: tty which received data.
+ * @cp: received bytes.
+ * @fp: per byte flags (TTY_NORMAL, TTY_PARITY etc) or NULL if all are normal.
+ * @count: number of bytes received.
+ *
+ * @return number of bytes consumed.
+ */
+static int sp_ring_receive_buf2(struct tty_struct *tty, const unsigned char *cp, char *fp, int count)
+{
+    unsigned int x = 0;
+    u64 head = 0;
+    u64 tail = 0;
+    unsigned int off = 0;
+    unsigned int room = 0;
+    unsigned int num = 0;
+    unsigned int chunk = 0;
+    unsigned int done = 0;
+    struct sp_ring *ring = sp_ring_get_attached(tty);
+
+    if(ring == NULL)
+        return 0;
+
+    head = ring->hdr->head;
+    while(1) {
+        tail = ACCESS_ONCE(ring->hdr->tail);
+        /* Do not let data writes be reordered before reading the tail released by application */
+        smp_mb();
+
+        room = 0;
+        if((head - tail) <= ring->size)
+            room = ring->size - (unsigned int) (head - tail);
+        num = min_t(unsigned int, room, (unsigned int) count - done);
+
+        off = (unsigned int) head & (ring->size - 1);
+        chunk = min_t(unsigned int, num, ring->size - off);
+        memcpy(ring->data + off, cp + done, chunk);
+        memcpy(ring->data, cp + done + chunk, num - chunk);
+
+        if(fp != NULL) {
+            for(x = done; x < (done + num); x++) {
+                if(fp[x] != TTY_NORMAL)
+                    ring->hdr->errors++;
             }
         }
 
-        mutex_unlock(&adaptlock);
-    }
-    else {
-        /* Destroy device command sent */
-
-        if((total_nm_pair <= 0) && (total_lb_devs <= 0))
-            return length;
-
-        /* An application may forget to close serial port or it might have been crashed resulting in
-         * unclosed port and hence leaked resources. We handle such scenarios as disconnected event
-         * as done in case of a plug and play for example usb device. Application is running, port
-         * is opened and then suddenly user removes tty device. */
+        head += num;
+        done += num;
+        if(done == (unsigned int) count)
+            break;
 
-        if(data[8] == 'x') {
+        /* Ring is full. Set blocked before publishing head and then look at tail once more, application
+         * may have drained the ring and checked blocked in between; it would never kick then. */
+        ACCESS_ONCE(ring->hdr->blocked) = 1;
+        smp_mb();
+        if(ACCESS_ONCE(ring->hdr->tail) == tail)
+            break;
+    }
 
-            /* Delete all virtual devices */
+    /* Data and blocked must be visible before application sees the new head */
+    smp_wmb();
+    ACCESS_ONCE(ring->hdr->head) = head;
 
-            mutex_lock(&adaptlock);
+    wake_up_interruptible(&ring->wait);
+    kref_put(&ring->kref, sp_ring_release_kref);
 
-            /* First tty must be released and than port. */
-            for(x=0; x < max_num_vtty_dev; x++) {
-                if (index_manager[x].index != -1) {
+    return done;
+}
 
-                    vttydev1 = index_manager[x].vttydev;
-                    if (vttydev1 != NULL) {
+/*
+ * Attaches ring created by opening /dev/tty2com_ring to the given tty and delivers any data which
+ * was already pending.
+ *
+ * @tty: tty whose line discipline is tty2com ring line discipline.
+ * @fd: file descriptor of the opened /dev/tty2com_ring in calling process.
+ *
+ * @return 0 on success or negative error code on failure.
+ */
+static int sp_ring_attach(struct tty_struct *tty, unsigned int fd)
+{
+    int ret = 0;
+    struct sp_ring *ring = NULL;
+    struct fd f = fdget(fd);
 
-                        sysfs_remove_group(&vttydev1->device->kobj, &sp_info_attr_group);
-
-                        if (vttydev1->own_tty && vttydev1->own_tty->port) {
-                            tty = tty_port_tty_get(vttydev1->own_tty->port);
-                            if (tty) {
-                                tty_vhangup(tty);
-                                tty_kref_put(tty);
-                            }
-                        }
-                        tty_unregister_device(spvtty_driver, index_manager[x].index);
-                        kfree(index_manager[x].vttydev);
-                    }
-                    index_manager[x].index = -1;
-                }
-            }
+    if(!f.file)
+        return -EBADF;
 
-            total_nm_pair = 0;
-            total_lb_devs = 0;
-            last_lbdev_idx  = -1;
-            last_nmdev1_idx = -1;
-            last_nmdev2_idx = -1;
+    if(f.file->f_op != &sp_ring_fops) {
+        fdput(f);
+        return -EINVAL;
+    }
 
-            mutex_unlock(&adaptlock);
-        }
-        else {
+    ring = f.file->private_data;
 
-            /* Delete a specific virtual device */
+    spin_lock(&sp_ring_lock);
+    if((tty->disc_data != NULL) || (ring->tty != NULL)) {
+        ret = -EBUSY;
+    }else {
+        kref_get(&ring->kref);
+        ring->tty = tty;
+        ring->hup = 0;
+        tty->disc_data = ring;
+    }
+    spin_unlock(&sp_ring_lock);
 
-            x = 4;
-            memset(tmp, '\0', sizeof(tmp));
-            i = 0;
-            for(i=0; i<5; i++) {
-                tmp[i] = data[x];
-                x++;
-            }
+    fdput(f);
 
-            x = -1;
-            y = -1;
+    if(ret == 0)
+        tty_schedule_flip(tty->port);
 
-            ret = kstrtouint(tmp, 10, &vdev1idx);
-            if(ret != 0)
-                return ret;
+    return ret;
+}
 
-            if((vdev1idx >= 0) && (vdev1idx <= 65535) && (index_manager[vdev1idx].index != -1)) {
-                mutex_lock(&adaptlock);
+/*
+ * Detaches ring (if any) from the given tty and wakes up application polling it.
+ *
+ * @tty: tty whose line discipline is tty2com ring line discipline.
+ */
+static void sp_ring_detach(struct tty_struct *tty)
+{
+    struct sp_ring *ring = NULL;
+
+    spin_lock(&sp_ring_lock);
+    ring = tty->disc_data;
+    if(ring != NULL) {
+        ring->tty = NULL;
+        ring->hup = 1;
+        tty->disc_data = NULL;
+    }
+    spin_unlock(&sp_ring_lock);
 
-                x = index_manager[vdev1idx].index;
-                vttydev1 = index_manager[x].vttydev;
-                sysfs_remove_group(&vttydev1->device->kobj, &sp_info_attr_group);
-                tty_unregister_device(spvtty_driver, index_manager[x].index);
-                if (vttydev1 && vttydev1->own_tty && vttydev1->own_tty->port) {
-                    tty = tty_port_tty_get(vttydev1->own_tty->port);
-                    if (tty) {
-                        tty_vhangup(tty);
-                        tty_kref_put(tty);
-                    }
-                }
+    if(ring != NULL) {
+        wake_up_interruptible(&ring->wait);
+        kref_put(&ring->kref, sp_ring_release_kref);
+    }
+}
 
-                if (vttydev1->own_index != vttydev1->peer_index) {
-                    y = index_manager[vttydev1->peer_index].index;
-                    vttydev2 = index_manager[y].vttydev;
-                    sysfs_remove_group(&vttydev2->device->kobj, &sp_info_attr_group);
-                    tty_unregister_device(spvtty_driver, index_manager[y].index);
-                    if (vttydev2 && vttydev2->own_tty && vttydev2->own_tty->port) {
-                        tty = tty_port_tty_get(vttydev2->own_tty->port);
-                        if (tty) {
-                            tty_vhangup(tty);
-                            tty_kref_put(tty);
-                        }
-                    }
-                }
+/*
+ * Invoked when application opens /dev/tty2com_ring. Every open gets its own ring of ring_size
+ * bytes which has to be mapped using mmap() and then attached to a tty.
+ *
+ * @inode: inode of the misc device.
+ * @file: file representing this open instance.
+ *
+ * @return 0 on success or negative error code on failure.
+ */
+static int sp_ring_open(struct inode *inode, struct file *file)
+{
+    unsigned int size = 0;
+    struct sp_ring *ring = NULL;
 
-                if (x != -1) {
-                    kfree(index_manager[x].vttydev);
-                    index_manager[x].index = -1;
-                }
-                if (y != -1) {
-                    kfree(index_manager[y].vttydev);
-                    index_manager[y].index = -1;
-                    --total_nm_pair;
-                }else {
-                    --total_lb_devs;
-                }
+    size = roundup_pow_of_two(max_t(uint, ring_size, PAGE_SIZE));
 
-                mutex_unlock(&adaptlock);
+    ring = kzalloc(sizeof(struct sp_ring), GFP_KERNEL);
+    if(ring == NULL)
+        return -ENOMEM;
 
-            }else {
-                return -EINVAL;
-            }
-        }
+    ring->memlen = PAGE_SIZE + size;
+    ring->mem = vmalloc_user(ring->memlen);
+    if(ring->mem == NULL) {
+        kfree(ring);
+        return -ENOMEM;
     }
 
-    return length;
+    kref_init(&ring->kref);
+    init_waitqueue_head(&ring->wait);
+    ring->size = size;
+    ring->hdr = ring->mem;
+    ring->data = (unsigned char *) ring->mem + PAGE_SIZE;
+    ring->hdr->size = size;
+    ring->hdr->data_offset = PAGE_SIZE;
 
-    fail_register:
-    sysfs_remove_group(&device1->kobj, &sp_info_attr_group);
-    tty_unregister_device(spvtty_driver, i);
+    file->private_data = ring;
+    return 0;
+}
 
-    fail_arg:
-    index_manager[i].index = -1;
+/*
+ * Invoked when application closes /dev/tty2com_ring. The ring stays alive until it is detached from
+ * the tty as well.
+ *
+ * @inode: inode of the misc device.
+ * @file: file representing this open instance.
+ *
+ * @return 0 always.
+ */
+static int sp_ring_release(struct inode *inode, struct file *file)
+{
+    struct sp_ring *ring = file->private_data;
 
-    if(vttydev2 != NULL)
-        kfree(vttydev2);
+    kref_put(&ring->kref, sp_ring_release_kref);
+    return 0;
+}
 
-    if(vttydev1 != NULL)
-        kfree(vttydev1);
+/*
+ * Maps header page and data area of the ring into application's address space.
+ *
+ * @file: file representing this open instance.
+ * @vma: user virtual memory area to map into, must start at offset 0.
+ *
+ * @return 0 on success or negative error code on failure.
+ */
+static int sp_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct sp_ring *ring = file->private_data;
 
-    return ret;
+    if((vma->vm_pgoff != 0) || ((vma->vm_end - vma->vm_start) > ring->memlen))
+        return -EINVAL;
+
+    return remap_vmalloc_range(vma, ring->mem, 0);
 }
 
 /*
- * Invoked when user space process opens /proc/sp_vmpscrdk file to create/destroy
- * virtual tty device(s).
+ * Reports readability when ring has unconsumed data and hangup when tty went away.
  *
- * @inode: inode in file system corresponding to this file
- * @file: file representing sp proc file
+ * @file: file representing this open instance.
+ * @wait: poll table.
  *
- * @return 0 on success.
+ * @return poll mask.
  */
-static int sp_vcard_proc_open(struct inode *inode, struct  file *file)
+static unsigned int sp_ring_poll(struct file *file, poll_table *wait)
 {
-    return 0;
+    unsigned int mask = 0;
+    struct sp_ring *ring = file->private_data;
+
+    poll_wait(file, &ring->wait, wait);
+
+    if(ACCESS_ONCE(ring->hdr->head) != ACCESS_ONCE(ring->hdr->tail))
+        mask |= POLLIN | POLLRDNORM;
+    if(ring->hup)
+        mask |= POLLHUP;
+
+    return mask;
 }
 
 /*
- * Invoked when user space process closes /proc/sp_vmpscrdk file.
+ * Executes commands issued on /dev/tty2com_ring fd.
  *
- * @inode: inode in file system corresponding to this file.
- * @file: file representing sp proc file.
+ * @file: file representing this open instance.
+ * @cmd: ioctl command to execute.
+ * @arg: arguments accompanying the command.
  *
- * @return 0 on success.
+ * @return 0 on success otherwise a negative error code on failures.
  */
-static int sp_vcard_proc_close(struct inode *inode, struct file *file)
+static long sp_ring_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-    return 0;
+    struct sp_ring *ring = file->private_data;
+
+    switch (cmd) {
+    case SP_RING_IOC_KICK:
+        spin_lock(&sp_ring_lock);
+        ACCESS_ONCE(ring->hdr->blocked) = 0;
+        if(ring->tty != NULL)
+            tty_schedule_flip(ring->tty->port);
+        spin_unlock(&sp_ring_lock);
+        return 0;
+    }
+
+    return -ENOTTY;
 }
 
-static const struct file_operations sp_vcard_proc_fops = {
-        .owner   = THIS_MODULE,
-        .open    = sp_vcard_proc_open,
-        .read    = sp_vcard_proc_read,
-        .write   = sp_vcard_proc_write,
-        .release = sp_vcard_proc_close,
+static struct tty_ldisc_ops sp_ring_ldisc_ops = {
+        .magic        = TTY_LDISC_MAGIC,
+        .owner        = THIS_MODULE,
+        .name         = "tty2com_ring",
+        .open         = sp_ring_ldisc_open,
+        .close        = sp_ring_ldisc_close,
+        .write        = sp_ring_ldisc_write,
+        .ioctl        = sp_ring_ldisc_ioctl,
+        .poll         = sp_ring_ldisc_poll,
+        .receive_buf2 = sp_ring_receive_buf2,
 };
 
 static const struct tty_operations sp_serial_ops = {
@@ -2390,6 +4631,26 @@ static int __init sp_tty2comKm_init(void)
         goto failed_proc;
     }
 
+    /* Application should read this file to list all existing devices and their state in one go */
+    pde = proc_create("sp_vmpscrdk_info", S_IRUGO, NULL, &sp_vcard_info_fops);
+    if(pde == NULL) {
+        ret = -ENOMEM;
+        goto failed_info;
+    }
+
+    /* Shared memory ring is an optional facility; driver works without it if the line discipline
+     * number is already taken by some other line discipline. */
+    ret = tty_register_ldisc(ring_ldisc, &sp_ring_ldisc_ops);
+    if(ret == 0) {
+        ret = misc_register(&sp_ring_miscdev);
+        if(ret == 0)
+            sp_ring_registered = 1;
+        else
+            tty_unregister_ldisc(ring_ldisc);
+    }
+    if(sp_ring_registered == 0)
+        pr_warning("Can't register ring line discipline %d, error code: %d\n", ring_ldisc, ret);
+
     /* If module was supplied parameters, create null-modem and loopback virtual tty devices */
     if (((2 * init_num_nm_pair) + init_num_lb_dev) <= max_num_vtty_dev) {
         for(x=0; x < init_num_nm_pair; x++) {
@@ -2409,6 +4670,8 @@ static int __init sp_tty2comKm_init(void)
     pr_info("%s %s\n", DRIVER_DESC, DRIVER_VERSION);
     return 0;
 
+    failed_info:
+    remove_proc_entry("sp_vmpscrdk", NULL);
     failed_proc:
     kfree(index_manager);
     failed_alloc:
@@ -2428,30 +4691,36 @@ static void __exit sp_tty2comKm_exit(void)
 {
     int x = 0;
     struct vtty_dev *vttydev = NULL;
-    struct tty_struct *tty;
 
+    remove_proc_entry("sp_vmpscrdk_info", NULL);
     remove_proc_entry("sp_vmpscrdk", NULL);
 
+    if(sp_ring_registered == 1) {
+        misc_deregister(&sp_ring_miscdev);
+        tty_unregister_ldisc(ring_ldisc);
+    }
+
+    mutex_lock(&adaptlock);
+
     for(x=0; x < max_num_vtty_dev; x++) {
         if (index_manager[x].index != -1) {
-
             vttydev = index_manager[x].vttydev;
-            sysfs_remove_group(&vttydev->device->kobj, &sp_info_attr_group);
-            tty_unregister_device(spvtty_driver, index_manager[x].index);
-
-            if (vttydev && vttydev->own_tty && vttydev->own_tty->port) {
-                tty = tty_port_tty_get(vttydev->own_tty->port);
-                if (tty) {
-                    tty_vhangup(tty);
-                    tty_kref_put(tty);
-                }
-                kfree(index_manager[x].vttydev);
-            }
+            sp_unregister_vttydev(vttydev);
+            sp_free_vttydev(vttydev);
+            index_manager[x].index = -1;
         }
     }
 
+    mutex_unlock(&adaptlock);
+
     kfree(index_manager);
 
+#ifdef CONFIG_BPF_SYSCALL
+    /* All programs have been detached by now */
+    if(sp_filter_netdev != NULL)
+        free_netdev(sp_filter_netdev);
+#endif
+
     tty_unregister_driver(spvtty_driver);
     put_tty_driver(spvtty_driver);
 
@@ -2473,6 +4742,12 @@ MODULE_PARM_DESC(init_num_lb_dev, "Number of standard loopback tty devices to be
 module_param(minor_begin, int, 0);
 MODULE_PARM_DESC(minor_begin, "Minor number of device nodes i.e. starting index of device nodes.");
 
+module_param(ring_ldisc, int, 0);
+MODULE_PARM_DESC(ring_ldisc, "Line discipline number for shared memory receive ring line discipline.");
+
+module_param(ring_size, uint, 0);
+MODULE_PARM_DESC(ring_size, "Size in bytes of each shared memory receive ring, rounded up to power of 2.");
+
 MODULE_AUTHOR( DRIVER_AUTHOR );
 MODULE_DESCRIPTION( DRIVER_DESC );
 MODULE_LICENSE("GPL v2");
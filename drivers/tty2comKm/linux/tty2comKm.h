@@ -0,0 +1,88 @@
+/************************************************************************************************
+ * This file is part of SerialPundit.
+ *
+ * Copyright (C) 2014-2016, Rishi Gupta. All rights reserved.
+ *
+ * The SerialPundit is DUAL LICENSED. It is made available under the terms of the GNU Affero
+ * General Public License (AGPL) v3.0 for non-commercial use and under the terms of a commercial
+ * license for commercial use of this software.
+ *
+ * The SerialPundit is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ ************************************************************************************************/
+
+/*
+ * Definitions shared between tty2comKm driver and applications. This file can be included as is
+ * by user space programs.
+ */
+
+#ifndef TTY2COMKM_H_
+#define TTY2COMKM_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Header placed at offset 0 of the memory mapped from /dev/tty2com_ring. Received bytes are placed
+ * at data_offset in a circular buffer of size bytes (power of 2). The head and tail are free running
+ * byte counters; data available is (head - tail) starting at data_offset + (tail & (size - 1)).
+ * Driver only writes head, application only writes tail. If the driver finds the ring full it sets
+ * blocked to 1 and stops taking data from the tty, application should issue SP_RING_IOC_KICK after
+ * consuming data when it finds blocked set.
+ */
+struct sp_ring_hdr {
+    __u32 size;
+    __u32 data_offset;
+    __u64 head;
+    __u64 tail;
+    __u64 errors;
+    __u32 blocked;
+    __u32 reserved;
+};
+
+/*
+ * Receive timestamp of a chunk of data. The offset is position of first byte of chunk in the stream
+ * of bytes received since timestamping was enabled, tstamp is CLOCK_MONOTONIC in nanoseconds at
+ * which the sender handed over the chunk to the driver.
+ */
+struct sp_rxts_record {
+    __u64 offset;
+    __u32 length;
+    __u32 reserved;
+    __u64 tstamp;
+};
+
+/*
+ * Argument of SP_IOC_RXTS_GET. Application sets max and records (pointer to array of max records),
+ * driver fills count with number of records returned and dropped with number of records lost so
+ * far because application did not fetch them in time.
+ */
+struct sp_rxts_req {
+    __u32 max;
+    __u32 count;
+    __u64 dropped;
+    __u64 records;
+};
+
+#define SP_IOC_MAGIC 0xB7
+
+/* On tty fd having tty2com ring line discipline; arg is file descriptor of opened /dev/tty2com_ring */
+#define SP_RING_IOC_ATTACH _IO(SP_IOC_MAGIC, 0x01)
+
+/* On tty fd having tty2com ring line discipline; detaches the ring attached currently */
+#define SP_RING_IOC_DETACH _IO(SP_IOC_MAGIC, 0x02)
+
+/* On /dev/tty2com_ring fd; restarts reception after application freed some space in full ring */
+#define SP_RING_IOC_KICK   _IO(SP_IOC_MAGIC, 0x03)
+
+/* On tty2comXX fd; arg 1 enables receive timestamps (discarding old records), 0 disables them */
+#define SP_IOC_RXTS_ENABLE _IO(SP_IOC_MAGIC, 0x10)
+
+/* On tty2comXX fd; fetches pending receive timestamp records, arg is struct sp_rxts_req */
+#define SP_IOC_RXTS_GET    _IOWR(SP_IOC_MAGIC, 0x11, struct sp_rxts_req)
+
+/* On tty2comXX fd; arg is fd of loaded BPF_PROG_TYPE_SOCKET_FILTER or BPF_PROG_TYPE_SCHED_CLS program
+ * to run on every chunk of data received by this device, or -1 to detach it; needs CAP_NET_ADMIN */
+#define SP_IOC_FILTER_ATTACH _IO(SP_IOC_MAGIC, 0x20)
+
+#endif /* TTY2COMKM_H_ */
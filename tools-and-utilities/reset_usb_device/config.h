@@ -59,7 +59,7 @@
 #define PACKAGE_NAME "spusbrst"
 
 /* Define to the full name and version of this package. */
-#define PACKAGE_STRING "spusbrst 1.0"
+#define PACKAGE_STRING "spusbrst 1.1"
 
 /* Define to the one symbol short name of this package. */
 #define PACKAGE_TARNAME "spusbrst"
@@ -68,10 +68,10 @@
 #define PACKAGE_URL ""
 
 /* Define to the version of this package. */
-#define PACKAGE_VERSION "1.0"
+#define PACKAGE_VERSION "1.1"
 
 /* Define to 1 if you have the ANSI C header files. */
 #define STDC_HEADERS 1
 
 /* Version number of package */
-#define VERSION "1.0"
+#define VERSION "1.1"
@@ -1,49 +1,963 @@
 /************************************************************************************************
  * This file is part of SerialPundit.
- * 
+ *
  * Copyright (C) 2014-2016, Rishi Gupta. All rights reserved.
  *
- * The SerialPundit is DUAL LICENSED. It is made available under the terms of the GNU Affero 
- * General Public License (AGPL) v3.0 for non-commercial use and under the terms of a commercial 
- * license for commercial use of this software. 
- * 
- * The SerialPundit is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * The SerialPundit is DUAL LICENSED. It is made available under the terms of the GNU Affero
+ * General Public License (AGPL) v3.0 for non-commercial use and under the terms of a commercial
+ * license for commercial use of this software.
+ *
+ * The SerialPundit is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
  * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
  ************************************************************************************************/
 
+/*
+ * Resets one or more USB devices. Devices are given either as usbfs nodes (/dev/bus/usb/BBB/DDD) or through
+ * selectors (VID:PID, serial number, bus-port path or tty name) which are resolved through sysfs to every
+ * matching device. All devices are reset in parallel, one child process per device, and result of each one
+ * is printed along with total elapsed time.
+ *
+ * Optionally it waits until every device is ready again: interfaces which had a driver before reset have been
+ * bound again, tty nodes (ttyUSBx, ttyACMx etc) have come back if asked for, and udev has finished processing
+ * all events of the device. Kernel and udev events are received through netlink (NETLINK_KOBJECT_UEVENT), so
+ * the time from start of reset to ready is measured without polling.
+ *
+ * Exit status is 0 if all devices were reset (and became ready), 1 if any reset failed, 2 for usage error or
+ * when no device matched and 3 if any device did not become ready within timeout.
+ */
+
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
 
+/* struct ucred and SCM_CREDENTIALS */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
 #include <linux/usbdevice_fs.h>
 
-int main(int argc, char **argv) {
-    
-    int ret = 0;
-    const char *filename;
+#define SYSFS_USB_DEVICES  "/sys/bus/usb/devices"
+#define SYSFS_TTY_CLASS    "/sys/class/tty"
+#define MAX_DEVICES        256
+#define MAX_SELECTORS      64
+#define USB_DEV_MAJOR      189
+#define MAX_INTERFACES     32
+#define UEVENT_BUF_SIZE    8192
+
+/* Netlink multicast groups of kernel and udev events, header of messages sent by udev (libudev) */
+#define UEVENT_GROUP_KERNEL  1
+#define UEVENT_GROUP_UDEV    2
+#define UDEV_MONITOR_MAGIC   0xfeedcafe
+#define UDEV_CONTROL_SOCKET  "/run/udev/control"
+
+#define EXIT_RESET_FAILED  1
+#define EXIT_USAGE         2
+#define EXIT_TIMEOUT       3
+
+/* What to wait for after reset */
+#define WAIT_NONE    0
+#define WAIT_DEVICE  1
+#define WAIT_TTY     2
+
+/* Selector given on command line; type is the option character ('d', 's', 'p', 't' or 'n' for usbfs node). */
+struct selector {
+    char type;
+    const char *arg;
+    int busnum;
+    int devnum;
+    int matched;
+};
+
+/* Outcome of reset reported by child process to parent; ready is 1 once device is ready, -1 on timeout. */
+struct reset_result {
+    int err;
+    double reset_ms;
+    int ready;
+    double ready_ms;
+    char ttys[128];
+};
+
+/* State of a device being waited for after reset. Devices are identified by sysfs path (which stays same
+ * even if device gets re-enumerated) and devpath is the same without /sys, as found in uevents. */
+struct wait_state {
+    char devdir[PATH_MAX];
+    const char *devpath;
+    char intf[MAX_INTERFACES][64];
+    int num_intf;
+    int ttys_before;
+    int ttys_now;
+    char ttys[128];
+    unsigned long long kernel_seq;
+    unsigned long long udev_seq;
+    int kernel_fd;
+    int udev_fd;
+};
+
+/* Properties of a uevent needed here */
+struct uevent {
+    const char *action;
+    const char *devpath;
+    unsigned long long seqnum;
+};
+
+struct usb_dev {
+    char name[64];
+    char node[PATH_MAX];
+    char id[16];
+    char serial[128];
+    int busnum;
+    int devnum;
+    pid_t pid;
+    int pipefd;
+    struct reset_result res;
+};
+
+static struct selector selectors[MAX_SELECTORS];
+static int num_selectors = 0;
+static struct usb_dev devices[MAX_DEVICES];
+static int num_devices = 0;
+static int wait_mode = WAIT_NONE;
+static int timeout_ms = 10000;
+static int kernel_only = 0;
+
+static double now_msecs(void);
+static int read_attr(const char *dir, const char *attr, char *buf, size_t len);
+static int resolve_tty(struct selector *sel);
+static int resolve_node(struct selector *sel);
+static int selector_matches(const struct selector *sel, const struct usb_dev *dev);
+static int add_device(const struct usb_dev *dev);
+static int scan_sysfs(void);
+static int reset_device(const char *node);
+static int is_below(const char *path, const char *dir);
+static int count_ttys(struct wait_state *ws);
+static int prepare_wait(const char *name, struct wait_state *ws);
+static int open_uevent_socket(int group);
+static int parse_uevent(char *buf, ssize_t len, int udev, struct uevent *ev);
+static void receive_uevents(struct wait_state *ws, int fd, int udev);
+static int device_ready(struct wait_state *ws);
+static void wait_ready(struct wait_state *ws, double start, struct reset_result *res);
+static int start_reset(struct usb_dev *dev);
+static void finish_reset(struct usb_dev *dev);
+static void usage(const char *prog);
+
+static double now_msecs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1e6);
+}
+
+/*
+ * Reads a sysfs attribute file, trailing newline is removed.
+ *
+ * @dir: sysfs directory
+ * @attr: name of attribute file in dir
+ * @buf: where value is stored
+ * @len: size of buf
+ *
+ * @return 0 on success otherwise -1.
+ */
+static int read_attr(const char *dir, const char *attr, char *buf, size_t len) {
     int fd = 0;
-    filename = argv[1];
-    
-    fd = open(filename, O_WRONLY);
-    errno = 0;
+    ssize_t ret = 0;
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    fd = open(path, O_RDONLY);
     if(fd < 0) {
-        fprintf(stderr, "failed with error code : %d\n", errno);
         return -1;
     }
-    
+
+    ret = read(fd, buf, len - 1);
+    close(fd);
+    if(ret < 0) {
+        return -1;
+    }
+
+    buf[ret] = '\0';
+    while((ret > 0) && ((buf[ret - 1] == '\n') || (buf[ret - 1] == '\r'))) {
+        buf[--ret] = '\0';
+    }
+    return 0;
+}
+
+/*
+ * Finds USB device which provides the given tty (ttyUSB0, ttyACM0, /dev/ttyUSB0 etc). Device link of tty in
+ * sysfs points to a port or interface below the USB device, parents are walked up until the directory
+ * having bus and device number is found.
+ *
+ * @sel: tty selector, busnum and devnum are set on success
+ *
+ * @return 0 on success otherwise -1.
+ */
+static int resolve_tty(struct selector *sel) {
+    char *p;
+    char buf[32];
+    char link[PATH_MAX];
+    char path[PATH_MAX];
+    const char *name = strrchr(sel->arg, '/');
+
+    name = name ? name + 1 : sel->arg;
+    snprintf(link, sizeof(link), "%s/%s/device", SYSFS_TTY_CLASS, name);
+    if(realpath(link, path) == NULL) {
+        return -1;
+    }
+
+    while((p = strrchr(path, '/')) != NULL && (p != path)) {
+        if(read_attr(path, "busnum", buf, sizeof(buf)) == 0) {
+            sel->busnum = atoi(buf);
+            if(read_attr(path, "devnum", buf, sizeof(buf)) < 0) {
+                return -1;
+            }
+            sel->devnum = atoi(buf);
+            return 0;
+        }
+        *p = '\0';
+    }
+
+    return -1;
+}
+
+/*
+ * Finds bus and device number of a usbfs node from its device number (major 189, minor encodes both).
+ *
+ * @sel: node selector, busnum and devnum are set on success
+ *
+ * @return 0 on success otherwise -1.
+ */
+static int resolve_node(struct selector *sel) {
+    struct stat st;
+
+    if(stat(sel->arg, &st) < 0) {
+        return -1;
+    }
+    if(!S_ISCHR(st.st_mode) || (major(st.st_rdev) != USB_DEV_MAJOR)) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    sel->busnum = (minor(st.st_rdev) >> 7) + 1;
+    sel->devnum = (minor(st.st_rdev) & 0x7F) + 1;
+    return 0;
+}
+
+static int selector_matches(const struct selector *sel, const struct usb_dev *dev) {
+    switch(sel->type) {
+    case 'd':
+        return strcasecmp(sel->arg, dev->id) == 0;
+    case 's':
+        return strcmp(sel->arg, dev->serial) == 0;
+    case 'p':
+        return strcmp(sel->arg, dev->name) == 0;
+    case 't':
+    case 'n':
+        return (sel->busnum == dev->busnum) && (sel->devnum == dev->devnum);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Adds device to the list of devices to be reset unless it is already there (more than one selector may match
+ * the same device).
+ *
+ * @return 0 on success otherwise -1 if there are too many devices.
+ */
+static int add_device(const struct usb_dev *dev) {
+    int x = 0;
+
+    for(x = 0; x < num_devices; x++) {
+        if((devices[x].busnum == dev->busnum) && (devices[x].devnum == dev->devnum)) {
+            return 0;
+        }
+    }
+
+    if(num_devices >= MAX_DEVICES) {
+        fprintf(stderr, "too many devices, only first %d will be reset\n", MAX_DEVICES);
+        return -1;
+    }
+
+    devices[num_devices++] = *dev;
+    return 0;
+}
+
+/*
+ * Walks all USB devices in sysfs and adds the ones matching any selector. Interfaces (names having ':') and
+ * root hubs (usbN) are skipped.
+ *
+ * @return 0 on success otherwise -1 if sysfs could not be read.
+ */
+static int scan_sysfs(void) {
+    int x = 0;
+    char buf[32];
+    char vid[8];
+    char dir[PATH_MAX];
+    DIR *d;
+    struct dirent *de;
+    struct usb_dev dev;
+
+    d = opendir(SYSFS_USB_DEVICES);
+    if(d == NULL) {
+        return -1;
+    }
+
+    while((de = readdir(d)) != NULL) {
+        if((de->d_name[0] == '.') || strchr(de->d_name, ':') || (strncmp(de->d_name, "usb", 3) == 0)) {
+            continue;
+        }
+
+        memset(&dev, 0, sizeof(dev));
+        snprintf(dev.name, sizeof(dev.name), "%.63s", de->d_name);
+        snprintf(dir, sizeof(dir), "%s/%s", SYSFS_USB_DEVICES, de->d_name);
+
+        if(read_attr(dir, "busnum", buf, sizeof(buf)) < 0) {
+            continue;
+        }
+        dev.busnum = atoi(buf);
+        if(read_attr(dir, "devnum", buf, sizeof(buf)) < 0) {
+            continue;
+        }
+        dev.devnum = atoi(buf);
+        if((read_attr(dir, "idVendor", vid, sizeof(vid)) < 0)
+                || (read_attr(dir, "idProduct", buf, sizeof(buf)) < 0)) {
+            continue;
+        }
+        snprintf(dev.id, sizeof(dev.id), "%.4s:%.4s", vid, buf);
+        if(read_attr(dir, "serial", dev.serial, sizeof(dev.serial)) < 0) {
+            dev.serial[0] = '\0';
+        }
+        snprintf(dev.node, sizeof(dev.node), "/dev/bus/usb/%03d/%03d", dev.busnum, dev.devnum);
+
+        for(x = 0; x < num_selectors; x++) {
+            if(selector_matches(&selectors[x], &dev)) {
+                selectors[x].matched++;
+                if(add_device(&dev) < 0) {
+                    closedir(d);
+                    return 0;
+                }
+            }
+        }
+    }
+
+    closedir(d);
+    return 0;
+}
+
+/*
+ * Issues USBDEVFS_RESET on the given usbfs node.
+ *
+ * @return 0 on success otherwise errno value.
+ */
+static int reset_device(const char *node) {
+    int fd = 0;
+    int ret = 0;
+
+    errno = 0;
+    fd = open(node, O_WRONLY);
+    if(fd < 0) {
+        return errno;
+    }
+
     errno = 0;
     ret = ioctl(fd, USBDEVFS_RESET, 0);
     if(ret < 0) {
-        fprintf(stderr, "failed with error code : %d\n", errno);
-        return -1;
+        ret = errno;
+        close(fd);
+        return ret;
     }
-    
+
     close(fd);
     return 0;
 }
 
+/*
+ * Tells whether path is dir itself or lies below it.
+ */
+static int is_below(const char *path, const char *dir) {
+    size_t len = strlen(dir);
+    return (strncmp(path, dir, len) == 0) && ((path[len] == '/') || (path[len] == '\0'));
+}
+
+/*
+ * Counts ttys provided by the device (and its interfaces) and records their names.
+ *
+ * @ws: wait state, ttys_now and ttys are updated
+ *
+ * @return number of ttys.
+ */
+static int count_ttys(struct wait_state *ws) {
+    size_t used = 0;
+    char link[PATH_MAX];
+    char path[PATH_MAX];
+    DIR *d;
+    struct dirent *de;
+
+    ws->ttys_now = 0;
+    ws->ttys[0] = '\0';
+
+    d = opendir(SYSFS_TTY_CLASS);
+    if(d == NULL) {
+        return 0;
+    }
+
+    while((de = readdir(d)) != NULL) {
+        if(de->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(link, sizeof(link), "%s/%.200s", SYSFS_TTY_CLASS, de->d_name);
+        if((realpath(link, path) == NULL) || !is_below(path, ws->devdir)) {
+            continue;
+        }
+        ws->ttys_now++;
+        if(used + strlen(de->d_name) + 2 < sizeof(ws->ttys)) {
+            used += snprintf(ws->ttys + used, sizeof(ws->ttys) - used, "%s%s", used ? "," : "", de->d_name);
+        }
+    }
+
+    closedir(d);
+    return ws->ttys_now;
+}
+
+/*
+ * Records what has to come back after reset (interfaces having a driver and ttys) and opens netlink sockets.
+ * Interfaces claimed through usbfs are not expected to be claimed again.
+ *
+ * @name: name of device in sysfs, e.g. 3-1.4
+ * @ws: wait state to be initialized
+ *
+ * @return 0 on success otherwise errno value.
+ */
+static int prepare_wait(const char *name, struct wait_state *ws) {
+    ssize_t len = 0;
+    char link[PATH_MAX + 80];
+    char path[PATH_MAX];
+    DIR *d;
+    struct dirent *de;
+
+    memset(ws, 0, sizeof(*ws));
+    ws->kernel_fd = -1;
+    ws->udev_fd = -1;
+
+    snprintf(link, sizeof(link), "%s/%s", SYSFS_USB_DEVICES, name);
+    if(realpath(link, ws->devdir) == NULL) {
+        return errno;
+    }
+    ws->devpath = ws->devdir + strlen("/sys");
+
+    d = opendir(ws->devdir);
+    if(d == NULL) {
+        return errno;
+    }
+    while(((de = readdir(d)) != NULL) && (ws->num_intf < MAX_INTERFACES)) {
+        if(strchr(de->d_name, ':') == NULL) {
+            continue;
+        }
+        snprintf(link, sizeof(link), "%s/%.64s/driver", ws->devdir, de->d_name);
+        len = readlink(link, path, sizeof(path) - 1);
+        if(len <= 0) {
+            continue;
+        }
+        path[len] = '\0';
+        if(strcmp(strrchr(path, '/') ? strrchr(path, '/') + 1 : path, "usbfs") == 0) {
+            continue;
+        }
+        snprintf(ws->intf[ws->num_intf++], sizeof(ws->intf[0]), "%.63s", de->d_name);
+    }
+    closedir(d);
+
+    ws->ttys_before = count_ttys(ws);
+
+    ws->kernel_fd = open_uevent_socket(UEVENT_GROUP_KERNEL);
+    if(ws->kernel_fd < 0) {
+        return errno;
+    }
+
+    /* Without udev running nothing would ever arrive on its group. */
+    if(!kernel_only && (access(UDEV_CONTROL_SOCKET, F_OK) == 0)) {
+        ws->udev_fd = open_uevent_socket(UEVENT_GROUP_UDEV);
+        if(ws->udev_fd < 0) {
+            return errno;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Opens netlink socket receiving uevents of the given multicast group. Credentials of sender are passed along
+ * with every message so that events can be accepted only from kernel or root.
+ *
+ * @return socket on success otherwise -1.
+ */
+static int open_uevent_socket(int group) {
+    int fd = 0;
+    int on = 1;
+    int rcvbuf = 1024 * 1024;
+    struct sockaddr_nl addr;
+
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if(fd < 0) {
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = group;
+    if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Extracts properties from a uevent. Kernel sends "action@devpath" followed by KEY=value strings, udev
+ * prefixes properties with its own header.
+ *
+ * @buf: message, must be nul terminated
+ * @len: length of message
+ * @udev: 1 if message came on udev group
+ * @ev: properties found
+ *
+ * @return 0 on success otherwise -1 if message is not a valid uevent.
+ */
+static int parse_uevent(char *buf, ssize_t len, int udev, struct uevent *ev) {
+    char *p;
+    char *end = buf + len;
+    unsigned int off = 0;
+    unsigned int plen = 0;
+    unsigned int magic = 0;
+
+    memset(ev, 0, sizeof(*ev));
+
+    if(udev) {
+        if((len < 24) || (strcmp(buf, "libudev") != 0)) {
+            return -1;
+        }
+        memcpy(&magic, buf + 8, 4);
+        memcpy(&off, buf + 16, 4);
+        memcpy(&plen, buf + 20, 4);
+        if((ntohl(magic) != UDEV_MONITOR_MAGIC) || (off + plen > (unsigned int) len)) {
+            return -1;
+        }
+        p = buf + off;
+        end = p + plen;
+    }else {
+        if(strchr(buf, '@') == NULL) {
+            return -1;
+        }
+        p = buf + strlen(buf) + 1;
+    }
+
+    for(; p < end; p += strlen(p) + 1) {
+        if(strncmp(p, "ACTION=", 7) == 0) {
+            ev->action = p + 7;
+        }else if(strncmp(p, "DEVPATH=", 8) == 0) {
+            ev->devpath = p + 8;
+        }else if(strncmp(p, "SEQNUM=", 7) == 0) {
+            ev->seqnum = strtoull(p + 7, NULL, 10);
+        }
+    }
+
+    return ((ev->action != NULL) && (ev->devpath != NULL)) ? 0 : -1;
+}
+
+/*
+ * Reads all pending events from the socket and records sequence number of the latest one which belongs to the
+ * device being waited for. Messages not sent by kernel (kernel group) or root (udev group) are ignored.
+ *
+ * @ws: wait state
+ * @fd: netlink socket
+ * @udev: 1 if socket is bound to udev group
+ */
+static void receive_uevents(struct wait_state *ws, int fd, int udev) {
+    ssize_t len = 0;
+    char buf[UEVENT_BUF_SIZE];
+    char cred[CMSG_SPACE(sizeof(struct ucred))];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct ucred *ucred;
+    struct sockaddr_nl addr;
+    struct uevent ev;
+
+    while(1) {
+        iov.iov_base = buf;
+        iov.iov_len = sizeof(buf) - 1;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &addr;
+        msg.msg_namelen = sizeof(addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cred;
+        msg.msg_controllen = sizeof(cred);
+
+        len = recvmsg(fd, &msg, 0);
+        if(len <= 0) {
+            return;
+        }
+        buf[len] = '\0';
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if((cmsg == NULL) || (cmsg->cmsg_type != SCM_CREDENTIALS)) {
+            continue;
+        }
+        ucred = (struct ucred *) CMSG_DATA(cmsg);
+        if((ucred->uid != 0) || (udev ? (addr.nl_pid == 0) : (addr.nl_pid != 0))) {
+            continue;
+        }
+
+        if((parse_uevent(buf, len, udev, &ev) < 0) || !is_below(ev.devpath, ws->devpath)) {
+            continue;
+        }
+
+        if(udev) {
+            if(ev.seqnum > ws->udev_seq) {
+                ws->udev_seq = ev.seqnum;
+            }
+        }else {
+            if(ev.seqnum > ws->kernel_seq) {
+                ws->kernel_seq = ev.seqnum;
+            }
+        }
+    }
+}
+
+/*
+ * Tells whether device is ready: it exists, every interface which had a driver before reset has one again,
+ * ttys are back (if asked for) and udev has handled every event the kernel has sent for the device.
+ *
+ * @return 1 if ready otherwise 0.
+ */
+static int device_ready(struct wait_state *ws) {
+    int x = 0;
+    char path[PATH_MAX + 80];
+
+    if(access(ws->devdir, F_OK) < 0) {
+        return 0;
+    }
+
+    for(x = 0; x < ws->num_intf; x++) {
+        snprintf(path, sizeof(path), "%s/%s/driver", ws->devdir, ws->intf[x]);
+        if(access(path, F_OK) < 0) {
+            return 0;
+        }
+    }
+
+    if((wait_mode == WAIT_TTY) && (ws->ttys_now < ws->ttys_before)) {
+        return 0;
+    }
+
+    if((ws->udev_fd >= 0) && (ws->udev_seq < ws->kernel_seq)) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Waits until device becomes ready or timeout expires. Readiness is re-evaluated whenever an event arrives;
+ * events generated while reset was in progress are already queued on sockets when this is called.
+ *
+ * @ws: wait state prepared before reset
+ * @start: time at which reset was started
+ * @res: ready, ready_ms and ttys are filled
+ */
+static void wait_ready(struct wait_state *ws, double start, struct reset_result *res) {
+    int nfds = 1;
+    int remaining = 0;
+    struct pollfd pfd[2];
+
+    pfd[0].fd = ws->kernel_fd;
+    pfd[0].events = POLLIN;
+    if(ws->udev_fd >= 0) {
+        pfd[1].fd = ws->udev_fd;
+        pfd[1].events = POLLIN;
+        nfds = 2;
+    }
+
+    while(1) {
+        receive_uevents(ws, ws->kernel_fd, 0);
+        if(ws->udev_fd >= 0) {
+            receive_uevents(ws, ws->udev_fd, 1);
+        }
+        count_ttys(ws);
+
+        if(device_ready(ws)) {
+            res->ready = 1;
+            res->ready_ms = now_msecs() - start;
+            break;
+        }
+
+        remaining = timeout_ms - (int) (now_msecs() - start);
+        if(remaining <= 0) {
+            res->ready = -1;
+            res->ready_ms = now_msecs() - start;
+            break;
+        }
+
+        if((poll(pfd, nfds, remaining) < 0) && (errno != EINTR)) {
+            res->ready = -1;
+            res->ready_ms = now_msecs() - start;
+            break;
+        }
+    }
+
+    snprintf(res->ttys, sizeof(res->ttys), "%s", ws->ttys);
+    close(ws->kernel_fd);
+    if(ws->udev_fd >= 0) {
+        close(ws->udev_fd);
+    }
+}
+
+/*
+ * Forks a child which resets the device and sends result back through a pipe, so that all devices are reset
+ * at the same time.
+ *
+ * @return 0 on success otherwise -1.
+ */
+static int start_reset(struct usb_dev *dev) {
+    int fds[2];
+    double start = 0;
+    struct reset_result res;
+    struct wait_state ws;
+
+    if(pipe(fds) < 0) {
+        return -1;
+    }
+
+    dev->pid = fork();
+    if(dev->pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if(dev->pid == 0) {
+        close(fds[0]);
+        memset(&res, 0, sizeof(res));
+
+        /* Sockets are opened before reset so that no event is missed. */
+        if(wait_mode != WAIT_NONE) {
+            res.err = prepare_wait(dev->name, &ws);
+        }
+
+        start = now_msecs();
+        if(res.err == 0) {
+            res.err = reset_device(dev->node);
+        }
+        res.reset_ms = now_msecs() - start;
+
+        /* ENODEV means device has been re-enumerated because its descriptors changed, it comes back at the
+         * same port and can still be waited for. */
+        if((wait_mode != WAIT_NONE) && ((res.err == 0) || (res.err == ENODEV)) && (ws.kernel_fd >= 0)) {
+            res.err = 0;
+            wait_ready(&ws, start, &res);
+        }
+
+        if(write(fds[1], &res, sizeof(res)) != (ssize_t) sizeof(res)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    dev->pipefd = fds[0];
+    return 0;
+}
+
+/*
+ * Collects result from child which reset the device.
+ */
+static void finish_reset(struct usb_dev *dev) {
+    ssize_t ret = 0;
+
+    do {
+        ret = read(dev->pipefd, &dev->res, sizeof(dev->res));
+    } while((ret < 0) && (errno == EINTR));
+
+    if(ret != (ssize_t) sizeof(dev->res)) {
+        dev->res.err = EPIPE;
+        dev->res.reset_ms = 0;
+    }
+
+    close(dev->pipefd);
+    waitpid(dev->pid, NULL, 0);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-d vid:pid] [-s serial] [-p bus-port] [-t tty] [-w|-W] [-T ms] [-k]\n", prog);
+    fprintf(stderr, "       [/dev/bus/usb/BBB/DDD ...]\n");
+    fprintf(stderr, "  -d  reset devices having this vendor and product ID (hex), e.g. 10c4:ea60\n");
+    fprintf(stderr, "  -s  reset devices having this serial number\n");
+    fprintf(stderr, "  -p  reset device at this bus-port path as in %s, e.g. 3-1.4\n", SYSFS_USB_DEVICES);
+    fprintf(stderr, "  -t  reset device which provides this tty, e.g. ttyUSB0\n");
+    fprintf(stderr, "  -w  wait until device is ready again (drivers bound, udev done)\n");
+    fprintf(stderr, "  -W  like -w and also wait for its tty nodes to come back\n");
+    fprintf(stderr, "  -T  how long to wait in milliseconds (default 10000), exit status 3 on timeout\n");
+    fprintf(stderr, "  -k  use kernel events only, do not wait for udev\n");
+    fprintf(stderr, "Options -d, -s, -p, -t may be repeated, every device matching any of them is reset.\n");
+    fprintf(stderr, "All resets run in parallel.\n");
+}
+
+int main(int argc, char **argv) {
+
+    int x = 0;
+    int opt = 0;
+    int failed = 0;
+    int timedout = 0;
+    double start = 0;
+    double elapsed = 0;
+    struct usb_dev dev;
+
+    while((opt = getopt(argc, argv, "d:s:p:t:wWT:kh")) != -1) {
+        switch(opt) {
+        case 'd':
+        case 's':
+        case 'p':
+        case 't':
+            if(num_selectors >= MAX_SELECTORS) {
+                fprintf(stderr, "too many selectors\n");
+                return EXIT_USAGE;
+            }
+            selectors[num_selectors].type = (char) opt;
+            selectors[num_selectors].arg = optarg;
+            num_selectors++;
+            break;
+        case 'w':
+            if(wait_mode == WAIT_NONE) {
+                wait_mode = WAIT_DEVICE;
+            }
+            break;
+        case 'W':
+            wait_mode = WAIT_TTY;
+            break;
+        case 'T':
+            timeout_ms = atoi(optarg);
+            break;
+        case 'k':
+            kernel_only = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_USAGE;
+        }
+    }
+
+    for(x = optind; x < argc; x++) {
+        if(num_selectors >= MAX_SELECTORS) {
+            fprintf(stderr, "too many selectors\n");
+            return EXIT_USAGE;
+        }
+        selectors[num_selectors].type = 'n';
+        selectors[num_selectors].arg = argv[x];
+        num_selectors++;
+    }
+
+    if((num_selectors == 0) || (timeout_ms <= 0)) {
+        usage(argv[0]);
+        return EXIT_USAGE;
+    }
+
+    for(x = 0; x < num_selectors; x++) {
+        if((selectors[x].type == 't') && (resolve_tty(&selectors[x]) < 0)) {
+            fprintf(stderr, "%s: not a tty of any usb device\n", selectors[x].arg);
+        }
+        if((selectors[x].type == 'n') && (resolve_node(&selectors[x]) < 0)) {
+            fprintf(stderr, "%s: not a usbfs device node, error code : %d\n", selectors[x].arg, errno);
+        }
+    }
+
+    if(scan_sysfs() < 0) {
+        fprintf(stderr, "failed to read %s, error code : %d\n", SYSFS_USB_DEVICES, errno);
+    }
+
+    /* usbfs nodes given explicitly are reset even if sysfs is not available. */
+    for(x = 0; x < num_selectors; x++) {
+        if((selectors[x].type == 'n') && !selectors[x].matched && selectors[x].busnum) {
+            memset(&dev, 0, sizeof(dev));
+            snprintf(dev.name, sizeof(dev.name), "%d-?", selectors[x].busnum);
+            snprintf(dev.node, sizeof(dev.node), "%s", selectors[x].arg);
+            dev.busnum = selectors[x].busnum;
+            dev.devnum = selectors[x].devnum;
+            add_device(&dev);
+            selectors[x].matched++;
+        }
+        if(!selectors[x].matched) {
+            fprintf(stderr, "-%c %s: no matching device\n", selectors[x].type, selectors[x].arg);
+        }
+    }
+
+    if(num_devices == 0) {
+        fprintf(stderr, "no device to reset\n");
+        return EXIT_USAGE;
+    }
+
+    start = now_msecs();
+    for(x = 0; x < num_devices; x++) {
+        if(start_reset(&devices[x]) < 0) {
+            devices[x].pid = -1;
+            devices[x].res.err = errno;
+        }
+    }
+    for(x = 0; x < num_devices; x++) {
+        if(devices[x].pid > 0) {
+            finish_reset(&devices[x]);
+        }
+    }
+    elapsed = now_msecs() - start;
+
+    for(x = 0; x < num_devices; x++) {
+        if((devices[x].res.err == 0) && (devices[x].res.ready > 0)) {
+            printf("%-12s %-10s %-20s %-22s ok %10.1f ms  ready %10.1f ms  %s\n", devices[x].name, devices[x].id,
+                    devices[x].serial, devices[x].node, devices[x].res.reset_ms, devices[x].res.ready_ms,
+                    devices[x].res.ttys);
+        }else if((devices[x].res.err == 0) && (devices[x].res.ready < 0)) {
+            printf("%-12s %-10s %-20s %-22s ok %10.1f ms  not ready after %.1f ms\n", devices[x].name,
+                    devices[x].id, devices[x].serial, devices[x].node, devices[x].res.reset_ms,
+                    devices[x].res.ready_ms);
+            timedout++;
+        }else if(devices[x].res.err == 0) {
+            printf("%-12s %-10s %-20s %-22s ok %10.1f ms\n", devices[x].name, devices[x].id, devices[x].serial,
+                    devices[x].node, devices[x].res.reset_ms);
+        }else {
+            printf("%-12s %-10s %-20s %-22s failed with error code : %d (%s)\n", devices[x].name, devices[x].id,
+                    devices[x].serial, devices[x].node, devices[x].res.err, strerror(devices[x].res.err));
+            failed++;
+        }
+    }
+    if(wait_mode != WAIT_NONE) {
+        printf("%d device(s) reset and waited for in %.1f ms, %d failed, %d not ready\n", num_devices, elapsed,
+                failed, timedout);
+    }else {
+        printf("%d device(s) reset in %.1f ms, %d failed\n", num_devices, elapsed, failed);
+    }
+
+    if(failed) {
+        return EXIT_RESET_FAILED;
+    }
+    return timedout ? EXIT_TIMEOUT : 0;
+}